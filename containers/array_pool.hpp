@@ -21,47 +21,57 @@
 //#include "TensorView.hpp"
 //#include "Tensor.hpp"
 #include "Ltensor.hpp"
+#include "array_pool_dir.hpp"
 
 
 namespace cnine{
 
-  template<typename TYPE>
+  template<typename TYPE, typename OFFSET=int>
   class array_pool;
 
-  template<typename TYPE>
+  template<typename TYPE, typename OFFSET=int>
   class hlists;
 
-  inline Itensor1_view view_of_part(const array_pool<int>&, const int);
-  inline Rtensor1_view view_of_part(const array_pool<float>&, const int);
+  template<typename OFFSET> Itensor1_view view_of_part(const array_pool<int,OFFSET>&, const int);
+  template<typename OFFSET> Rtensor1_view view_of_part(const array_pool<float,OFFSET>&, const int);
   class TensorPackDir;
-  template<typename TYPE> class CSRmatrix;
+  template<typename TYPE, typename OFFSET=int> class CSRmatrix;
 
 
-  template<typename TYPE>
+  // OFFSET is the type of the offsets into arr and of the total number of elements. With the default int
+  // the directory is an IntTensor, which can also be moved to the GPU. Pools that may hold 2^31 or more 
+  // elements have to use a 64 bit OFFSET, with an array_pool_dir directory on the host. The length of each
+  // individual array and the number of arrays are int in either case.
+
+  template<typename TYPE, typename OFFSET>
   class array_pool{
     //private:
   public:
 
+    typedef typename std::conditional<std::is_same<OFFSET,int>::value,IntTensor,array_pool_dir<OFFSET> >::type DIR;
+
+    static constexpr size_t max_total=std::numeric_limits<OFFSET>::max();
+
     TYPE* arr=nullptr;
     TYPE* arrg=nullptr;
-    int memsize=0;
-    int tail=0;
+    OFFSET memsize=0;
+    OFFSET tail=0;
     int dev=0;
     bool is_view=false;
     array_pool* gpu_clone=nullptr;
 
   public: 
 
-    IntTensor dir; // should become private 
+    DIR dir; // should become private 
 
 
   public:
 
-    friend class hlists<TYPE>;
+    friend class hlists<TYPE,OFFSET>;
     friend class TensorPackDir; // decomission this
-    friend class CSRmatrix<TYPE>;
-    friend Itensor1_view view_of_part(const array_pool<int>&, const int);
-    friend Rtensor1_view view_of_part(const array_pool<float>&, const int);
+    friend class CSRmatrix<TYPE,OFFSET>;
+    template<typename OFF> friend Itensor1_view view_of_part(const array_pool<int,OFF>&, const int);
+    template<typename OFF> friend Rtensor1_view view_of_part(const array_pool<float,OFF>&, const int);
 
     ~array_pool(){
       if(is_view) return;
@@ -81,32 +91,32 @@ namespace cnine{
       dir(Gdims({n,2})){}
 
     array_pool(const int n, const int m, const int _dev=0): 
-      memsize(n*m),
-      tail(n*m),
+      memsize(checked_total((size_t)n*m)),
+      tail(memsize),
       dev(_dev),
       dir(Gdims({n,2})){
       for(int i=0; i<n; i++){
-	dir.set(i,0,i*m);
+	dir.set(i,0,(OFFSET)i*m);
 	dir.set(i,1,m);
       }
-      CPUCODE(arr=new TYPE[std::max(n*m,1)]);
-      GPUCODE(CUDA_SAFE(cudaMalloc((void **)&arrg, std::max(memsize,1)*sizeof(TYPE))));
+      CPUCODE(arr=new TYPE[std::max<OFFSET>(memsize,1)]);
+      GPUCODE(CUDA_SAFE(cudaMalloc((void **)&arrg, std::max<OFFSET>(memsize,1)*sizeof(TYPE))));
     }
 
     array_pool(const int n, const int m, const fill_sequential& dummy, const int _dev=0): 
       array_pool(n,m){
-      for(int i=0; i<n*m; i++)
+      for(OFFSET i=0; i<memsize; i++)
 	arr[i]=i;
       to_device(_dev);
     }
 
-    array_pool(const int n, const int _total, const fill_reserve& dummy, const int _dev=0): 
-      memsize(_total),
+    array_pool(const int n, const size_t _total, const fill_reserve& dummy, const int _dev=0): 
+      memsize(checked_total(_total)),
       tail(0),
       dev(_dev),
       dir(Gdims({n,2})){
-      CPUCODE(arr=new TYPE[std::max(memsize,1)]);
-      GPUCODE(CUDA_SAFE(cudaMalloc((void **)&arrg, std::max(memsize,1)*sizeof(TYPE))));
+      CPUCODE(arr=new TYPE[std::max<OFFSET>(memsize,1)]);
+      GPUCODE(CUDA_SAFE(cudaMalloc((void **)&arrg, std::max<OFFSET>(memsize,1)*sizeof(TYPE))));
     }
 
     /*
@@ -124,11 +134,11 @@ namespace cnine{
 	dir.set(i,1,n1);
       }
       if(dev==0){
-	arr=new TYPE[std::max(memsize,1)]; 
+	arr=new TYPE[std::max<OFFSET>(memsize,1)]; 
 	std::copy(M.mem(),M.mem()+memsize,arr);
       }
       if(dev==1){
-	CUDA_SAFE(cudaMalloc((void **)&arrg, std::max(memsize,1)*sizeof(TYPE)));
+	CUDA_SAFE(cudaMalloc((void **)&arrg, std::max<OFFSET>(memsize,1)*sizeof(TYPE)));
 	CUDA_SAFE(cudaMemcpy(arrg,M.mem(),memsize*sizeof(TYPE),cudaMemcpyDeviceToDevice));  
       }
     }
@@ -147,11 +157,11 @@ namespace cnine{
 	dir.set(i,1,n1);
       }
       if(dev==0){
-	arr=new TYPE[std::max(memsize,1)]; 
+	arr=new TYPE[std::max<OFFSET>(memsize,1)]; 
 	std::copy(M.mem(),M.mem()+memsize,arr);
       }
       if(dev==1){
-	CUDA_SAFE(cudaMalloc((void **)&arrg, std::max(memsize,1)*sizeof(TYPE)));
+	CUDA_SAFE(cudaMalloc((void **)&arrg, std::max<OFFSET>(memsize,1)*sizeof(TYPE)));
 	CUDA_SAFE(cudaMemcpy(arrg,M.mem(),memsize*sizeof(TYPE),cudaMemcpyDeviceToDevice));  
       }
     }
@@ -160,19 +170,20 @@ namespace cnine{
   public: // ---- Static constructors ------------------------------------------------------------------------
 
 
-    static array_pool<TYPE> cat(const vector<reference_wrapper<array_pool<TYPE> > >& list){
+    static array_pool cat(const vector<reference_wrapper<array_pool> >& list){
       int _dev=0; 
       if(list.size()>0) _dev=list[0].get().dev;
  
       int n=0; for(auto& p:list) n+=p.get().size();
-      array_pool<TYPE> R((n));
+      array_pool R((n));
       R.dev=_dev;
-      int s=0; for(auto& p:list) s+=p.get().tail;
+      size_t s=0; for(auto& p:list) s+=p.get().tail;
+      s=checked_total(s);
       R.reserve(s);
 
       int a=0;
       for(auto& _p:list){
-	array_pool<TYPE>& p=_p.get();
+	array_pool& p=_p.get();
 	CNINE_ASSRT(p.dev==_dev);
 	for(int i=0; i<p.size(); i++){
 	  R.dir.set(a+i,0,R.tail+p.dir(i,0));
@@ -194,21 +205,22 @@ namespace cnine{
   public: // ---- Memory management --------------------------------------------------------------------------
 
 
-    void reserve(const int n){
+    void reserve(const OFFSET n){
       if(n<=memsize) return;
-      int newsize=n;
+      OFFSET newsize=n;
       if(dev==0){
-	TYPE* newarr=new TYPE[std::max(newsize,1)];
+	TYPE* newarr=new TYPE[std::max<OFFSET>(newsize,1)];
 	if(arr){
 	  std::copy(arr,arr+memsize,newarr);
-	  delete[] arr;
+	  if(!is_view) delete[] arr;
 	}
 	arr=newarr;
 	memsize=newsize;
+	is_view=false;
       }
       if(dev==1){
 	TYPE* newarrg=nullptr;
-	CUDA_SAFE(cudaMalloc((void **)&newarrg, std::max(newsize,1)*sizeof(TYPE)));
+	CUDA_SAFE(cudaMalloc((void **)&newarrg, std::max<OFFSET>(newsize,1)*sizeof(TYPE)));
 	if(arrg){
 	  CUDA_SAFE(cudaMemcpy(newarrg,arrg,memsize*sizeof(TYPE),cudaMemcpyDeviceToDevice));  
 	  CUDA_SAFE(cudaFree(arrg));
@@ -219,6 +231,27 @@ namespace cnine{
     }
 
 
+    // A directory viewing memory elsewhere (see view_memory) is copied before it is first extended, as 
+    // reserve does with arr
+    void own_dir(){
+      if constexpr(std::is_same<DIR,IntTensor>::value)
+	if(dir.is_view) dir=IntTensor(dir,nowarn_flag());
+    }
+
+    // Make room for n elements in total, at least doubling the capacity, or fail if OFFSET is too narrow
+    void grow(const size_t n){
+      if(n<=memsize) return;
+      reserve(checked_total(std::min(std::max(2*(size_t)memsize,n),std::max(max_total,n))));
+    }
+
+    static OFFSET checked_total(const size_t n){
+      if(n>max_total) 
+	CNINE_ERROR("array_pool of "+to_string(n)+" elements would overflow its "+to_string(8*sizeof(OFFSET))+
+	  " bit offsets. Use 64 bit offsets, e.g., array_pool<TYPE,int64_t>.");
+      return n;
+    }
+
+
   public: // ---- Copying ------------------------------------------------------------------------------------
 
 
@@ -228,7 +261,7 @@ namespace cnine{
       tail=x.tail;
       memsize=tail;
       if(dev==0){
-	arr=new TYPE[std::max(memsize,1)];
+	arr=new TYPE[std::max<OFFSET>(memsize,1)];
 	std::copy(x.arr,x.arr+memsize,arr);
       }
       if(dev==1){
@@ -248,7 +281,7 @@ namespace cnine{
       is_view=x.is_view;
     }
 
-    array_pool<TYPE>& operator=(const array_pool<TYPE>& x){
+    array_pool& operator=(const array_pool& x){
       CNINE_ASSIGN_WARNING();
 
       if(is_view){
@@ -268,19 +301,19 @@ namespace cnine{
       is_view=false;
 
       if(dev==0){
-	arr=new TYPE[std::max(memsize,1)]; 
+	arr=new TYPE[std::max<OFFSET>(memsize,1)]; 
 	std::copy(x.arr,x.arr+memsize,arr);
       }
       if(dev==1){
 	//cout<<12233331122<<endl;
-	CUDA_SAFE(cudaMalloc((void **)&arrg, std::max(memsize,1)*sizeof(TYPE)));
+	CUDA_SAFE(cudaMalloc((void **)&arrg, std::max<OFFSET>(memsize,1)*sizeof(TYPE)));
 	CUDA_SAFE(cudaMemcpy(arrg,x.arrg,memsize*sizeof(TYPE),cudaMemcpyDeviceToDevice));  
       }
       return *this;
     }
 
 
-    array_pool<TYPE>& operator=(array_pool<TYPE>&& x){
+    array_pool& operator=(array_pool&& x){
       CNINE_MOVEASSIGN_WARNING();
       if(!is_view){
 	delete[] arr; 
@@ -302,8 +335,8 @@ namespace cnine{
   public: // ---- Views --------------------------------------------------------------------------------------
 
 
-    array_pool<TYPE> view(){
-      array_pool<TYPE> R;
+    array_pool view(){
+      array_pool R;
       R.dev=dev;
       R.tail=tail;
       R.memsize=memsize;
@@ -315,6 +348,22 @@ namespace cnine{
       return R;
     }
 
+    // Make this pool a view of n arrays stored elsewhere on the host, e.g. in a mapped file. _dir holds
+    // the offset and length of each array and _arr their _tail elements. Nothing is copied or freed.
+    void view_memory(const int n, int* _dir, TYPE* _arr, const size_t _tail){
+      if(!is_view && arr) delete[] arr;
+      arr=_arr;
+      tail=checked_total(_tail);
+      memsize=tail;
+      dev=0;
+      is_view=true;
+      IntTensor d(Gdims({n,2}),fill_noalloc());
+      d.arr=_dir;
+      d.memsize=2*n;
+      d.is_view=true;
+      dir=std::move(d);
+    }
+
 
   public: // ---- Conversions --------------------------------------------------------------------------------
 
@@ -351,25 +400,25 @@ namespace cnine{
   public: // ---- Transport ----------------------------------------------------------------------------------
 
 
-  array_pool(const array_pool<TYPE>& x, const int _dev): 
+  array_pool(const array_pool& x, const int _dev): 
     dir(x.dir){
     dev=_dev;
     tail=x.tail;
     memsize=x.tail;
     if(dev==0){
-      arr=new TYPE[std::max(memsize,1)];
+      arr=new TYPE[std::max<OFFSET>(memsize,1)];
       if(x.dev==0) std::copy(x.arr,x.arr+tail,arr);
       if(x.dev==1) CUDA_SAFE(cudaMemcpy(arr,x.arrg,memsize*sizeof(TYPE),cudaMemcpyDeviceToHost));  
     }
     if(dev==1){
-      CUDA_SAFE(cudaMalloc((void **)&arrg, std::max(memsize,1)*sizeof(TYPE)));
+      CUDA_SAFE(cudaMalloc((void **)&arrg, std::max<OFFSET>(memsize,1)*sizeof(TYPE)));
       if(x.dev==0) CUDA_SAFE(cudaMemcpy(arrg,x.arr,memsize*sizeof(TYPE),cudaMemcpyHostToDevice)); 
       if(x.dev==1) CUDA_SAFE(cudaMemcpy(arrg,x.arrg,memsize*sizeof(TYPE),cudaMemcpyDeviceToDevice)); 
     }
   }
 
 
-  array_pool<TYPE>& to_device(const int _dev){
+  array_pool& to_device(const int _dev){
       if(dev==_dev) return *this;
 
       if(_dev==0){
@@ -377,7 +426,7 @@ namespace cnine{
 	  //cout<<"Moving array_pool to host "<<tail<<endl;
 	  memsize=tail;
 	  delete[] arr;
-	  arr=new TYPE[std::max(memsize,1)];
+	  arr=new TYPE[std::max<OFFSET>(memsize,1)];
 	  CUDA_SAFE(cudaMemcpy(arr,arrg,memsize*sizeof(TYPE),cudaMemcpyDeviceToHost));  
 	  CUDA_SAFE(cudaFree(arrg));
 	  arrg=nullptr;
@@ -391,7 +440,7 @@ namespace cnine{
 	  memsize=tail;
 	  if(arrg) CUDA_SAFE(cudaFree(arrg));
 	  //cout<<12233331122<j<endl;
-	  CUDA_SAFE(cudaMalloc((void **)&arrg, std::max(memsize,1)*sizeof(TYPE)));
+	  CUDA_SAFE(cudaMalloc((void **)&arrg, std::max<OFFSET>(memsize,1)*sizeof(TYPE)));
 	  CUDA_SAFE(cudaMemcpy(arrg,arr,memsize*sizeof(TYPE),cudaMemcpyHostToDevice));  
 	  delete[] arr;
 	  arr=nullptr;
@@ -406,7 +455,7 @@ namespace cnine{
     pair<TYPE*,int*> gpu_arrs(const int _dev){
       CNINE_ASSRT(dev==0);
       if(!gpu_clone){
-	gpu_clone=new array_pool<TYPE>(*this,_dev);
+	gpu_clone=new array_pool(*this,_dev);
 	gpu_clone->dir.move_to_device(_dev);
       }
       return make_pair(gpu_clone->arrg,gpu_clone->dir.arrg);
@@ -428,11 +477,11 @@ namespace cnine{
       return dir.dim(0);
     }
 
-    int total() const{ // this might not be the sum of the sizes if there are gaps
+    OFFSET total() const{ // this might not be the sum of the sizes if there are gaps
       return tail;
     }
 
-    int get_tail() const{
+    OFFSET get_tail() const{
       return tail;
     }
 
@@ -445,11 +494,11 @@ namespace cnine{
       return arrg;
     }
 
-    int get_memsize() const{
+    OFFSET get_memsize() const{
       return memsize;
     }
 
-    int offset(const int i) const{
+    OFFSET offset(const int i) const{
       CNINE_ASSRT(i<size());
       return dir(i,0);
     }
@@ -479,7 +528,7 @@ namespace cnine{
 
     vector<TYPE> operator()(const int i) const{
       CNINE_ASSRT(i<size());
-      int addr=dir(i,0);
+      OFFSET addr=dir(i,0);
       int len=dir(i,1);
       vector<TYPE> R(len);
       for(int i=0; i<len; i++)
@@ -492,18 +541,18 @@ namespace cnine{
     }
     
     void push_back(const int len){
-      if(tail+len>memsize)
-	reserve(std::max(2*memsize,tail+len));
+      grow((size_t)tail+len);
+      own_dir();
       dir.push_back(tail,len);
       tail+=len;
     }
 
     void push_back(const vector<TYPE>& v){
       int len=v.size();
-      if(tail+len>memsize)
-	reserve(std::max(2*memsize,tail+len));
+      grow((size_t)tail+len);
       for(int i=0; i<len; i++)
 	arr[tail+i]=v[i];
+      own_dir();
       dir.push_back(tail,len);
       tail+=len;
     }
@@ -523,13 +572,13 @@ namespace cnine{
 
     void push_back(const std::set<TYPE>& v){
       int len=v.size();
-      if(tail+len>memsize)
-	reserve(std::max(2*memsize,tail+len));
+      grow((size_t)tail+len);
       int i=0; 
       for(TYPE p:v){
 	arr[tail+i]=p;
 	i++;
       }
+      own_dir();
       dir.push_back(tail,len);
       tail+=len;
     }
@@ -574,7 +623,7 @@ namespace cnine{
 
     void for_each_of(const int i, const std::function<void(const TYPE)>& lambda) const{
       CNINE_ASSRT(i<size());
-      int offs=offset(i);
+      OFFSET offs=offset(i);
       int n=size_of(i);
       for(int j=0; j<n; j++)
 	lambda(arr[offs+j]);
@@ -582,7 +631,7 @@ namespace cnine{
 
     void for_each_of(const int i, std::function<void(const TYPE&)>& lambda) const{
       CNINE_ASSRT(i<size());
-      int offs=offset(i);
+      OFFSET offs=offset(i);
       int n=size_of(i);
       for(int j=0; j<n; j++)
 	lambda(arr[offs+j]);
@@ -594,12 +643,12 @@ namespace cnine{
       return R;
     }
 
-    bool operator==(const array_pool<TYPE>& y) const{
+    bool operator==(const array_pool& y) const{
       if(size()!=y.size()) return false;
       for(int i=0; i<size(); i++){
 	int n=dir(i,1);
-	int offs=dir(i,0);
-	int offsy=y.dir(i,0);
+	OFFSET offs=dir(i,0);
+	OFFSET offsy=y.dir(i,0);
 	if(n!=y.dir(i,1)) return false;
 	for(int j=0; j<n; j++)
 	  if(arr[offs+j]!=y.arr[offsy+j]) return false;
@@ -607,7 +656,7 @@ namespace cnine{
       return true;
     }
 
-    bool operator!=(const array_pool<TYPE>& y) const{
+    bool operator!=(const array_pool& y) const{
       return !((*this)==y);
     }
 
@@ -669,12 +718,14 @@ namespace cnine{
   };
 
 
-  inline Itensor1_view view_of_part(const array_pool<int>& x, const int i){
+  template<typename OFFSET>
+  inline Itensor1_view view_of_part(const array_pool<int,OFFSET>& x, const int i){
       CNINE_ASSRT(i<x.size());
       return Itensor1_view(x.arr+x.dir(i,0),x.dir(i,1),1,x.dev);
   }
 
-  inline Rtensor1_view view_of_part(const array_pool<float>& x, const int i){
+  template<typename OFFSET>
+  inline Rtensor1_view view_of_part(const array_pool<float,OFFSET>& x, const int i){
       CNINE_ASSRT(i<x.size());
       return Rtensor1_view(x.arr+x.dir(i,0),x.dir(i,1),1,x.dev);
   }
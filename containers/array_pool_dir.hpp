@@ -0,0 +1,92 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#ifndef _cnine_array_pool_dir
+#define _cnine_array_pool_dir
+
+#include "Cnine_base.hpp"
+#include "Gdims.hpp"
+
+
+namespace cnine{
+
+
+  // ---- array_pool_dir ---------------------------------------------------------------------------------------
+  //
+  // The directory of an array_pool with offsets wider than int: an n x 2 table of the offset and the length 
+  // of each array. It provides the part of the IntTensor interface that the pools use, on the host only. 
+  // array_pool<TYPE,int> keeps using IntTensor, so pools of the default type do not get any larger.
+
+
+  template<typename OFFSET>
+  class array_pool_dir{
+  public:
+
+    int n=0;
+    vector<OFFSET> v;
+
+
+  public: // ---- Constructors -------------------------------------------------------------------------------
+
+
+    array_pool_dir(){}
+
+    array_pool_dir(const Gdims& _dims, const int _dev=0):
+      n(_dims[0]), v(2*(size_t)_dims[0],0){
+      CNINE_ASSRT(_dims.size()==2 && _dims[1]==2);
+      CNINE_ASSRT(_dev==0);
+    }
+
+    array_pool_dir(const Gdims& _dims, const fill_noalloc& dummy, const int _dev=0):
+      array_pool_dir(_dims,_dev){}
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    int get_dev() const{
+      return 0;
+    }
+
+    int dim(const int i) const{
+      return i==0?n:2;
+    }
+
+    OFFSET operator()(const int i, const int j) const{
+      return v[2*(size_t)i+j];
+    }
+
+    void set(const int i, const int j, const OFFSET x){
+      v[2*(size_t)i+j]=x;
+    }
+
+    void push_back(const OFFSET offs, const OFFSET len){
+      v.push_back(offs);
+      v.push_back(len);
+      n++;
+    }
+
+    void resize0(const int _n){
+      v.resize(2*(size_t)_n,0);
+      n=_n;
+    }
+
+    void move_to_device(const int _dev){
+      if(_dev!=0) CNINE_ERROR("array pools with wide offsets are host only");
+    }
+
+  };
+
+}
+
+#endif
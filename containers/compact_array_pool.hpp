@@ -19,13 +19,21 @@
 
 namespace cnine{
 
-  template<typename TYPE>
+
+  // The arrays of an array_pool in a single buffer, e.g. for copying to the GPU in one go. The buffer starts
+  // with a header of OFFSET words: the number of arrays n followed by the n+1 offsets (in units of TYPE, 
+  // from the start of the buffer) at which the arrays begin and the last one ends. With a 64 bit OFFSET 
+  // the pool can hold 2^31 or more elements. For TYPE=OFFSET=int the layout is the same as it always was.
+
+  template<typename TYPE, typename OFFSET=int>
   class compact_array_pool{
   public:
 
+    static constexpr size_t max_total=std::numeric_limits<OFFSET>::max();
+
     int n;
     int last=-1;
-    int memsize;
+    OFFSET memsize;
     int dev=0;
     TYPE* arr=nullptr;
 
@@ -34,12 +42,12 @@ namespace cnine{
       if(dev>0 && arr) CUDA_SAFE(cudaFree(arr));
     }
     
-    compact_array_pool(const int _n, const int _m):
+    compact_array_pool(const int _n, const size_t _m):
       n(_n){
-      memsize=_n+_m+2;
+      memsize=checked_total(header_size(n)+_m);
       arr=new TYPE[memsize];
-      arr[0]=n;
-      arr[1]=n+2; 
+      head()[0]=n;
+      head()[1]=header_size(n);
     }
     
 
@@ -56,7 +64,7 @@ namespace cnine{
 	std::copy(x.arr,x.arr+memsize,arr);
       }
       if(dev==1){
-	CUDA_SAFE(cudaMalloc((void **)&arr, std::max(memsize,1)*sizeof(TYPE)));
+	CUDA_SAFE(cudaMalloc((void **)&arr, std::max<OFFSET>(memsize,1)*sizeof(TYPE)));
 	CUDA_SAFE(cudaMemcpy(arr,x.arr,x.memsize*sizeof(TYPE),cudaMemcpyDeviceToDevice));  
       }
     }
@@ -82,49 +90,55 @@ namespace cnine{
 	std::copy(x.arr,x.arr+memsize,arr);
       }
       if(dev==1){
-	CUDA_SAFE(cudaMalloc((void **)&arr, std::max(memsize,1)*sizeof(TYPE)));
+	CUDA_SAFE(cudaMalloc((void **)&arr, std::max<OFFSET>(memsize,1)*sizeof(TYPE)));
 	CUDA_SAFE(cudaMemcpy(arr,x.arr,x.memsize*sizeof(TYPE),cudaMemcpyDeviceToDevice));  
       }
       return *this;
     };
 
+    compact_array_pool& operator=(compact_array_pool&& x){
+      if(dev==0 && arr) delete[] arr;
+      if(dev>0 && arr) CUDA_SAFE(cudaFree(arr));
+      n=x.n;
+      last=x.last;
+      memsize=x.memsize;
+      dev=x.dev;
+      arr=x.arr;
+      x.arr=nullptr;
+      return *this;
+    };
+
 
   public: // ---- Transport ----------------------------------------------------------------------------------
 
 
     compact_array_pool(const compact_array_pool& x, const int _dev):
-      n(x.n), 
-      last(x.last), 
-      memsize(x.memsize), 
-      dev(x.dev){
-      if(dev==x.dev) return compact_array_pool(x);
-      if(dev==0){
-	arr=new TYPE[memsize];
-	CUDA_SAFE(cudaMemcpy(arr,x.arr,x.memsize*sizeof(TYPE),cudaMemcpyDeviceToHost));  
-      }
-      if(dev==1){
-	CUDA_SAFE(cudaMalloc((void **)&arr, std::max(memsize,1)*sizeof(TYPE)));
-	CUDA_SAFE(cudaMemcpy(arr,x.arr,x.memsize*sizeof(TYPE),cudaMemcpyHostToDevice));  
-      }
+      compact_array_pool(x){
+      to_device(_dev);
     }
 
     compact_array_pool& to_device(const int _dev){
       if(_dev==dev) return *this;
       if(_dev==0){
-	narr=new TYPE[memsize];
+	TYPE* narr=new TYPE[memsize];
 	CUDA_SAFE(cudaMemcpy(narr,arr,memsize*sizeof(TYPE),cudaMemcpyDeviceToHost));  
 	CUDA_SAFE(cudaFree(arr));
 	arr=narr;
 	dev=_dev;
       }
-     if(_dev>0){
-	TYPE* narr;
-	CUDA_SAFE(cudaMalloc((void **)&narr, std::max(memsize,1)*sizeof(TYPE)));
+      if(_dev>0){
+#ifdef _WITH_CUDA
+	TYPE* narr=nullptr;
+	CUDA_SAFE(cudaMalloc((void **)&narr, std::max<OFFSET>(memsize,1)*sizeof(TYPE)));
 	CUDA_SAFE(cudaMemcpy(narr,arr,memsize*sizeof(TYPE),cudaMemcpyHostToDevice));  
 	delete[] arr;
 	arr=narr;
 	dev=_dev;
+#else
+	CNINE_ERROR("cnine was compiled without GPU support");
+#endif
       }
+      return *this;
     }
 
 
@@ -139,63 +153,75 @@ namespace cnine{
       return n;
     }
 
-    int tail() const{
+    OFFSET tail() const{
       CNINE_CPUONLY();
-      return arr[last+2];
+      return head()[last+2];
     }
 
-    int offset(const int i) const{
+    OFFSET offset(const int i) const{
       CNINE_IN_RANGE(i,n);
       CNINE_CPUONLY();
-      return arr[i+1];
+      return head()[i+1];
     }
 
     int size_of(const int i) const{
       CNINE_IN_RANGE(i,n);
       CNINE_CPUONLY();
-      return arr[i+2]-arr[i+1];
+      return head()[i+2]-head()[i+1];
     }
 
-    int operator()(const int i, const int j) const{
+    TYPE operator()(const int i, const int j) const{
       CNINE_IN_RANGE(i,n);
       CNINE_IN_RANGE(j,size_of(i));
       CNINE_CPUONLY();
-      return arr[arr[i+1]+j];
+      return arr[head()[i+1]+j];
     }
 
 
   public: // ---- Setters ------------------------------------------------------------------------------------
 
 
-    void set(const int i, const int j, const int v){
+    void set(const int i, const int j, const TYPE v){
       CNINE_IN_RANGE(i,n);
       CNINE_IN_RANGE(j,size_of(i));
       CNINE_CPUONLY();
-      arr[arr[i+1]+j]=v;
+      arr[head()[i+1]+j]=v;
     }
 
 
   public: // ---- Conversions ---------------------------------------------------------------------------------
 
 
-    compact_array_pool(const array_pool<TYPE>& x, const int _dev=0){
-      if(x.dev>0){
-	*this=compact_array_pool(array_pool<TYPE>(x,0),_dev);
-	return;
-      }
-      n=x.size();
-      last=x.size();
-      memsize=x.size()+x.tail+2;
-      arr=new TYPE[memsize];
-      arr[0]=n;
-      arr[1]=0;
-      int t=n+2;
+    compact_array_pool(const array_pool<TYPE,OFFSET>& x, const int _dev=0):
+      compact_array_pool(x.size(),x.tail){
+      CNINE_ASSRT(x.dev==0);
+      last=n-1;
+      OFFSET t=header_size(n);
       for(int i=0; i<n; i++){
-	std::copy(x.arr+x.offset(i)+x.arr+x.offset(i)+x.size_of(i),arr+t);
+	std::copy(x.arr+x.offset(i),x.arr+x.offset(i)+x.size_of(i),arr+t);
 	t+=x.size_of(i);
-	arr[i+2]=t;
+	head()[i+2]=t;
       }
-      move_to_device(_dev);
+      to_device(_dev);
+    }
+
+
+  private:
+
+    OFFSET* head() const{
+      return reinterpret_cast<OFFSET*>(arr);
+    }
+
+    // the number of TYPE elements taken up by the header
+    static size_t header_size(const int n){
+      return ((size_t)(n+2)*sizeof(OFFSET)+sizeof(TYPE)-1)/sizeof(TYPE);
+    }
+
+    static OFFSET checked_total(const size_t n){
+      if(n>max_total) 
+	CNINE_ERROR("compact_array_pool of "+to_string(n)+" elements would overflow its "+to_string(8*sizeof(OFFSET))+
+	  " bit offsets. Use 64 bit offsets, e.g., compact_array_pool<TYPE,int64_t>.");
+      return n;
     }
 
 
@@ -207,7 +233,7 @@ namespace cnine{
     }
 
     string str(const string indent="") const{
-      if(dev>0) return compact_array_pool(*this,0);
+      if(dev>0) return compact_array_pool(*this,0).str(indent);
       ostringstream oss;
       for(int i=0; i<n; i++){
 	oss<<indent<<i<<":(";
@@ -228,4 +254,3 @@ namespace cnine{
 };
 
 #endif 
-
@@ -21,11 +21,13 @@
 
 namespace cnine{
 
-  template<typename TYPE>
-  class hlists: public array_pool<TYPE>{
+  // hlists<TYPE,int64_t> is the variant with 64 bit offsets for pools of 2^31 or more elements
+
+  template<typename TYPE, typename OFFSET>
+  class hlists: public array_pool<TYPE,OFFSET>{
   public:
 
-    typedef array_pool<TYPE> BASE;
+    typedef array_pool<TYPE,OFFSET> BASE;
 
     using BASE::BASE;
     using BASE::arr;
@@ -38,7 +40,7 @@ namespace cnine{
 
 
     hlists(const vector<TYPE>& heads, const vector<int>& lengths):
-      BASE(lengths.size(),std::accumulate(lengths.begin(),lengths.end(),0)+lengths.size(),fill_reserve()){
+      BASE(lengths.size(),BASE::checked_total(std::accumulate(lengths.begin(),lengths.end(),(size_t)0)+lengths.size()),fill_reserve()){
       int N=size();
       CNINE_ASSRT(heads.size()==N);
       for(int i=0; i<N; i++){
@@ -50,7 +52,7 @@ namespace cnine{
     }
 
     hlists(const vector<TYPE>& heads, const vector<int>& lengths, const fill_noalloc& dummy):
-      BASE(lengths.size(),std::accumulate(lengths.begin(),lengths.end(),0)+lengths.size(),fill_reserve()){
+      BASE(lengths.size(),BASE::checked_total(std::accumulate(lengths.begin(),lengths.end(),(size_t)0)+lengths.size()),fill_reserve()){
       int N=size();
       CNINE_ASSRT(heads.size()==N);
       for(int i=0; i<N; i++){
@@ -62,7 +64,7 @@ namespace cnine{
     }
 
     hlists(const map_of_lists<TYPE,TYPE>& map):
-      BASE(map.size(),map.size()+map.tsize(),fill_reserve()){
+      BASE(map.size(),BASE::checked_total((size_t)map.size()+map.tsize()),fill_reserve()){
       int i=0;
       for(auto& p:map){
 	int m=p.second.size();
@@ -91,11 +93,16 @@ namespace cnine{
       return *this;
     }
 
+    hlists& operator=(hlists&& x){
+      BASE::operator=(std::move(x));
+      return *this;
+    }
+
 
   public: // ---- Access -------------------------------------------------------------------------------------
     
 
-    int total() const{
+    OFFSET total() const{
       return BASE::total()-size();
     }
 
@@ -134,7 +141,7 @@ namespace cnine{
 
     vector<TYPE> operator()(const int i) const{
       CNINE_ASSRT(i<size());
-      int addr=dir(i,0)+1;
+      OFFSET addr=dir(i,0)+1;
       int len=dir(i,1)-1;
       vector<TYPE> R(len);
       for(int i=0; i<len; i++)
@@ -156,7 +163,7 @@ namespace cnine{
       int n=size();
       for(int i=0; i<n; i++){
 	TYPE h=head(i);
-	int offs=dir(i,0)+1;
+	OFFSET offs=dir(i,0)+1;
 	int n=dir(i,1)-1;
 	for(int j=0; j<n; j++)
 	  lambda(h,arr[offs+j]);
@@ -165,7 +172,7 @@ namespace cnine{
 
     void for_each_of(const int i, std::function<void(const TYPE)> lambda) const{
       CNINE_ASSRT(i<size());
-      int offs=dir(i,0)+1;
+      OFFSET offs=dir(i,0)+1;
       int n=dir(i,1)-1;
       for(int j=0; j<n; j++)
 	lambda(arr[offs+j]);
@@ -173,7 +180,7 @@ namespace cnine{
 
     void for_each_of(const int i, std::function<void(const TYPE&)>& lambda) const{
       CNINE_ASSRT(i<size());
-      int offs=dir(i,0)+1;
+      OFFSET offs=dir(i,0)+1;
       int n=dir(i,1)-1;
       for(int j=0; j<n; j++)
 	lambda(arr[offs+j]);
@@ -189,23 +196,23 @@ namespace cnine{
 
     void push_back(const TYPE x, const vector<TYPE>& v){
       int len=v.size()+1;
-      if(tail+len>BASE::memsize)
-	BASE::reserve(std::max(2*BASE::memsize,tail+len));
+      BASE::grow((size_t)tail+len);
       arr[tail]=x;
       for(int i=0; i<len-1; i++)
 	arr[tail+i+1]=v[i];
+      BASE::own_dir();
       dir.push_back(tail,len);
       tail+=len;
     }
 
     void push_back(const TYPE h, const std::set<TYPE>& x){
       int len=x.size()+1;
-      if(tail+len>BASE::memsize)
-	BASE::reserve(std::max(2*BASE::memsize,tail+len));
+      BASE::grow((size_t)tail+len);
       arr[tail]=h;
       int i=0; 
       for(auto p:x)
-	arr[tail+i+1]=p;
+	arr[tail+(i++)+1]=p;
+      BASE::own_dir();
       dir.push_back(tail,len);
       tail+=len;
     }
@@ -0,0 +1,79 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#include "Cnine_base.cpp"
+
+#include "CnineSession.hpp"
+#include "hlists.hpp"
+#include "compact_array_pool.hpp"
+#include "GatherRows.hpp"
+#include "CSRmatrix.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+  cnine_session session(4);
+
+  cout<<"sizeof(array_pool<int>): "<<sizeof(array_pool<int>)<<", ";
+  cout<<"sizeof(array_pool<int,int64_t>): "<<sizeof(array_pool<int,int64_t>)<<endl;
+
+  array_pool<int,int64_t> A0(5,3,fill_sequential());
+  array_pool<int,int64_t> A1(3,3,fill_sequential());
+  cout<<array_pool<int,int64_t>::cat({A0,A1})<<endl;
+  compact_array_pool<int,int64_t> C0(A0);
+  cout<<"compact copy with 64 bit offsets: tail="<<C0.tail()<<endl<<C0<<endl;
+
+  const int n_out=400, n_in=500, C=33;
+  map_of_lists<int,int> edges;
+  uniform_int_distribution<int> node(0,n_in-1);
+  uniform_int_distribution<int> degree(0,20);
+  for(int i=0; i<n_out; i++){
+    int d=degree(rndGen);
+    for(int j=0; j<d; j++)
+      edges.push_back(i,node(rndGen));
+  }
+  GatherMapB g(edges);
+  hlists<int,int64_t> lists(edges);
+
+  Ltensor<float> x=Ltensor<float>::gaussian({n_in,C});
+  Ltensor<float> r0({n_out,C},0,0);
+  Ltensor<float> r1({n_out,C},0,0);
+  GatherRows()(r0,x,g);
+  GatherRows()(r1,x,lists);
+  cout<<"gather with 64 bit offsets: "<<r1.diff2(r0)<<endl;
+
+  TensorView<float> D=TensorView<float>::gaussian({n_out,n_in});
+  uniform_real_distribution<float> u(0,1);
+  for(int i=0; i<n_out; i++)
+    for(int j=0; j<n_in; j++)
+      if(u(rndGen)>0.05) D.set(i,j,0);
+  CSRmatrix<float> A(D);
+  CSRmatrix<float,int64_t> A64(D);
+  TensorView<float> X=TensorView<float>::gaussian({n_in,C});
+  cout<<"SpMM with 64 bit offsets: "<<(A64*X).diff2(A*X)<<endl;
+  TensorView<float> Y=TensorView<float>::gaussian({n_out,C});
+  TensorView<float> S({n_in,C},0,0);
+  TensorView<float> S64({n_in,C},0,0);
+  A.apply_transp_to(S,Y);
+  A64.apply_transp_to(S64,Y);
+  cout<<"transposed SpMM with 64 bit offsets: "<<S64.diff2(S)<<endl;
+
+  try{
+    array_pool<float>::checked_total(((size_t)1)<<31);
+  }catch(std::runtime_error& e){
+    cout<<"int offsets overflow detected"<<endl;
+  }
+  cout<<"int64_t offsets accept "<<array_pool<float,int64_t>::checked_total(((size_t)1)<<31)<<" elements"<<endl;
+
+}
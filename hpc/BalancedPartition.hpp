@@ -0,0 +1,96 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _CnineBalancedPartition
+#define _CnineBalancedPartition
+
+#include "Cnine_base.hpp"
+#include "ThreadPool.hpp"
+
+
+namespace cnine{
+
+
+  // ---- BalancedPartition ------------------------------------------------------------------------------------
+  //
+  // Split of the rows [0,N) of a sparse operand into contiguous ranges of roughly equal work, one range per
+  // task, shared by the row parallel host kernels (CpuGatherRows, CSRmatrix, BlockCsparseMatrix). Row i
+  // costs cost(i), and the rows are split over up to 4*nthreads tasks if the total cost times unit_cost
+  // (e.g., the number of columns each unit of cost touches) is at least parallel_threshold. Since each
+  // row belongs to one range, tasks that write only to their own rows need no synchronization. The column
+  // tiling constants of those kernels live here as well.
+
+
+  class BalancedPartition{
+  public:
+
+    static constexpr size_t parallel_threshold=1<<15;
+    static constexpr int tile_cols=512;
+    static constexpr int prefetch_dist=4;
+
+    int N;
+    int ntasks=1;
+    vector<size_t> cum; // cum[i] is the total cost of rows 0,...,i-1
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    template<typename COST>
+    BalancedPartition(const int _N, COST&& cost, const size_t unit_cost=1):
+      N(_N), cum(_N+1,0){
+      for(int i=0; i<N; i++)
+	cum[i+1]=cum[i]+cost(i);
+      if(nthreads>1 && total()*unit_cost>=parallel_threshold)
+	ntasks=std::min(N,4*nthreads);
+    }
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    size_t total() const{
+      return cum[N];
+    }
+
+    // The first row of the range of task t
+    int begin(const int t) const{
+      if(t>=ntasks) return N;
+      return std::lower_bound(cum.begin(),cum.begin()+N,t*total()/ntasks)-cum.begin();
+    }
+
+
+  public: // ---- Execution ----------------------------------------------------------------------------------
+
+
+    // Call fn(i) for each row, the ranges in parallel
+    template<typename FN>
+    void for_each(FN&& fn) const{
+      parallel_for(0,ntasks,1,[&](const int t){
+	  const int i1=begin(t+1);
+	  for(int i=begin(t); i<i1; i++) fn(i);
+	});
+    }
+
+    // Call fn(i0,i1) on each range [i0,i1) in parallel, for tasks that keep state across their rows
+    template<typename FN>
+    void for_each_range(FN&& fn) const{
+      parallel_for(0,ntasks,1,[&](const int t){
+	  fn(begin(t),begin(t+1));});
+    }
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2023, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _CnineCpuCgemm
+#define _CnineCpuCgemm
+
+#include "CpuGemm.hpp"
+
+
+namespace cnine{
+
+
+  // ---- CpuCgemm ---------------------------------------------------------------------------------------------
+  //
+  // C+=op(A)*op(B) for complex matrices stored in cnine's split layout, i.e., the real and imaginary parts
+  // are separate arrays (arr and arrc) with common strides. op is the identity or complex conjugation.
+  // The product is reduced to real products on the packed CpuGemm kernels, with conjugation fused into
+  // packing as a sign flip on the imaginary part. Large products use the 3M (Gauss) algorithm
+  //
+  //   T1=Ar*Br, T2=Ai*Bi, T3=(Ar+Ai)*(Br+Bi),  Cr+=T1-T2,  Ci+=T3-T1-T2
+  //
+  // which saves a quarter of the flops, small ones the 4M algorithm, which has better rounding behavior.
+
+
+  template<typename TYPE>
+  class CpuCgemm{
+  public:
+
+    typedef CpuGemm<TYPE> GEMM;
+    typedef CpuGemmOperand<TYPE> OPERAND;
+    typedef CpuGemmTarget<TYPE> TARGET;
+
+    static constexpr int threshold_3m=128;
+
+    static void add(const int M, const int N, const int K,
+      const TYPE* ar, const TYPE* ai, const int rsa, const int csa, const bool conja,
+      const TYPE* br, const TYPE* bi, const int rsb, const int csb, const bool conjb,
+      TYPE* cr, TYPE* ci, const int rsc, const int csc){
+
+      if(M<=0 || N<=0 || K<=0) return;
+      const TYPE sa=conja?-1:1;
+      const TYPE sb=conjb?-1:1;
+
+      if(std::min(M,std::min(N,K))<threshold_3m){
+	GEMM::add(M,N,K,OPERAND(ar,rsa,csa),OPERAND(br,rsb,csb),TARGET(cr,rsc,csc,1));
+	GEMM::add(M,N,K,OPERAND(ai,rsa,csa,sa),OPERAND(bi,rsb,csb,sb),TARGET(cr,rsc,csc,-1));
+	GEMM::add(M,N,K,OPERAND(ar,rsa,csa),OPERAND(bi,rsb,csb,sb),TARGET(ci,rsc,csc,1));
+	GEMM::add(M,N,K,OPERAND(ai,rsa,csa,sa),OPERAND(br,rsb,csb),TARGET(ci,rsc,csc,1));
+	return;
+      }
+
+      GEMM::add(M,N,K,OPERAND(ar,rsa,csa),OPERAND(br,rsb,csb),TARGET(cr,rsc,csc,1,ci,-1));
+      GEMM::add(M,N,K,OPERAND(ai,rsa,csa,sa),OPERAND(bi,rsb,csb,sb),TARGET(cr,rsc,csc,-1,ci,-1));
+      GEMM::add(M,N,K,OPERAND(ar,rsa,csa,1,ai,sa),OPERAND(br,rsb,csb,1,bi,sb),TARGET(ci,rsc,csc,1));
+    }
+
+
+    // C+=A*B where A is real and B and C are complex
+    static void add_RC(const int M, const int N, const int K,
+      const TYPE* a, const int rsa, const int csa,
+      const TYPE* br, const TYPE* bi, const int rsb, const int csb, const bool conjb,
+      TYPE* cr, TYPE* ci, const int rsc, const int csc){
+      GEMM::add(M,N,K,OPERAND(a,rsa,csa),OPERAND(br,rsb,csb),TARGET(cr,rsc,csc,1));
+      GEMM::add(M,N,K,OPERAND(a,rsa,csa),OPERAND(bi,rsb,csb),TARGET(ci,rsc,csc,conjb?-1:1));
+    }
+
+  };
+
+}
+
+#endif
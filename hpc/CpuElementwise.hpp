@@ -0,0 +1,276 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _CnineCpuElementwise
+#define _CnineCpuElementwise
+
+#include "Cnine_base.hpp"
+#include "Gdims.hpp"
+#include "GstridesB.hpp"
+#include "ThreadPool.hpp"
+#include <utility>
+
+#if defined(__clang__)
+#define CNINE_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define CNINE_IVDEP _Pragma("GCC ivdep")
+#else
+#define CNINE_IVDEP
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CNINE_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define CNINE_PREFETCH(p)
+#endif
+
+
+namespace cnine{
+
+
+  // ---- CpuElementwise ---------------------------------------------------------------------------------------
+  //
+  // Loop over the elements of N tensors of the same dimensions but arbitrary strides, calling fn(x0,...,xN-1)
+  // on corresponding elements. The loop nest is first simplified: dimensions of size 1 are dropped, the
+  // remaining ones are sorted by decreasing stride of the first operand (so a unit stride dimension ends up
+  // innermost), and adjacent dimensions that are contiguous in every operand are fused (generalizing
+  // co_scrunch). When the innermost dimension has unit stride in every operand, the inner loop runs over
+  // plain pointers with no loop-carried dependencies, so the compiler can vectorize it. Large loops are
+  // split across threads along the outer dimensions, or along the inner one if there are too few rows.
+  //
+  // fn is applied to each element exactly once, but in no particular order, and possibly from several
+  // threads at once if parallel is set.
+
+
+  template<int N>
+  class CpuElementwise{
+  public:
+
+    static constexpr size_t parallel_threshold=1<<15;
+    static constexpr size_t min_chunk=1<<12;
+    static constexpr size_t tile=32;
+
+    int D=0;
+    vector<size_t> n;
+    vector<size_t> s[N];
+    size_t nrows=1;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    CpuElementwise(const Gdims& dims, const std::array<const GstridesB*,N>& strides){
+      int k=dims.size();
+      for(int j=0; j<N; j++)
+	CNINE_ASSRT(strides[j]->size()==k);
+
+      vector<int> order;
+      for(int i=0; i<k; i++)
+	if(dims[i]!=1) order.push_back(i);
+      std::stable_sort(order.begin(),order.end(),[&](const int a, const int b){
+	  for(int j=0; j<N; j++)
+	    if((*strides[j])[a]!=(*strides[j])[b]) return (*strides[j])[a]>(*strides[j])[b];
+	  return false;
+	});
+
+      for(auto i:order){
+	if(D>0){
+	  bool fuse=true;
+	  for(int j=0; j<N; j++)
+	    if(s[j][D-1]!=(*strides[j])[i]*dims[i]) fuse=false;
+	  if(fuse){
+	    n[D-1]*=dims[i];
+	    for(int j=0; j<N; j++) s[j][D-1]=(*strides[j])[i];
+	    continue;
+	  }
+	}
+	n.push_back(dims[i]);
+	for(int j=0; j<N; j++) s[j].push_back((*strides[j])[i]);
+	D++;
+      }
+
+      if(D==0){
+	n.push_back(1);
+	for(int j=0; j<N; j++) s[j].push_back(1);
+	D=1;
+      }
+      for(int i=0; i<D-1; i++) nrows*=n[i];
+    }
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    size_t asize() const{
+      return nrows*n[D-1];
+    }
+
+    size_t ncols() const{
+      return n[D-1];
+    }
+
+    size_t inner_stride(const int j) const{
+      return s[j][D-1];
+    }
+
+    bool unit_inner() const{
+      for(int j=0; j<N; j++) if(s[j][D-1]!=1) return false;
+      return true;
+    }
+
+
+  public: // ---- Execution ----------------------------------------------------------------------------------
+
+
+    template<typename TYPE, typename FN>
+    void operator()(const std::array<TYPE*,N>& ptrs, FN fn, const bool parallel=true) const{
+      const size_t m=n[D-1];
+      if(nrows==0 || m==0) return;
+
+      if(!parallel || nthreads<=1 || asize()<parallel_threshold){
+	run(ptrs,fn,0,nrows,0,m);
+	return;
+      }
+
+      // split the inner dimension too if there are not enough rows to go around
+      const size_t target=4*nthreads;
+      size_t ncols=1;
+      if(nrows<target) ncols=std::max((size_t)1,std::min(m/min_chunk,target/nrows));
+
+      if(ncols==1){
+	const size_t rows_per_task=std::max({(size_t)1,nrows/target,min_chunk/m});
+	const int ntasks=(nrows+rows_per_task-1)/rows_per_task;
+	parallel_for(0,ntasks,1,[&](const int t){
+	    size_t r0=t*rows_per_task;
+	    run(ptrs,fn,r0,std::min(nrows,r0+rows_per_task),0,m);});
+      }else{
+	const size_t colw=(m+ncols-1)/ncols;
+	parallel_for(0,nrows*ncols,1,[&](const int t){
+	    size_t r=t/ncols;
+	    size_t c0=(t%ncols)*colw;
+	    if(c0<m) run(ptrs,fn,r,r+1,c0,std::min(m,c0+colw));});
+      }
+    }
+
+
+  public: // ---- Traversal ----------------------------------------------------------------------------------
+
+
+    // Call seg(q,m) for segments of m consecutive elements of the innermost dimension covering rows [r0,r1)
+    // of the outer loops and columns [c0,c1), where q holds the addresses of the first element of the
+    // segment in each operand. If the innermost dimension is strided in some operand, rows are visited in
+    // tiles of tile x tile elements, so that the strided accesses of neighboring rows hit the same cache lines.
+    template<typename TYPE, typename SEG>
+    void traverse(const std::array<TYPE*,N>& ptrs, const size_t r0, const size_t r1,
+      const size_t c0, const size_t c1, SEG&& seg) const{
+
+      const int O=D-1;
+      vector<size_t> ix(std::max(1,O));
+      size_t offs[N];
+      for(int j=0; j<N; j++) offs[j]=c0*s[j][O];
+      size_t t=r0;
+      for(int i=O-1; i>=0; i--){
+	ix[i]=t%n[i];
+	t/=n[i];
+	for(int j=0; j<N; j++) offs[j]+=ix[i]*s[j][i];
+      }
+
+      auto advance=[&](){
+	for(int i=O-1; i>=0; i--){
+	  for(int j=0; j<N; j++) offs[j]+=s[j][i];
+	  if(++ix[i]<n[i]) break;
+	  for(int j=0; j<N; j++) offs[j]-=n[i]*s[j][i];
+	  ix[i]=0;
+	}
+      };
+
+      const size_t m=c1-c0;
+      std::array<TYPE*,N> q;
+
+      if(unit_inner() || O==0){
+	for(size_t r=r0; r<r1; r++){
+	  for(int j=0; j<N; j++) q[j]=ptrs[j]+offs[j];
+	  seg(q,m);
+	  advance();
+	}
+	return;
+      }
+
+      for(size_t r=r0; r<r1;){
+	const size_t g=std::min({tile,n[O-1]-ix[O-1],r1-r});
+	for(size_t c=0; c<m; c+=tile){
+	  const size_t mc=std::min(tile,m-c);
+	  for(size_t k=0; k<g; k++){
+	    for(int j=0; j<N; j++) q[j]=ptrs[j]+offs[j]+k*s[j][O-1]+c*s[j][O];
+	    seg(q,mc);
+	  }
+	}
+	for(size_t k=0; k<g; k++) advance();
+	r+=g;
+      }
+    }
+
+
+  private:
+
+    template<typename TYPE, typename FN>
+    void run(const std::array<TYPE*,N>& ptrs, FN& fn, const size_t r0, const size_t r1,
+      const size_t c0, const size_t c1) const{
+      if(unit_inner())
+	traverse(ptrs,r0,r1,c0,c1,[&](const std::array<TYPE*,N>& q, const size_t m){
+	    inner_unit(q,m,fn,std::make_index_sequence<N>());});
+      else
+	traverse(ptrs,r0,r1,c0,c1,[&](const std::array<TYPE*,N>& q, const size_t m){
+	    inner_strided(q,m,fn,std::make_index_sequence<N>());});
+    }
+
+    template<typename TYPE, typename FN, size_t... I>
+    static inline void inner_unit(const std::array<TYPE*,N>& q, const size_t m, FN& fn, std::index_sequence<I...>){
+      CNINE_IVDEP
+      for(size_t i=0; i<m; i++)
+	fn(q[I][i]...);
+    }
+
+    template<typename TYPE, typename FN, size_t... I>
+    inline void inner_strided(const std::array<TYPE*,N>& q, const size_t m, FN& fn, std::index_sequence<I...>) const{
+      const size_t st[N]={s[I][D-1]...};
+      for(size_t i=0; i<m; i++)
+	fn(q[I][i*st[I]]...);
+    }
+
+  };
+
+
+  // ---- Functions --------------------------------------------------------------------------------------------
+
+
+  template<typename TYPE, typename FN>
+  inline void cpu_elementwise(const Gdims& dims, TYPE* x, const GstridesB& xs, FN fn, const bool parallel=true){
+    CpuElementwise<1>(dims,{&xs})(std::array<TYPE*,1>{x},fn,parallel);
+  }
+
+  template<typename TYPE, typename FN>
+  inline void cpu_elementwise(const Gdims& dims, TYPE* x, const GstridesB& xs, TYPE* y, const GstridesB& ys,
+    FN fn, const bool parallel=true){
+    CpuElementwise<2>(dims,{&xs,&ys})(std::array<TYPE*,2>{x,y},fn,parallel);
+  }
+
+  template<typename TYPE, typename FN>
+  inline void cpu_elementwise(const Gdims& dims, TYPE* x, const GstridesB& xs, TYPE* y, const GstridesB& ys,
+    TYPE* z, const GstridesB& zs, FN fn, const bool parallel=true){
+    CpuElementwise<3>(dims,{&xs,&ys,&zs})(std::array<TYPE*,3>{x,y,z},fn,parallel);
+  }
+
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _CnineCpuGatherLinear
+#define _CnineCpuGatherLinear
+
+#include "CpuGatherRows.hpp"
+#include "CpuGemm.hpp"
+
+
+namespace cnine{
+
+
+  // ---- CpuGatherLinear --------------------------------------------------------------------------------------
+  //
+  // Host kernels for r[g.target(i)]+=(sum_j x[g(i,j)])*W, with x an n_in x C matrix, W a C x D matrix and r
+  // an n_out x D matrix. When W narrows the rows enough that it pays to apply it first, that is, when
+  // n_in*C*D+E*D<n_out*C*D+E*C (E being the number of edges), forward forms x*W and gathers its rows.
+  // Otherwise the lists are gathered in tiles, each tile into a buffer small enough to stay in L2, which
+  // is multiplied by W with the packed CpuGemm kernels right away, so the n_out x C gathered matrix is
+  // never written out. This saves memory traffic but adds per tile overhead, so GatherLinear only uses it
+  // where fuse_pays holds; without the AVX micro-kernels the product is compute bound and the tiles do
+  // not come out ahead of GatherRows followed by add_mprod.
+  //
+  // The weight gradient Wgrad+=(gather of x)^T*rgrad is computed as x^T*(gather of rgrad by g.inv()),
+  // tiled the same way over the lists of the inverse map.
+
+
+  template<typename TYPE>
+  class CpuGatherLinear{
+  public:
+
+    typedef CpuGemm<TYPE> GEMM;
+
+    static constexpr size_t tile_bytes=1<<17;
+    static constexpr int min_tile=8;
+    static constexpr int max_tile=256;
+    static constexpr size_t parallel_threshold=1<<16;
+    static constexpr int min_fused_cols=64;
+
+
+  public: // ---- Forward ------------------------------------------------------------------------------------
+
+
+    static void forward(TYPE* r, const int rs0, const int rs1,
+      const TYPE* x, const int n_in, const int xs0, const int xs1,
+      const TYPE* W, const int ws0, const int ws1,
+      const int C, const int D, const GatherMapB& g){
+
+      if(g.size()==0 || C==0 || D==0) return;
+      CNINE_ASSRT(g.get_dev()==0);
+
+      if(transform_first(n_in,g,C,D)){
+	vector<TYPE> Y((size_t)n_in*D,0);
+	GEMM::add(n_in,D,C,1,x,xs0,xs1,W,ws0,ws1,Y.data(),D,1);
+	CpuGatherRows()(r,rs0,rs1,Y.data(),D,1,D,g);
+	return;
+      }
+
+      // as in GatherRows, maps with unique targets are run through their fixed degree decomposition
+      const bool unique=g.unique_targets();
+      shared_ptr<GatherMapB> graded=unique?g.graded():nullptr;
+      const GatherMapB& h=graded?*graded:g;
+
+      for(auto& p:h.fixedk_maps)
+	fused_fixedk<CpuGatherRows::max_unrolled>(p->dim(1)-1,r,rs0,rs1,x,xs0,xs1,W,ws0,ws1,C,D,
+	  p->get_arr(),p->strides[0],p->dim(0),unique);
+
+      const int* lists=h.arr.arr;
+      fused_tiles(r,rs0,rs1,W,ws0,ws1,C,D,h.size(),h.n_ops(),unique,
+	[&](const int i){return lists[h.offset(i)];},
+	[&](TYPE* dest, const int i){
+	  CpuGatherRows::gather_list(dest,1,lists+h.offset(i)+1,h.size_of(i),x,xs0,xs1,C);});
+    }
+
+    // True if the tiled gather-then-multiply pass of forward is worth using in place of GatherRows followed
+    // by add_mprod. It saves writing and rereading the gathered rows, which only matters once they are
+    // wide and the GEMM is fast enough for memory traffic to dominate, i.e., with the vectorized CpuGemm
+    // kernels. The tiles also repack W, which costs more than it saves when D>C.
+    static bool fuse_pays(const int C, const int D){
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+      return C>=min_fused_cols && D<=C;
+#else
+      return false;
+#endif
+    }
+
+    // True if n_in*C*D+E*D<n_out*C*D+E*C, i.e., if forming x*W first and gathering its rows (or, for the
+    // weight gradient, gathering rgrad by the inverse map) takes fewer operations than gathering x
+    static bool transform_first(const int n_in, const GatherMapB& g, const int C, const int D){
+      const size_t E=g.n_ops();
+      return (size_t)n_in*C*D+E*D<(size_t)g.size()*C*D+E*C;
+    }
+
+
+  public: // ---- Weight gradient ----------------------------------------------------------------------------
+
+
+    // Wgrad (C x D) += sum_s x[s]^T * (sum_j rgrad[ginv(s,j)]), where ginv is the inverse of the forward map
+    static void weight_grad(TYPE* Wg, const int wgs0, const int wgs1,
+      const TYPE* x, const int xs0, const int xs1,
+      const TYPE* rg, const int rgs0, const int rgs1,
+      const int C, const int D, const GatherMapB& ginv){
+
+      const int N=ginv.size();
+      if(N==0 || C==0 || D==0) return;
+      CNINE_ASSRT(ginv.get_dev()==0);
+
+      const int mt=tile_rows(std::max(C,D));
+      const int ntiles=(N+mt-1)/mt;
+      const int* lists=ginv.arr.arr;
+      const int nchunks=std::min(ntiles,std::max(1,nthreads));
+      vector<vector<TYPE> > partial(nchunks);
+
+      for_each_tile(ntiles,(size_t)ginv.n_ops()*D+(size_t)N*C*D,[&](const int ch, const int t0, const int t1){
+	  vector<TYPE> H((size_t)mt*D);
+	  vector<TYPE> X((size_t)mt*C);
+	  vector<TYPE> Wp((size_t)C*D,0);
+	  for(int t=t0; t<t1; t++){
+	    const int i0=t*mt;
+	    const int m=std::min(N,i0+mt)-i0;
+	    std::fill(H.begin(),H.begin()+(size_t)m*D,0);
+	    for(int k=0; k<m; k++){
+	      const int* l=lists+ginv.offset(i0+k);
+	      if(k+1<m) prefetch_list(lists+ginv.offset(i0+k+1),ginv.size_of(i0+k+1),rg,rgs0,rgs1,D);
+	      CpuGatherRows::gather_list(H.data()+(size_t)k*D,1,l+1,ginv.size_of(i0+k),rg,rgs0,rgs1,D);
+	      const TYPE* xr=x+(size_t)l[0]*xs0;
+	      for(int c=0; c<C; c++) X[(size_t)k*C+c]=xr[(size_t)c*xs1];
+	    }
+	    GEMM::add(C,D,m,1,X.data(),1,C,H.data(),D,1,Wp.data(),D,1);
+	  }
+	  partial[ch]=std::move(Wp);
+	},nchunks);
+
+      for(auto& p:partial){
+	if(p.size()==0) continue;
+	for(int a=0; a<C; a++)
+	  for(int b=0; b<D; b++)
+	    Wg[(size_t)a*wgs0+(size_t)b*wgs1]+=p[(size_t)a*D+b];
+      }
+    }
+
+
+  private:
+
+    // Prefetch the source rows of the list l[1],...,l[M] (l[0] is the target)
+    static void prefetch_list(const int* l, const int M, const TYPE* x, const int xs0, const int xs1, const int ncols){
+      for(int j=1; j<=std::min(M,CpuGatherRows::max_unrolled); j++)
+	CpuGatherRows::prefetch_row(x+((size_t)l[j])*xs0,ncols,xs1);
+    }
+
+    // The n rows of a fixed-k map, each holding a target and its K sources, with the sum over the sources
+    // unrolled for K<=max_unrolled
+    template<int K>
+    static void fused_fixedk(const int k, TYPE* r, const int rs0, const int rs1,
+      const TYPE* x, const int xs0, const int xs1,
+      const TYPE* W, const int ws0, const int ws1,
+      const int C, const int D, const int* rows, const int ls, const int n, const bool unique){
+      if constexpr(K==0){
+	fused_tiles(r,rs0,rs1,W,ws0,ws1,C,D,n,(size_t)n*k,unique,
+	  [&](const int i){return rows[(size_t)i*ls];},
+	  [&](TYPE* dest, const int i){
+	    CpuGatherRows::gather_one(dest,1,rows+(size_t)i*ls+1,k,x,xs0,xs1,C);});
+      }else{
+	if(k!=K){
+	  fused_fixedk<K-1>(k,r,rs0,rs1,x,xs0,xs1,W,ws0,ws1,C,D,rows,ls,n,unique);
+	  return;
+	}
+	fused_tiles(r,rs0,rs1,W,ws0,ws1,C,D,n,(size_t)n*K,unique,
+	  [&](const int i){return rows[(size_t)i*ls];},
+	  [&](TYPE* dest, const int i){
+	    CpuGatherRows::fixedk_one<K>(dest,1,rows+(size_t)i*ls+1,x,xs0,xs1,C);});
+      }
+    }
+
+    // The tiles of the forward pass over N lists with E edges in total. gather(dest,i) adds the sum
+    // of the source rows of list i to the row dest of the tile buffer, and target(i) is its target. The
+    // GEMM of a tile writes straight into r if the targets of the tile are consecutive rows, otherwise it
+    // goes through a buffer that is then added to the target rows.
+    template<typename TARGET, typename GATHER>
+    static void fused_tiles(TYPE* r, const int rs0, const int rs1,
+      const TYPE* W, const int ws0, const int ws1, const int C, const int D,
+      const int N, const size_t E, const bool unique, const TARGET& target, const GATHER& gather){
+
+      if(N==0) return;
+      const int mt=tile_rows(C);
+      const int ntiles=(N+mt-1)/mt;
+
+      // tiles with lists of the same target could scatter into the same row, so those maps run serially
+      const size_t work=unique?E*C+(size_t)N*C*D:0;
+      for_each_tile(ntiles,work,[&](const int, const int t0, const int t1){
+	  vector<TYPE> G((size_t)mt*C);
+	  vector<TYPE> P((size_t)mt*D);
+	  for(int t=t0; t<t1; t++){
+	    const int i0=t*mt;
+	    const int m=std::min(N,i0+mt)-i0;
+	    std::fill(G.begin(),G.begin()+(size_t)m*C,0);
+	    const int first=target(i0);
+	    bool consecutive=true;
+	    for(int k=0; k<m; k++){
+	      if(target(i0+k)!=first+k) consecutive=false;
+	      gather(G.data()+(size_t)k*C,i0+k);
+	    }
+	    if(consecutive){
+	      GEMM::add(m,D,C,1,G.data(),C,1,W,ws0,ws1,r+(size_t)first*rs0,rs0,rs1);
+	      continue;
+	    }
+	    std::fill(P.begin(),P.begin()+(size_t)m*D,0);
+	    GEMM::add(m,D,C,1,G.data(),C,1,W,ws0,ws1,P.data(),D,1);
+	    for(int k=0; k<m; k++){
+	      TYPE* rr=r+(size_t)target(i0+k)*rs0;
+	      const TYPE* q=P.data()+(size_t)k*D;
+	      if(rs1==1){
+		CNINE_IVDEP
+		for(int c=0; c<D; c++) rr[c]+=q[c];
+	      }else{
+		for(int c=0; c<D; c++) rr[(size_t)c*rs1]+=q[c];
+	      }
+	    }
+	  }
+	});
+    }
+
+    static int tile_rows(const int width){
+      int mt=tile_bytes/(sizeof(TYPE)*std::max(1,width));
+      return std::max(min_tile,std::min(max_tile,mt));
+    }
+
+    // Call fn(c,t0,t1) on nchunks consecutive ranges [t0,t1) of tiles, in parallel if there is enough work.
+    // The pool gives each chunk its share of nthreads, so the GEMMs inside fn only spawn further tasks if
+    // there are fewer chunks than threads.
+    template<typename FN>
+    static void for_each_tile(const int ntiles, const size_t work, FN&& fn, int nchunks=0){
+      if(nchunks==0) nchunks=std::min(ntiles,4*std::max(1,nthreads));
+      auto chunk=[&](const int c){
+	fn(c,(int)((size_t)c*ntiles/nchunks),(int)((size_t)(c+1)*ntiles/nchunks));};
+      if(nthreads<=1 || work<parallel_threshold){
+	for(int c=0; c<nchunks; c++) chunk(c);
+	return;
+      }
+      parallel_for(0,nchunks,1,chunk);
+    }
+
+  };
+
+}
+
+#endif
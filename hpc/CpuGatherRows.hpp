@@ -0,0 +1,256 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _CnineCpuGatherRows
+#define _CnineCpuGatherRows
+
+#include "Cnine_base.hpp"
+#include "GatherMapB.hpp"
+#include "ThreadPool.hpp"
+#include "BalancedPartition.hpp"
+#include "CpuElementwise.hpp"
+
+
+namespace cnine{
+
+
+  // ---- CpuGatherRows ----------------------------------------------------------------------------------------
+  //
+  // Host implementation of r[g.target(i)]+=sum_j x[g(i,j)] over the rows of two strided matrices. The lists
+  // of g are split into contiguous ranges of roughly equal numbers of edges (see BalancedPartition), so that a
+  // few high degree targets do not serialize the loop. If each target appears in only one list, the
+  // tasks write to disjoint rows and need no synchronization, otherwise the lists are processed serially.
+  // Wide rows are processed in column tiles of tile_cols elements, so the slice of the target row being
+  // accumulated stays in L1 while the sources stream through, and the source rows prefetch_dist edges ahead
+  // are prefetched. The lists of fixed-k maps are processed by kernels specialized for each K up to
+  // max_unrolled.
+
+
+  class CpuGatherRows{
+  public:
+
+    static constexpr int tile_cols=BalancedPartition::tile_cols;
+    static constexpr int prefetch_dist=BalancedPartition::prefetch_dist;
+    static constexpr size_t parallel_threshold=BalancedPartition::parallel_threshold;
+    static constexpr int max_unrolled=16;
+
+
+  public: // ---- Execution ----------------------------------------------------------------------------------
+
+
+    // r and x are n_out x ncols and n_in x ncols matrices with strides (rs0,rs1) and (xs0,xs1)
+    template<typename TYPE>
+    void operator()(TYPE* r, const int rs0, const int rs1, const TYPE* x, const int xs0, const int xs1,
+      const int ncols, const GatherMapB& g) const{
+      for_each_list(g,ncols,[&](const int i, const size_t e0, const int* l, const int M){
+	  gather_one(r+((size_t)l[0])*rs0,rs1,l+1,M,x,xs0,xs1,ncols);});
+    }
+
+    // The same for lists given directly as hlists, e.g., ones with 64 bit offsets
+    template<typename TYPE, typename OFFSET>
+    void operator()(TYPE* r, const int rs0, const int rs1, const TYPE* x, const int xs0, const int xs1,
+      const int ncols, const hlists<int,OFFSET>& lists) const{
+      for_each_list(lists,ncols,[&](const int i, const size_t e0, const int* l, const int M){
+	  gather_one(r+((size_t)l[0])*rs0,rs1,l+1,M,x,xs0,xs1,ncols);});
+    }
+
+    // The same for a fixed-k map given as n rows of K+1 ints with stride ls, each row holding a target and
+    // its K sources. For K<=max_unrolled the inner sum is unrolled at compile time, so each output element
+    // is a single branch free expression over K source rows, vectorized along the columns. As for the
+    // lists of a GatherMapB, the rows are only split over tasks if unique is set, i.e., no two of them have
+    // the same target (see FixedkGatherMap::unique_targets).
+    template<typename TYPE>
+    void fixedk(TYPE* r, const int rs0, const int rs1, const TYPE* x, const int xs0, const int xs1,
+      const int ncols, const int* rows, const int ls, const int n, const int K, const bool unique) const{
+      if(n==0 || ncols==0 || K==0) return;
+      int ntasks=1;
+      if(nthreads>1 && (size_t)n*K*ncols>=parallel_threshold && unique)
+	ntasks=std::min(n,4*nthreads);
+      parallel_for(0,ntasks,1,[&](const int t){
+	  const int i0=(size_t)t*n/ntasks;
+	  const int i1=(size_t)(t+1)*n/ntasks;
+	  fixedk_dispatch<max_unrolled>(K,r,rs0,rs1,x,xs0,xs1,ncols,rows,ls,i0,i1);
+	});
+    }
+
+
+  public: // ---- Traversal ----------------------------------------------------------------------------------
+
+
+    // Call fn(i,e0,l,M) for each list i of g, where l[0] is the target, l[1],...,l[M] are the sources, and
+    // e0 is the index of the first edge of the list in the order g.for_each visits the edges. The lists are
+    // split into contiguous ranges of roughly equal numbers of edges, which are processed in parallel if
+    // there is enough work, taking ncols as the cost of each edge, and no two lists have the same target.
+    template<typename FN>
+    static void for_each_list(const GatherMapB& g, const size_t ncols, FN&& fn){
+      for_each_list(g.arr,ncols,std::forward<FN>(fn),g.unique_targets());
+    }
+
+    template<typename OFFSET, typename FN>
+    static void for_each_list(const hlists<int,OFFSET>& g, const size_t ncols, FN&& fn){
+      for_each_list(g,ncols,std::forward<FN>(fn),unique_heads(g));
+    }
+
+    template<typename OFFSET, typename FN>
+    static void for_each_list(const hlists<int,OFFSET>& g, const size_t ncols, FN&& fn, const bool unique){
+      const int N=g.size();
+      if(N==0 || ncols==0) return;
+      CNINE_ASSRT(g.get_dev()==0);
+
+      const int* lists=g.arr;
+      BalancedPartition parts(N,[&](const int i){return g.size_of(i)+1;},ncols);
+      if(!unique) parts.ntasks=1;
+      const vector<size_t>& cum=parts.cum;
+      parts.for_each([&](const int i){
+	  fn(i,cum[i]-i,lists+g.offset(i),(int)(cum[i+1]-cum[i]-1));});
+    }
+
+    template<typename OFFSET>
+    static bool unique_heads(const hlists<int,OFFSET>& g){
+      vector<char> seen;
+      for(int i=0; i<g.size(); i++){
+	const int t=g.head(i);
+	if(t>=seen.size()) seen.resize(t+1,0);
+	if(seen[t]) return false;
+	seen[t]=1;
+      }
+      return true;
+    }
+
+    // Call fn(c0,c1) on blocks of columns covering [0,ncols), in parallel if there is enough work. This is
+    // for scattering into the sources, which is only race free if each thread owns whole columns.
+    template<typename FN>
+    static void for_column_blocks(const int ncols, const size_t work_per_column, FN&& fn){
+      int nblocks=1;
+      if(nthreads>1 && ncols*work_per_column>=parallel_threshold)
+	nblocks=std::min(ncols,nthreads);
+      parallel_for(0,nblocks,1,[&](const int b){
+	  fn((int)((size_t)b*ncols/nblocks),(int)((size_t)(b+1)*ncols/nblocks));});
+    }
+
+
+  public: // ---- Kernels --------------------------------------------------------------------------------------
+
+
+    // t+=sum_j x[src[j]] for a single row t of length ncols, tile by tile
+    template<typename TYPE>
+    static void gather_one(TYPE* t, const int ts, const int* src, const int M, const TYPE* x, const int xs0,
+      const int xs1, const int ncols){
+      gather_one(t,ts,src,M,x,xs0,xs1,ncols,[](const int j){return (TYPE)1;});
+    }
+
+    // t+=sum_j w(j)*x[src[j]]
+    template<typename TYPE, typename WEIGHT>
+    static void gather_one(TYPE* t, const int ts, const int* src, const int M, const TYPE* x, const int xs0,
+      const int xs1, const int ncols, const WEIGHT& w){
+      const bool unit=(ts==1 && xs1==1);
+      for(int c0=0; c0<ncols; c0+=tile_cols){
+	const int mc=std::min(tile_cols,ncols-c0);
+	TYPE* tt=t+((size_t)c0)*ts;
+	for(int j=0; j<M; j++){
+	  if(j+prefetch_dist<M) prefetch_row(x+((size_t)src[j+prefetch_dist])*xs0+((size_t)c0)*xs1,mc,xs1);
+	  const TYPE* s=x+((size_t)src[j])*xs0+((size_t)c0)*xs1;
+	  const TYPE a=w(j);
+	  if(unit){
+	    CNINE_IVDEP
+	    for(int k=0; k<mc; k++) tt[k]+=a*s[k];
+	  }else{
+	    for(int k=0; k<mc; k++) tt[k*ts]+=a*s[k*xs1];
+	  }
+	}
+      }
+    }
+
+    // t+=sum_j x[src[j]] for a list of any length M, through the unrolled kernel if M<=max_unrolled
+    template<typename TYPE>
+    static void gather_list(TYPE* t, const int ts, const int* src, const int M, const TYPE* x, const int xs0,
+      const int xs1, const int ncols){
+      list_dispatch<max_unrolled>(M,t,ts,src,x,xs0,xs1,ncols);
+    }
+
+    // t+=sum_j x[src[j]] for a list of exactly K sources, with the sum over j unrolled
+    template<int K, typename TYPE>
+    static void fixedk_one(TYPE* t, const int ts, const int* src, const TYPE* x, const int xs0, const int xs1,
+      const int ncols){
+      const TYPE* s[K];
+      for(int j=0; j<K; j++) s[j]=x+((size_t)src[j])*xs0;
+      if(ts==1 && xs1==1){
+	CNINE_IVDEP
+	for(int c=0; c<ncols; c++){
+	  TYPE a=t[c];
+	  for(int j=0; j<K; j++) a+=s[j][c];
+	  t[c]=a;
+	}
+      }else{
+	for(int c=0; c<ncols; c++){
+	  TYPE a=t[c*ts];
+	  for(int j=0; j<K; j++) a+=s[j][c*xs1];
+	  t[c*ts]=a;
+	}
+      }
+    }
+
+    // Rows [i0,i1) of a fixed-k map
+    template<int K, typename TYPE>
+    static void fixedk_rows(TYPE* r, const int rs0, const int rs1, const TYPE* x, const int xs0, const int xs1,
+      const int ncols, const int* rows, const int ls, const int i0, const int i1){
+      for(int i=i0; i<i1; i++){
+	const int* l=rows+((size_t)i)*ls;
+	if(i+1<i1)
+	  for(int j=0; j<K; j++) CNINE_PREFETCH(x+((size_t)l[ls+j+1])*xs0);
+	fixedk_one<K>(r+((size_t)l[0])*rs0,rs1,l+1,x,xs0,xs1,ncols);
+      }
+    }
+
+    template<int K, typename TYPE>
+    static void list_dispatch(const int M, TYPE* t, const int ts, const int* src, const TYPE* x, const int xs0,
+      const int xs1, const int ncols){
+      if constexpr(K==0){
+	gather_one(t,ts,src,M,x,xs0,xs1,ncols);
+      }else{
+	if(M==K) fixedk_one<K>(t,ts,src,x,xs0,xs1,ncols);
+	else list_dispatch<K-1>(M,t,ts,src,x,xs0,xs1,ncols);
+      }
+    }
+
+    template<int K, typename TYPE>
+    static void fixedk_dispatch(const int k, TYPE* r, const int rs0, const int rs1, const TYPE* x, const int xs0,
+      const int xs1, const int ncols, const int* rows, const int ls, const int i0, const int i1){
+      if constexpr(K==0){
+	for(int i=i0; i<i1; i++){
+	  const int* l=rows+((size_t)i)*ls;
+	  gather_one(r+((size_t)l[0])*rs0,rs1,l+1,k,x,xs0,xs1,ncols);
+	}
+      }else{
+	if(k==K) fixedk_rows<K>(r,rs0,rs1,x,xs0,xs1,ncols,rows,ls,i0,i1);
+	else fixedk_dispatch<K-1>(k,r,rs0,rs1,x,xs0,xs1,ncols,rows,ls,i0,i1);
+      }
+    }
+
+    // Prefetch n elements with stride s starting at p (just the first one if s!=1)
+    template<typename TYPE>
+    static inline void prefetch_row(const TYPE* p, const int n, const int s){
+      if(s!=1){
+	CNINE_PREFETCH(p);
+	return;
+      }
+      const char* q=reinterpret_cast<const char*>(p);
+      for(size_t b=0; b<n*sizeof(TYPE); b+=64)
+	CNINE_PREFETCH(q+b);
+    }
+
+  };
+
+}
+
+#endif
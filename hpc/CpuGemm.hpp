@@ -0,0 +1,559 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2023, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _CnineCpuGemm
+#define _CnineCpuGemm
+
+#include "Cnine_base.hpp"
+#include "MultiLoop.hpp"
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+
+namespace cnine{
+
+  extern thread_local int nthreads;
+
+
+  // ---- Micro-kernels ----------------------------------------------------------------------------------------
+  //
+  // A micro-kernel computes the MR x NR tile c=a*b, where a is a packed MR x kc micro-panel of the left
+  // operand (column by column) and b is a packed kc x NR micro-panel of the right operand (row by row).
+  // The tile is written row major into c, which must be 64-byte aligned.
+
+
+  template<typename TYPE>
+  class CpuGemmKernel{
+  public:
+
+    static constexpr int MR=4;
+    static constexpr int NR=8;
+
+    static void apply(const int kc, const TYPE* __restrict__ a, const TYPE* __restrict__ b, TYPE* __restrict__ c){
+      TYPE acc[MR*NR];
+      for(int i=0; i<MR*NR; i++) acc[i]=0;
+      for(int k=0; k<kc; k++){
+	for(int i=0; i<MR; i++){
+	  const TYPE t=a[i];
+	  for(int j=0; j<NR; j++)
+	    acc[i*NR+j]+=t*b[j];
+	}
+	a+=MR;
+	b+=NR;
+      }
+      for(int i=0; i<MR*NR; i++) c[i]=acc[i];
+    }
+
+  };
+
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+
+  template<typename TYPE, typename VEC, int _MR, int NV>
+  class CpuGemmSimdKernel{
+  public:
+
+    typedef typename VEC::vec vec;
+
+    static constexpr int MR=_MR;
+    static constexpr int NR=NV*VEC::width;
+
+    static void apply(const int kc, const TYPE* __restrict__ a, const TYPE* __restrict__ b, TYPE* __restrict__ c){
+      vec acc[MR][NV];
+      for(int i=0; i<MR; i++)
+	for(int v=0; v<NV; v++)
+	  acc[i][v]=VEC::zero();
+      for(int k=0; k<kc; k++){
+	vec bv[NV];
+	for(int v=0; v<NV; v++)
+	  bv[v]=VEC::load(b+v*VEC::width);
+	for(int i=0; i<MR; i++){
+	  const vec t=VEC::set1(a[i]);
+	  for(int v=0; v<NV; v++)
+	    acc[i][v]=VEC::fmadd(t,bv[v],acc[i][v]);
+	}
+	a+=MR;
+	b+=NR;
+      }
+      for(int i=0; i<MR; i++)
+	for(int v=0; v<NV; v++)
+	  VEC::store(c+i*NR+v*VEC::width,acc[i][v]);
+    }
+
+  };
+
+#endif
+
+
+#if defined(__AVX512F__)
+
+  struct CpuGemmVec_avx512f{
+    typedef __m512 vec;
+    static constexpr int width=16;
+    static inline vec zero(){return _mm512_setzero_ps();}
+    static inline vec load(const float* p){return _mm512_load_ps(p);}
+    static inline vec set1(const float x){return _mm512_set1_ps(x);}
+    static inline vec fmadd(const vec a, const vec b, const vec c){return _mm512_fmadd_ps(a,b,c);}
+    static inline void store(float* p, const vec x){_mm512_store_ps(p,x);}
+  };
+
+  struct CpuGemmVec_avx512d{
+    typedef __m512d vec;
+    static constexpr int width=8;
+    static inline vec zero(){return _mm512_setzero_pd();}
+    static inline vec load(const double* p){return _mm512_load_pd(p);}
+    static inline vec set1(const double x){return _mm512_set1_pd(x);}
+    static inline vec fmadd(const vec a, const vec b, const vec c){return _mm512_fmadd_pd(a,b,c);}
+    static inline void store(double* p, const vec x){_mm512_store_pd(p,x);}
+  };
+
+  template<>
+  class CpuGemmKernel<float>: public CpuGemmSimdKernel<float,CpuGemmVec_avx512f,12,2>{};
+
+  template<>
+  class CpuGemmKernel<double>: public CpuGemmSimdKernel<double,CpuGemmVec_avx512d,12,2>{};
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+  struct CpuGemmVec_avx2f{
+    typedef __m256 vec;
+    static constexpr int width=8;
+    static inline vec zero(){return _mm256_setzero_ps();}
+    static inline vec load(const float* p){return _mm256_load_ps(p);}
+    static inline vec set1(const float x){return _mm256_set1_ps(x);}
+    static inline vec fmadd(const vec a, const vec b, const vec c){return _mm256_fmadd_ps(a,b,c);}
+    static inline void store(float* p, const vec x){_mm256_store_ps(p,x);}
+  };
+
+  struct CpuGemmVec_avx2d{
+    typedef __m256d vec;
+    static constexpr int width=4;
+    static inline vec zero(){return _mm256_setzero_pd();}
+    static inline vec load(const double* p){return _mm256_load_pd(p);}
+    static inline vec set1(const double x){return _mm256_set1_pd(x);}
+    static inline vec fmadd(const vec a, const vec b, const vec c){return _mm256_fmadd_pd(a,b,c);}
+    static inline void store(double* p, const vec x){_mm256_store_pd(p,x);}
+  };
+
+  template<>
+  class CpuGemmKernel<float>: public CpuGemmSimdKernel<float,CpuGemmVec_avx2f,6,2>{};
+
+  template<>
+  class CpuGemmKernel<double>: public CpuGemmSimdKernel<double,CpuGemmVec_avx2d,6,2>{};
+
+#endif
+
+
+  // ---- Packing buffers --------------------------------------------------------------------------------------
+
+
+  template<typename TYPE>
+  class CpuGemmBuffer{
+  public:
+
+    TYPE* arr=nullptr;
+    size_t memsize=0;
+
+    CpuGemmBuffer(){}
+
+    CpuGemmBuffer(const CpuGemmBuffer& x)=delete;
+    CpuGemmBuffer& operator=(const CpuGemmBuffer& x)=delete;
+
+    ~CpuGemmBuffer(){
+      if(arr) ::operator delete(arr,std::align_val_t(64));
+    }
+
+    TYPE* get(const size_t n){
+      if(n>memsize){
+	if(arr) ::operator delete(arr,std::align_val_t(64));
+	arr=static_cast<TYPE*>(::operator new(n*sizeof(TYPE),std::align_val_t(64)));
+	memsize=n;
+      }
+      return arr;
+    }
+
+  };
+
+
+  // ---- Operands -------------------------------------------------------------------------------------------
+  //
+  // An operand is c*arr (or c*arr+c2*arr2 if arr2 is set, with the same strides), so that scalings,
+  // conjugation and the sums needed by the 3M complex product are fused into packing.
+  // A target receives alpha*P (and alpha2*P into arr2 if set), where P is the computed product.
+
+
+  template<typename TYPE>
+  class CpuGemmOperand{
+  public:
+
+    const TYPE* arr;
+    int rs,cs;
+    TYPE c=1;
+    const TYPE* arr2=nullptr;
+    TYPE c2=0;
+
+    CpuGemmOperand(const TYPE* _arr, const int _rs, const int _cs, const TYPE _c=1):
+      arr(_arr), rs(_rs), cs(_cs), c(_c){}
+
+    CpuGemmOperand(const TYPE* _arr, const int _rs, const int _cs, const TYPE _c, const TYPE* _arr2, const TYPE _c2):
+      arr(_arr), rs(_rs), cs(_cs), c(_c), arr2(_arr2), c2(_c2){}
+
+    CpuGemmOperand transp() const{
+      CpuGemmOperand R(*this);
+      std::swap(R.rs,R.cs);
+      return R;
+    }
+
+    CpuGemmOperand offset(const int i, const int j) const{
+      CpuGemmOperand R(*this);
+      size_t t=(size_t)i*rs+(size_t)j*cs;
+      R.arr+=t;
+      if(arr2) R.arr2+=t;
+      return R;
+    }
+
+    TYPE operator()(const int i, const int j) const{
+      size_t t=(size_t)i*rs+(size_t)j*cs;
+      if(arr2) return c*arr[t]+c2*arr2[t];
+      return c*arr[t];
+    }
+
+  };
+
+
+  template<typename TYPE>
+  class CpuGemmTarget{
+  public:
+
+    TYPE* arr;
+    int rs,cs;
+    TYPE alpha=1;
+    TYPE* arr2=nullptr;
+    TYPE alpha2=0;
+
+    CpuGemmTarget(TYPE* _arr, const int _rs, const int _cs, const TYPE _alpha=1):
+      arr(_arr), rs(_rs), cs(_cs), alpha(_alpha){}
+
+    CpuGemmTarget(TYPE* _arr, const int _rs, const int _cs, const TYPE _alpha, TYPE* _arr2, const TYPE _alpha2):
+      arr(_arr), rs(_rs), cs(_cs), alpha(_alpha), arr2(_arr2), alpha2(_alpha2){}
+
+    CpuGemmTarget transp() const{
+      CpuGemmTarget R(*this);
+      std::swap(R.rs,R.cs);
+      return R;
+    }
+
+    CpuGemmTarget offset(const int i, const int j) const{
+      CpuGemmTarget R(*this);
+      size_t t=(size_t)i*rs+(size_t)j*cs;
+      R.arr+=t;
+      if(arr2) R.arr2+=t;
+      return R;
+    }
+
+  };
+
+
+  // ---- CpuGemm ----------------------------------------------------------------------------------------------
+  //
+  // C+=alpha*A*B for arbitrarily strided A (MxK), B (KxN) and C (MxN). The loop structure follows the usual
+  // Goto/BLIS scheme: KCxNC blocks of B are packed into NR wide micro-panels that stay in L3, MCxKC blocks
+  // of A are packed into MR high micro-panels that stay in L2, and the micro-kernel streams one micro-panel
+  // of B through L1. Transposed operands are handled simply by swapping strides, since packing absorbs them.
+  // The MC blocks, and if necessary groups of NR micro-panels, are distributed over nthreads threads.
+
+
+  template<typename TYPE>
+  class CpuGemm{
+  public:
+
+    typedef CpuGemmKernel<TYPE> KERNEL;
+    typedef CpuGemmOperand<TYPE> OPERAND;
+    typedef CpuGemmTarget<TYPE> TARGET;
+
+    static constexpr int MR=KERNEL::MR;
+    static constexpr int NR=KERNEL::NR;
+    static constexpr int KC=256;
+    static constexpr int MC=(240/MR)*MR;
+    static constexpr int NC=(4096/NR)*NR;
+
+    static constexpr size_t small_threshold=8*8*8;
+    static constexpr size_t parallel_threshold=64*64*64;
+
+
+  public: // ---- Entry points --------------------------------------------------------------------------------
+
+
+    static void add(const int M, const int N, const int K, const TYPE alpha,
+      const TYPE* A, const int rsa, const int csa,
+      const TYPE* B, const int rsb, const int csb,
+      TYPE* C, const int rsc, const int csc){
+      add(M,N,K,OPERAND(A,rsa,csa),OPERAND(B,rsb,csb),TARGET(C,rsc,csc,alpha));
+    }
+
+
+    static void add(const int M, const int N, const int K, const OPERAND& A, const OPERAND& B, const TARGET& C){
+
+      if(M<=0 || N<=0 || K<=0) return;
+      if((size_t)M*N*K<=small_threshold){
+	add_naive(M,N,K,A,B,C);
+	return;
+      }
+
+      // If C is column major it is better to compute C^T+=B^T*A^T
+      if(C.cs!=1 && C.rs==1){
+	add(N,M,K,B.transp(),A.transp(),C.transp());
+	return;
+      }
+
+      const bool parallel=(nthreads>1 && (size_t)M*N*K>=parallel_threshold);
+      const int nmblocks=(M+MC-1)/MC;
+      BbufferScope Bscope;
+      CpuGemmBuffer<TYPE>& Bbuf=Bscope.buf;
+
+      for(int jc=0; jc<N; jc+=NC){
+	const int nc=std::min(NC,N-jc);
+	const int npanels=(nc+NR-1)/NR;
+
+	for(int pc=0; pc<K; pc+=KC){
+	  const int kc=std::min(KC,K-pc);
+	  TYPE* Bp=Bbuf.get((size_t)npanels*NR*kc);
+	  const OPERAND Bblock=B.offset(pc,jc);
+
+	  if(!parallel){
+	    pack_B(kc,nc,Bblock,Bp);
+	    TYPE* Ap=Abuffer().get((size_t)MC*kc);
+	    for(int ic=0; ic<M; ic+=MC){
+	      const int mc=std::min(MC,M-ic);
+	      pack_A(mc,kc,A.offset(ic,pc),Ap);
+	      macro_kernel(mc,nc,kc,Ap,Bp,0,npanels,C.offset(ic,jc));
+	    }
+	    continue;
+	  }
+
+	  const int nsplit=std::min(npanels,std::max(1,(nthreads+nmblocks-1)/nmblocks));
+	  const int panels_per_split=(npanels+nsplit-1)/nsplit;
+
+	  MultiLoop(nsplit,[&](const int s){
+	      const int p0=s*panels_per_split;
+	      const int p1=std::min(npanels,p0+panels_per_split);
+	      if(p0>=p1) return;
+	      pack_B(kc,std::min(nc,p1*NR)-p0*NR,Bblock.offset(0,p0*NR),Bp+(size_t)p0*NR*kc);
+	    });
+
+	  MultiLoop(nmblocks*nsplit,[&](const int t){
+	      const int ic=(t/nsplit)*MC;
+	      const int s=t%nsplit;
+	      const int mc=std::min(MC,M-ic);
+	      const int p0=s*panels_per_split;
+	      const int p1=std::min(npanels,p0+panels_per_split);
+	      if(p0>=p1) return;
+	      TYPE* Ap=Abuffer().get((size_t)MC*kc);
+	      pack_A(mc,kc,A.offset(ic,pc),Ap);
+	      macro_kernel(mc,nc,kc,Ap,Bp,p0,p1,C.offset(ic,jc));
+	    });
+	}
+      }
+    }
+
+
+    static void add_naive(const int M, const int N, const int K, const OPERAND& A, const OPERAND& B, const TARGET& C){
+      for(int i=0; i<M; i++)
+	for(int j=0; j<N; j++){
+	  TYPE t=0;
+	  for(int k=0; k<K; k++)
+	    t+=A(i,k)*B(k,j);
+	  size_t offs=(size_t)i*C.rs+(size_t)j*C.cs;
+	  C.arr[offs]+=C.alpha*t;
+	  if(C.arr2) C.arr2[offs]+=C.alpha2*t;
+	}
+    }
+
+
+  public: // ---- Packing -------------------------------------------------------------------------------------
+
+
+    // Pack an mc x kc block of A into ceil(mc/MR) micro-panels of size MR x kc, zero padding the last one
+    static void pack_A(const int mc, const int kc, const OPERAND& A, TYPE* dest){
+      if(A.arr2){
+	const TYPE* a2=A.arr2;
+	const TYPE c=A.c;
+	const TYPE c2=A.c2;
+	pack_A(mc,kc,A.arr,A.rs,A.cs,dest,[a2,c,c2](const TYPE* p, const size_t t){return c*p[t]+c2*a2[t];});
+	return;
+      }
+      if(A.c!=1){
+	const TYPE c=A.c;
+	pack_A(mc,kc,A.arr,A.rs,A.cs,dest,[c](const TYPE* p, const size_t t){return c*p[t];});
+	return;
+      }
+      pack_A(mc,kc,A.arr,A.rs,A.cs,dest,[](const TYPE* p, const size_t t){return p[t];});
+    }
+
+    // Pack a kc x nc block of B into ceil(nc/NR) micro-panels of size kc x NR, zero padding the last one
+    static void pack_B(const int kc, const int nc, const OPERAND& B, TYPE* dest){
+      if(B.arr2){
+	const TYPE* b2=B.arr2;
+	const TYPE c=B.c;
+	const TYPE c2=B.c2;
+	pack_B(kc,nc,B.arr,B.rs,B.cs,dest,[b2,c,c2](const TYPE* p, const size_t t){return c*p[t]+c2*b2[t];});
+	return;
+      }
+      if(B.c!=1){
+	const TYPE c=B.c;
+	pack_B(kc,nc,B.arr,B.rs,B.cs,dest,[c](const TYPE* p, const size_t t){return c*p[t];});
+	return;
+      }
+      pack_B(kc,nc,B.arr,B.rs,B.cs,dest,[](const TYPE* p, const size_t t){return p[t];});
+    }
+
+
+  private:
+
+    // READ(base,offset) returns the value of the operand at base[offset]
+
+    template<typename READ>
+    static void pack_A(const int mc, const int kc, const TYPE* A, const int rs, const int cs, TYPE* dest, const READ& read){
+      for(int i0=0; i0<mc; i0+=MR){
+	const int m=std::min(MR,mc-i0);
+	const size_t offs=(size_t)i0*rs;
+	if(cs==1){
+	  for(int i=0; i<m; i++){
+	    const size_t t=offs+(size_t)i*rs;
+	    for(int k=0; k<kc; k++)
+	      dest[k*MR+i]=read(A,t+k);
+	  }
+	  for(int i=m; i<MR; i++)
+	    for(int k=0; k<kc; k++)
+	      dest[k*MR+i]=0;
+	}else{
+	  for(int k=0; k<kc; k++){
+	    const size_t t=offs+(size_t)k*cs;
+	    for(int i=0; i<m; i++)
+	      dest[k*MR+i]=read(A,t+(size_t)i*rs);
+	    for(int i=m; i<MR; i++)
+	      dest[k*MR+i]=0;
+	  }
+	}
+	dest+=MR*kc;
+      }
+    }
+
+    template<typename READ>
+    static void pack_B(const int kc, const int nc, const TYPE* B, const int rs, const int cs, TYPE* dest, const READ& read){
+      for(int j0=0; j0<nc; j0+=NR){
+	const int n=std::min(NR,nc-j0);
+	const size_t offs=(size_t)j0*cs;
+	if(cs==1 || rs!=1){
+	  for(int k=0; k<kc; k++){
+	    const size_t t=offs+(size_t)k*rs;
+	    for(int j=0; j<n; j++)
+	      dest[k*NR+j]=read(B,t+(size_t)j*cs);
+	    for(int j=n; j<NR; j++)
+	      dest[k*NR+j]=0;
+	  }
+	}else{
+	  for(int j=0; j<n; j++){
+	    const size_t t=offs+(size_t)j*cs;
+	    for(int k=0; k<kc; k++)
+	      dest[k*NR+j]=read(B,t+k);
+	  }
+	  for(int j=n; j<NR; j++)
+	    for(int k=0; k<kc; k++)
+	      dest[k*NR+j]=0;
+	}
+	dest+=NR*kc;
+      }
+    }
+
+
+  private: // ---- Macro-kernel -------------------------------------------------------------------------------
+
+
+    static void macro_kernel(const int mc, const int nc, const int kc,
+      const TYPE* Ap, const TYPE* Bp, const int p0, const int p1, const TARGET& C){
+      alignas(64) TYPE tile[MR*NR];
+      for(int p=p0; p<p1; p++){
+	const int jr=p*NR;
+	const int nr=std::min(NR,nc-jr);
+	for(int ir=0; ir<mc; ir+=MR){
+	  const int mr=std::min(MR,mc-ir);
+	  KERNEL::apply(kc,Ap+(size_t)ir*kc,Bp+(size_t)jr*kc,tile);
+	  const size_t offs=(size_t)ir*C.rs+(size_t)jr*C.cs;
+	  update(mr,nr,C.alpha,tile,C.arr+offs,C.rs,C.cs);
+	  if(C.arr2) update(mr,nr,C.alpha2,tile,C.arr2+offs,C.rs,C.cs);
+	}
+      }
+    }
+
+    static void update(const int mr, const int nr, const TYPE alpha, const TYPE* tile, TYPE* C, const int rsc, const int csc){
+      if(csc==1){
+	for(int i=0; i<mr; i++){
+	  TYPE* c=C+(size_t)i*rsc;
+	  const TYPE* t=tile+i*NR;
+	  for(int j=0; j<nr; j++)
+	    c[j]+=alpha*t[j];
+	}
+	return;
+      }
+      for(int i=0; i<mr; i++)
+	for(int j=0; j<nr; j++)
+	  C[(size_t)i*rsc+(size_t)j*csc]+=alpha*tile[i*NR+j];
+    }
+
+    static CpuGemmBuffer<TYPE>& Abuffer(){
+      static thread_local CpuGemmBuffer<TYPE> buf;
+      return buf;
+    }
+
+    // The packed B block is read by the other threads until the call returns, so each call on a thread
+    // gets its own buffer: a product started by a task that this thread runs in the meantime (e.g. a
+    // nested parallel loop in a caller) must not reuse it. The buffers are kept per nesting depth, so
+    // repeated calls still reuse their storage.
+    class BbufferScope{
+    public:
+      CpuGemmBuffer<TYPE>& buf;
+      BbufferScope(): buf(get(depth()++)){}
+      ~BbufferScope(){depth()--;}
+      BbufferScope(const BbufferScope& x)=delete;
+    private:
+      static int& depth(){
+	static thread_local int d=0;
+	return d;
+      }
+      static CpuGemmBuffer<TYPE>& get(const int d){
+	static thread_local vector<unique_ptr<CpuGemmBuffer<TYPE> > > stack;
+	while(stack.size()<=d) stack.push_back(unique_ptr<CpuGemmBuffer<TYPE> >(new CpuGemmBuffer<TYPE>()));
+	return *stack[d];
+      }
+    };
+
+  };
+
+
+  // ---- Functions --------------------------------------------------------------------------------------------
+
+
+  template<typename TYPE>
+  inline void cpu_gemm(const int M, const int N, const int K, const TYPE alpha,
+    const TYPE* A, const int rsa, const int csa,
+    const TYPE* B, const int rsb, const int csb,
+    TYPE* C, const int rsc, const int csc){
+    CpuGemm<TYPE>::add(M,N,K,alpha,A,rsa,csa,B,rsb,csb,C,rsc,csc);
+  }
+
+}
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _CnineCpuReduce
+#define _CnineCpuReduce
+
+#include "CpuElementwise.hpp"
+
+
+namespace cnine{
+
+  // If set, reductions are computed in an order that does not depend on the number of threads
+  extern bool deterministic_reductions;
+
+
+  // ---- CpuReduce --------------------------------------------------------------------------------------------
+  //
+  // Reduce N tensors of the same dimensions but arbitrary strides to a single value of type ACC, using the
+  // loop nest of CpuElementwise. fn(acc,x0,...,xN-1) folds one element into an accumulator, and
+  // combine(a,b) merges accumulator b into a. Both must be associative up to rounding.
+  //
+  // Each segment of the innermost dimension is folded into nacc independent accumulators in round robin
+  // fashion, which breaks the dependency chain of the inner loop and lets the compiler vectorize it. The
+  // elements are cut into blocks of about block_size elements, each block is reduced separately, and the
+  // partial results are merged by a pairwise tree. In deterministic mode the blocks and the tree only
+  // depend on the dimensions and strides, so the result is bitwise the same for any number of threads.
+  // Otherwise each thread folds a contiguous range of blocks into one accumulator.
+
+
+  template<int N>
+  class CpuReduce{
+  public:
+
+    static constexpr int nacc=8;
+    static constexpr size_t block_size=1<<14;
+
+    CpuElementwise<N> loops;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    CpuReduce(const Gdims& dims, const std::array<const GstridesB*,N>& strides):
+      loops(dims,strides){}
+
+
+  public: // ---- Execution ----------------------------------------------------------------------------------
+
+
+    template<typename TYPE, typename ACC, typename FN, typename COMBINE>
+    ACC operator()(const std::array<TYPE*,N>& ptrs, const ACC& zero, FN fn, COMBINE combine,
+      const bool parallel=true) const{
+
+      const size_t nrows=loops.nrows;
+      const size_t m=loops.ncols();
+      if(nrows==0 || m==0) return zero;
+
+      // blocks are either groups of whole rows or pieces of a single row
+      const size_t rows_per_block=std::max((size_t)1,block_size/m);
+      const size_t cblocks=(m+block_size-1)/block_size;
+      const size_t nblocks=(m>=block_size)?nrows*cblocks:(nrows+rows_per_block-1)/rows_per_block;
+
+      auto reduce_block=[&](const size_t b){
+	if(m>=block_size){
+	  const size_t c0=(b%cblocks)*block_size;
+	  return reduce_range(ptrs,zero,fn,combine,b/cblocks,b/cblocks+1,c0,std::min(m,c0+block_size));
+	}
+	const size_t r0=b*rows_per_block;
+	return reduce_range(ptrs,zero,fn,combine,r0,std::min(nrows,r0+rows_per_block),0,m);
+      };
+
+      const bool par=parallel && nthreads>1 && loops.asize()>=CpuElementwise<N>::parallel_threshold;
+
+      if(deterministic_reductions){
+	vector<ACC> partial(nblocks,zero);
+	if(par) parallel_for(0,nblocks,1,[&](const int b){partial[b]=reduce_block(b);});
+	else for(size_t b=0; b<nblocks; b++) partial[b]=reduce_block(b);
+	return tree(partial,combine);
+      }
+
+      if(!par){
+	ACC r=zero;
+	for(size_t b=0; b<nblocks; b++) combine(r,reduce_block(b));
+	return r;
+      }
+
+      const int ntasks=std::min(nblocks,(size_t)4*nthreads);
+      vector<ACC> partial(ntasks,zero);
+      parallel_for(0,ntasks,1,[&](const int t){
+	  for(size_t b=t*nblocks/ntasks; b<(t+1)*nblocks/ntasks; b++)
+	    combine(partial[t],reduce_block(b));});
+      return tree(partial,combine);
+    }
+
+
+  private:
+
+    template<typename TYPE, typename ACC, typename FN, typename COMBINE>
+    ACC reduce_range(const std::array<TYPE*,N>& ptrs, const ACC& zero, FN& fn, COMBINE& combine,
+      const size_t r0, const size_t r1, const size_t c0, const size_t c1) const{
+      ACC acc[nacc];
+      for(int k=0; k<nacc; k++) acc[k]=zero;
+      if(loops.unit_inner())
+	loops.traverse(ptrs,r0,r1,c0,c1,[&](const std::array<TYPE*,N>& q, const size_t m){
+	    fold_unit(acc,q,m,fn,std::make_index_sequence<N>());});
+      else
+	loops.traverse(ptrs,r0,r1,c0,c1,[&](const std::array<TYPE*,N>& q, const size_t m){
+	    fold_strided(acc,q,m,fn,std::make_index_sequence<N>());});
+      for(int w=nacc/2; w>0; w/=2)
+	for(int k=0; k<w; k++) combine(acc[k],acc[k+w]);
+      return acc[0];
+    }
+
+    template<typename TYPE, typename ACC, typename FN, size_t... I>
+    static inline void fold_unit(ACC* acc, const std::array<TYPE*,N>& q, const size_t m, FN& fn,
+      std::index_sequence<I...>){
+      size_t i=0;
+      for(; i+nacc<=m; i+=nacc)
+	for(int k=0; k<nacc; k++)
+	  fn(acc[k],q[I][i+k]...);
+      for(int k=0; i<m; i++, k++)
+	fn(acc[k],q[I][i]...);
+    }
+
+    template<typename TYPE, typename ACC, typename FN, size_t... I>
+    inline void fold_strided(ACC* acc, const std::array<TYPE*,N>& q, const size_t m, FN& fn,
+      std::index_sequence<I...>) const{
+      const size_t st[N]={loops.inner_stride(I)...};
+      size_t i=0;
+      for(; i+nacc<=m; i+=nacc)
+	for(int k=0; k<nacc; k++)
+	  fn(acc[k],q[I][(i+k)*st[I]]...);
+      for(int k=0; i<m; i++, k++)
+	fn(acc[k],q[I][i*st[I]]...);
+    }
+
+    // Pairwise reduction of v in a fixed order
+    template<typename ACC, typename COMBINE>
+    static ACC tree(vector<ACC>& v, COMBINE& combine){
+      for(size_t w=1; w<v.size(); w*=2)
+	for(size_t i=0; i+w<v.size(); i+=2*w)
+	  combine(v[i],v[i+w]);
+      return v[0];
+    }
+
+  };
+
+
+  // ---- Functions --------------------------------------------------------------------------------------------
+
+
+  template<typename TYPE, typename ACC, typename FN, typename COMBINE>
+  inline ACC cpu_reduce(const Gdims& dims, TYPE* x, const GstridesB& xs, const ACC& zero, FN fn,
+    COMBINE combine, const bool parallel=true){
+    return CpuReduce<1>(dims,{&xs})(std::array<TYPE*,1>{x},zero,fn,combine,parallel);
+  }
+
+  template<typename TYPE, typename ACC, typename FN, typename COMBINE>
+  inline ACC cpu_reduce(const Gdims& dims, TYPE* x, const GstridesB& xs, TYPE* y, const GstridesB& ys,
+    const ACC& zero, FN fn, COMBINE combine, const bool parallel=true){
+    return CpuReduce<2>(dims,{&xs,&ys})(std::array<TYPE*,2>{x,y},zero,fn,combine,parallel);
+  }
+
+  // Reduce the n>0 elements x[0],x[s],...,x[(n-1)s] serially with the same multi-accumulator scheme, where
+  // fn(a,b) folds b into a. The accumulators start from the first elements, so no identity is needed.
+  template<typename TYPE, typename FN>
+  inline TYPE cpu_reduce_1d(const TYPE* x, const size_t n, const size_t s, FN fn){
+    constexpr int nacc=CpuReduce<1>::nacc;
+    if(n<nacc){
+      TYPE t=x[0];
+      for(size_t i=1; i<n; i++) fn(t,x[i*s]);
+      return t;
+    }
+    TYPE acc[nacc];
+    for(int k=0; k<nacc; k++) acc[k]=x[k*s];
+    size_t i=nacc;
+    if(s==1){
+      for(; i+nacc<=n; i+=nacc)
+	for(int k=0; k<nacc; k++) fn(acc[k],x[i+k]);
+    }else{
+      for(; i+nacc<=n; i+=nacc)
+	for(int k=0; k<nacc; k++) fn(acc[k],x[(i+k)*s]);
+    }
+    for(int k=0; i<n; i++, k++) fn(acc[k],x[i*s]);
+    for(int w=nacc/2; w>0; w/=2)
+      for(int k=0; k<w; k++) fn(acc[k],acc[k+w]);
+    return acc[0];
+  }
+
+}
+
+#endif
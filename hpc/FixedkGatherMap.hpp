@@ -18,6 +18,7 @@
 #include "Ltensor.hpp"
 #include "hlists.hpp"
 #include "RemoteCopy.hpp"
+#include "GatherMapFileHeader.hpp"
 
 namespace cnine{
 
@@ -34,6 +35,19 @@ namespace cnine{
     int in_columns=1;
     int out_columns=1;
 
+    // Cache of unique_targets(), filled under mx. Grading a map with unique targets fills it right away. A
+    // copy starts with an empty cache, so that a copy whose targets are then changed never inherits it.
+    class UniqueCache{
+    public:
+      std::mutex mx;
+      int unique=-1; // -1 until unique_targets() is first called
+      UniqueCache(){}
+      UniqueCache(const UniqueCache& x){}
+      UniqueCache& operator=(const UniqueCache& x){unique=-1; return *this;}
+    };
+
+    mutable UniqueCache _unique;
+
     cnine::RemoteCopy<int,BASE> on_device=cnine::RemoteCopy<int,BASE>([this](const int& _dev){
 	return to_share(new BASE(*this,_dev));});
 
@@ -106,6 +120,8 @@ namespace cnine{
 
     void set_target(const int i, const int x){
       BASE::set(i,0,x);
+      lock_guard<mutex> lock(_unique.mx);
+      _unique.unique=-1;
     }
 
     int operator()(const int i, const int j) const{
@@ -117,6 +133,28 @@ namespace cnine{
     }
 
 
+    // True if no two rows have the same target. The host kernels only split the rows over tasks if this
+    // holds, since otherwise two tasks could write to the same row. Computed when first needed.
+    bool unique_targets() const{
+      lock_guard<mutex> lock(_unique.mx);
+      if(_unique.unique<0){
+	CNINE_ASSRT(get_dev()==0);
+	const int N=getn();
+	const int* rows=get_arr();
+	const int ls=strides[0];
+	vector<char> seen;
+	_unique.unique=1;
+	for(int i=0; i<N && _unique.unique; i++){
+	  const int t=rows[(size_t)i*ls];
+	  if(t>=seen.size()) seen.resize(t+1,0);
+	  if(seen[t]) _unique.unique=0;
+	  seen[t]=1;
+	}
+      }
+      return _unique.unique;
+    }
+
+
     void for_each(std::function<void(const int i, const int j)> lambda) const{
       int N=getn();
       int K=getk();
@@ -132,6 +170,65 @@ namespace cnine{
 
 
 
+  public: // ---- Binary serialization ---------------------------------------------------------------------
+
+
+    // Write the map as a record of a gather map file (see GatherMapFileHeader) and return its position
+    size_t serialize(Bofstream& ofs) const{
+      GatherMapFileHeader header(GatherMapFileHeader::fixedk_map);
+      const size_t pos=GatherMapFileHeader::reserve(ofs);
+      header.in_columns=in_columns;
+      header.out_columns=out_columns;
+      ofs.align(GatherMapFileHeader::data_alignment);
+      header.arr_offset=ofs.pos();
+      BASE::serialize(ofs);
+      header.end_offset=ofs.pos();
+      header.rewrite(ofs,pos);
+      return pos;
+    }
+
+    static shared_ptr<FixedkGatherMap> read_record(Bifstream& ifs, const size_t pos){
+      auto header=GatherMapFileHeader::read(ifs,pos,GatherMapFileHeader::fixedk_map);
+      ifs.seekg(header.arr_offset);
+      auto r=make_shared<FixedkGatherMap>(TensorView<int>(ifs));
+      r->in_columns=header.in_columns;
+      r->out_columns=header.out_columns;
+      return r;
+    }
+
+    // The map stored in the record at pos of a mapped file, used in place
+    static shared_ptr<FixedkGatherMap> map_record(const shared_ptr<MappedFile>& file, const size_t pos){
+      auto header=GatherMapFileHeader::read(*file,pos,GatherMapFileHeader::fixedk_map);
+      GatherMapFileHeader::check_array<TensorFileHeader>(*file,header.arr_offset,1);
+      TensorFileHeader theader;
+      std::memcpy(&theader,file->data()+header.arr_offset,sizeof(TensorFileHeader));
+      theader.check(dtype_of<int>(),file->path);
+      if(theader.ndims!=2 || theader.data_offset>file->size())
+	CNINE_ERROR(file->path+" is corrupt: bad fixed-k gather map tensor at offset "+std::to_string(header.arr_offset));
+      GatherMapFileHeader::check_array<int>(*file,header.arr_offset+theader.data_offset,
+	theader.get_strides().memsize(theader.get_dims()));
+      auto r=make_shared<FixedkGatherMap>(TensorView<int>(MemArr<int>(new MemBlob<int>(file,header.arr_offset+theader.data_offset)),
+	  theader.get_dims(),theader.get_strides()));
+      r->in_columns=header.in_columns;
+      r->out_columns=header.out_columns;
+      return r;
+    }
+
+    void save(const string& filename, const bool checksum=false) const{
+      Bofstream ofs(filename,checksum);
+      serialize(ofs);
+    }
+
+    static shared_ptr<FixedkGatherMap> load(const string& filename){
+      Bifstream ifs(filename);
+      return read_record(ifs,0);
+    }
+
+    static shared_ptr<FixedkGatherMap> map_file(const string& filename, const MappedFile::map_mode mode=MappedFile::copy_on_write){
+      return map_record(make_shared<MappedFile>(filename,mode),0);
+    }
+
+
   public: // ---- I/O ----------------------------------------------------------------------------------------
 
 
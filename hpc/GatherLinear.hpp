@@ -0,0 +1,120 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _cnine_gather_linear
+#define _cnine_gather_linear
+
+#include "Cnine_base.hpp"
+#include "GatherRows.hpp"
+#include "CpuGatherLinear.hpp"
+
+
+namespace cnine{
+
+
+  // r+=GatherRows()(x,g)*W. On the host, when W narrows the rows (see CpuGatherLinear::transform_first),
+  // x*W is formed first and its rows are gathered. Otherwise, if the rows of x are wide enough and the
+  // vectorized CpuGemm kernels are compiled in (see CpuGatherLinear::fuse_pays), they are gathered in
+  // tiles that are multiplied by W while still in cache, and failing that they are gathered with
+  // GatherRows and multiplied by W. back0 and back1 accumulate the gradients with respect to x and W.
+
+  class GatherLinear{
+  public:
+
+    template<typename TYPE>
+    void operator()(const TensorView<TYPE>& r, const TensorView<TYPE>& x, const GatherMapB& g, const TensorView<TYPE>& W){
+      CNINE_ASSRT(r.ndims()==2);
+      CNINE_ASSRT(x.ndims()==2);
+      CNINE_ASSRT(W.ndims()==2);
+      CNINE_ASSRT(W.dim(0)==x.dim(1));
+      CNINE_ASSRT(W.dim(1)==r.dim(1));
+      CNINE_ASSRT(x.get_dev()==r.get_dev());
+      CNINE_ASSRT(W.get_dev()==r.get_dev());
+
+      if constexpr(std::is_floating_point<TYPE>::value){
+	if(fused(r,g) && (CpuGatherLinear<TYPE>::transform_first(x.dim(0),g,x.dim(1),W.dim(1)) ||
+	    CpuGatherLinear<TYPE>::fuse_pays(x.dim(1),W.dim(1)))){
+	  fnlog timer("GatherLinear::operator()");
+	  CpuGatherLinear<TYPE>::forward(r.get_arr(),r.strides[0],r.strides[1],
+	    x.get_arr(),x.dim(0),x.strides[0],x.strides[1],W.get_arr(),W.strides[0],W.strides[1],
+	    x.dim(1),W.dim(1),g);
+	  return;
+	}
+      }
+
+      if constexpr(std::is_same<TYPE,double>::value)
+	CNINE_ASSRT(r.get_dev()==0); // the CUDA gather kernels are float only
+      Ltensor<TYPE> t({r.dim(0),x.dim(1)},0,r.get_dev());
+      GatherRows()(t,Ltensor<TYPE>(x),g);
+      r.add_mprod(t,W);
+    }
+
+    template<typename TYPE>
+    Ltensor<TYPE> operator()(const TensorView<TYPE>& x, const GatherMapB& g, const TensorView<TYPE>& W){
+      Ltensor<TYPE> r({g.get_nout(),W.dim(1)},0,x.get_dev());
+      (*this)(r,x,g,W);
+      return r;
+    }
+
+
+  public: // ---- Backward ---------------------------------------------------------------------------------
+
+
+    // xgrad+=GatherRows()(rgrad,g.inv())*W^T
+    template<typename TYPE>
+    void back0(const TensorView<TYPE>& xgrad, const TensorView<TYPE>& rgrad, const GatherMapB& g, const TensorView<TYPE>& W){
+      (*this)(xgrad,rgrad,g.inv(),W.transp());
+    }
+
+    // Wgrad+=GatherRows()(x,g)^T*rgrad
+    template<typename TYPE>
+    void back1(const TensorView<TYPE>& Wgrad, const TensorView<TYPE>& x, const TensorView<TYPE>& rgrad, const GatherMapB& g){
+      CNINE_ASSRT(Wgrad.ndims()==2);
+      CNINE_ASSRT(x.ndims()==2);
+      CNINE_ASSRT(rgrad.ndims()==2);
+      CNINE_ASSRT(Wgrad.dim(0)==x.dim(1));
+      CNINE_ASSRT(Wgrad.dim(1)==rgrad.dim(1));
+
+      if constexpr(std::is_floating_point<TYPE>::value){
+	if(fused(Wgrad,g) && CpuGatherLinear<TYPE>::transform_first(x.dim(0),g,x.dim(1),rgrad.dim(1))){
+	  fnlog timer("GatherLinear::back1()");
+	  CpuGatherLinear<TYPE>::weight_grad(Wgrad.get_arr(),Wgrad.strides[0],Wgrad.strides[1],
+	    x.get_arr(),x.strides[0],x.strides[1],rgrad.get_arr(),rgrad.strides[0],rgrad.strides[1],
+	    x.dim(1),rgrad.dim(1),g.inv());
+	  return;
+	}
+      }
+
+      if constexpr(std::is_same<TYPE,double>::value)
+	CNINE_ASSRT(x.get_dev()==0); // the CUDA gather kernels are float only
+      Ltensor<TYPE> t({rgrad.dim(0),x.dim(1)},0,x.get_dev());
+      GatherRows()(t,Ltensor<TYPE>(x),g);
+      Wgrad.add_mprod(t.transp(),rgrad);
+    }
+
+
+  private:
+
+    // The CpuGatherLinear kernels handle plain maps on the host
+    template<typename TYPE>
+    bool fused(const TensorView<TYPE>& r, const GatherMapB& g) const{
+      return r.get_dev()==0 && g.get_dev()==0 &&
+	g.in_columns==1 && g.out_columns==1 && g.in_columns_n==1 && g.out_columns_n==1 &&
+	g.fixedk_maps.size()==0 && !dynamic_cast<const WeightedGatherMapB*>(&g);
+    }
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+
+#ifndef _CnineGatherMapAlgebra
+#define _CnineGatherMapAlgebra
+
+#include "Cnine_base.hpp"
+#include "GatherMapB.hpp"
+#include "WeightedGatherMapB.hpp"
+#include "ThreadPool.hpp"
+
+
+namespace cnine{
+
+
+  // ---- Gather map algebra -----------------------------------------------------------------------------------
+  //
+  // A GatherMapB g stands for the n_out x n_in matrix G in which G(t,s) is the number of times s occurs in
+  // the list of t, so that gathering x by g computes G*x. A WeightedGatherMapB stands for the matrix of its
+  // weights, summed over repeated (t,s) pairs. The functions below compute the maps of products, sums and
+  // transposes of these matrices, so that chains of gathers can be collapsed into a single one:
+  //
+  // compose(g2,g1)       G2*G1, i.e., gathering by g1 and then by g2. For GatherMapB the result keeps the
+  //                      multiplicities as repeated sources, so it is exact without weights.
+  // map_union(a,b)       A+B, the lists of a followed by the lists of b for each target.
+  // transpose(g)         G^T, as an independent map rather than the cached g.inv().
+  // merge_duplicates(g)  the same matrix as a WeightedGatherMapB without repeated (t,s) pairs.
+  //
+  // None of these look at the columns fields or at fixed-k parts, so they are for plain (ungraded) maps.
+
+
+  namespace gather_map_algebra{
+
+    // The lists of each target of g, in their order in g, since a target may have more than one list. The
+    // lists of t are lists[start[t]..start[t+1]). Covers at least n targets, and more if g has targets beyond
+    // that (n_out is not set by every constructor).
+    class list_index{
+    public:
+
+      vector<int> start;
+      vector<int> lists;
+
+      list_index(const GatherMapB& g, const int n){
+	int m=n;
+	for(int i=0; i<g.size(); i++){
+	  CNINE_ASSRT(g.target(i)>=0);
+	  m=std::max(m,g.target(i)+1);
+	}
+	start.assign(m+1,0);
+	for(int i=0; i<g.size(); i++)
+	  start[g.target(i)+1]++;
+	for(int t=0; t<m; t++) start[t+1]+=start[t];
+	lists.resize(g.size());
+	vector<int> next(start.begin(),start.end()-1);
+	for(int i=0; i<g.size(); i++)
+	  lists[next[g.target(i)]++]=i;
+      }
+
+      int size() const{
+	return start.size()-1;
+      }
+
+      // call fn(i) for each list i of target t, if any
+      template<typename FN>
+      void for_each(const int t, FN&& fn) const{
+	if(t<0 || t>=size()) return;
+	for(int k=start[t]; k<start[t+1]; k++)
+	  fn(lists[k]);
+      }
+
+    };
+
+    // n_in, or one more than the largest source if that is larger
+    inline int source_bound(const GatherMapB& g){
+      int r=g.n_in;
+      g.for_each([&](const int t, const int s){r=std::max(r,s+1);});
+      return r;
+    }
+
+    inline int source_bound(const WeightedGatherMapB& g){
+      int r=g.n_in;
+      g.for_each([&](const int t, const int s, const float w){r=std::max(r,s+1);});
+      return r;
+    }
+
+    inline bool plain_layout(const GatherMapB& g){
+      return g.get_dev()==0 && g.fixedk_maps.size()==0 && g.in_columns==1 && g.out_columns==1 && 
+	g.in_columns_n==1 && g.out_columns_n==1;
+    }
+
+    inline void check_plain(const GatherMapB& g){
+      CNINE_ASSRT(g.get_dev()==0);
+      CNINE_ASSRT(g.fixedk_maps.size()==0);
+    }
+
+    // Allocate the lists of arr for the given targets, with len[i] edges of ipe ints each in list i. Empty
+    // lists are dropped. Returns the position of the first edge of each list in arr.arr.
+    inline vector<size_t> allocate_lists(hlists<int>& arr, const vector<int>& heads, const vector<int>& len,
+      const int ipe){
+      const int N=heads.size();
+      int nlists=0;
+      size_t total=0;
+      for(int i=0; i<N; i++)
+	if(len[i]>0){
+	  nlists++;
+	  total+=(size_t)len[i]*ipe+1;
+	}
+      CNINE_ASSRT(total<(size_t)std::numeric_limits<int>::max());
+      arr=hlists<int>(nlists,total,fill_reserve());
+      vector<size_t> r(N,0);
+      int k=0;
+      int pos=0;
+      for(int i=0; i<N; i++){
+	if(len[i]==0) continue;
+	arr.dir.set(k,0,pos);
+	arr.dir.set(k,1,len[i]*ipe+1);
+	arr.arr[pos]=heads[i];
+	r[i]=pos+1;
+	pos+=len[i]*ipe+1;
+	k++;
+      }
+      arr.tail=pos;
+      return r;
+    }
+
+    // Call fn(i0,i1) on consecutive ranges of [0,N), in parallel if the total work is large enough
+    inline void for_ranges(const int N, const size_t work, const std::function<void(int,int)>& fn){
+      int ntasks=1;
+      if(nthreads>1 && work>=(1<<15)) ntasks=std::min(N,4*nthreads);
+      parallel_for(0,ntasks,1,[&](const int t){
+	  fn((int)((size_t)t*N/ntasks),(int)((size_t)(t+1)*N/ntasks));});
+    }
+
+    // A weighted map from n_out lists of (source,weight) pairs given by row(t,v), merging repeated sources
+    template<typename ROW>
+    inline WeightedGatherMapB weighted_from_rows(const int n_out, const int n_in, const size_t work,
+      const ROW& row){
+      WeightedGatherMapB r(n_out,n_in);
+      vector<int> heads(n_out);
+      vector<int> len(n_out,0);
+      for(int t=0; t<n_out; t++) heads[t]=t;
+
+      // each task accumulates its rows in a dense array of length n_in, in order of first occurrence
+      auto accumulate=[&](const int t, vector<float>& acc, vector<int>& touched, vector<char>& seen){
+	touched.clear();
+	row(t,[&](const int s, const float w){
+	    if(!seen[s]){seen[s]=1; acc[s]=0; touched.push_back(s);}
+	    acc[s]+=w;});
+	for(auto s:touched) seen[s]=0;
+      };
+
+      for_ranges(n_out,work,[&](const int t0, const int t1){
+	  vector<float> acc(n_in); vector<int> touched; vector<char> seen(n_in,0);
+	  for(int t=t0; t<t1; t++){
+	    accumulate(t,acc,touched,seen);
+	    len[t]=touched.size();
+	  }
+	});
+
+      vector<size_t> pos=allocate_lists(r.arr,heads,len,2);
+      for_ranges(n_out,work,[&](const int t0, const int t1){
+	  vector<float> acc(n_in); vector<int> touched; vector<char> seen(n_in,0);
+	  for(int t=t0; t<t1; t++){
+	    if(len[t]==0) continue;
+	    accumulate(t,acc,touched,seen);
+	    int* p=r.arr.arr+pos[t];
+	    for(auto s:touched){
+	      *p++=s;
+	      *p++=reinterpret_cast<const int&>(acc[s]);
+	    }
+	  }
+	});
+      return r;
+    }
+
+  }
+
+
+  // ---- Composition ------------------------------------------------------------------------------------------
+
+
+  // Whether g can be used in the algebra: on the host, without fixed-k parts, and acting on whole rows.
+  // A WeightedGatherMapB seen as a GatherMapB is not, since the unweighted operations would read its
+  // weights as sources.
+  inline bool composable(const GatherMapB& g){
+    return !dynamic_cast<const WeightedGatherMapB*>(&g) && gather_map_algebra::plain_layout(g);
+  }
+
+  inline bool composable(const WeightedGatherMapB& g){
+    return gather_map_algebra::plain_layout(g);
+  }
+
+  // The number of edges of compose(second,first) before merging repeated pairs, without computing it
+  inline size_t compose_size(const GatherMapB& second, const GatherMapB& first){
+    using namespace gather_map_algebra;
+    const list_index index(first,std::max(second.n_in,first.n_out));
+    size_t r=0;
+    second.for_each([&](const int t, const int s){
+	index.for_each(s,[&](const int k){r+=first.size_of(k);});});
+    return r;
+  }
+
+  inline size_t compose_size(const WeightedGatherMapB& second, const WeightedGatherMapB& first){
+    using namespace gather_map_algebra;
+    const list_index index(first,std::max(second.n_in,first.n_out));
+    size_t r=0;
+    second.for_each([&](const int t, const int s, const float w){
+	index.for_each(s,[&](const int k){r+=first.size_of(k);});});
+    return r;
+  }
+
+
+  // The map of gathering by first and then by second. List t of the result is the concatenation of the
+  // lists of first for the sources in the list of t in second.
+  inline GatherMapB compose(const GatherMapB& second, const GatherMapB& first){
+    cnine::fnlog timer("compose(const GatherMapB&, const GatherMapB&)");
+    using namespace gather_map_algebra;
+    check_plain(first);
+    check_plain(second);
+    const int m=std::max(second.n_in,first.n_out);
+    const list_index index(first,m);
+
+    const int N=second.size();
+    vector<int> heads(N);
+    vector<int> len(N,0);
+    for_ranges(N,second.n_ops(),[&](const int i0, const int i1){
+	for(int i=i0; i<i1; i++){
+	  heads[i]=second.target(i);
+	  size_t n=0;
+	  for(int j=0; j<second.size_of(i); j++)
+	    index.for_each(second(i,j),[&](const int k){n+=first.size_of(k);});
+	  CNINE_ASSRT(n<(size_t)std::numeric_limits<int>::max());
+	  len[i]=n;
+	}
+      });
+
+    GatherMapB r(second.n_out,first.n_in);
+    vector<size_t> pos=allocate_lists(r.arr,heads,len,1);
+    for_ranges(N,r.arr.tail,[&](const int i0, const int i1){
+	for(int i=i0; i<i1; i++){
+	  if(len[i]==0) continue;
+	  int* p=r.arr.arr+pos[i];
+	  for(int j=0; j<second.size_of(i); j++)
+	    index.for_each(second(i,j),[&](const int k){
+		const int* l=first.arr.arr+first.offset(k)+1;
+		p=std::copy(l,l+first.size_of(k),p);});
+	}
+      });
+    return r;
+  }
+
+
+  // The same for weighted maps. The weights along each path are multiplied and summed over paths with the
+  // same endpoints, so the result has no repeated (t,s) pairs.
+  inline WeightedGatherMapB compose(const WeightedGatherMapB& second, const WeightedGatherMapB& first){
+    cnine::fnlog timer("compose(const WeightedGatherMapB&, const WeightedGatherMapB&)");
+    using namespace gather_map_algebra;
+    check_plain(first);
+    check_plain(second);
+    const int m=std::max(second.n_in,first.n_out);
+    const list_index index1(first,m);
+    const list_index index2(second,second.n_out);
+
+    return weighted_from_rows(index2.size(),source_bound(first),(size_t)second.n_ops()*16,[&](const int t, auto&& emit){
+	index2.for_each(t,[&](const int i){
+	    for(int j=0; j<second.size_of(i); j++){
+	      const float w=second.weight(i,j);
+	      index1.for_each(second.src(i,j),[&](const int k){
+		  for(int a=0; a<first.size_of(k); a++)
+		    emit(first.src(k,a),w*first.weight(k,a));});
+	    }});
+      });
+  }
+
+
+  // ---- Union ------------------------------------------------------------------------------------------------
+
+
+  inline GatherMapB map_union(const GatherMapB& a, const GatherMapB& b){
+    cnine::fnlog timer("map_union(const GatherMapB&, const GatherMapB&)");
+    using namespace gather_map_algebra;
+    check_plain(a);
+    check_plain(b);
+    const list_index ia(a,std::max(a.n_out,b.n_out));
+    const list_index ib(b,ia.size());
+    const int n_out=ib.size();
+
+    vector<int> heads(n_out);
+    vector<int> len(n_out,0);
+    for(int t=0; t<n_out; t++){
+      heads[t]=t;
+      ia.for_each(t,[&](const int i){len[t]+=a.size_of(i);});
+      ib.for_each(t,[&](const int i){len[t]+=b.size_of(i);});
+    }
+
+    GatherMapB r(n_out,std::max(a.n_in,b.n_in));
+    vector<size_t> pos=allocate_lists(r.arr,heads,len,1);
+    for_ranges(n_out,a.n_ops()+b.n_ops(),[&](const int t0, const int t1){
+	for(int t=t0; t<t1; t++){
+	  int* p=r.arr.arr+pos[t];
+	  ia.for_each(t,[&](const int i){
+	      const int* l=a.arr.arr+a.offset(i)+1;
+	      p=std::copy(l,l+a.size_of(i),p);});
+	  ib.for_each(t,[&](const int i){
+	      const int* l=b.arr.arr+b.offset(i)+1;
+	      p=std::copy(l,l+b.size_of(i),p);});
+	}
+      });
+    return r;
+  }
+
+  inline WeightedGatherMapB map_union(const WeightedGatherMapB& a, const WeightedGatherMapB& b){
+    cnine::fnlog timer("map_union(const WeightedGatherMapB&, const WeightedGatherMapB&)");
+    using namespace gather_map_algebra;
+    check_plain(a);
+    check_plain(b);
+    const list_index ia(a,std::max(a.n_out,b.n_out));
+    const list_index ib(b,ia.size());
+    const int n_out=ib.size();
+    return weighted_from_rows(n_out,std::max(source_bound(a),source_bound(b)),(size_t)(a.n_ops()+b.n_ops())*16,
+      [&](const int t, auto&& emit){
+	ia.for_each(t,[&](const int i){for(int j=0; j<a.size_of(i); j++) emit(a.src(i,j),a.weight(i,j));});
+	ib.for_each(t,[&](const int i){for(int j=0; j<b.size_of(i); j++) emit(b.src(i,j),b.weight(i,j));});
+      });
+  }
+
+
+  // ---- Transpose --------------------------------------------------------------------------------------------
+
+
+  inline GatherMapB transpose(const GatherMapB& g){
+    cnine::fnlog timer("transpose(const GatherMapB&)");
+    gather_map_algebra::check_plain(g);
+    const size_t N=g.n_ops();
+    vector<int> sources(N);
+    vector<int> targets(N);
+    size_t e=0;
+    g.for_each([&](const int t, const int s){
+	sources[e]=t;
+	targets[e++]=s;});
+    GatherMapB r(sources,targets);
+    r.n_in=std::max(r.n_in,g.n_out);
+    r.n_out=std::max(r.n_out,g.n_in);
+    return r;
+  }
+
+  inline WeightedGatherMapB transpose(const WeightedGatherMapB& g){
+    cnine::fnlog timer("transpose(const WeightedGatherMapB&)");
+    using namespace gather_map_algebra;
+    check_plain(g);
+    int n_out=g.n_in;
+    g.for_each([&](const int t, const int s, const float w){
+	CNINE_ASSRT(s>=0);
+	n_out=std::max(n_out,s+1);});
+    vector<size_t> start(n_out+1,0);
+    g.for_each([&](const int t, const int s, const float w){
+	start[s+1]++;});
+    for(int s=0; s<n_out; s++) start[s+1]+=start[s];
+    vector<pair<int,float> > edges(start[n_out]);
+    vector<size_t> next(start.begin(),start.end()-1);
+    g.for_each([&](const int t, const int s, const float w){
+	edges[next[s]++]=make_pair(t,w);});
+    return weighted_from_rows(n_out,list_index(g,g.n_out).size(),edges.size()*16,[&](const int s, auto&& emit){
+	for(size_t e=start[s]; e<start[s+1]; e++)
+	  emit(edges[e].first,edges[e].second);
+      });
+  }
+
+
+  // ---- Merging duplicates -----------------------------------------------------------------------------------
+
+
+  // The map of the same matrix with each repeated source of a list replaced by a single weighted edge
+  inline WeightedGatherMapB merge_duplicates(const GatherMapB& g){
+    cnine::fnlog timer("merge_duplicates(const GatherMapB&)");
+    using namespace gather_map_algebra;
+    check_plain(g);
+    const list_index index(g,g.n_out);
+    return weighted_from_rows(index.size(),source_bound(g),(size_t)g.n_ops()*16,[&](const int t, auto&& emit){
+	index.for_each(t,[&](const int i){for(int j=0; j<g.size_of(i); j++) emit(g(i,j),1.0f);});
+      });
+  }
+
+  inline WeightedGatherMapB merge_duplicates(const WeightedGatherMapB& g){
+    cnine::fnlog timer("merge_duplicates(const WeightedGatherMapB&)");
+    using namespace gather_map_algebra;
+    check_plain(g);
+    const list_index index(g,g.n_out);
+    return weighted_from_rows(index.size(),source_bound(g),(size_t)g.n_ops()*16,[&](const int t, auto&& emit){
+	index.for_each(t,[&](const int i){for(int j=0; j<g.size_of(i); j++) emit(g.src(i,j),g.weight(i,j));});
+      });
+  }
+
+}
+
+#endif
@@ -20,6 +20,10 @@
 #include "map_of_lists.hpp"
 #include "fnlog.hpp"
 #include "RemoteCopy.hpp"
+#include "ThreadPool.hpp"
+#include "MappedFile.hpp"
+#include "GatherMapFileHeader.hpp"
+#include <iomanip>
 
 namespace cnine{
 
@@ -34,6 +38,49 @@ namespace cnine{
 
     hlists<int> arr;
     shared_ptr<GatherMapB> _inv;
+
+    // Cache of inv_degree(), filled under mx. Copies share the degrees already computed, since they only
+    // depend on the edges.
+    class DegreeCache{
+    public:
+      std::mutex mx;
+      shared_ptr<vector<double> > inv;
+      DegreeCache(){}
+      DegreeCache(const DegreeCache& x){
+	lock_guard<mutex> lock(const_cast<DegreeCache&>(x).mx);
+	inv=x.inv;
+      }
+      DegreeCache& operator=(const DegreeCache& x){
+	if(&x==this) return *this;
+	std::scoped_lock lock(mx,const_cast<DegreeCache&>(x).mx);
+	inv=x.inv;
+	return *this;
+      }
+      void clear(){
+	lock_guard<mutex> lock(mx);
+	inv.reset();
+      }
+    };
+
+    mutable DegreeCache _inv_degree;
+
+    // Cache of graded() and unique_targets(). A copy of a map starts with an empty cache, so a copy that is
+    // then reordered or extended never runs the lists of the original. Filling the cache is guarded by mx,
+    // so two threads can gather through the same map.
+    class GradedCache{
+    public:
+      std::mutex mx;
+      bool done=false;
+      shared_ptr<GatherMapB> map; // stays null if the decomposition has no fixed-k parts
+      int unique=-1; // -1 until unique_targets() is first called
+      GradedCache(){}
+      GradedCache(const GradedCache& x){}
+      GradedCache& operator=(const GradedCache& x){clear(); return *this;}
+      void clear(){done=false; map.reset(); unique=-1;}
+    };
+
+    mutable GradedCache _graded;
+    shared_ptr<MappedFile> mapping; // the file arr lives in if the map was mapped from disk
     mutable bool sorted=false;
 
     int n_out=0;
@@ -74,72 +121,28 @@ namespace cnine{
     GatherMapB(const int _n_out, const int _n_in): 
       n_out(_n_out), n_in(_n_in){}
 
+    // Edge list constructors. The lists are ordered by target and the sources within each list keep their
+    // order in the input, independently of the number of threads (see build_from_edges).
+
     GatherMapB(const vector<int>& sources, const vector<int>& targets){
       cnine::fnlog timer("GatherMapB::GatherMapB(const vector<int>& sources, const vector<int>& targets)");
       CNINE_ASSRT(sources.size()==targets.size());
-
-      int N=sources.size();
-      unordered_map<int,int> sizes;
-      for(int i=0; i<N; i++){
-	sizes[targets[i]]++;
-	n_out=std::max(n_out,targets[i]+1);
-	n_in=std::max(n_in,sources[i]+1);
-      }
-
-      int n=sizes.size();
-      vector<int> heads(n);
-      vector<int> lengths(n);
-      unordered_map<int,int> mapping;
-      int i=0;
-      for(auto p:sizes){
-	heads[i]=p.first;
-	lengths[i]=p.second;
-	mapping[p.first]=i;
-	i++;
-      }
-
-      arr=hlists<int>(heads,lengths);
-      for(int i=0; i<N; i++){
-	arr.push_back(mapping[targets[i]],sources[i]);
-      }
+      const int* src=sources.data();
+      const int* tgt=targets.data();
+      build_from_edges(sources.size(),[src](const size_t i){return src[i];},[tgt](const size_t i){return tgt[i];});
     }
     
 
-    explicit GatherMapB(const TensorView<int>& M, int n_in=-1, int n_out=-1){
-
+    explicit GatherMapB(const TensorView<int>& M, int _n_in=-1, int _n_out=-1){
+      cnine::fnlog timer("GatherMapB::GatherMapB(const TensorView<int>& M)");
       CNINE_ASSRT(M.ndims()==2);
       CNINE_ASSRT(M.dims(1)==2);
-      int N=M.dim(0);
-      if(n_in==-1)
-	for(int i=0; i<N; i++)
-	  n_in=std::max(n_in,M(i,0)+1);
-      if(n_out==-1)
-	for(int i=0; i<N; i++)
-	  n_out=std::max(n_out,M(i,1)+1);
-
-      unordered_map<int,int> sizes;
-      for(int i=0; i<N; i++){
-	CNINE_ASSRT(M(i,0)<n_in);
-	CNINE_ASSRT(M(i,1)<n_out);
-	sizes[M(i,1)]++;
-      }
-
-      int n=sizes.size();
-      vector<int> heads(n);
-      vector<int> lengths(n);
-      unordered_map<int,int> mapping;
-      int i=0;
-      for(auto p:sizes){
-	heads[i]=p.first;
-	lengths[i]=p.second;
-	mapping[p.first]=i;
-	i++;
-      }
-
-      arr=hlists<int>(heads,lengths,fill_noalloc());
-      for(int i=0; i<N; i++){
-	arr.push_back(mapping[M(i,1)],M(i,0));
-      }
+      CNINE_CPUONLY1(M);
+      const int* m=M.get_arr();
+      const size_t s0=M.strides[0];
+      const size_t s1=M.strides[1];
+      build_from_edges(M.dim(0),[m,s0](const size_t i){return m[i*s0];},[m,s0,s1](const size_t i){return m[i*s0+s1];},
+	_n_in,_n_out);
     }
     
 
@@ -280,6 +283,11 @@ namespace cnine{
       return arr.get_tail()-arr.size();
     }
 
+    // the lists of a WeightedGatherMapB interleave sources with the bits of their weights
+    virtual bool is_weighted() const{
+      return false;
+    }
+
     int offset(const int i) const{
       return arr.offset(i);
     }
@@ -293,6 +301,8 @@ namespace cnine{
     }
 
     void set_target(const int i, const int x){
+      check_writable();
+      clear_caches();
       arr.set_head(i,x);
     }
 
@@ -310,6 +320,24 @@ namespace cnine{
       return *_inv;
     }
 
+    // 1/(total size of the lists of target t) for each target t<n_out, and 0 for targets with no edges. Kept
+    // in double precision so that it can be rounded once to the type of the tensors it scales. Computed on 
+    // first use, and safe to call from several threads at once.
+    const vector<double>& inv_degree() const{
+      lock_guard<mutex> lock(_inv_degree.mx);
+      if(!_inv_degree.inv){
+	auto r=make_shared<vector<double> >(n_out,0);
+	for(int i=0; i<size(); i++){
+	  if(target(i)>=r->size()) r->resize(target(i)+1,0);
+	  (*r)[target(i)]+=size_of(i);
+	}
+	for(auto& d:*r)
+	  if(d>0) d=1.0/d;
+	_inv_degree.inv=r;
+      }
+      return *_inv_degree.inv;
+    }
+
 
   public: // ---- Lambdas ------------------------------------------------------------------------------------
 
@@ -330,27 +358,33 @@ namespace cnine{
 
     
     void set(const int i, const int j, const int x){
+      check_writable();
+      clear_caches();
       arr.set(i,j,x);
     }
 
     int push_back(const int len){
       sorted=false;
+      clear_caches();
       arr.push_back(len);
       return size()-1;
     }
 
     void push_back(const int t, const std::set<int>& v){
       sorted=false;
+      clear_caches();
       arr.push_back(t,v);
     }
 
     void push_back(const int t, const vector<int>& v){
       sorted=false;
+      clear_caches();
       arr.push_back(t,v);
     }
 
     void push_back(const int t, const initializer_list<int>& v){
       sorted=false;
+      clear_caches();
       arr.push_back(t,v);
     }
 
@@ -361,18 +395,17 @@ namespace cnine{
 
     void make_inv() const{
       cnine::fnlog timer("GatherMapB::make_inv()");
-      map<int,vector<int> > inv_map;
-      int total=0;
+      vector<int> sources(n_ops());
+      vector<int> targets(n_ops());
+      size_t e=0;
       for_each([&](const int i, const int j){
-	  inv_map[j].push_back(i);
-	  total++;
+	  sources[e]=i;
+	  targets[e++]=j;
 	});
-      GatherMapB* r=new GatherMapB(n_in,n_out);
-      //if(inv_map.size()==0) r=new GatherMapB(0); 
-      //else r=new GatherMapB(inv_map.rbegin()->first+1);
-      r->arr.reserve(inv_map.size()+total);
-      for(auto& p: inv_map)
-	r->arr.push_back(p.first,p.second);
+      GatherMapB* r=new GatherMapB();
+      r->build_from_edges(e,[&](const size_t k){return sources[k];},[&](const size_t k){return targets[k];});
+      r->n_in=std::max(r->n_in,n_out);
+      r->n_out=std::max(r->n_out,n_in);
       r->in_columns=out_columns;
       r->out_columns=in_columns;
       r->in_columns_n=out_columns_n;
@@ -403,48 +436,595 @@ namespace cnine{
 	}
       }
       const_cast<GatherMapB&>(*this).arr=std::move(r.arr);
+      _graded.clear();
       sorted=true;
       return *this;
     }
 
 
-    const GatherMapB& grade(const int min_size=0) const{
+  public: // ---- Fixed degree decomposition ---------------------------------------------------------------
+
+
+    static constexpr int max_fixedk=16;
+    static constexpr int min_fixedk_lists=32;
+
+    // A map with the same edges, in which the lists of each length k<=max_k that occurs at least min_lists
+    // times are moved to a FixedkGatherMap (keeping their relative order), and the remaining nonempty lists
+    // are left in arr. Empty lists are dropped. GatherRows runs the fixed-k parts with unrolled kernels.
+    shared_ptr<GatherMapB> grade(const int max_k=max_fixedk, const int min_lists=min_fixedk_lists) const{
       cnine::fnlog timer("GatherMapB::grade()");
-      map<int,vector<int> > lengths;
-      int N=size();
+      CNINE_ASSRT(get_dev()==0);
+      const int N=size();
+      vector<int> count(max_k+1,0);
       for(int i=0; i<N; i++)
-	lengths[size_of(i)].push_back(i);
-
-      int rem_size=0;
-      for(auto& p:lengths)
-	if(p.second.size()<min_size)
-	  rem_size+=(p.first+1)*p.second.size();
+	if(size_of(i)<=max_k) count[size_of(i)]++;
+
+      auto r=make_shared<GatherMapB>(n_out,n_in);
+      r->in_columns=in_columns;
+      r->out_columns=out_columns;
+      r->in_columns_n=in_columns_n;
+      r->out_columns_n=out_columns_n;
+
+      vector<int*> fill(max_k+1,nullptr);
+      for(int k=1; k<=max_k; k++){
+	if(count[k]<min_lists) continue;
+	auto f=make_shared<FixedkGatherMap>(count[k],k);
+	fill[k]=f->get_arr();
+	r->fixedk_maps.push_back(f);
+      }
 
-      GatherMapB r(n_out,n_in);
-      r.arr.reserve(rem_size);
+      size_t residual=0;
+      int nresidual=0;
+      for(int i=0; i<N; i++){
+	const int m=size_of(i);
+	if(m>0 && (m>max_k || !fill[m])){
+	  residual+=m+1;
+	  nresidual++;
+	}
+      }
+      r->arr=hlists<int>(nresidual,residual,fill_reserve());
 
-      for(auto& p:lengths){
-	int K=p.first;
-	if(p.second.size()>=min_size){
-	  FixedkGatherMap* g=new FixedkGatherMap(p.second.size(),K);
-	  auto gv=g->view2();
-	  for(int j=0; j<p.second.size(); j++)
-	    gv.slice0(j)=arr.array_pool<int>::view_of(p.second[j]);
-	  const_cast<GatherMapB&>(*this).fixedk_maps.push_back(shared_ptr<FixedkGatherMap>(g));
+      // the parts get their unique_targets() flag here, since they are run in parallel only if it holds
+      vector<char> seen(n_out,0);
+      bool unique=true;
+      int k=0;
+      for(int i=0; i<N; i++){
+	const int m=size_of(i);
+	if(m==0) continue;
+	const int* l=arr.arr+offset(i);
+	if(l[0]>=seen.size()) seen.resize(l[0]+1,0);
+	if(seen[l[0]]) unique=false;
+	seen[l[0]]=1;
+	int* dest;
+	if(m<=max_k && fill[m]){
+	  dest=fill[m];
+	  fill[m]+=m+1;
 	}else{
-	  for(auto q:p.second){
-	    int i=r.push_back(K);
-	    r.set_target(i,target(q));
-	    for(int a=0; a<K; a++)
-	      r.set(i,a,(*this)(q,a));
+	  dest=r->arr.arr+r->arr.tail;
+	  r->arr.dir.set(k,0,r->arr.tail);
+	  r->arr.dir.set(k,1,m+1);
+	  r->arr.tail+=m+1;
+	  k++;
+	}
+	std::copy(l,l+m+1,dest);
+      }
+      if(unique)
+	for(auto& p:r->fixedk_maps)
+	  p->_unique.unique=1;
+      return r;
+    }
+
+    // True if no two lists have the same target. push_back allows repeated targets, but the host kernels 
+    // only process the lists in parallel if they do not, since otherwise two tasks could write to the same
+    // row. Computed when first needed.
+    bool unique_targets() const{
+      lock_guard<mutex> lock(_graded.mx);
+      if(_graded.unique<0){
+	const int N=size();
+	vector<char> seen(n_out,0);
+	_graded.unique=1;
+	for(int i=0; i<N && _graded.unique; i++){
+	  const int t=target(i);
+	  if(t>=seen.size()) seen.resize(t+1,0);
+	  if(seen[t]) _graded.unique=0;
+	  seen[t]=1;
+	}
+      }
+      return _graded.unique;
+    }
+
+    // The decomposition given by grade() with the default parameters, computed when first needed. Null
+    // if no list length qualifies for a fixed-k part, in which case only that fact is cached.
+    shared_ptr<GatherMapB> graded() const{
+      lock_guard<mutex> lock(_graded.mx);
+      if(!_graded.done){
+	auto r=grade();
+	if(r->fixedk_maps.size()>0) _graded.map=r;
+	_graded.done=true;
+      }
+      return _graded.map;
+    }
+
+
+  public: // ---- Locality -----------------------------------------------------------------------------------
+
+
+    // Order in which a breadth first search over the bipartite graph of lists and sources discovers the
+    // lists and the sources, in the manner of Cuthill-McKee: each connected component is started from
+    // its smallest list, and the sources of each list are visited in order of increasing degree. Sources
+    // that do not occur in any list are put at the end.
+    void locality_order(vector<int>& list_order, vector<int>& source_order) const{
+      cnine::fnlog timer("GatherMapB::locality_order()");
+      if(is_weighted()) CNINE_ERROR("locality ordering is not implemented for weighted gather maps.");
+      const int N=size();
+      vector<const int*> lists(N);
+      vector<int> lens(N);
+      int nsrc=n_in;
+      for(int i=0; i<N; i++){
+	lists[i]=arr.arr+offset(i)+1;
+	lens[i]=size_of(i);
+	for(int j=0; j<lens[i]; j++)
+	  bump(nsrc,lists[i][j]+1);
+      }
+
+      // lists containing each source, in CSR form
+      vector<int> soffs(nsrc+1,0);
+      for(int i=0; i<N; i++)
+	for(int j=0; j<lens[i]; j++)
+	  soffs[lists[i][j]+1]++;
+      for(int s=0; s<nsrc; s++) soffs[s+1]+=soffs[s];
+      vector<int> slists(soffs[nsrc]);
+      vector<int> fill(soffs.begin(),soffs.end()-1);
+      for(int i=0; i<N; i++)
+	for(int j=0; j<lens[i]; j++)
+	  slists[fill[lists[i][j]]++]=i;
+
+      vector<int> starts(N);
+      for(int i=0; i<N; i++) starts[i]=i;
+      std::stable_sort(starts.begin(),starts.end(),[&](const int a, const int b){return lens[a]<lens[b];});
+
+      vector<char> lvisited(N,0);
+      vector<char> svisited(nsrc,0);
+      list_order.clear(); list_order.reserve(N);
+      source_order.clear(); source_order.reserve(nsrc);
+      vector<int> srcs;
+
+      for(auto i0:starts){
+	if(lvisited[i0]) continue;
+	lvisited[i0]=1;
+	size_t head=list_order.size();
+	list_order.push_back(i0);
+	while(head<list_order.size()){
+	  int i=list_order[head++];
+	  srcs.clear();
+	  for(int j=0; j<lens[i]; j++){
+	    int s=lists[i][j];
+	    if(!svisited[s]){svisited[s]=1; srcs.push_back(s);}
+	  }
+	  std::sort(srcs.begin(),srcs.end(),[&](const int a, const int b){
+	      return soffs[a+1]-soffs[a]<soffs[b+1]-soffs[b];});
+	  for(auto s:srcs){
+	    source_order.push_back(s);
+	    for(int k=soffs[s]; k<soffs[s+1]; k++)
+	      if(!lvisited[slists[k]]){
+		lvisited[slists[k]]=1;
+		list_order.push_back(slists[k]);
+	      }
 	  }
 	}
       }
 
-      const_cast<GatherMapB&>(*this).arr=std::move(r.arr);
+      for(int s=0; s<nsrc; s++)
+	if(!svisited[s]) source_order.push_back(s);
+    }
+
+    // Reorder the lists in locality_order and sort the sources within each list, so that consecutive
+    // gathers on the CPU touch nearby rows. Does not change what the map computes.
+    GatherMapB& reorder_for_locality(){
+      cnine::fnlog timer("GatherMapB::reorder_for_locality()");
+      if(is_weighted()) CNINE_ERROR("locality ordering is not implemented for weighted gather maps.");
+      vector<int> lorder;
+      vector<int> sorder;
+      locality_order(lorder,sorder);
+      arr=reordered_lists(lorder,nullptr,nullptr);
+      _graded.clear();
+      sorted=false;
       return *this;
     }
 
+    // Permutation of the rows of x that goes with relabel: row i of the permuted x is row perm[i] of x
+    vector<int> source_permutation() const{
+      vector<int> lorder;
+      vector<int> sorder;
+      locality_order(lorder,sorder);
+      return sorder;
+    }
+
+    // Permutation of the rows of the output that goes with relabel: row i of the permuted output is
+    // row perm[i] of the original one. A target with several lists is placed at its first list in locality
+    // order, and targets that do not occur in any list are put at the end.
+    vector<int> target_permutation() const{
+      vector<int> lorder;
+      vector<int> sorder;
+      locality_order(lorder,sorder);
+      vector<int> r;
+      vector<char> used(n_out,0);
+      for(auto i:lorder){
+	const int t=target(i);
+	if(t>=used.size()) used.resize(t+1,0);
+	if(used[t]) continue;
+	r.push_back(t);
+	used[t]=1;
+      }
+      for(int i=0; i<used.size(); i++)
+	if(!used[i]) r.push_back(i);
+      return r;
+    }
+
+    // The same map for the permuted input x'[i]=x[in_perm[i]] and, if out_perm is not empty, the permuted
+    // output r'[i]=r[out_perm[i]], with its lists in locality order
+    GatherMapB relabel(const vector<int>& in_perm, const vector<int>& out_perm=vector<int>()) const{
+      cnine::fnlog timer("GatherMapB::relabel()");
+      if(is_weighted()) CNINE_ERROR("relabeling is not implemented for weighted gather maps.");
+      vector<int> in_inv=inverse_permutation(in_perm);
+      vector<int> out_inv=inverse_permutation(out_perm);
+      vector<int> lorder;
+      vector<int> sorder;
+      locality_order(lorder,sorder);
+      GatherMapB r(std::max<int>(n_out,out_perm.size()),std::max<int>(n_in,in_perm.size()));
+      r.arr=reordered_lists(lorder,&in_inv,out_perm.size()>0?&out_inv:nullptr);
+      r.in_columns=in_columns;
+      r.out_columns=out_columns;
+      r.in_columns_n=in_columns_n;
+      r.out_columns_n=out_columns_n;
+      return r;
+    }
+
+    // The map that copies row perm[i] of the input to row i of the output
+    static GatherMapB permutation(const vector<int>& perm){
+      const int n=perm.size();
+      GatherMapB r(n,n);
+      r.arr.reserve(2*n);
+      for(int i=0; i<n; i++)
+	r.arr.push_back(i,vector<int>({perm[i]}));
+      return r;
+    }
+
+    static vector<int> inverse_permutation(const vector<int>& perm){
+      vector<int> r(perm.size(),-1);
+      for(int i=0; i<perm.size(); i++)
+	r[perm[i]]=i;
+      return r;
+    }
+
+
+
+  public: // ---- Binary serialization -----------------------------------------------------------------------
+
+
+    // Write the map, its cached inverse and its fixed-k submaps as a record of a gather map file (see
+    // GatherMapFileHeader) and return the position of the record
+    size_t serialize(Bofstream& ofs, const bool with_inv=true) const{
+      CNINE_ASSRT(get_dev()==0);
+      GatherMapFileHeader header(GatherMapFileHeader::gather_map);
+      const size_t pos=GatherMapFileHeader::reserve(ofs);
+      header.n_in=n_in;
+      header.n_out=n_out;
+      header.in_columns=in_columns;
+      header.out_columns=out_columns;
+      header.in_columns_n=in_columns_n;
+      header.out_columns_n=out_columns_n;
+      header.nlists=size();
+      header.tail=arr.get_tail();
+      if(sorted) header.flags|=GatherMapFileHeader::is_sorted;
+
+      TensorChecksum checksum;
+      TensorChecksum* cs=ofs.checksums?&checksum:nullptr;
+      header.dir_offset=GatherMapFileHeader::write_array(ofs,arr.dir.arr,2*header.nlists,cs);
+      header.arr_offset=GatherMapFileHeader::write_array(ofs,arr.arr,header.tail,cs);
+      if(cs){
+	header.flags|=GatherMapFileHeader::has_checksum;
+	header.checksum=checksum.value();
+      }
+
+      if(with_inv && _inv){
+	header.flags|=GatherMapFileHeader::has_inv;
+	header.inv_offset=_inv->serialize(ofs,false);
+      }
+
+      vector<uint64_t> children;
+      for(auto& p:fixedk_maps)
+	children.push_back(p->serialize(ofs));
+      header.nchildren=children.size();
+      header.children_offset=GatherMapFileHeader::write_array(ofs,children.data(),children.size());
+
+      header.end_offset=ofs.pos();
+      header.rewrite(ofs,pos);
+      return pos;
+    }
+
+    static shared_ptr<GatherMapB> read_record(Bifstream& ifs, const size_t pos){
+      auto header=GatherMapFileHeader::read(ifs,pos,GatherMapFileHeader::gather_map);
+      check_nlists(header,ifs.filename);
+      auto r=make_shared<GatherMapB>();
+      r->set_from(header);
+      r->arr=hlists<int>(header.nlists,header.tail,fill_reserve());
+      r->arr.tail=header.tail;
+
+      TensorChecksum checksum;
+      const bool verify=ifs.checksums && (header.flags&GatherMapFileHeader::has_checksum);
+      TensorChecksum* cs=verify?&checksum:nullptr;
+      GatherMapFileHeader::read_array(ifs,header.dir_offset,r->arr.dir.arr,2*header.nlists,cs);
+      GatherMapFileHeader::read_array(ifs,header.arr_offset,r->arr.arr,header.tail,cs);
+      if(verify && checksum.value()!=header.checksum)
+	CNINE_ERROR("Checksum mismatch in "+ifs.filename);
+      check_directory(r->arr.dir.arr,header,ifs.filename);
+
+      if(header.flags&GatherMapFileHeader::has_inv)
+	r->_inv=read_record(ifs,header.inv_offset);
+      vector<uint64_t> children(header.nchildren);
+      GatherMapFileHeader::read_array(ifs,header.children_offset,children.data(),children.size());
+      for(auto p:children)
+	r->fixedk_maps.push_back(FixedkGatherMap::read_record(ifs,p));
+      return r;
+    }
+
+    // The map stored in the record at pos of a mapped file. Its lists are used in place, so pages of the
+    // array are only read when they are first touched. The directory is checked against the size of the
+    // array up front. Appending lists copies the directory and the array, and set/set_target fail on a map 
+    // mapped readonly.
+    static shared_ptr<GatherMapB> map_record(const shared_ptr<MappedFile>& file, const size_t pos){
+      auto header=GatherMapFileHeader::read(*file,pos,GatherMapFileHeader::gather_map);
+      check_nlists(header,file->path);
+      GatherMapFileHeader::check_array<int>(*file,header.dir_offset,2*header.nlists);
+      GatherMapFileHeader::check_array<int>(*file,header.arr_offset,header.tail);
+      GatherMapFileHeader::check_array<uint64_t>(*file,header.children_offset,header.nchildren);
+      check_directory(reinterpret_cast<const int*>(file->data()+header.dir_offset),header,file->path);
+
+      auto r=make_shared<GatherMapB>();
+      r->set_from(header);
+      r->arr.view_memory(header.nlists,reinterpret_cast<int*>(file->data()+header.dir_offset),
+	reinterpret_cast<int*>(file->data()+header.arr_offset),header.tail);
+      r->mapping=file;
+
+      if(header.flags&GatherMapFileHeader::has_inv)
+	r->_inv=map_record(file,header.inv_offset);
+      const uint64_t* children=reinterpret_cast<const uint64_t*>(file->data()+header.children_offset);
+      for(size_t i=0; i<header.nchildren; i++)
+	r->fixedk_maps.push_back(FixedkGatherMap::map_record(file,children[i]));
+      return r;
+    }
+
+    // Checks shared by read_record and map_record, made before the directory and the lists are used
+    static void check_nlists(const GatherMapFileHeader& header, const string& filename){
+      if(header.nlists>(uint64_t)std::numeric_limits<int>::max()) 
+	CNINE_ERROR(filename+" is corrupt: too many lists");
+    }
+
+    static void check_directory(const int* dir, const GatherMapFileHeader& header, const string& filename){
+      for(size_t i=0; i<header.nlists; i++)
+	if(dir[2*i]<0 || dir[2*i+1]<1 || (uint64_t)dir[2*i]+dir[2*i+1]>header.tail)
+	  CNINE_ERROR(filename+" is corrupt: list "+std::to_string(i)+" does not lie in the array of the map");
+    }
+
+    void save(const string& filename, const bool checksum=false) const{
+      Bofstream ofs(filename,checksum);
+      serialize(ofs);
+    }
+
+    static shared_ptr<GatherMapB> load(const string& filename){
+      Bifstream ifs(filename);
+      return read_record(ifs,0);
+    }
+
+    // The default copy_on_write mode lets sort() and the other in place operations work on mapped maps
+    static shared_ptr<GatherMapB> map_file(const string& filename,
+      const MappedFile::map_mode mode=MappedFile::copy_on_write){
+      return map_record(make_shared<MappedFile>(filename,mode),0);
+    }
+
+
+  public: // ---- Caching ------------------------------------------------------------------------------------
+
+
+    // Hash of an edge list, for keying cached maps on the input they were built from
+    static uint64_t edge_hash(const vector<int>& sources, const vector<int>& targets){
+      TensorChecksum h;
+      const uint64_t n=sources.size();
+      h.update(&n,sizeof(n));
+      h.update(sources.data(),sources.size()*sizeof(int));
+      h.update(targets.data(),targets.size()*sizeof(int));
+      return h.value();
+    }
+
+    static string cache_path(const string& dir, const vector<int>& sources, const vector<int>& targets){
+      ostringstream oss;
+      oss<<dir<<"/gathermap_v"<<GatherMapFileHeader::current_version<<"_"
+	 <<std::hex<<std::setw(16)<<std::setfill('0')<<edge_hash(sources,targets)<<".bin";
+      return oss.str();
+    }
+
+    // True if the lists are exactly the ones GatherMapB(sources,targets) builds: one list for each target
+    // that occurs, in increasing order of target, holding its sources in the order of the edge list
+    bool built_from(const vector<int>& sources, const vector<int>& targets) const{
+      if(get_dev()!=0 || sources.size()!=targets.size()) return false;
+      const size_t N=sources.size();
+      int max_s=-1, max_t=-1;
+      for(size_t i=0; i<N; i++){
+	if(sources[i]<0 || targets[i]<0) return false;
+	max_s=std::max(max_s,sources[i]);
+	max_t=std::max(max_t,targets[i]);
+      }
+      if(n_in!=max_s+1 || n_out!=max_t+1) return false;
+
+      vector<int> list_of(n_out,-1);
+      size_t total=0;
+      for(int i=0; i<size(); i++){
+	const int t=target(i);
+	if(t<0 || t>=n_out || (i>0 && t<=target(i-1)) || size_of(i)==0) return false;
+	list_of[t]=i;
+	total+=size_of(i);
+      }
+      if(total!=N) return false;
+
+      vector<int> used(size(),0);
+      for(size_t i=0; i<N; i++){
+	const int l=list_of[targets[i]];
+	if(l<0 || used[l]==size_of(l) || (*this)(l,used[l]++)!=sources[i]) return false;
+      }
+      return true;
+    }
+
+    // The map GatherMapB(sources,targets), mapped from the file cache_path(dir,sources,targets) if it
+    // exists, and otherwise built and saved there. The file name only carries a hash of the edges, so a map
+    // found there is checked against the edges with built_from, and rebuilt if it does not match or cannot
+    // be read. The file is written under a temporary name and then renamed, so concurrent processes never
+    // see a partial file.
+    static shared_ptr<GatherMapB> cached(const string& dir, const vector<int>& sources,
+      const vector<int>& targets, const bool with_inv=false){
+      const string path=cache_path(dir,sources,targets);
+      if(::access(path.c_str(),R_OK)==0){
+	try{
+	  auto r=map_file(path);
+	  if(r->built_from(sources,targets)) return r;
+	}catch(std::runtime_error& e){} // truncated or corrupt file, rebuild it
+      }
+
+      GatherMapB g(sources,targets);
+      if(with_inv) g.inv();
+      const string tmp=path+".tmp"+std::to_string(::getpid());
+      g.save(tmp);
+      if(std::rename(tmp.c_str(),path.c_str())!=0)
+	CNINE_ERROR("Cannot rename "+tmp+" to "+path+": "+std::strerror(errno));
+      return map_file(path);
+    }
+
+
+  private:
+
+    // The lists of a map mapped from a file readonly cannot be changed in place
+    void check_writable() const{
+      if(mapping && !mapping->writable() && arr.is_view)
+	CNINE_ERROR("GatherMapB is mapped readonly from "+mapping->path+". Map it copy_on_write to modify it.");
+    }
+
+    // Drop everything computed from the lists, called by the operations that change them. The inverse
+    // and the degrees only depend on the edges, so reordering the lists keeps them.
+    void clear_caches(){
+      _inv.reset();
+      _inv_degree.clear();
+      _graded.clear();
+    }
+
+    // Counting sort of the edges (source(i),target(i)) by target: a histogram of the targets over chunks of
+    // the edge list, a prefix sum giving the offset of each list and of each chunk's share of it, and a
+    // scatter of the sources. The histogram and the scatter run in parallel, one task per chunk. The
+    // scatter is stable, so the result does not depend on the chunking, and the storage of arr is
+    // allocated once, at its final size. The histogram is capped at a few times the size of the edge list.
+    template<typename SOURCE, typename TARGET>
+    void build_from_edges(const size_t N, const SOURCE& source, const TARGET& target, const int _n_in=-1,
+      const int _n_out=-1){
+
+      int nchunks=std::max(1,std::min<int>(nthreads,N/min_edges_per_chunk));
+      auto chunk_begin=[&](const int c){return (size_t)c*N/nchunks;};
+
+      n_in=std::max(_n_in,0);
+      n_out=std::max(_n_out,0);
+      if(_n_in<0 || _n_out<0){
+	vector<int> in_max(nchunks,0);
+	vector<int> out_max(nchunks,0);
+	parallel_for(0,nchunks,1,[&](const int c){
+	    int a=0, b=0;
+	    for(size_t i=chunk_begin(c); i<chunk_begin(c+1); i++){
+	      a=std::max(a,source(i)+1);
+	      b=std::max(b,target(i)+1);
+	    }
+	    in_max[c]=a;
+	    out_max[c]=b;
+	  });
+	if(_n_in<0) n_in=*std::max_element(in_max.begin(),in_max.end());
+	if(_n_out<0) n_out=*std::max_element(out_max.begin(),out_max.end());
+      }
+
+      nchunks=std::max<int>(1,std::min<size_t>(nchunks,4*N/std::max(n_out,1)));
+      vector<int> count((size_t)nchunks*n_out,0);
+      parallel_for(0,nchunks,1,[&](const int c){
+	  int* cnt=count.data()+(size_t)c*n_out;
+	  for(size_t i=chunk_begin(c); i<chunk_begin(c+1); i++){
+	    const int s=source(i);
+	    const int t=target(i);
+	    CNINE_ASSRT(s>=0 && s<n_in);
+	    CNINE_ASSRT(t>=0 && t<n_out);
+	    cnt[t]++;
+	  }
+	});
+
+      int nlists=0;
+      for(int t=0; t<n_out; t++)
+	for(int c=0; c<nchunks; c++)
+	  if(count[(size_t)c*n_out+t]>0){nlists++; break;}
+
+      // fails if the lists do not fit int offsets, so the positions stored in count below fit in an int
+      arr=hlists<int>(nlists,(size_t)nlists+N,fill_reserve());
+      int k=0;
+      size_t pos=0;
+      for(int t=0; t<n_out; t++){
+	const size_t head=pos;
+	pos++;
+	for(int c=0; c<nchunks; c++){
+	  int& cnt=count[(size_t)c*n_out+t];
+	  const int m=cnt;
+	  cnt=pos;
+	  pos+=m;
+	}
+	if(pos==head+1){
+	  pos=head;
+	  continue;
+	}
+	arr.dir.set(k,0,head);
+	arr.dir.set(k,1,pos-head);
+	arr.arr[head]=t;
+	k++;
+      }
+      arr.tail=pos;
+
+      parallel_for(0,nchunks,1,[&](const int c){
+	  int* next=count.data()+(size_t)c*n_out;
+	  int* a=arr.arr;
+	  for(size_t i=chunk_begin(c); i<chunk_begin(c+1); i++)
+	    a[next[target(i)]++]=source(i);
+	});
+    }
+
+    static constexpr int min_edges_per_chunk=1<<16;
+
+    void set_from(const GatherMapFileHeader& header){
+      n_in=header.n_in;
+      n_out=header.n_out;
+      in_columns=header.in_columns;
+      out_columns=header.out_columns;
+      in_columns_n=header.in_columns_n;
+      out_columns_n=header.out_columns_n;
+      sorted=(header.flags&GatherMapFileHeader::is_sorted);
+    }
+
+    hlists<int> reordered_lists(const vector<int>& order, const vector<int>* in_relabel,
+      const vector<int>* out_relabel) const{
+      CNINE_ASSRT(!is_weighted());
+      hlists<int> r;
+      r.reserve(arr.get_tail());
+      vector<int> v;
+      for(auto i:order){
+	const int* l=arr.arr+offset(i)+1;
+	v.resize(size_of(i));
+	for(int j=0; j<v.size(); j++)
+	  v[j]=in_relabel?(*in_relabel)[l[j]]:l[j];
+	std::sort(v.begin(),v.end());
+	r.push_back(out_relabel?(*out_relabel)[target(i)]:target(i),v);
+      }
+      return r;
+    }
+
 
   public: // ---- I/O ----------------------------------------------------------------------------------------
 
@@ -0,0 +1,182 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+
+#ifndef _CnineGatherMapFileHeader
+#define _CnineGatherMapFileHeader
+
+#include "Cnine_base.hpp"
+#include "TensorFileHeader.hpp"
+#include "Bofstream.hpp"
+#include "Bifstream.hpp"
+#include "MappedFile.hpp"
+#include <cstring>
+
+
+namespace cnine{
+
+
+  // ---- GatherMapFileHeader ----------------------------------------------------------------------------------
+  //
+  // Fixed size header of a gather map record in a binary file. A record consists of the header followed by
+  // its arrays, each starting at a multiple of data_alignment bytes so that they can be used in place when
+  // the file is mapped. All offsets are absolute positions in the file.
+  //
+  // gather_map:  the hlists directory of a GatherMapB (nlists x 2 ints) at dir_offset and its array (tail
+  //              ints) at arr_offset. If has_inv is set, the record of the cached inverse starts at
+  //              inv_offset. nchildren FixedkGatherMap records follow, their positions listed at
+  //              children_offset. checksum is the TensorChecksum of the directory and the array.
+  // fixedk_map:  the tensor of a FixedkGatherMap, in tensor file format, at arr_offset.
+  // map_pack:    the in_offsets and out_offsets tables of a GatherMapPack (nchildren ints each) at dir_offset
+  //              and arr_offset, and the positions of the records of its nchildren maps at children_offset.
+
+
+  class GatherMapFileHeader{
+  public:
+
+    static constexpr uint64_t data_alignment=4096;
+    static constexpr uint32_t current_version=1;
+
+    enum record_kind{gather_map=1,fixedk_map=2,map_pack=3};
+
+    char magic[8];
+    uint32_t version=current_version;
+    uint32_t kind=0;
+    uint32_t flags=0;
+    int32_t n_in=0;
+    int32_t n_out=0;
+    int32_t in_columns=1;
+    int32_t out_columns=1;
+    int32_t in_columns_n=1;
+    int32_t out_columns_n=1;
+    uint64_t nlists=0;
+    uint64_t tail=0;
+    uint64_t dir_offset=0;
+    uint64_t arr_offset=0;
+    uint64_t inv_offset=0;
+    uint64_t nchildren=0;
+    uint64_t children_offset=0;
+    uint64_t end_offset=0;
+    uint64_t checksum=0;
+
+    static constexpr uint32_t has_inv=1;
+    static constexpr uint32_t is_sorted=2;
+    static constexpr uint32_t has_checksum=4;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    GatherMapFileHeader(){
+      std::memcpy(magic,"CNINEGMP",8);
+    }
+
+    GatherMapFileHeader(const record_kind _kind):
+      GatherMapFileHeader(){
+      kind=_kind;
+    }
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    bool valid() const{
+      return std::memcmp(magic,"CNINEGMP",8)==0 && version<=current_version;
+    }
+
+    void check(const record_kind _kind, const string& path) const{
+      if(!valid()) CNINE_ERROR(path+" does not contain a cnine gather map at the expected position");
+      if(kind!=_kind) CNINE_ERROR(path+" contains a different kind of gather map record than expected");
+    }
+
+
+  public: // ---- Writing and reading ------------------------------------------------------------------------
+
+
+    // Write a placeholder for the header of a record at the current (aligned) position and return its
+    // position. The header is filled in with rewrite once the positions of the arrays are known.
+    static size_t reserve(Bofstream& ofs){
+      ofs.align(data_alignment);
+      const size_t pos=ofs.pos();
+      ofs.write(GatherMapFileHeader());
+      return pos;
+    }
+
+    void rewrite(Bofstream& ofs, const size_t pos) const{
+      const size_t end=ofs.pos();
+      ofs.seekp(pos);
+      ofs.write(*this);
+      ofs.seekp(end);
+      ofs.check();
+    }
+
+    static GatherMapFileHeader read(Bifstream& ifs, const size_t pos, const record_kind _kind){
+      ifs.seekg(pos);
+      GatherMapFileHeader header;
+      ifs.read(header);
+      header.check(_kind,ifs.filename);
+      return header;
+    }
+
+    static GatherMapFileHeader read(const MappedFile& file, const size_t pos, const record_kind _kind){
+      check_array<GatherMapFileHeader>(file,pos,1);
+      GatherMapFileHeader header;
+      std::memcpy(&header,file.data()+pos,sizeof(GatherMapFileHeader));
+      header.check(_kind,file.path);
+      if(header.end_offset>file.size()) CNINE_ERROR(file.path+" is truncated");
+      return header;
+    }
+
+    // Fail unless n objects of type TYPE fit in the mapped file starting at offs, which must be suitably 
+    // aligned. Used on every offset of a record before anything is read through it.
+    template<typename TYPE>
+    static void check_array(const MappedFile& file, const uint64_t offs, const uint64_t n){
+      if(offs>file.size() || n>(file.size()-offs)/sizeof(TYPE))
+	CNINE_ERROR(file.path+" is truncated or corrupt: "+std::to_string(n)+" objects of "+std::to_string(sizeof(TYPE))+
+	  " bytes at offset "+std::to_string(offs)+" do not fit in the file");
+      if(offs%alignof(TYPE)!=0)
+	CNINE_ERROR(file.path+" is corrupt: misaligned array at offset "+std::to_string(offs));
+    }
+
+    // Write n elements of an array at the next aligned position and return that position
+    template<typename TYPE>
+    static size_t write_array(Bofstream& ofs, const TYPE* p, const size_t n, TensorChecksum* checksum=nullptr){
+      ofs.align(data_alignment);
+      const size_t pos=ofs.pos();
+      const char* q=reinterpret_cast<const char*>(p);
+      const size_t nbytes=n*sizeof(TYPE);
+      for(size_t i=0; i<nbytes; i+=ofs.chunk_bytes){
+	size_t m=std::min(ofs.chunk_bytes,nbytes-i);
+	if(checksum) checksum->update(q+i,m);
+	ofs.write_array(q+i,m);
+      }
+      return pos;
+    }
+
+    template<typename TYPE>
+    static void read_array(Bifstream& ifs, const size_t pos, TYPE* p, const size_t n, TensorChecksum* checksum=nullptr){
+      ifs.seekg(pos);
+      char* q=reinterpret_cast<char*>(p);
+      const size_t nbytes=n*sizeof(TYPE);
+      for(size_t i=0; i<nbytes; i+=ifs.chunk_bytes){
+	size_t m=std::min(ifs.chunk_bytes,nbytes-i);
+	ifs.read_array(q+i,m);
+	if(checksum) checksum->update(q+i,m);
+      }
+    }
+
+  };
+
+}
+
+#endif
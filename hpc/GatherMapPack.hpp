@@ -105,6 +105,98 @@ namespace cnine{
       return *this;
     }
 
+
+
+  public: // ---- Binary serialization ---------------------------------------------------------------------
+
+
+    // Write the pack as a record of a gather map file (see GatherMapFileHeader) and return its position
+    size_t serialize(Bofstream& ofs) const{
+      GatherMapFileHeader header(GatherMapFileHeader::map_pack);
+      const size_t pos=GatherMapFileHeader::reserve(ofs);
+      header.n_in=n_in;
+      header.n_out=n_out;
+      header.in_columns=in_columns;
+      header.out_columns=out_columns;
+      header.in_columns_n=in_columns_n;
+      header.out_columns_n=out_columns_n;
+      header.nchildren=size();
+
+      vector<uint64_t> children;
+      for(int i=0; i<size(); i++)
+	children.push_back((*this)[i].serialize(ofs));
+      header.dir_offset=GatherMapFileHeader::write_array(ofs,in_offsets.data(),in_offsets.size());
+      header.arr_offset=GatherMapFileHeader::write_array(ofs,out_offsets.data(),out_offsets.size());
+      header.children_offset=GatherMapFileHeader::write_array(ofs,children.data(),children.size());
+
+      header.end_offset=ofs.pos();
+      header.rewrite(ofs,pos);
+      return pos;
+    }
+
+    static shared_ptr<GatherMapPack> read_record(Bifstream& ifs, const size_t pos){
+      auto header=GatherMapFileHeader::read(ifs,pos,GatherMapFileHeader::map_pack);
+      vector<uint64_t> children(header.nchildren);
+      GatherMapFileHeader::read_array(ifs,header.children_offset,children.data(),children.size());
+      vector<shared_ptr<GatherMapB> > maps;
+      for(auto p:children)
+	maps.push_back(GatherMapB::read_record(ifs,p));
+      auto r=make_shared<GatherMapPack>(maps);
+      r->set_from(header);
+      GatherMapFileHeader::read_array(ifs,header.dir_offset,r->in_offsets.data(),r->in_offsets.size());
+      GatherMapFileHeader::read_array(ifs,header.arr_offset,r->out_offsets.data(),r->out_offsets.size());
+      return r;
+    }
+
+    // The pack stored in the record at pos of a mapped file, its maps used in place
+    static shared_ptr<GatherMapPack> map_record(const shared_ptr<MappedFile>& file, const size_t pos){
+      auto header=GatherMapFileHeader::read(*file,pos,GatherMapFileHeader::map_pack);
+      GatherMapFileHeader::check_array<uint64_t>(*file,header.children_offset,header.nchildren);
+      GatherMapFileHeader::check_array<int>(*file,header.dir_offset,header.nchildren);
+      GatherMapFileHeader::check_array<int>(*file,header.arr_offset,header.nchildren);
+      const uint64_t* children=reinterpret_cast<const uint64_t*>(file->data()+header.children_offset);
+      vector<shared_ptr<GatherMapB> > maps;
+      for(size_t i=0; i<header.nchildren; i++)
+	maps.push_back(GatherMapB::map_record(file,children[i]));
+      auto r=make_shared<GatherMapPack>(maps);
+      r->set_from(header);
+      const int* in=reinterpret_cast<const int*>(file->data()+header.dir_offset);
+      const int* out=reinterpret_cast<const int*>(file->data()+header.arr_offset);
+      r->in_offsets.assign(in,in+header.nchildren);
+      r->out_offsets.assign(out,out+header.nchildren);
+      return r;
+    }
+
+    void save(const string& filename, const bool checksum=false) const{
+      Bofstream ofs(filename,checksum);
+      serialize(ofs);
+    }
+
+    static shared_ptr<GatherMapPack> load(const string& filename){
+      Bifstream ifs(filename);
+      return read_record(ifs,0);
+    }
+
+    static shared_ptr<GatherMapPack> map_file(const string& filename, const MappedFile::map_mode mode=MappedFile::copy_on_write){
+      return map_record(make_shared<MappedFile>(filename,mode),0);
+    }
+
+
+  private:
+
+    void set_from(const GatherMapFileHeader& header){
+      n_in=header.n_in;
+      n_out=header.n_out;
+      in_columns=header.in_columns;
+      out_columns=header.out_columns;
+      in_columns_n=header.in_columns_n;
+      out_columns_n=header.out_columns_n;
+    }
+
+
+  public: // ---- I/O ----------------------------------------------------------------------------------------
+
+
     string str(const string indent="") const{
       ostringstream oss;
       for(int s=0; s<size(); s++){
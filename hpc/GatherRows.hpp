@@ -22,6 +22,7 @@
 #include "Ltensor.hpp"
 #include "logged_timer.hpp"
 #include "MultiLoop.hpp"
+#include "CpuGatherRows.hpp"
 
 
 namespace cnine{
@@ -46,13 +47,27 @@ namespace cnine{
       int dev=_x.get_dev();
       CNINE_ASSRT(_r.get_dev()==dev);
 
+      // on the host, plain maps are run through their fixed degree decomposition, unless a target has
+      // several lists, which the parallel fixed-k kernels could split over different tasks
+      if constexpr(!is_complex<TYPE>::value){
+	if(dev==0 && g.fixedk_maps.size()==0 && !dynamic_cast<const WeightedGatherMapB*>(&g) &&
+	  g.in_columns==1 && g.out_columns==1 && g.in_columns_n==1 && g.out_columns_n==1 && g.unique_targets()){
+	  if(auto graded=g.graded()){
+	    (*this)(_r,_x,*graded);
+	    return;
+	  }
+	}
+      }
+
       if(g.fixedk_maps.size()>0){
 	for(auto& p: g.fixedk_maps)
 	  (*this)(_r,_x,*p);
       }
 
-      if(dynamic_cast<const WeightedGatherMapB*>(&g)) 
+      if(dynamic_cast<const WeightedGatherMapB*>(&g)){
 	weighted(_r,_x,dynamic_cast<const WeightedGatherMapB&>(g));
+	return;
+      }
 
       if(g.size()==0) return;
 
@@ -70,17 +85,22 @@ namespace cnine{
 	fnlog timer("GatherRows::operator()");
 	//logged_timer ptimer("GatherRows(CPU)",r,x,((long long)g.n_ops())*x.n1);
 	CNINE_ASSRT(g.get_dev()==0);
-	int N=g.size();
-	for(int i=0; i<N; i++){
-	  auto targt=r.slice0(g.target(i));
-	  int M=g.size_of(i);
-	  for(int j=0; j<M; j++){
-	    targt+=x.slice0(g(i,j));
+	if constexpr(!is_complex<TYPE>::value){
+	  CpuGatherRows()(_r.get_arr(),r.s0,r.s1,_x.get_arr(),x.s0,x.s1,r.n1,g);
+	}else{
+	  int N=g.size();
+	  for(int i=0; i<N; i++){
+	    auto targt=r.slice0(g.target(i));
+	    int M=g.size_of(i);
+	    for(int j=0; j<M; j++){
+	      targt+=x.slice0(g(i,j));
+	    }
 	  }
 	}
       }
 
       if(_r.get_dev()==1){
+	CNINE_ASSRT((!std::is_same<TYPE,double>::value));
 	g.sort();
 	fnlog timer("GatherRows::operator()(G)");
 	//logged_timer ptimer("GatherRows(GPU)",r,x,((long long)g.n_ops())*x.n1);
@@ -89,6 +109,26 @@ namespace cnine{
     }
 
 
+    // Gather through lists with 64 bit offsets, for maps with 2^31 or more edges. Host only.
+    template<typename TYPE>
+    void operator()(const Ltensor<TYPE>& _r, const Ltensor<TYPE>& _x, const hlists<int,int64_t>& lists){
+      CNINE_ASSRT(_r.ndims()==2);
+      CNINE_ASSRT(_x.ndims()==2);
+      CNINE_ASSRT(_r.dim(1)==_x.dim(1));
+      CNINE_CPUONLY1(_r);
+      CNINE_CPUONLY1(_x);
+      fnlog timer("GatherRows::operator()(hlists64)");
+      if constexpr(!is_complex<TYPE>::value){
+	CpuGatherRows()(_r.get_arr(),_r.stride(0),_r.stride(1),_x.get_arr(),_x.stride(0),_x.stride(1),_r.dim(1),lists);
+      }else{
+	for(int i=0; i<lists.size(); i++){
+	  auto targt=_r.slice(0,lists.head(i));
+	  lists.for_each_of(i,[&](const int j){targt.add(_x.slice(0,j));});
+	}
+      }
+    }
+
+
     template<typename TYPE>
     void operator()(const Ltensor<TYPE>& _r, const Ltensor<TYPE>& _x, const GatherMapPack& gmaps){
       CNINE_ASSRT(_r.ndims()==2);
@@ -117,6 +157,7 @@ namespace cnine{
       }
 
       if(dev==1){
+	CNINE_ASSRT((!std::is_same<TYPE,double>::value));
 	gmaps.sort();
 	fnlog timer("GatherRows::operator_pack()(G)");
 	//logged_timer ptimer("GatherRows(GPU)",r,x,((long long)g.n_ops())*x.n1);
@@ -140,13 +181,24 @@ namespace cnine{
 	fnlog timer("GatherRows::weighted()");
 	//logged_timer ptimer("GatherRows::weighted(CPU)",r,x,((long long)g.n_ops())*x.n1);
 	CNINE_ASSRT(g.get_dev()==0);
+	// view2() of a double tensor is a float view, so the host loop goes through the typed arrays
+	TYPE* rarr=_r.get_arr();
+	const TYPE* xarr=_x.get_arr();
+	const size_t rs0=_r.stride(0)/g.out_columns;
+	const size_t rs1=_r.stride(1);
+	const size_t xs0=_x.stride(0)/g.in_columns;
+	const size_t xs1=_x.stride(1);
+	const int nc=_x.dim(1)/g.in_columns;
 	int N=g.size();
 	for(int i=0; i<N; i++){
-	  auto targt=r.slice0(g.target(i));
-	  targt.n0=x.n1; // hack
+	  TYPE* targt=rarr+g.target(i)*rs0;
 	  int M=g.size_of(i);
-	  for(int j=0; j<M; j++)
-	    targt.add(x.slice0(g.src(i,j)),g.weight(i,j));
+	  for(int j=0; j<M; j++){
+	    const TYPE* src=xarr+g.src(i,j)*xs0;
+	    const float w=g.weight(i,j);
+	    for(int c=0; c<nc; c++)
+	      targt[c*rs1]+=w*src[c*xs1];
+	  }
 	}
       }
 
@@ -178,14 +230,44 @@ namespace cnine{
       CNINE_ASSRT(g.get_dev()==0);
       int N=g.getn();
       int K=g.getk();
-      for(int i=0; i<N; i++){
-	int targt=g.target(i);
-	for(int j=0; j<K; j++)
-	  r.slice0(targt)+=x.slice0(g(i,j));
+      if constexpr(!is_complex<TYPE>::value){
+	if(g.in_columns==1 && g.out_columns==1 && g.strides[1]==1){
+	  fnlog timer("GatherRows::operator()(fixedk)");
+	  CpuGatherRows().fixedk(_r.get_arr(),r.s0,r.s1,_x.get_arr(),x.s0,x.s1,r.n1,g.get_arr(),g.strides[0],N,K,
+	    g.unique_targets());
+	  return;
+	}
+	// each index addresses a run of in_columns (resp. out_columns) consecutive rows, read through
+	// the typed arrays since view2() of a double tensor is a float view
+	CNINE_ASSRT(r.n1==x.n1);
+	CNINE_ASSRT(g.out_columns==1 || _r.stride(0)==_r.dim(1)*_r.stride(1));
+	CNINE_ASSRT(g.in_columns==1 || _x.stride(0)==_x.dim(1)*_x.stride(1));
+	TYPE* rarr=_r.get_arr();
+	const TYPE* xarr=_x.get_arr();
+	const size_t rs0=_r.stride(0);
+	const size_t rs1=_r.stride(1);
+	const size_t xs0=_x.stride(0);
+	const size_t xs1=_x.stride(1);
+	const int nc=r.n1;
+	for(int i=0; i<N; i++){
+	  TYPE* targt=rarr+g.target(i)*rs0;
+	  for(int j=0; j<K; j++){
+	    const TYPE* src=xarr+g(i,j)*xs0;
+	    for(int c=0; c<nc; c++)
+	      targt[c*rs1]+=src[c*xs1];
+	  }
+	}
+      }else{
+	for(int i=0; i<N; i++){
+	  int targt=g.target(i);
+	  for(int j=0; j<K; j++)
+	    r.slice0(targt)+=x.slice0(g(i,j));
+	}
       }
     }
 
     if(_r.get_dev()==1){
+      CNINE_ASSRT((!std::is_same<TYPE,double>::value));
       CUDA_STREAM(gatherRows_cu(r,x,g,stream));
     }
   }
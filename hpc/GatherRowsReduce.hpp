@@ -0,0 +1,399 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _cnine_gather_rows_reduce
+#define _cnine_gather_rows_reduce
+
+#include "Cnine_base.hpp"
+#include "GatherMapB.hpp"
+#include "WeightedGatherMapB.hpp"
+#include "Ltensor.hpp"
+#include "logged_timer.hpp"
+#include "CpuGatherRows.hpp"
+
+
+namespace cnine{
+
+
+  // Segmented reductions over the lists of a GatherMapB, the counterparts of GatherRows for max, mean and
+  // softmax weighted aggregation. x is an n_in x C matrix and r is an n_out x C matrix, the rows of r being
+  // indexed by the targets of g and the rows of x by its sources. Only plain maps on the host are supported.
+  // The edges of g are numbered in the order that g.for_each visits them, i.e., list by list.
+
+  class GatherRowsReduceBase{
+  protected:
+
+    template<typename TYPE>
+    static void check(const TensorView<TYPE>& r, const TensorView<TYPE>& x, const GatherMapB& g){
+      CNINE_ASSRT(r.ndims()==2);
+      CNINE_ASSRT(x.ndims()==2);
+      CNINE_ASSRT(r.dim(1)==x.dim(1));
+      CNINE_ASSRT(r.dim(0)>=g.get_nout());
+      CNINE_ASSRT(x.dim(0)>=g.get_nin());
+      CNINE_CPUONLY1(r);
+      CNINE_CPUONLY1(x);
+      CNINE_ASSRT(g.get_dev()==0);
+      CNINE_ASSRT(g.in_columns==1 && g.out_columns==1 && g.in_columns_n==1 && g.out_columns_n==1);
+      CNINE_ASSRT(g.fixedk_maps.size()==0);
+      if(dynamic_cast<const WeightedGatherMapB*>(&g))
+	CNINE_ERROR("weighted gather maps are not supported by segmented reductions.");
+    }
+
+    template<typename TYPE>
+    static void check_edges(const TensorView<TYPE>& e, const GatherMapB& g){
+      CNINE_ASSRT(e.ndims()==1);
+      CNINE_ASSRT(e.dim(0)==g.n_ops());
+      CNINE_CPUONLY1(e);
+    }
+
+  };
+
+
+  // ---- Max ----------------------------------------------------------------------------------------------
+  //
+  // r[g.target(i)]=max_j x[g(i,j)] column by column, and argmax[g.target(i)] is the row of x where the max
+  // was attained. Rows of r with no list are left untouched. Each target must have at most one list.
+
+  class GatherRowsMax: public GatherRowsReduceBase{
+  public:
+
+    template<typename TYPE>
+    void operator()(const TensorView<TYPE>& r, const TensorView<int>& argmax, const TensorView<TYPE>& x,
+      const GatherMapB& g){
+      check(r,x,g);
+      CNINE_ASSRT(g.unique_targets());
+      CNINE_ASSRT(argmax.dims==r.dims);
+      CNINE_CPUONLY1(argmax);
+      fnlog timer("GatherRowsMax::operator()");
+
+      const int C=x.dim(1);
+      TYPE* rarr=r.get_arr();
+      int* aarr=argmax.get_arr();
+      const TYPE* xarr=x.get_arr();
+      const int rs0=r.strides[0], rs1=r.strides[1];
+      const int as0=argmax.strides[0], as1=argmax.strides[1];
+      const int xs0=x.strides[0], xs1=x.strides[1];
+
+      CpuGatherRows::for_each_list(g,C,[&](const int i, const size_t e0, const int* l, const int M){
+	  if(M==0) return;
+	  TYPE* rr=rarr+((size_t)l[0])*rs0;
+	  int* aa=aarr+((size_t)l[0])*as0;
+	  const TYPE* x0=xarr+((size_t)l[1])*xs0;
+	  for(int c=0; c<C; c++){
+	    rr[c*rs1]=x0[c*xs1];
+	    aa[c*as1]=l[1];
+	  }
+	  for(int j=1; j<M; j++){
+	    if(j+CpuGatherRows::prefetch_dist<M)
+	      CpuGatherRows::prefetch_row(xarr+((size_t)l[1+j+CpuGatherRows::prefetch_dist])*xs0,C,xs1);
+	    const int s=l[1+j];
+	    const TYPE* xx=xarr+((size_t)s)*xs0;
+	    for(int c=0; c<C; c++)
+	      if(xx[c*xs1]>rr[c*rs1]){
+		rr[c*rs1]=xx[c*xs1];
+		aa[c*as1]=s;
+	      }
+	  }
+	});
+    }
+
+    // Returns the pair (r,argmax), with argmax equal to -1 in rows with no list
+    template<typename TYPE>
+    pair<Ltensor<TYPE>,Ltensor<int> > operator()(const TensorView<TYPE>& x, const GatherMapB& g){
+      Ltensor<TYPE> r({g.get_nout(),x.dim(1)},0,x.get_dev());
+      Ltensor<int> argmax({g.get_nout(),x.dim(1)},0,x.get_dev());
+      argmax.for_each([](int& v){v=-1;});
+      (*this)(r,argmax,x,g);
+      return make_pair(r,argmax);
+    }
+
+
+  public: // ---- Backward ---------------------------------------------------------------------------------
+
+
+    // xgrad[argmax[t,c],c]+=rgrad[t,c]
+    template<typename TYPE>
+    void back(const TensorView<TYPE>& xgrad, const TensorView<TYPE>& rgrad, const TensorView<int>& argmax){
+      CNINE_ASSRT(xgrad.ndims()==2);
+      CNINE_ASSRT(rgrad.dims==argmax.dims);
+      CNINE_ASSRT(xgrad.dim(1)==rgrad.dim(1));
+      CNINE_CPUONLY1(xgrad);
+      CNINE_CPUONLY1(rgrad);
+      fnlog timer("GatherRowsMax::back()");
+
+      const int N=rgrad.dim(0);
+      TYPE* xg=xgrad.get_arr();
+      const TYPE* rg=rgrad.get_arr();
+      const int* aarr=argmax.get_arr();
+      const int xgs0=xgrad.strides[0], xgs1=xgrad.strides[1];
+      const int rgs0=rgrad.strides[0], rgs1=rgrad.strides[1];
+      const int as0=argmax.strides[0], as1=argmax.strides[1];
+
+      CpuGatherRows::for_column_blocks(rgrad.dim(1),N,[&](const int c0, const int c1){
+	  for(int t=0; t<N; t++)
+	    for(int c=c0; c<c1; c++){
+	      const int s=aarr[((size_t)t)*as0+c*as1];
+	      if(s>=0) xg[((size_t)s)*xgs0+c*xgs1]+=rg[((size_t)t)*rgs0+c*rgs1];
+	    }
+	});
+    }
+
+  };
+
+
+  // ---- Mean ---------------------------------------------------------------------------------------------
+  //
+  // r[t]+=(1/d_t) sum_{i: g.target(i)=t} sum_j x[g(i,j)], d_t being the total size of the lists of t, whose
+  // inverses are cached in the map
+
+  class GatherRowsMean: public GatherRowsReduceBase{
+  public:
+
+    template<typename TYPE>
+    void operator()(const TensorView<TYPE>& r, const TensorView<TYPE>& x, const GatherMapB& g){
+      check(r,x,g);
+      fnlog timer("GatherRowsMean::operator()");
+      const vector<double>& invd=g.inv_degree();
+      const int C=x.dim(1);
+      TYPE* rarr=r.get_arr();
+      const TYPE* xarr=x.get_arr();
+
+      CpuGatherRows::for_each_list(g,C,[&](const int i, const size_t e0, const int* l, const int M){
+	  const TYPE a=(TYPE)invd[l[0]];
+	  CpuGatherRows::gather_one(rarr+((size_t)l[0])*r.strides[0],r.strides[1],l+1,M,
+	    xarr,x.strides[0],x.strides[1],C,[&](const int j){return a;});
+	});
+    }
+
+    template<typename TYPE>
+    Ltensor<TYPE> operator()(const TensorView<TYPE>& x, const GatherMapB& g){
+      Ltensor<TYPE> r({g.get_nout(),x.dim(1)},0,x.get_dev());
+      (*this)(r,x,g);
+      return r;
+    }
+
+
+  public: // ---- Backward ---------------------------------------------------------------------------------
+
+
+    // xgrad[s]+=sum_{t->s} rgrad[t]/|list of t|, gathered along g.inv()
+    template<typename TYPE>
+    void back(const TensorView<TYPE>& xgrad, const TensorView<TYPE>& rgrad, const GatherMapB& g){
+      check(rgrad,xgrad,g);
+      fnlog timer("GatherRowsMean::back()");
+      const vector<double>& invd=g.inv_degree();
+      const int C=xgrad.dim(1);
+      TYPE* xg=xgrad.get_arr();
+      const TYPE* rg=rgrad.get_arr();
+
+      CpuGatherRows::for_each_list(g.inv(),C,[&](const int i, const size_t e0, const int* l, const int M){
+	  CpuGatherRows::gather_one(xg+((size_t)l[0])*xgrad.strides[0],xgrad.strides[1],l+1,M,
+	    rg,rgrad.strides[0],rgrad.strides[1],C,[&](const int j){return (TYPE)invd[l[1+j]];});
+	});
+    }
+
+  };
+
+
+  // ---- Softmax ------------------------------------------------------------------------------------------
+  //
+  // r[g.target(i)]+=sum_j alpha_e x[g(i,j)], where e is the index of edge (i,j) and alpha_e is the softmax
+  // of the per-edge scores over all edges into g.target(i). The maximum and the normalizer of each target
+  // are found in a single online pass over its scores, so the rows of x are only read once. If a target
+  // has several lists, this pass runs over all of them before any row is gathered. If the alpha argument
+  // is given, the normalized weights are written to it for the backward pass.
+
+  class GatherRowsSoftmax: public GatherRowsReduceBase{
+  public:
+
+    template<typename TYPE>
+    void operator()(const TensorView<TYPE>& r, const TensorView<TYPE>& x, const GatherMapB& g,
+      const TensorView<TYPE>& scores){
+      forward(r,x,g,scores,nullptr);
+    }
+
+    template<typename TYPE>
+    void operator()(const TensorView<TYPE>& r, const TensorView<TYPE>& alpha, const TensorView<TYPE>& x,
+      const GatherMapB& g, const TensorView<TYPE>& scores){
+      check_edges(alpha,g);
+      forward(r,x,g,scores,&alpha);
+    }
+
+    template<typename TYPE>
+    Ltensor<TYPE> operator()(const TensorView<TYPE>& x, const GatherMapB& g, const TensorView<TYPE>& scores){
+      Ltensor<TYPE> r({g.get_nout(),x.dim(1)},0,x.get_dev());
+      (*this)(r,x,g,scores);
+      return r;
+    }
+
+
+  public: // ---- Backward ---------------------------------------------------------------------------------
+
+
+    // xgrad[g(i,j)]+=alpha_e rgrad[g.target(i)]. Each thread owns a block of columns, since different lists
+    // can scatter to the same source.
+    template<typename TYPE>
+    void back0(const TensorView<TYPE>& xgrad, const TensorView<TYPE>& rgrad, const GatherMapB& g,
+      const TensorView<TYPE>& alpha){
+      check(rgrad,xgrad,g);
+      check_edges(alpha,g);
+      fnlog timer("GatherRowsSoftmax::back0()");
+
+      const int N=g.size();
+      const int* lists=g.arr.arr;
+      TYPE* xg=xgrad.get_arr();
+      const TYPE* rg=rgrad.get_arr();
+      const TYPE* al=alpha.get_arr();
+      const int xgs0=xgrad.strides[0], xgs1=xgrad.strides[1];
+      const int rgs0=rgrad.strides[0], rgs1=rgrad.strides[1];
+      const int als=alpha.strides[0];
+
+      CpuGatherRows::for_column_blocks(xgrad.dim(1),g.n_ops(),[&](const int c0, const int c1){
+	  size_t e=0;
+	  for(int i=0; i<N; i++){
+	    const int* l=lists+g.offset(i);
+	    const int M=g.size_of(i);
+	    const TYPE* rr=rg+((size_t)l[0])*rgs0;
+	    for(int j=0; j<M; j++, e++){
+	      const TYPE a=al[e*als];
+	      TYPE* xx=xg+((size_t)l[1+j])*xgs0;
+	      for(int c=c0; c<c1; c++)
+		xx[c*xgs1]+=a*rr[c*rgs1];
+	    }
+	  }
+	});
+    }
+
+    // sgrad_e+=alpha_e (<rgrad[t],x[s_e]> - sum_k alpha_k <rgrad[t],x[s_k]>), k running over the edges into
+    // the target t of e
+    template<typename TYPE>
+    void back1(const TensorView<TYPE>& sgrad, const TensorView<TYPE>& x, const TensorView<TYPE>& rgrad,
+      const GatherMapB& g, const TensorView<TYPE>& alpha){
+      check(rgrad,x,g);
+      check_edges(sgrad,g);
+      check_edges(alpha,g);
+      fnlog timer("GatherRowsSoftmax::back1()");
+
+      const int C=x.dim(1);
+      TYPE* sg=sgrad.get_arr();
+      const TYPE* xarr=x.get_arr();
+      const TYPE* rg=rgrad.get_arr();
+      const TYPE* al=alpha.get_arr();
+      const int xs0=x.strides[0], xs1=x.strides[1];
+      const int rgs0=rgrad.strides[0], rgs1=rgrad.strides[1];
+      const int sgs=sgrad.strides[0], als=alpha.strides[0];
+
+      auto dot=[&](const int t, const int s){
+	const TYPE* rr=rg+((size_t)t)*rgs0;
+	const TYPE* xx=xarr+((size_t)s)*xs0;
+	TYPE d=0;
+	for(int c=0; c<C; c++) d+=rr[c*rgs1]*xx[c*xs1];
+	return d;
+      };
+
+      if(g.unique_targets()){
+	CpuGatherRows::for_each_list(g,C,[&](const int i, const size_t e0, const int* l, const int M){
+	    if(M==0) return;
+	    thread_local vector<TYPE> dots;
+	    dots.resize(M);
+	    TYPE mean=0;
+	    for(int j=0; j<M; j++){
+	      dots[j]=dot(l[0],l[1+j]);
+	      mean+=al[(e0+j)*als]*dots[j];
+	    }
+	    for(int j=0; j<M; j++)
+	      sg[(e0+j)*sgs]+=al[(e0+j)*als]*(dots[j]-mean);
+	  });
+	return;
+      }
+
+      // the lists of a target share its mean, so it has to be complete before any of them is written
+      vector<TYPE> dots(g.n_ops());
+      vector<TYPE> mean(rgrad.dim(0),0);
+      CpuGatherRows::for_each_list(g,C,[&](const int i, const size_t e0, const int* l, const int M){
+	  for(int j=0; j<M; j++){
+	    dots[e0+j]=dot(l[0],l[1+j]);
+	    mean[l[0]]+=al[(e0+j)*als]*dots[e0+j];
+	  }
+	});
+      CpuGatherRows::for_each_list(g,C,[&](const int i, const size_t e0, const int* l, const int M){
+	  for(int j=0; j<M; j++)
+	    sg[(e0+j)*sgs]+=al[(e0+j)*als]*(dots[e0+j]-mean[l[0]]);
+	});
+    }
+
+
+  private:
+
+    template<typename TYPE>
+    void forward(const TensorView<TYPE>& r, const TensorView<TYPE>& x, const GatherMapB& g,
+      const TensorView<TYPE>& scores, const TensorView<TYPE>* alpha){
+      check(r,x,g);
+      check_edges(scores,g);
+      fnlog timer("GatherRowsSoftmax::operator()");
+
+      const int C=x.dim(1);
+      TYPE* rarr=r.get_arr();
+      const TYPE* xarr=x.get_arr();
+      const TYPE* sc=scores.get_arr();
+      const int ss=scores.strides[0];
+      TYPE* al=alpha?alpha->get_arr():nullptr;
+      const int als=alpha?alpha->strides[0]:0;
+
+      // fold score v into the running maximum mx and normalizer sum, sum==0 meaning no score yet
+      auto fold=[](TYPE& mx, TYPE& sum, const TYPE v){
+	if(sum==0){
+	  mx=v;
+	  sum=1;
+	}else if(v>mx){
+	  sum=sum*std::exp(mx-v)+1;
+	  mx=v;
+	}else sum+=std::exp(v-mx);
+      };
+
+      auto apply=[&](const size_t e0, const int* l, const int M, const TYPE mx, const TYPE sum){
+	thread_local vector<TYPE> w;
+	w.resize(M);
+	for(int j=0; j<M; j++)
+	  w[j]=std::exp(sc[(e0+j)*ss]-mx)/sum;
+	if(al)
+	  for(int j=0; j<M; j++) al[(e0+j)*als]=w[j];
+	CpuGatherRows::gather_one(rarr+((size_t)l[0])*r.strides[0],r.strides[1],l+1,M,
+	  xarr,x.strides[0],x.strides[1],C,[&](const int j){return w[j];});
+      };
+
+      if(g.unique_targets()){
+	CpuGatherRows::for_each_list(g,C,[&](const int i, const size_t e0, const int* l, const int M){
+	    if(M==0) return;
+	    TYPE mx=0, sum=0;
+	    for(int j=0; j<M; j++) fold(mx,sum,sc[(e0+j)*ss]);
+	    apply(e0,l,M,mx,sum);
+	  });
+	return;
+      }
+
+      vector<TYPE> mx(r.dim(0),0);
+      vector<TYPE> sum(r.dim(0),0);
+      CpuGatherRows::for_each_list(g,C,[&](const int i, const size_t e0, const int* l, const int M){
+	  for(int j=0; j<M; j++) fold(mx[l[0]],sum[l[0]],sc[(e0+j)*ss]);
+	});
+      CpuGatherRows::for_each_list(g,C,[&](const int i, const size_t e0, const int* l, const int M){
+	  if(M>0) apply(e0,l,M,mx[l[0]],sum[l[0]]);
+	});
+    }
+
+  };
+
+}
+
+#endif
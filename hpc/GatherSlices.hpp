@@ -22,6 +22,7 @@
 #include "Ltensor.hpp"
 #include "logged_timer.hpp"
 #include "MultiLoop.hpp"
+#include "CpuGatherRows.hpp"
 
 
 namespace cnine{
@@ -74,88 +75,9 @@ namespace cnine{
       CNINE_ASSRT(X.get_dev()==dev);
       
       if(dev==0){
-
-	if(k==1){
-	  int rs0=R.strides[0];
-	  int rs1=R.strides[1];
-
-	  int xs0=X.strides[0];
-	  int xs1=X.strides[1];
-
-	  int d1=X.dims[1];
-
-	  if(rs1==1 & xs1==1){
-	    gmap.for_each([&](const int i, const int j){
-		stdadd(X.get_arr()+j*xs0,X.get_arr()+j*xs0+d1,R.get_arr()+i*rs0);});
-	  }else{
-	    gmap.for_each([&](const int i, const int j){
-		for(int s=0; s<d1; s++)
-		  R.arr[j*rs0+s*rs1]+=X.arr[i*xs0+j*rs1];
-	      });
-	  }
-	  return;
-	}
-
-	if(k==2){
-	  int rs0=R.strides[0];
-	  int rs1=R.strides[1];
-	  int rs2=R.strides[2];
-
-	  int xs0=X.strides[0];
-	  int xs1=X.strides[1];
-	  int xs2=X.strides[2];
-
-	  int d1=X.dims[1];
-	  int d2=X.dims[2];
-
-	  if(rs2==1 & xs2==1){
-	    gmap.for_each([&](const int i, const int j){
-		for(int i1=0; i1<d1; i1++)
-		  stdadd(X.get_arr()+j*xs0+i1*xs1,X.get_arr()+j*xs0+i1*xs1+d2,R.get_arr()+i*rs0+i1*rs1);});
-	  }else{
-	    gmap.for_each([&](const int i, const int j){
-		for(int i1=0; i1<d1; i1++)
-		  for(int i2=0; i2<d2; i2++)
-		    R.arr[j*rs0+i1*rs1+i2*rs2]+=X.arr[i*xs0+i1*xs1+i2*xs2];
-	      });
-	  }
-	  return;
-	}
-
-	if(k==3){
-	  int rs0=R.strides[0];
-	  int rs1=R.strides[1];
-	  int rs2=R.strides[2];
-	  int rs3=R.strides[3];
-
-	  int xs0=X.strides[0];
-	  int xs1=X.strides[1];
-	  int xs2=X.strides[2];
-	  int xs3=X.strides[3];
-
-	  int d1=X.dims[1];
-	  int d2=X.dims[2];
-	  int d3=X.dims[2];
-
-	  if(rs3==1 && xs3==1){
-	    gmap.for_each([&](const int i, const int j){
-		for(int i1=0; i1<d1; i1++)
-		  for(int i2=0; i2<d2; i2++)
-		    stdadd(X.get_arr()+j*xs0+i1*xs1+i2*xs2,X.get_arr()+j*xs0+i1*xs1+i2*xs2+d3,
-		      R.get_arr()+i*rs0+i1*rs1+i2*rs2);});
-	  }else{
-	    gmap.for_each([&](const int i, const int j){
-		for(int i1=0; i1<d1; i1++)
-		  for(int i2=0; i2<d2; i2++)
-		    for(int i3=0; i3<d3; i3++)
-		      R.arr[j*rs0+i1*rs1+i2*rs2+i3*rs3]+=X.arr[i*xs0+i1*xs1+i2*xs2+i3*xs3];
-	      });
-	  }
-	  return;
-	}
-
-	CNINE_UNIMPL();
-
+	fnlog timer("GatherSlices::operator()");
+	gather_cpu(R,X,gmap);
+	return;
       }
       
       if(dev==1){
@@ -169,68 +91,67 @@ namespace cnine{
       }
     }
 
+    // xgrad+=the gradient of the gather with respect to X, i.e., the slices of rgrad along out_dim are
+    // added to the slices of xgrad along in_dim. This runs as a gather along the cached inverse of gmap,
+    // so every slice of xgrad is written by a single task.
     template<typename TYPE>
-    void naive(const TensorView<TYPE>& _R, const TensorView<TYPE>& _X, const GatherMapB& gmap, int in_dim, int out_dim=-1){
+    void scatter_add(const TensorView<TYPE>& xgrad, const TensorView<TYPE>& rgrad, const GatherMapB& gmap, int in_dim, int out_dim=-1){
       if(out_dim==-1) out_dim=in_dim;
+      (*this)(xgrad,rgrad,gmap.inv(),out_dim,in_dim);
+    }
 
-      int m=_R.ndims();
-      CNINE_ASSRT(_X.ndims()==m);
-      CNINE_ASSRT(m<5);
-
-      Gdims xdims(m,fill_raw());
-      GstridesB xstrides(m,fill_raw());
-      xdims[0]=_X.dim(in_dim);
-      xstrides[0]=_X.stride(in_dim);
-      for(int i=0; i<in_dim; i++){
-	xdims[i+1]=_X.dim(i);
-	xstrides[i+1]=_X.stride(i);
-      }
-      for(int i=in_dim+1; i<m; i++){
-	xdims[i]=_X.dim(i);
-	xstrides[i]=_X.stride(i);
-      }
-      TensorView X(_X.arr,xdims,xstrides);
-
-      Gdims rdims(m,fill_raw());
-      GstridesB rstrides(m,fill_raw());
-      rdims[0]=_R.dim(out_dim);
-      rstrides[0]=_R.stride(out_dim);
-      for(int i=0; i<out_dim; i++){
-	rdims[i+1]=_R.dim(i);
-	rstrides[i+1]=_R.stride(i);
-      }
-      for(int i=out_dim+1; i<m; i++){
-	rdims[i]=_R.dim(i);
-	rstrides[i]=_R.stride(i);
-      }
-      TensorView R(_R.arr,rdims,rstrides);
+    template<typename TYPE>
+    void naive(const TensorView<TYPE>& R, const TensorView<TYPE>& X, const GatherMapB& gmap, int in_dim, int out_dim=-1){
+      if(out_dim==-1) out_dim=in_dim;
+      CNINE_ASSRT(X.ndims()==R.ndims());
+      gmap.for_each([&](const int i, const int j){
+	  R.slice(out_dim,i).add(X.slice(in_dim,j));});
+    }
 
-      if(m==1){
-	gmap.for_each([&](const int i0, const int j0){
-	    R.inc(i0,X(j0));});
-      }
 
-      if(m==2){
-	gmap.for_each([&](const int i0, const int j0){
-	    for(int i1=0; i1<X.dim(1); i1++)
-	      R.inc(i0,i1,X(j0,i1));});
-      }
+  private:
 
-      if(m==3){
-	gmap.for_each([&](const int i0, const int j0){
-	    for(int i1=0; i1<X.dim(1); i1++)
-	      for(int i2=0; i2<X.dim(2); i2++)
-		R.inc(i0,i1,i2,X(j0,i1,i2));});
+    // R and X have been co-scrunched, so that the gathered dimension is the first one and the last one has
+    // the smallest stride in R (co_scrunch_except orders the dimensions by the strides of R, not X). The
+    // last dimension is gathered like the columns of a matrix by CpuGatherRows::gather_one, which is a
+    // vectorized add only if it has unit stride in both R and X, and the ones in
+    // between are looped over. The lists of gmap are distributed over the threads by
+    // CpuGatherRows::for_each_list, which only does so if each target has one list, so different threads
+    // write to different slices of R.
+    template<typename TYPE>
+    void gather_cpu(const TensorView<TYPE>& R, const TensorView<TYPE>& X, const GatherMapB& gmap){
+      CNINE_ASSRT(gmap.get_dev()==0);
+      const int k=R.ndims()-1;
+      TYPE* rarr=R.get_arr();
+      const TYPE* xarr=X.get_arr();
+      const int rs0=R.strides[0];
+      const int xs0=X.strides[0];
+
+      if(k==0){
+	CpuGatherRows()(rarr,rs0,1,xarr,xs0,1,1,gmap);
+	return;
       }
 
-      if(m==4){
-	gmap.for_each([&](const int i0, const int j0){
-	    for(int i1=0; i1<X.dim(1); i1++)
-	      for(int i2=0; i2<X.dim(2); i2++)
-		for(int i3=0; i3<X.dim(3); i3++)
-		  R.inc(i0,i1,i2,i3,X(j0,i1,i2,i3));});
+      const int n=R.dims[k];
+      const int rs=R.strides[k];
+      const int xs=X.strides[k];
+      vector<size_t> roffs(1,0);
+      vector<size_t> xoffs(1,0);
+      for(int d=k-1; d>=1; d--){
+	const size_t m=roffs.size();
+	for(int a=1; a<R.dims[d]; a++)
+	  for(size_t b=0; b<m; b++){
+	    roffs.push_back(roffs[b]+(size_t)a*R.strides[d]);
+	    xoffs.push_back(xoffs[b]+(size_t)a*X.strides[d]);
+	  }
       }
+      const size_t nouter=roffs.size();
 
+      CpuGatherRows::for_each_list(gmap,nouter*n,[&](const int i, const size_t e0, const int* l, const int M){
+	  TYPE* t=rarr+((size_t)l[0])*rs0;
+	  for(size_t o=0; o<nouter; o++)
+	    CpuGatherRows::gather_one(t+roffs[o],rs,l+1,M,xarr+xoffs[o],xs0,xs,n);
+	});
     }
 
   };
@@ -17,6 +17,8 @@
 #include "Cnine_base.hpp"
 #include "TensorProgramHelpers.hpp"
 #include "GatherRows.hpp"
+#include "GatherMapAlgebra.hpp"
+#include "ThreadPool.hpp"
 
 
 namespace cnine{
@@ -27,6 +29,16 @@ namespace cnine{
   class TensorProgramPack; 
 
 
+  // Whether OPERATION()(r,x,g) adds G*x to r, where G is the matrix of g in the sense of the gather map
+  // algebra. TensorProgram::optimize only rewrites programs of such operations.
+  template<typename OPERATION>
+  struct is_linear_gather: public std::false_type{};
+
+  template<>
+  struct is_linear_gather<GatherRows>: public std::true_type{};
+
+
+
 
   template<typename OPERATION, typename MAP>
   class TensorProgram{
@@ -42,6 +54,9 @@ namespace cnine{
     vector<VAR> vars;
     vector<INSTR> instructions;
 
+    shared_ptr<TensorProgramPlan> plan;
+    TensorProgramWorkspaces workspaces;
+
 
   public: // ---- Constructors -------------------------------------------------------------------------------
 
@@ -69,15 +84,111 @@ namespace cnine{
 
     int add_var(const Gdims& _dims){
       vars.push_back(VAR(_dims));
+      invalidate();
       return vars.size()-1;
     }
 
     void add_map(MAP* map, const int out=1, const int in=0){
       instructions.push_back(INSTR(map,out,in));
+      invalidate();
     }
 
     void add_map(const MAP& map, const int out=1, const int in=0){
       instructions.push_back(INSTR(map,out,in));
+      invalidate();
+    }
+
+
+  public: // ---- Optimization -------------------------------------------------------------------------------
+
+
+    // Rewrite the program into an equivalent one that makes fewer passes over the data, using the gather map
+    // algebra (so this is only available for GatherMapB and WeightedGatherMapB programs):
+    // 1. consecutive instructions with the same input and output are merged into one with the union of
+    //    their maps,
+    // 2. an intermediate written only by tmp<-g1(in) and read only by a later out<-g2(tmp) is eliminated by
+    //    replacing the two with out<-compose(g2,g1)(in), provided that in is not overwritten in between and
+    //    that the cost model favors it: the composed map must have fewer edges than g1 and g2 together plus
+    //    the rows of tmp, which would have to be cleared. Each of these moves one row of the same width.
+    // Returns the number of rewrites. Programs of nonlinear operations (see is_linear_gather), such as
+    // GatherRowsMean, and maps that are not composable are left unchanged.
+    int optimize(){
+      cnine::fnlog timer("TensorProgram::optimize()");
+      if constexpr(!is_linear_gather<OPERATION>::value) return 0;
+      int nrewrites=0;
+      while(merge_consecutive() || eliminate_intermediate())
+	nrewrites++;
+      if(nrewrites>0) invalidate();
+      return nrewrites;
+    }
+
+
+  private:
+
+    bool merge_consecutive(){
+      for(int i=0; i+1<instructions.size(); i++){
+	auto& a=instructions[i];
+	auto& b=instructions[i+1];
+	if(a.out!=b.out || a.in!=b.in || !composable(*a.map) || !composable(*b.map)) continue;
+	a.map=make_shared<MAP>(map_union(*a.map,*b.map));
+	instructions.erase(instructions.begin()+i+1);
+	return true;
+      }
+      return false;
+    }
+
+    bool eliminate_intermediate(){
+      const int n=instructions.size();
+      for(int v=0; v<vars.size(); v++){
+	if(v==inputvar || v==outputvar) continue;
+	int w=-1, r=-1, nw=0, nr=0;
+	for(int i=0; i<n; i++){
+	  if(instructions[i].out==v){w=i; nw++;}
+	  if(instructions[i].in==v){r=i; nr++;}
+	}
+	if(nw!=1 || nr!=1 || w>=r) continue;
+
+	auto& W=instructions[w];
+	auto& R=instructions[r];
+	if(R.out==W.in || !composable(*W.map) || !composable(*R.map)) continue;
+	bool clobbered=false;
+	for(int i=w+1; i<r; i++)
+	  if(instructions[i].out==W.in) clobbered=true;
+	if(clobbered) continue;
+
+	const size_t fused=compose_size(*R.map,*W.map);
+	const size_t unfused=W.map->n_ops()+R.map->n_ops()+vars[v].dims[0];
+	if(fused>=unfused) continue;
+
+	R.map=make_shared<MAP>(compose(*R.map,*W.map));
+	R.in=W.in;
+	instructions.erase(instructions.begin()+w);
+	return true;
+      }
+      return false;
+    }
+
+
+  public: // ---- Compilation --------------------------------------------------------------------------------
+
+
+    // Compute the lifetimes of the variables, their placement in the workspace and the levels of independent
+    // instructions. This is done automatically on the first call, but has to be redone if vars, instructions,
+    // inputvar or outputvar are changed directly.
+    const TensorProgramPlan& compile(){
+      lock_guard<mutex> lock(workspaces.mx);
+      if(!plan){
+	vector<pair<int,int> > instr;
+	for(auto& p:instructions)
+	  instr.push_back(make_pair(p.out,p.in));
+	plan=make_shared<TensorProgramPlan>(vars,instr,inputvar,outputvar);
+      }
+      return *plan;
+    }
+
+    void invalidate(){
+      plan.reset();
+      workspaces.clear();
     }
 
 
@@ -104,25 +215,31 @@ namespace cnine{
       CNINE_ASSRT(output.ndims()==vars[outputvar].dims.size());
       CNINE_ASSRT(output.get_dims()==scale_last(vars[outputvar].dims,nc));
 
-      vector<Ltensor<TYPE>*> v(vars.size());
-      v[inputvar]=new Ltensor<TYPE>(input);
-      v[outputvar]=new Ltensor<TYPE>(output);
-
-      for(int i=0; i<vars.size(); i++){
-	if(i==inputvar) v[i]=new Ltensor<TYPE>(input);
-	if(i==outputvar) v[i]=new Ltensor<TYPE>(output);
-	if(i!=inputvar && i!=outputvar)
-	  v[i]=new Ltensor<TYPE>(scale_last(vars[i].dims,nc),0,dev);
-      }
-
-      for(auto& p:instructions){
-	CNINE_ASSRT(p.out<vars.size());
-	CNINE_ASSRT(p.in<vars.size());
-	OPERATION()(*v[p.out],*v[p.in],*p.map);
+      // the levels are executed in order, the independent instructions within a level concurrently
+      const TensorProgramPlan& _plan=compile();
+      auto ws=workspaces.take<TYPE>(dev);
+      auto& v=prepare_workspace(*ws,nc).vars;
+      v[inputvar]=&input;
+      v[outputvar]=&output;
+
+      for(int l=0; l<_plan.levels.size(); l++){
+	for(auto i:_plan.zero_at[l])
+	  v[i]->set_zero();
+	const vector<int>& level=_plan.levels[l];
+	if(dev==0 && level.size()>1)
+	  parallel_for(0,level.size(),1,[&](const int j){
+	      auto& p=instructions[level[j]];
+	      OPERATION()(*v[p.out],*v[p.in],*p.map);});
+	else
+	  for(auto j:level){
+	    auto& p=instructions[j];
+	    OPERATION()(*v[p.out],*v[p.in],*p.map);
+	  }
       }
 
-      for(auto p:v) 
-	delete p;
+      v[inputvar]=nullptr;
+      v[outputvar]=nullptr;
+      workspaces.put_back(ws);
     }
 
 
@@ -192,6 +309,30 @@ namespace cnine{
   private: // ------------------------------------------------------------------------------------------------
 
 
+    // The arena of a workspace is only reallocated if more channels are needed than before, and the views 
+    // of the intermediates only have to be rebuilt if nc changes. 
+    template<typename TYPE>
+    TensorProgramWorkspace<TYPE>& prepare_workspace(TensorProgramWorkspace<TYPE>& ws, const int nc){
+      if(ws.nc==nc && ws.vars.size()==vars.size())
+	return ws;
+
+      const size_t n=plan->workspace_size*nc;
+      if(ws.capacity==0 || n>ws.capacity){
+	ws.capacity=std::max(n,(size_t)1);
+	ws.arena=MemArr<TYPE>(ws.capacity,ws.dev);
+      }
+      ws.views.clear();
+      ws.vars.assign(vars.size(),nullptr);
+      ws.views.reserve(vars.size());
+      for(int i=0; i<vars.size(); i++){
+	if(i==inputvar || i==outputvar || plan->first[i]<0) continue;
+	ws.views.push_back(Ltensor<TYPE>(MemArr<TYPE>(ws.arena,plan->offset[i]*nc),scale_last(vars[i].dims,nc)));
+	ws.vars[i]=&ws.views.back();
+      }
+      ws.nc=nc;
+      return ws;
+    }
+
     Gdims scale_last(const Gdims& x, const int nc){
       Gdims R(x);
       R.set_back(R.back()*nc);
@@ -210,6 +351,10 @@ namespace cnine{
       oss<<indent<<"Instructions:"<<endl;
       for(auto& p:instructions)
 	oss<<indent<<"  "<<p<<endl;
+      if(plan){
+	oss<<indent<<"Schedule:"<<endl;
+	oss<<plan->str(indent+"  ");
+      }
       return oss.str();
     }
 
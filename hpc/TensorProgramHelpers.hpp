@@ -15,6 +15,7 @@
 #define _TensorProgramHelpers
 
 #include "Cnine_base.hpp"
+#include "Ltensor.hpp"
 
 
 namespace cnine{
@@ -28,7 +29,7 @@ namespace cnine{
     TensorProgramVariable(){}
 
     TensorProgramVariable(const int _nrows, const int _ncols):
-      dims(_nrows,_ncols){}
+      dims({_nrows,_ncols}){}
 
     TensorProgramVariable(const Gdims& _dims):
       dims(_dims){
@@ -89,6 +90,192 @@ namespace cnine{
 
   };
 
+  // ---- TensorProgramPlan ------------------------------------------------------------------------------------
+  //
+  // The result of compiling a TensorProgram. The instructions are grouped into levels, each instruction being
+  // placed one level after the last earlier instruction that it conflicts with, i.e., that reads its output,
+  // writes its input, or accumulates into the same variable. The instructions within a level are independent.
+  // Each intermediate variable is live from the level of its first use to the level of its last use, and is
+  // given an offset in a shared workspace so that variables with overlapping lifetimes do not overlap in
+  // memory. Sizes and offsets are in units of the number of channels nc, which is only known at run time.
+
+
+  class TensorProgramPlan{
+  public:
+
+    static constexpr size_t alignment=16;
+
+    vector<int> level_of;           // level of each instruction
+    vector<vector<int> > levels;    // instructions in each level
+    vector<vector<int> > zero_at;   // variables to clear at the start of each level
+    vector<int> first;              // level of the first use of each variable, -1 if unused
+    vector<int> last;               // level of the last use of each variable
+    vector<size_t> offset;          // offset of each intermediate variable in the workspace
+    size_t workspace_size=0;
+
+
+    TensorProgramPlan(){}
+
+    TensorProgramPlan(const vector<TensorProgramVariable>& vars, const vector<pair<int,int> >& instr, 
+      const int inputvar, const int outputvar){
+      const int nvars=vars.size();
+      const int ninstr=instr.size();
+
+      level_of.resize(ninstr,0);
+      int nlevels=0;
+      for(int j=0; j<ninstr; j++){
+	const int out=instr[j].first;
+	const int in=instr[j].second;
+	CNINE_ASSRT(out<nvars && in<nvars);
+	for(int i=0; i<j; i++)
+	  if(instr[i].first==in || instr[i].first==out || instr[i].second==out)
+	    level_of[j]=std::max(level_of[j],level_of[i]+1);
+	nlevels=std::max(nlevels,level_of[j]+1);
+      }
+      levels.resize(nlevels);
+      for(int j=0; j<ninstr; j++)
+	levels[level_of[j]].push_back(j);
+
+      first.resize(nvars,-1);
+      last.resize(nvars,-1);
+      for(int j=0; j<ninstr; j++)
+	for(auto v:{instr[j].first,instr[j].second}){
+	  if(first[v]==-1 || level_of[j]<first[v]) first[v]=level_of[j];
+	  last[v]=std::max(last[v],level_of[j]);
+	}
+
+      zero_at.resize(nlevels);
+      for(int v=0; v<nvars; v++)
+	if(v!=inputvar && v!=outputvar && first[v]>=0)
+	  zero_at[first[v]].push_back(v);
+
+      // place the variables greedily in order of decreasing size at the lowest offset where they do not 
+      // collide with an already placed variable that is live at the same time 
+      vector<size_t> size(nvars,0);
+      vector<int> order;
+      for(int v=0; v<nvars; v++)
+	if(v!=inputvar && v!=outputvar && first[v]>=0){
+	  size[v]=(vars[v].dims.asize()+alignment-1)/alignment*alignment;
+	  order.push_back(v);
+	}
+      std::stable_sort(order.begin(),order.end(),[&](const int a, const int b){return size[a]>size[b];});
+
+      offset.resize(nvars,0);
+      vector<int> placed;
+      for(auto v:order){
+	vector<pair<size_t,size_t> > taken;
+	for(auto u:placed)
+	  if(first[u]<=last[v] && first[v]<=last[u])
+	    taken.push_back(make_pair(offset[u],offset[u]+size[u]));
+	std::sort(taken.begin(),taken.end());
+	size_t offs=0;
+	for(auto& p:taken){
+	  if(p.first>=offs+size[v]) break;
+	  offs=std::max(offs,p.second);
+	}
+	offset[v]=offs;
+	workspace_size=std::max(workspace_size,offs+size[v]);
+	placed.push_back(v);
+      }
+    }
+
+
+  public: // ---- I/O ----------------------------------------------------------------------------------------
+
+
+    string str(const string indent="") const{
+      ostringstream oss;
+      for(int l=0; l<levels.size(); l++){
+	oss<<indent<<"Level "<<l<<": instructions";
+	for(auto p:levels[l]) oss<<" "<<p;
+	oss<<endl;
+      }
+      oss<<indent<<"Workspace: "<<workspace_size<<" x nc"<<endl;
+      return oss.str();
+    }
+
+    friend ostream& operator<<(ostream& stream, const TensorProgramPlan& v){
+      stream<<v.str(); return stream;}
+
+  };
+
+
+
+  // ---- TensorProgramWorkspace -------------------------------------------------------------------------------
+  //
+  // The memory of the intermediate variables of a TensorProgram for a given scalar type, device and number
+  // of channels, together with the views of the variables, kept between calls. The workspace only grows, 
+  // so repeated executions of the same program allocate no tensor memory.
+
+
+  class TensorProgramWorkspaceBase{
+  public:
+    virtual ~TensorProgramWorkspaceBase(){}
+  };
+
+
+  template<typename TYPE>
+  class TensorProgramWorkspace: public TensorProgramWorkspaceBase{
+  public:
+
+    int dev=0;
+    int nc=0;
+    size_t capacity=0;
+    MemArr<TYPE> arena;
+    vector<Ltensor<TYPE> > views;          // views of the intermediates in the arena
+    vector<const Ltensor<TYPE>*> vars;     // the tensor of each variable during a call 
+
+    TensorProgramWorkspace(const int _dev):
+      dev(_dev){}
+
+  };
+
+
+  // The workspaces of a TensorProgram. A call takes a workspace out of the pool and puts it back when it
+  // returns, so concurrent calls of the same program each work in their own, and consecutive calls reuse 
+  // the same one. A copy of a program starts with an empty pool. mx also guards compiling the program.
+
+  class TensorProgramWorkspaces{
+  public:
+
+    std::mutex mx;
+    vector<shared_ptr<TensorProgramWorkspaceBase> > idle;
+
+    TensorProgramWorkspaces(){}
+
+    TensorProgramWorkspaces(const TensorProgramWorkspaces& x){}
+
+    TensorProgramWorkspaces& operator=(const TensorProgramWorkspaces& x){
+      clear();
+      return *this;
+    }
+
+    template<typename TYPE>
+    shared_ptr<TensorProgramWorkspace<TYPE> > take(const int dev){
+      lock_guard<mutex> lock(mx);
+      for(int i=idle.size()-1; i>=0; i--){
+	auto ws=dynamic_pointer_cast<TensorProgramWorkspace<TYPE> >(idle[i]);
+	if(ws && ws->dev==dev){
+	  idle.erase(idle.begin()+i);
+	  return ws;
+	}
+      }
+      return make_shared<TensorProgramWorkspace<TYPE> >(dev);
+    }
+
+    void put_back(const shared_ptr<TensorProgramWorkspaceBase>& ws){
+      lock_guard<mutex> lock(mx);
+      idle.push_back(ws);
+    }
+
+    void clear(){
+      lock_guard<mutex> lock(mx);
+      idle.clear();
+    }
+
+  };
+
+
 }
 
 #endif 
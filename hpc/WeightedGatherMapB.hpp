@@ -81,12 +81,12 @@ namespace cnine{
       int i=0;
       for(auto p:sizes){
 	heads[i]=p.first;
-	lengths[i]=p.second;
+	lengths[i]=2*p.second; // each edge is a (source,weight) pair
 	mapping[p.first]=i;
 	i++;
       }
 
-      arr=hlists<int>(heads,lengths);
+      arr=hlists<int>(heads,lengths,fill_noalloc());
       for(int i=0; i<N; i++){
 	push_back(mapping[targets[i]],sources[i],weights[i]);
       }
@@ -185,6 +185,10 @@ namespace cnine{
       return arr.get_tail()/2-arr.size();
     }
 
+    bool is_weighted() const{
+      return true;
+    }
+
     //int offset(const int i) const{
     //return arr.offset(i);
     //}
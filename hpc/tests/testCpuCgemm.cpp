@@ -0,0 +1,74 @@
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "TensorView.hpp"
+#include "CpuCgemm.hpp"
+
+using namespace cnine;
+
+typedef complex<float> cflt;
+
+
+TensorView<cflt> naive(const TensorView<cflt>& x, const TensorView<cflt>& y, const bool hx, const bool hy){
+  int M=hx?x.dims[1]:x.dims[0];
+  int K=hx?x.dims[0]:x.dims[1];
+  int N=hy?y.dims[0]:y.dims[1];
+  TensorView<cflt> R=TensorView<cflt>::zero({M,N});
+  for(int i=0; i<M; i++)
+    for(int j=0; j<N; j++){
+      complex<double> t=0;
+      for(int k=0; k<K; k++){
+	complex<double> a=hx?std::conj(x(k,i)):x(i,k);
+	complex<double> b=hy?std::conj(y(j,k)):y(k,j);
+	t+=a*b;
+      }
+      R.set(i,j,cflt(t));
+    }
+  return R;
+}
+
+float maxdiff(const TensorView<cflt>& x, const TensorView<cflt>& y){
+  float t=0;
+  for(int i=0; i<x.dims[0]; i++)
+    for(int j=0; j<x.dims[1]; j++)
+      t=std::max(t,std::abs(x(i,j)-y(i,j)));
+  return t;
+}
+
+void check(const int M, const int N, const int K){
+  TensorView<cflt> x=TensorView<cflt>::gaussian({M,K});
+  TensorView<cflt> y=TensorView<cflt>::gaussian({K,N});
+  TensorView<cflt> xh=TensorView<cflt>::gaussian({K,M});
+  TensorView<cflt> yh=TensorView<cflt>::gaussian({N,K});
+
+  TensorView<cflt> R=TensorView<cflt>::zero({M,N});
+  R.add_mprod(x,y);
+  TensorView<cflt> RAH=TensorView<cflt>::zero({M,N});
+  view2_of(RAH).add_matmul_AH(view2_of(x),view2_of(yh));
+  TensorView<cflt> RHA=TensorView<cflt>::zero({M,N});
+  view2_of(RHA).add_matmul_HA(view2_of(xh),view2_of(y));
+
+  cout<<"("<<M<<","<<N<<","<<K<<"): "
+      <<maxdiff(R,naive(x,y,false,false))<<" "
+      <<maxdiff(RAH,naive(x,yh,false,true))<<" "
+      <<maxdiff(RHA,naive(xh,y,true,false))<<endl;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  check(3,5,7);
+  check(37,29,300);
+  check(200,150,260);
+
+  int n=512;
+  TensorView<cflt> x=TensorView<cflt>::gaussian({n,n});
+  TensorView<cflt> y=TensorView<cflt>::gaussian({n,n});
+  TensorView<cflt> R=TensorView<cflt>::zero({n,n});
+  auto t0=chrono::system_clock::now();
+  R.add_mprod(x,y);
+  double elapsed=chrono::duration<double>(chrono::system_clock::now()-t0).count();
+  cout<<n<<"x"<<n<<" complex matmul: "<<8.0*n*n*n/elapsed/1e9<<" effective Gflops"<<endl;
+
+}
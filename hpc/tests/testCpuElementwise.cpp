@@ -0,0 +1,78 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "TensorView_functions.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+float reference_error(const TensorView<float>& r, const TensorView<float>& x){
+  float err=0;
+  r.get_dims().for_each_index([&](const Gindex& ix){
+      err=std::max(err,std::abs(r(ix)-x(ix)));});
+  return err;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  // permuted, sliced and high rank layouts
+  TensorView<float> A=TensorView<float>::gaussian({4,5,6,7,3,2});
+  TensorView<float> B=TensorView<float>::gaussian({2,3,7,6,5,4});
+  TensorView<float> Bt=B.permute_indices({5,4,3,2,1,0});
+
+  TensorView<float> C=A.copy();
+  C.add(Bt);
+  TensorView<float> D=A.copy();
+  D.for_each([&](const Gindex& ix, float& v){v+=Bt(ix);});
+  cout<<"add (rank 6, permuted):   "<<reference_error(C,D)<<endl;
+
+  TensorView<float> E({4,5,6,7,3,2},fill_zero());
+  E.set(Bt);
+  cout<<"assign (rank 6, permuted): "<<reference_error(E,Bt)<<endl;
+
+  TensorView<float> F=A.odot(Bt);
+  float err=0;
+  F.get_dims().for_each_index([&](const Gindex& ix){err=std::max(err,std::abs(F(ix)-A(ix)*Bt(ix)));});
+  cout<<"odot:                      "<<err<<endl;
+
+  TensorView<float> G=TensorView<float>::gaussian({10,10});
+  TensorView<float> R({10,10},fill_zero());
+  R.add_ReLU(G.transp(),0.1);
+  err=0;
+  for(int i=0; i<10; i++) for(int j=0; j<10; j++){
+    float x=G(j,i); err=std::max(err,std::abs(R(i,j)-(x>0?x:0.1f*x)));}
+  cout<<"add_ReLU (transposed):     "<<err<<endl;
+
+  // timing
+  for(int nt: {1,4}){
+    nthreads=nt;
+    TensorView<float> X=TensorView<float>::gaussian({2000,2000});
+    TensorView<float> Y=TensorView<float>::gaussian({2000,2000});
+    TensorView<float> Z({2000,2000},fill_zero());
+    TensorView<float> Yt=Y.transp();
+    auto t0=std::chrono::steady_clock::now();
+    for(int i=0; i<20; i++) Z.add(X);
+    auto t1=std::chrono::steady_clock::now();
+    for(int i=0; i<20; i++) Z.add(Yt);
+    auto t2=std::chrono::steady_clock::now();
+    cout<<nt<<" threads: contiguous add "<<std::chrono::duration<double,std::milli>(t1-t0).count()/20<<" ms, ";
+    cout<<"transposed add "<<std::chrono::duration<double,std::milli>(t2-t1).count()/20<<" ms"<<endl;
+  }
+
+}
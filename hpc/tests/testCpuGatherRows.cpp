@@ -0,0 +1,124 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherMapB.hpp"
+#include "GatherRows.hpp"
+#include "Ltensor.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+// Random graph with a few very high degree nodes
+GatherMapB skewed_map(const int n, const int avg_deg){
+  map_of_lists<int,int> edges;
+  uniform_int_distribution<int> node(0,n-1);
+  for(int i=0; i<n; i++){
+    int d=(i%1000==0)?100*avg_deg:avg_deg;
+    for(int j=0; j<d; j++)
+      edges.push_back(i,node(rndGen));
+  }
+  return GatherMapB(edges);
+}
+
+
+float gather_error(const Ltensor<float>& r, const Ltensor<float>& x, const GatherMapB& g){
+  Ltensor<float> R({r.dim(0),r.dim(1)},0,0);
+  g.for_each([&](const int i, const int j){
+      for(int c=0; c<x.dim(1); c++) R.inc(i,c,x(j,c));});
+  float err=0;
+  for(int i=0; i<r.dim(0); i++)
+    for(int c=0; c<r.dim(1); c++)
+      err=std::max(err,std::abs(r(i,c)-R(i,c)));
+  return err;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  GatherMapB g=skewed_map(5000,8);
+  for(int nc: {3,64,1500}){
+    Ltensor<float> x=Ltensor<float>::gaussian({5000,nc});
+    Ltensor<float> r=GatherRows()(x,g);
+    cout<<"ncols="<<nc<<" error: "<<gather_error(r,x,g)<<endl;
+  }
+
+  // transposed input
+  Ltensor<float> X=Ltensor<float>::gaussian({64,5000});
+  Ltensor<float> Xt(X.transp());
+  Ltensor<float> R=GatherRows()(Xt,g);
+  cout<<"transposed error: "<<gather_error(R,Xt,g)<<endl;
+
+  // repeated targets, appended by push_back, are gathered serially
+  GatherMapB gr(5000,5000);
+  uniform_int_distribution<int> node(0,4999);
+  for(int i=0; i<20000; i++)
+    gr.push_back(node(rndGen)%100,{node(rndGen),node(rndGen),node(rndGen)});
+  Ltensor<float> xr=Ltensor<float>::gaussian({5000,64});
+  Ltensor<float> rr=GatherRows()(xr,gr);
+  cout<<"repeated targets: "<<(gr.unique_targets()?"unique":"shared")<<", error: "<<gather_error(rr,xr,gr)<<endl;
+
+  // the same for a fixed-k map
+  FixedkGatherMap fr(20000,3);
+  for(int i=0; i<20000; i++){
+    fr.set_target(i,node(rndGen)%100);
+    for(int j=0; j<3; j++) fr.set(i,j,node(rndGen));
+  }
+  Ltensor<float> rf({5000,64},0,0);
+  GatherRows()(rf,xr,fr);
+  Ltensor<float> Rf({5000,64},0,0);
+  for(int i=0; i<20000; i++)
+    for(int j=0; j<3; j++)
+      for(int c=0; c<64; c++) Rf.inc(fr.target(i),c,xr(fr(i,j),c));
+  cout<<"repeated fixed-k targets error: "<<rf.diff2(Rf)<<endl;
+
+  // the flag is cached on the map, and recomputed after a target changes
+  FixedkGatherMap fu(100,3);
+  for(int i=0; i<100; i++) fu.set_target(i,i);
+  cout<<"fixed-k targets: "<<(fr.unique_targets()?"unique":"shared")<<", "<<(fu.unique_targets()?"unique":"shared");
+  fu.set_target(1,0);
+  cout<<", after set_target: "<<(fu.unique_targets()?"unique":"shared")<<endl;
+  for(auto& p:g.graded()->fixedk_maps)
+    if(p->_unique.unique!=1) cout<<"graded part of a map with unique targets not flagged"<<endl;
+
+  // double, with each index addressing two consecutive rows
+  FixedkGatherMap fc(2,1);
+  fc.in_columns=2;
+  fc.out_columns=2;
+  fc.set_target(0,0); fc.set(0,0,2);
+  fc.set_target(1,2); fc.set(1,0,0);
+  Ltensor<double> xc({4,3},0,0);
+  for(int i=0; i<4; i++)
+    for(int c=0; c<3; c++) xc.set(i,c,3*i+c);
+  Ltensor<double> rc({4,3},0,0);
+  GatherRows()(rc,xc,fc);
+  cout<<"double fixed-k with 2 columns:"<<endl<<rc<<endl;
+
+  // timing
+  GatherMapB G=skewed_map(200000,16);
+  Ltensor<float> x=Ltensor<float>::gaussian({200000,128});
+  for(int nt: {1,4}){
+    nthreads=nt;
+    Ltensor<float> r({200000,128},0,0);
+    auto t0=std::chrono::steady_clock::now();
+    for(int i=0; i<5; i++) GatherRows()(r,x,G);
+    auto t1=std::chrono::steady_clock::now();
+    double ms=std::chrono::duration<double,std::milli>(t1-t0).count()/5;
+    cout<<nt<<" threads: "<<ms<<" ms ("<<G.n_ops()*128.0*sizeof(float)/ms/1e6<<" GB/s gathered)"<<endl;
+  }
+
+}
@@ -0,0 +1,67 @@
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "TensorView.hpp"
+#include "CpuGemm.hpp"
+
+using namespace cnine;
+
+
+template<typename TYPE>
+TensorView<TYPE> naive_mprod(const TensorView<TYPE>& x, const TensorView<TYPE>& y){
+  TensorView<TYPE> R=TensorView<TYPE>::zero({x.dims[0],y.dims[1]});
+  for(int i=0; i<x.dims[0]; i++)
+    for(int j=0; j<y.dims[1]; j++){
+      TYPE t=0;
+      for(int k=0; k<x.dims[1]; k++)
+	t+=x(i,k)*y(k,j);
+      R.set(i,j,t);
+    }
+  return R;
+}
+
+template<typename TYPE>
+void check(const int M, const int N, const int K){
+  TensorView<TYPE> x=TensorView<TYPE>::gaussian({M,K});
+  TensorView<TYPE> y=TensorView<TYPE>::gaussian({K,N});
+  TensorView<TYPE> xt=TensorView<TYPE>::gaussian({K,M}).transp();
+  TensorView<TYPE> yt=TensorView<TYPE>::gaussian({N,K}).transp();
+  xt.set(x);
+  yt.set(y);
+  TensorView<TYPE> R0=naive_mprod(x,y);
+
+  TensorView<TYPE> R1=TensorView<TYPE>::zero({M,N});
+  R1.add_mprod(x,y);
+  TensorView<TYPE> R2=TensorView<TYPE>::zero({M,N});
+  R2.add_mprod(xt,yt);
+  TensorView<TYPE> R3=TensorView<TYPE>::zero({N,M}).transp();
+  R3.add_mprod(x,yt);
+
+  cout<<"("<<M<<","<<N<<","<<K<<"): "<<R1.diff2(R0)<<" "<<R2.diff2(R0)<<" "<<R3.diff2(R0)<<endl;
+}
+
+template<typename TYPE>
+void time(const int n){
+  TensorView<TYPE> x=TensorView<TYPE>::gaussian({n,n});
+  TensorView<TYPE> y=TensorView<TYPE>::gaussian({n,n});
+  TensorView<TYPE> R=TensorView<TYPE>::zero({n,n});
+  auto t0=chrono::system_clock::now();
+  R.add_mprod(x,y);
+  double elapsed=chrono::duration<double>(chrono::system_clock::now()-t0).count();
+  cout<<n<<"x"<<n<<" matmul: "<<2.0*n*n*n/elapsed/1e9<<" Gflops"<<endl;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  check<float>(3,5,7);
+  check<float>(37,29,300);
+  check<float>(251,263,517);
+  check<double>(37,29,300);
+  check<double>(251,263,517);
+
+  time<float>(1024);
+  time<double>(1024);
+
+}
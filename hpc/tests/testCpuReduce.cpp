@@ -0,0 +1,85 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "TensorView_functions.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  TensorView<double> A=TensorView<double>::gaussian({7,5,300,4});
+  TensorView<double> At=A.permute_indices({2,0,3,1});
+
+  double sum=0, nrm=0, mx=-1e9, mn=1e9, mabs=0;
+  A.get_dims().for_each_index([&](const Gindex& ix){
+      double v=A(ix);
+      sum+=v; nrm+=v*v;
+      mx=std::max(mx,v); mn=std::min(mn,v); mabs=std::max(mabs,std::abs(v));});
+
+  cout<<"sum:     "<<At.sum()-sum<<endl;
+  cout<<"norm2:   "<<At.norm2()-nrm<<endl;
+  cout<<"max:     "<<At.max()-mx<<endl;
+  cout<<"min:     "<<At.min()-mn<<endl;
+  cout<<"max_abs: "<<At.max_abs()-mabs<<endl;
+  cout<<"inp:     "<<At.copy().inp(At)-nrm<<endl;
+  cout<<"diff2:   "<<A.diff2(A.copy())<<endl;
+
+  // axis reductions, with the reduced dimension innermost and outermost
+  for(int d: {0,3}){
+    TensorView<double> S=A.sum(d);
+    TensorView<double> M=A.max(d);
+    double err=0;
+    S.get_dims().for_each_index([&](const Gindex& ix){
+	double s=0, m=-1e9;
+	for(int i=0; i<A.dims[d]; i++){
+	  double v=(d==0)?A(i,ix[0],ix[1],ix[2]):A(ix[0],ix[1],ix[2],i);
+	  s+=v; m=std::max(m,v);
+	}
+	err=std::max(err,std::abs(S(ix)-s)+std::abs(M(ix)-m));});
+    cout<<"sum/max along "<<d<<": "<<err<<endl;
+  }
+
+  // deterministic mode gives the same bits for any number of threads
+  session.set_deterministic_reductions();
+  TensorView<float> X=TensorView<float>::gaussian({3000,1000});
+  nthreads=1;
+  float s1=X.sum();
+  nthreads=4;
+  float s4=X.sum();
+  cout<<"deterministic: "<<(s1==s4?"yes":"no")<<endl;
+  session.set_deterministic_reductions(false);
+
+  // timing
+  TensorView<float> Xt=X.transp();
+  for(int nt: {1,4}){
+    nthreads=nt;
+    float t=0;
+    auto t0=std::chrono::steady_clock::now();
+    for(int i=0; i<20; i++) t+=X.sum();
+    auto t1=std::chrono::steady_clock::now();
+    for(int i=0; i<20; i++) t+=Xt.sum();
+    auto t2=std::chrono::steady_clock::now();
+    for(int i=0; i<20; i++) t+=X.inp(Xt.transp());
+    auto t3=std::chrono::steady_clock::now();
+    cout<<nt<<" threads: sum "<<std::chrono::duration<double,std::milli>(t1-t0).count()/20<<" ms, ";
+    cout<<"transposed sum "<<std::chrono::duration<double,std::milli>(t2-t1).count()/20<<" ms, ";
+    cout<<"inp "<<std::chrono::duration<double,std::milli>(t3-t2).count()/20<<" ms"<<endl;
+  }
+
+}
@@ -0,0 +1,155 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherLinear.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+GatherMapB random_map(const int n_out, const int n_in, const int deg, const bool shuffled){
+  map_of_lists<int,int> edges;
+  uniform_int_distribution<int> node(0,n_in-1);
+  for(int i=0; i<n_out; i++)
+    for(int j=0; j<deg; j++)
+      edges.push_back(i,node(rndGen));
+  GatherMapB g(edges);
+  if(!shuffled) g.reorder_for_locality();
+  return g;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  // D=48 gathers then multiplies, D=3 multiplies first, and C=D=64 gathers in tiles
+  for(auto shuffled: {false,true})
+    for(auto [C,D]: vector<pair<int,int> >({{40,48},{40,3},{64,64}})){
+      const int n=3000;
+      GatherMapB g=random_map(n,n,6,shuffled);
+      Ltensor<float> x=Ltensor<float>::gaussian({n,C});
+      Ltensor<float> W=Ltensor<float>::gaussian({C,D});
+
+      Ltensor<float> r=GatherLinear()(x,g,W);
+      Ltensor<float> t=GatherRows()(x,g);
+      Ltensor<float> rr({n,D},0,0);
+      rr.add_mprod(t,W);
+      cout<<"C="<<C<<" D="<<D<<(shuffled?" shuffled":"")<<" forward: "<<r.diff2(rr)/rr.norm2();
+
+      // the host kernel, which GatherLinear does not pick for every size
+      Ltensor<float> rt({n,D},0,0);
+      CpuGatherLinear<float>::forward(rt.get_arr(),rt.strides[0],rt.strides[1],x.get_arr(),n,x.strides[0],x.strides[1],
+	W.get_arr(),W.strides[0],W.strides[1],C,D,g);
+      cout<<", kernel: "<<rt.diff2(rr)/rr.norm2();
+
+      Ltensor<float> rg=Ltensor<float>::gaussian({n,D});
+      Ltensor<float> xg({n,C},0,0);
+      GatherLinear().back0(xg,rg,g,W);
+      Ltensor<float> xgr({n,C},0,0);
+      xgr.add_mprod(GatherRows()(rg,g.inv()),W.transp());
+      cout<<", back0: "<<xg.diff2(xgr)/xgr.norm2();
+
+      Ltensor<float> Wg({C,D},0,0);
+      GatherLinear().back1(Wg,x,rg,g);
+      Ltensor<float> Wgr({C,D},0,0);
+      Wgr.add_mprod(t.transp(),rg);
+      cout<<", back1: "<<Wg.diff2(Wgr)/Wgr.norm2()<<endl;
+    }
+
+  // a map whose targets have several lists, which the tiles scatter serially
+  {
+    const int n=1000, C=64;
+    GatherMapB g=random_map(n,n,6,true);
+    GatherMapB gs(n,n);
+    for(int i=0; i<g.size(); i++){
+      vector<int> src;
+      for(int j=0; j<g.size_of(i); j++) src.push_back(g(i,j));
+      gs.push_back(g.target(i),vector<int>(src.begin(),src.begin()+2));
+      gs.push_back(g.target(i),vector<int>(src.begin()+2,src.end()));
+    }
+    Ltensor<float> x=Ltensor<float>::gaussian({n,C});
+    Ltensor<float> W=Ltensor<float>::gaussian({C,C});
+    Ltensor<float> r=GatherLinear()(x,gs,W);
+    Ltensor<float> rr({n,C},0,0);
+    rr.add_mprod(GatherRows()(x,g),W);
+    cout<<"split lists forward: "<<r.diff2(rr)/rr.norm2()<<endl;
+  }
+
+  // double precision through a weighted map, which goes through GatherRows::weighted
+  {
+    const int n=500, C=20, D=30;
+    vector<int> sources, targets;
+    vector<float> weights;
+    uniform_int_distribution<int> node(0,n-1);
+    uniform_real_distribution<float> u(-1,1);
+    for(int i=0; i<n; i++)
+      for(int j=0; j<4; j++){
+	targets.push_back(i);
+	sources.push_back(node(rndGen));
+	weights.push_back(u(rndGen));
+      }
+    WeightedGatherMapB g(sources,targets,weights);
+    TensorView<double> x=TensorView<double>::gaussian({n,C});
+    TensorView<double> W=TensorView<double>::gaussian({C,D});
+    TensorView<double> t({n,C},0,0);
+    for(int e=0; e<sources.size(); e++)
+      for(int c=0; c<C; c++)
+	t.inc(targets[e],c,weights[e]*x(sources[e],c));
+    TensorView<double> r({n,D},0,0);
+    GatherLinear()(r,x,g,W);
+    TensorView<double> rr({n,D},0,0);
+    rr.add_mprod(t,W);
+    TensorView<double> rg=TensorView<double>::gaussian({n,D});
+    TensorView<double> Wg({C,D},0,0);
+    GatherLinear().back1(Wg,x,rg,g);
+    TensorView<double> Wgr({C,D},0,0);
+    Wgr.add_mprod(t.transp(),rg);
+    cout<<"double weighted forward: "<<r.diff2(rr)/rr.norm2()<<", back1: "<<Wg.diff2(Wgr)/Wgr.norm2()<<endl;
+  }
+
+  // timing, best of 5 runs. With D<C GatherLinear multiplies first. With D=C it gathers in tiles when
+  // built with AVX2 (e.g. WITH_NATIVE_ARCH), and otherwise runs GatherRows followed by add_mprod.
+  const int n=100000, C=128;
+  for(int D: {128,8}){
+    GatherMapB g=random_map(n,n,16,true);
+    Ltensor<float> x=Ltensor<float>::gaussian({n,C});
+    Ltensor<float> W=Ltensor<float>::gaussian({C,D});
+    Ltensor<float> rg=Ltensor<float>::gaussian({n,D});
+    Ltensor<float> r({n,D},0,0);
+    Ltensor<float> Wg({C,D},0,0);
+    g.inv();
+    auto ms=[](const auto& t0, const auto& t1){return std::chrono::duration<double,std::milli>(t1-t0).count();};
+    double unfused=1e9, fused=1e9, unfused1=1e9, fused1=1e9;
+    for(int i=0; i<5; i++){
+      auto t0=std::chrono::steady_clock::now();
+      {Ltensor<float> t=GatherRows()(x,g); r.add_mprod(t,W);}
+      auto t1=std::chrono::steady_clock::now();
+      GatherLinear()(r,x,g,W);
+      auto t2=std::chrono::steady_clock::now();
+      {Ltensor<float> t=GatherRows()(x,g); Wg.add_mprod(t.transp(),rg);}
+      auto t3=std::chrono::steady_clock::now();
+      GatherLinear().back1(Wg,x,rg,g);
+      auto t4=std::chrono::steady_clock::now();
+      unfused=std::min(unfused,ms(t0,t1));
+      fused=std::min(fused,ms(t1,t2));
+      unfused1=std::min(unfused1,ms(t2,t3));
+      fused1=std::min(fused1,ms(t3,t4));
+    }
+    cout<<"C="<<C<<" D="<<D<<": forward: gather then mprod "<<unfused<<" ms, GatherLinear "<<fused<<" ms";
+    cout<<", back1: gather then mprod "<<unfused1<<" ms, GatherLinear "<<fused1<<" ms"<<endl;
+  }
+
+}
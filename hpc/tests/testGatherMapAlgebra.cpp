@@ -0,0 +1,160 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherMapAlgebra.hpp"
+#include "GatherRows.hpp"
+#include "GatherRowsReduce.hpp"
+#include "TensorProgram.hpp"
+
+using namespace cnine;
+
+
+Ltensor<float> dense(const GatherMapB& g, const int n, const int m){
+  Ltensor<float> R({n,m},0,0);
+  g.for_each([&](const int t, const int s){R.inc(t,s,1);});
+  return R;
+}
+
+Ltensor<float> dense(const WeightedGatherMapB& g, const int n, const int m){
+  Ltensor<float> R({n,m},0,0);
+  g.for_each([&](const int t, const int s, const float w){R.inc(t,s,w);});
+  return R;
+}
+
+Ltensor<float> product(const Ltensor<float>& A, const Ltensor<float>& B){
+  Ltensor<float> R({A.dim(0),B.dim(1)},0,0);
+  for(int i=0; i<A.dim(0); i++)
+    for(int k=0; k<A.dim(1); k++)
+      for(int j=0; j<B.dim(1); j++)
+	R.inc(i,j,A(i,k)*B(k,j));
+  return R;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  GatherMapB g1=GatherMapB::random(30,50,0.2);
+  GatherMapB g2=GatherMapB::random(20,30,0.2);
+  GatherMapB g3=GatherMapB::random(20,30,0.1);
+  auto D1=dense(g1,30,50);
+  auto D2=dense(g2,20,30);
+  auto D3=dense(g3,20,30);
+  Ltensor<float> D23=dense(g2,20,30);
+  D23.add(D3);
+
+  GatherMapB c=compose(g2,g1);
+  cout<<"compose: "<<dense(c,20,50).diff2(product(D2,D1))<<" ("<<c.n_ops()<<" edges)"<<endl;
+  auto m=merge_duplicates(c);
+  cout<<"merge_duplicates: "<<dense(m,20,50).diff2(product(D2,D1))<<" ("<<m.n_ops()<<" edges)"<<endl;
+  auto wc=compose(merge_duplicates(g2),merge_duplicates(g1));
+  cout<<"weighted compose: "<<dense(wc,20,50).diff2(product(D2,D1))<<endl;
+  cout<<"union: "<<dense(map_union(g2,g3),20,30).diff2(D23)<<endl;
+  cout<<"weighted union: "<<dense(map_union(merge_duplicates(g2),merge_duplicates(g3)),20,30).diff2(D23)<<endl;
+  cout<<"transpose: "<<dense(transpose(g1),50,30).diff2(D1.transp())<<endl;
+  cout<<"weighted transpose: "<<dense(transpose(m),50,20).diff2(dense(m,20,50).transp())<<endl;
+
+  // maps with more than one list for the same target
+  GatherMapB a(2,4);
+  a.push_back(0,vector<int>({1}));
+  a.push_back(0,vector<int>({2}));
+  a.push_back(1,vector<int>({3}));
+  GatherMapB b(4,2);
+  b.push_back(2,vector<int>({0}));
+  b.push_back(3,vector<int>({1}));
+  b.push_back(2,vector<int>({1}));
+  auto Da=dense(a,2,4);
+  auto Db=dense(b,4,2);
+  cout<<"compose repeated targets: "<<dense(compose(b,a),4,4).diff2(product(Db,Da))<<endl;
+  cout<<"weighted compose repeated targets: "<<
+    dense(compose(merge_duplicates(b),merge_duplicates(a)),4,4).diff2(product(Db,Da))<<endl;
+  Ltensor<float> Daa=dense(a,2,4);
+  Daa.add(Da);
+  cout<<"union repeated targets: "<<dense(map_union(a,a),2,4).diff2(Daa)<<endl;
+  cout<<"weighted union repeated targets: "<<
+    dense(map_union(merge_duplicates(a),merge_duplicates(a)),2,4).diff2(Daa)<<endl;
+  cout<<"merge_duplicates repeated targets: "<<dense(merge_duplicates(b),4,2).diff2(Db)<<endl;
+
+  // in -> tmp -> out, where the first map just permutes the rows, so optimize() collapses the two
+  const int n=2000, nc=4;
+  map_of_lists<int,int> e1, e2;
+  vector<int> perm(n);
+  for(int i=0; i<n; i++) perm[i]=i;
+  std::shuffle(perm.begin(),perm.end(),rndGen);
+  uniform_int_distribution<int> src(0,n-1);
+  for(int i=0; i<n; i++){
+    e1.push_back(i,perm[i]);
+    for(int j=0; j<3; j++) e2.push_back(i,src(rndGen));
+  }
+  TensorProgram<GatherRows,GatherMapB> prog(dims(n,1),dims(n,1));
+  int tmp=prog.add_var(dims(n,1));
+  prog.add_map(GatherMapB(e1),tmp,0);
+  prog.add_map(GatherMapB(e2),1,tmp);
+
+  Ltensor<float> x=Ltensor<float>::gaussian({n,nc});
+  Ltensor<float> r0({n,nc},0,0);
+  prog(r0,x);
+  int nrewrites=prog.optimize();
+  Ltensor<float> r1({n,nc},0,0);
+  prog(r1,x);
+  cout<<"optimize: "<<nrewrites<<" rewrites, "<<prog.instructions.size()<<" instruction(s), error "<<r1.diff2(r0)<<endl;
+
+  // here the two reads of tmp are merged, but eliminating tmp would multiply the number of edges
+  TensorProgram<GatherRows,GatherMapB> prog2(dims(20,1),dims(50,1));
+  int tmp2=prog2.add_var(dims(30,1));
+  prog2.add_map(g1,tmp2,0);
+  prog2.add_map(g2,1,tmp2);
+  prog2.add_map(g3,1,tmp2);
+  cout<<"optimize: "<<prog2.optimize()<<" rewrites, "<<prog2.instructions.size()<<" instruction(s)"<<endl;
+
+  // the same with repeated targets in both maps
+  TensorProgram<GatherRows,GatherMapB> prog5(dims(4,1),dims(4,1));
+  int tmp5=prog5.add_var(dims(2,1));
+  prog5.add_map(a,tmp5,0);
+  prog5.add_map(b,1,tmp5);
+  Ltensor<float> x5=Ltensor<float>::gaussian({4,nc});
+  Ltensor<float> r7({4,nc},0,0);
+  prog5(r7,x5);
+  nrewrites=prog5.optimize();
+  Ltensor<float> r8({4,nc},0,0);
+  prog5(r8,x5);
+  cout<<"optimize repeated targets: "<<nrewrites<<" rewrites, error "<<r8.diff2(r7)<<endl;
+
+  // weighted maps in a GatherMapB program are not composable, so nothing is rewritten
+  TensorProgram<GatherRows,GatherMapB> prog3(dims(n,1),dims(n,1));
+  int tmp3=prog3.add_var(dims(n,1));
+  prog3.add_map(new WeightedGatherMapB(merge_duplicates(GatherMapB(e1))),tmp3,0);
+  prog3.add_map(new WeightedGatherMapB(merge_duplicates(GatherMapB(e2))),1,tmp3);
+  Ltensor<float> r3({n,nc},0,0);
+  prog3(r3,x);
+  nrewrites=prog3.optimize();
+  Ltensor<float> r4({n,nc},0,0);
+  prog3(r4,x);
+  cout<<"optimize weighted maps: "<<nrewrites<<" rewrites, error "<<r4.diff2(r0)<<endl;
+
+  // neither are programs of nonlinear operations
+  TensorProgram<GatherRowsMean,GatherMapB> prog4(dims(n,1),dims(n,1));
+  int tmp4=prog4.add_var(dims(n,1));
+  prog4.add_map(GatherMapB(e1),tmp4,0);
+  prog4.add_map(GatherMapB(e2),1,tmp4);
+  Ltensor<float> r5({n,nc},0,0);
+  prog4(r5,x);
+  nrewrites=prog4.optimize();
+  Ltensor<float> r6({n,nc},0,0);
+  prog4(r6,x);
+  cout<<"optimize mean: "<<nrewrites<<" rewrites, error "<<r6.diff2(r5)<<endl;
+
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherMapB.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  const int n=1000000;
+  const int E=10000000;
+  vector<int> sources(E);
+  vector<int> targets(E);
+  uniform_int_distribution<int> node(0,n-1);
+  for(int i=0; i<E; i++){
+    sources[i]=node(rndGen);
+    targets[i]=node(rndGen);
+  }
+
+  auto t0=std::chrono::steady_clock::now();
+  GatherMapB g(sources,targets);
+  auto t1=std::chrono::steady_clock::now();
+  map_of_lists<int,int> edges;
+  for(int i=0; i<E; i++)
+    edges.push_back(targets[i],sources[i]);
+  GatherMapB g0(edges);
+  auto t2=std::chrono::steady_clock::now();
+
+  // map_of_lists is unordered, so compare list by list through the targets
+  vector<int> list_of(n,-1);
+  for(int i=0; i<g.size(); i++) list_of[g.target(i)]=i;
+  bool same=(g.size()==g0.size() && g.n_ops()==g0.n_ops());
+  for(int i=0; i<g0.size() && same; i++){
+    const int k=list_of[g0.target(i)];
+    same=(k>=0 && g.size_of(k)==g0.size_of(i));
+    for(int j=0; j<g0.size_of(i) && same; j++)
+      same=(g(k,j)==g0(i,j));
+  }
+  cout<<"edge list constructor matches map_of_lists: "<<(same?"yes":"no")<<endl;
+  cout<<"counting sort: "<<std::chrono::duration<double,std::milli>(t1-t0).count()<<" ms, ";
+  cout<<"map_of_lists: "<<std::chrono::duration<double,std::milli>(t2-t1).count()<<" ms"<<endl;
+
+  Ltensor<int> M({5,2},0,0);
+  vector<int> s={1,4,0,9,3}, t={3,2,8,4,3};
+  for(int i=0; i<5; i++){
+    M.set(i,0,s[i]);
+    M.set(i,1,t[i]);
+  }
+  cout<<GatherMapB(M)<<endl;
+  cout<<GatherMapB(M).inv()<<endl;
+
+}
@@ -0,0 +1,122 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherMapPack.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session;
+
+  const int n=2000;
+  const int E=20000;
+  vector<int> sources(E);
+  vector<int> targets(E);
+  uniform_int_distribution<int> node(0,n-1);
+  for(int i=0; i<E; i++){
+    sources[i]=node(rndGen);
+    targets[i]=node(rndGen);
+  }
+
+  GatherMapB g(sources,targets);
+  g.inv();
+  auto f=make_shared<FixedkGatherMap>(5,3);
+  for(int i=0; i<5; i++){
+    f->set_target(i,2*i);
+    for(int j=0; j<3; j++) f->set(i,j,i+j);
+  }
+  g.fixedk_maps.push_back(f);
+
+  g.save("gathermap.bin",true);
+  auto g1=GatherMapB::load("gathermap.bin");
+  auto g2=GatherMapB::map_file("gathermap.bin");
+  cout<<"loaded map equal:   "<<(g1->str()==g.str() && g1->inv().str()==g.inv().str())<<endl;
+  cout<<"mapped map equal:   "<<(g2->str()==g.str() && g2->inv().str()==g.inv().str())<<endl;
+  cout<<"fixed-k submaps equal: "<<(g1->fixedk_maps[0]->str()==f->str() && g2->fixedk_maps[0]->str()==f->str())<<endl;
+
+  GatherMapPack pack({make_shared<GatherMapB>(g),make_shared<GatherMapB>(GatherMapB::random(n,n,0.001))});
+  pack.save("gathermap_pack.bin");
+  auto p1=GatherMapPack::load("gathermap_pack.bin");
+  auto p2=GatherMapPack::map_file("gathermap_pack.bin");
+  cout<<"loaded pack equal:  "<<(p1->str()==pack.str() && p1->out_offsets==pack.out_offsets)<<endl;
+  cout<<"mapped pack equal:  "<<(p2->str()==pack.str() && p2->out_offsets==pack.out_offsets)<<endl;
+
+  auto t0=std::chrono::steady_clock::now();
+  auto c1=GatherMapB::cached(".",sources,targets);
+  auto t1=std::chrono::steady_clock::now();
+  auto c2=GatherMapB::cached(".",sources,targets);
+  auto t2=std::chrono::steady_clock::now();
+  cout<<"cached map equal:   "<<(c1->str()==g.str() && c2->str()==g.str())<<endl;
+  cout<<"build and save: "<<std::chrono::duration<double,std::milli>(t1-t0).count()<<" ms, ";
+  cout<<"map from cache: "<<std::chrono::duration<double,std::milli>(t2-t1).count()<<" ms"<<endl;
+
+  // a different edge list stored under this edge list's cache name is rebuilt, not returned
+  vector<int> sources2(sources);
+  std::swap(sources2[0],sources2[1]);
+  GatherMapB(sources2,targets).save(GatherMapB::cache_path(".",sources,targets));
+  auto c3=GatherMapB::cached(".",sources,targets);
+  cout<<"stale cache entry rebuilt: "<<(c3->str()==g.str())<<endl;
+
+  auto r=GatherMapB::map_file("gathermap.bin",MappedFile::readonly);
+  r->push_back(n,{1,2,3});
+  cout<<"push_back on mapped map: "<<(r->size()==g.size()+1 && (*r)(g.size(),2)==3)<<endl;
+  try{
+    GatherMapB::map_file("gathermap.bin",MappedFile::readonly)->set(0,0,1);
+  }catch(std::runtime_error& e){
+    cout<<"set on readonly map rejected"<<endl;
+  }
+
+  {
+    std::fstream fs("gathermap.bin",std::ios::in|std::ios::out|std::ios::binary);
+    GatherMapFileHeader header;
+    fs.read(reinterpret_cast<char*>(&header),sizeof(header));
+    header.arr_offset=1ull<<40;
+    fs.seekp(0);
+    fs.write(reinterpret_cast<const char*>(&header),sizeof(header));
+  }
+  try{
+    GatherMapB::map_file("gathermap.bin");
+  }catch(std::runtime_error& e){
+    cout<<"bad array offset rejected"<<endl;
+  }
+
+  // a directory entry running past the end of the array, which load() catches as well
+  g.save("gathermap.bin");
+  {
+    std::fstream fs("gathermap.bin",std::ios::in|std::ios::out|std::ios::binary);
+    GatherMapFileHeader header;
+    fs.read(reinterpret_cast<char*>(&header),sizeof(header));
+    const int len=header.tail+1;
+    fs.seekp(header.dir_offset+sizeof(int));
+    fs.write(reinterpret_cast<const char*>(&len),sizeof(len));
+  }
+  try{
+    GatherMapB::load("gathermap.bin");
+  }catch(std::runtime_error& e){
+    cout<<"bad directory rejected by load"<<endl;
+  }
+  try{
+    GatherMapB::map_file("gathermap.bin");
+  }catch(std::runtime_error& e){
+    cout<<"bad directory rejected by map_file"<<endl;
+  }
+
+  std::remove("gathermap.bin");
+  std::remove("gathermap_pack.bin");
+  std::remove(GatherMapB::cache_path(".",sources,targets).c_str());
+}
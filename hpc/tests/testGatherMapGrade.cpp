@@ -0,0 +1,76 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherRows.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+// Lists of length 1..6, with a few long ones
+GatherMapB low_degree_map(const int n){
+  vector<int> sources, targets;
+  uniform_int_distribution<int> node(0,n-1);
+  uniform_int_distribution<int> degree(1,6);
+  for(int i=0; i<n; i++){
+    int d=(i%500==0)?200:degree(rndGen);
+    for(int j=0; j<d; j++){
+      sources.push_back(node(rndGen));
+      targets.push_back(i);
+    }
+  }
+  return GatherMapB(sources,targets);
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session;
+
+  GatherMapB g=low_degree_map(3000);
+  const GatherMapB& gg=*g.graded();
+  cout<<"buckets:";
+  for(auto& p:gg.fixedk_maps) cout<<" k="<<p->getk()<<"("<<p->getn()<<")";
+  cout<<", residual lists: "<<gg.size()<<endl;
+
+  // copies start with their own cache, and rewriting the lists drops it
+  GatherMapB g1=g;
+  g1.reorder_for_locality();
+  cout<<"copy shares graded(): "<<(g1.graded().get()==g.graded().get())<<endl;
+  cout<<"graded() of a map with no fixed-k part: "<<GatherMapB::random(50,50,0.5).graded().get()<<endl;
+
+  for(int nc: {1,7,64}){
+    Ltensor<float> x=Ltensor<float>::gaussian({3000,nc});
+    Ltensor<float> r=GatherRows()(x,g);
+    Ltensor<float> R({3000,nc},0,0);
+    CpuGatherRows()(R.get_arr(),nc,1,x.get_arr(),nc,1,nc,g);
+    cout<<"ncols="<<nc<<" error: "<<r.diff2(R)<<endl;
+  }
+
+  // timing
+  const int n=500000, nc=32;
+  GatherMapB G=low_degree_map(n);
+  G.graded();
+  Ltensor<float> x=Ltensor<float>::gaussian({n,nc});
+  Ltensor<float> r({n,nc},0,0);
+  auto t0=std::chrono::steady_clock::now();
+  for(int i=0; i<5; i++) CpuGatherRows()(r.get_arr(),nc,1,x.get_arr(),nc,1,nc,G);
+  auto t1=std::chrono::steady_clock::now();
+  for(int i=0; i<5; i++) GatherRows()(r,x,G);
+  auto t2=std::chrono::steady_clock::now();
+  cout<<"generic: "<<std::chrono::duration<double,std::milli>(t1-t0).count()/5<<" ms, ";
+  cout<<"fixed-k buckets: "<<std::chrono::duration<double,std::milli>(t2-t1).count()/5<<" ms"<<endl;
+
+}
@@ -0,0 +1,113 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherMapB.hpp"
+#include "GatherRows.hpp"
+#include "Ltensor.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+// n x n grid graph with randomly permuted node labels
+GatherMapB shuffled_grid(const int n){
+  vector<int> label(n*n);
+  for(int i=0; i<n*n; i++) label[i]=i;
+  std::shuffle(label.begin(),label.end(),rndGen);
+  map_of_lists<int,int> edges;
+  for(int i=0; i<n; i++)
+    for(int j=0; j<n; j++){
+      int t=label[i*n+j];
+      edges.push_back(t,t);
+      if(i>0) edges.push_back(t,label[(i-1)*n+j]);
+      if(i<n-1) edges.push_back(t,label[(i+1)*n+j]);
+      if(j>0) edges.push_back(t,label[i*n+j-1]);
+      if(j<n-1) edges.push_back(t,label[i*n+j+1]);
+    }
+  return GatherMapB(edges);
+}
+
+
+template<typename FN>
+double time_ms(FN fn, const int niter=10){
+  auto t0=std::chrono::steady_clock::now();
+  for(int i=0; i<niter; i++) fn();
+  auto t1=std::chrono::steady_clock::now();
+  return std::chrono::duration<double,std::milli>(t1-t0).count()/niter;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session;
+
+  const int n=800;
+  const int nc=32;
+  GatherMapB g=shuffled_grid(n);
+  Ltensor<float> x=Ltensor<float>::gaussian({n*n,nc});
+  Ltensor<float> r0=GatherRows()(x,g);
+
+  // reordering the lists only
+  GatherMapB g1=g;
+  g1.reorder_for_locality();
+  Ltensor<float> r1=GatherRows()(x,g1);
+  cout<<"reordered lists error:    "<<r1.diff2(r0)<<endl;
+
+  // reordering the lists and permuting the rows of x
+  vector<int> perm=g.source_permutation();
+  GatherMapB g2=g.relabel(perm);
+  Ltensor<float> x2=GatherRows()(x,GatherMapB::permutation(perm));
+  Ltensor<float> r2=GatherRows()(x2,g2);
+  cout<<"relabeled sources error:  "<<r2.diff2(r0)<<endl;
+
+  // permuting the rows of the output as well
+  vector<int> operm=g.target_permutation();
+  GatherMapB g3=g.relabel(perm,operm);
+  Ltensor<float> r3=GatherRows()(x2,g3);
+  Ltensor<float> r3u=GatherRows()(r3,GatherMapB::permutation(GatherMapB::inverse_permutation(operm)));
+  cout<<"relabeled targets error:  "<<r3u.diff2(r0)<<endl;
+
+  // a target with several lists appears once in the permutation
+  GatherMapB gr(200,200);
+  uniform_int_distribution<int> node(0,199);
+  for(int i=0; i<600; i++)
+    gr.push_back(node(rndGen),{node(rndGen),node(rndGen)});
+  vector<int> rperm=gr.target_permutation();
+  vector<int> sorted_perm(rperm);
+  std::sort(sorted_perm.begin(),sorted_perm.end());
+  bool is_perm=sorted_perm.size()==200;
+  for(int i=0; i<sorted_perm.size(); i++) is_perm=is_perm && sorted_perm[i]==i;
+  vector<int> sperm=gr.source_permutation();
+  Ltensor<float> xr=Ltensor<float>::gaussian({200,nc});
+  Ltensor<float> xr2=GatherRows()(xr,GatherMapB::permutation(sperm));
+  Ltensor<float> rr=GatherRows()(GatherRows()(xr2,gr.relabel(sperm,rperm)),
+    GatherMapB::permutation(GatherMapB::inverse_permutation(rperm)));
+  cout<<"repeated targets permutation: "<<is_perm<<", error: "<<rr.diff2(GatherRows()(xr,gr))<<endl;
+
+  // the lists of a weighted map hold (source, weight) pairs, so it cannot be reordered
+  WeightedGatherMapB gw({0,1,2},{1,0,1},{0.5,1.0,2.0});
+  int nrejected=0;
+  try{gw.reorder_for_locality();}catch(const std::runtime_error& e){nrejected++;}
+  try{gw.relabel(vector<int>({2,1,0}));}catch(const std::runtime_error& e){nrejected++;}
+  try{gw.source_permutation();}catch(const std::runtime_error& e){nrejected++;}
+  cout<<"weighted map rejected: "<<nrejected<<" of 3"<<endl;
+
+  Ltensor<float> r({n*n,nc},0,0);
+  cout<<"original map:        "<<time_ms([&](){GatherRows()(r,x,g);})<<" ms"<<endl;
+  cout<<"reordered lists:     "<<time_ms([&](){GatherRows()(r,x,g1);})<<" ms"<<endl;
+  cout<<"relabeled sources:   "<<time_ms([&](){GatherRows()(r,x2,g2);})<<" ms"<<endl;
+  cout<<"relabeled both:      "<<time_ms([&](){GatherRows()(r,x2,g3);})<<" ms"<<endl;
+
+}
@@ -0,0 +1,148 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherRowsReduce.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  const int n_out=500, n_in=700, C=24;
+  map_of_lists<int,int> edges;
+  uniform_int_distribution<int> node(0,n_in-1);
+  uniform_int_distribution<int> degree(0,12);
+  for(int i=0; i<n_out; i++){
+    int d=degree(rndGen);
+    for(int j=0; j<d; j++)
+      edges.push_back(i,node(rndGen));
+  }
+  GatherMapB g(edges);
+  const int E=g.n_ops();
+
+  Ltensor<float> x=Ltensor<float>::gaussian({n_in,C});
+  Ltensor<float> rg=Ltensor<float>::gaussian({n_out,C});
+  Ltensor<float> scores=Ltensor<float>::gaussian({E});
+
+  // naive references, with the edges numbered in the order of g.for_each
+  vector<vector<int> > src(n_out);
+  vector<int> order;
+  g.for_each([&](const int t, const int s){
+      if(order.size()==0 || order.back()!=t) order.push_back(t);
+      src[t].push_back(s);});
+
+  Ltensor<float> max_r({n_out,C},0,0);
+  Ltensor<float> max_xg({n_in,C},0,0);
+  Ltensor<float> mean_r({n_out,C},0,0);
+  Ltensor<float> mean_xg({n_in,C},0,0);
+  Ltensor<float> sm_r({n_out,C},0,0);
+  Ltensor<float> sm_xg({n_in,C},0,0);
+  Ltensor<float> sm_sg({E},0,0);
+  int e=0;
+  for(auto t:order){
+    const int M=src[t].size();
+    float mx=scores(e);
+    for(int j=1; j<M; j++) mx=std::max(mx,scores(e+j));
+    float Z=0;
+    for(int j=0; j<M; j++) Z+=exp(scores(e+j)-mx);
+    for(int c=0; c<C; c++){
+      int best=src[t][0];
+      for(auto s:src[t]){
+	if(x(s,c)>x(best,c)) best=s;
+	mean_r.inc(t,c,x(s,c)/M);
+	mean_xg.inc(s,c,rg(t,c)/M);
+      }
+      max_r.set(t,c,x(best,c));
+      max_xg.inc(best,c,rg(t,c));
+    }
+    float mean_dot=0;
+    vector<float> dots(M,0);
+    for(int j=0; j<M; j++){
+      const float a=exp(scores(e+j)-mx)/Z;
+      const int s=src[t][j];
+      for(int c=0; c<C; c++){
+	sm_r.inc(t,c,a*x(s,c));
+	sm_xg.inc(s,c,a*rg(t,c));
+	dots[j]+=rg(t,c)*x(s,c);
+      }
+      mean_dot+=a*dots[j];
+    }
+    for(int j=0; j<M; j++)
+      sm_sg.set(e+j,exp(scores(e+j)-mx)/Z*(dots[j]-mean_dot));
+    e+=M;
+  }
+
+  auto [r,argmax]=GatherRowsMax()(x,g);
+  Ltensor<float> xg({n_in,C},0,0);
+  GatherRowsMax().back(xg,rg,argmax);
+  cout<<"max forward: "<<r.diff2(max_r)<<", backward: "<<xg.diff2(max_xg)<<endl;
+
+  r=GatherRowsMean()(x,g);
+  xg.set_zero();
+  GatherRowsMean().back(xg,rg,g);
+  cout<<"mean forward: "<<r.diff2(mean_r)<<", backward: "<<xg.diff2(mean_xg)<<endl;
+
+  // the same with the list of each target split in two, so the mean is over the lists of a target
+  GatherMapB gs(n_out,n_in);
+  for(auto t:order){
+    const int h=src[t].size()/2;
+    gs.push_back(t,vector<int>(src[t].begin(),src[t].begin()+h));
+    gs.push_back(t,vector<int>(src[t].begin()+h,src[t].end()));
+  }
+  r=GatherRowsMean()(x,gs);
+  xg.set_zero();
+  GatherRowsMean().back(xg,rg,gs);
+  cout<<"mean over split lists forward: "<<r.diff2(mean_r)<<", backward: "<<xg.diff2(mean_xg)<<endl;
+
+  // in double precision, from several threads at once on a map whose degrees are not cached yet
+  GatherMapB g2(edges);
+  TensorView<double> xd=TensorView<double>::gaussian({n_in,C});
+  TensorView<double> mean_rd({n_out,C},0,0);
+  for(auto t:order)
+    for(auto s:src[t])
+      for(int c=0; c<C; c++)
+	mean_rd.inc(t,c,xd(s,c)/src[t].size());
+  vector<TensorView<double> > rd;
+  for(int i=0; i<4; i++) rd.push_back(TensorView<double>({n_out,C},0,0));
+  vector<std::thread> threads;
+  for(int i=0; i<4; i++)
+    threads.emplace_back([&,i](){GatherRowsMean()(rd[i],xd,g2);});
+  for(auto& p:threads) p.join();
+  double err=0;
+  for(int i=0; i<4; i++) err=std::max(err,rd[i].diff2(mean_rd));
+  cout<<"mean in double from 4 threads: "<<err<<endl;
+
+  Ltensor<float> alpha({E},0,0);
+  r.set_zero();
+  GatherRowsSoftmax()(r,alpha,x,g,scores);
+  xg.set_zero();
+  GatherRowsSoftmax().back0(xg,rg,g,alpha);
+  Ltensor<float> sg({E},0,0);
+  GatherRowsSoftmax().back1(sg,x,rg,g,alpha);
+  cout<<"softmax forward: "<<r.diff2(sm_r)<<", back0: "<<xg.diff2(sm_xg)<<", back1: "<<sg.diff2(sm_sg)<<endl;
+
+  // on the split lists the softmax is still normalized over all edges into each target
+  alpha.set_zero();
+  r.set_zero();
+  GatherRowsSoftmax()(r,alpha,x,gs,scores);
+  xg.set_zero();
+  GatherRowsSoftmax().back0(xg,rg,gs,alpha);
+  sg.set_zero();
+  GatherRowsSoftmax().back1(sg,x,rg,gs,alpha);
+  cout<<"softmax over split lists forward: "<<r.diff2(sm_r)<<", back0: "<<xg.diff2(sm_xg)<<", back1: "<<sg.diff2(sm_sg)<<endl;
+
+}
@@ -33,5 +33,23 @@ int main(int argc, char** argv){
   auto C=GatherSlices().naive(A,g,1);
   cout<<C<<endl;
 
+  GatherMapB h=GatherMapB::random(40,30,0.2);
+  TensorView<float> D(dims(30,6,5,7),4,0);
+  for(int d=0; d<4; d++){
+    Gdims edims=D.get_dims();
+    edims[d]=30;
+    TensorView<float> E(edims,4,0);
+    auto F=GatherSlices()(E,h,d,3);
+    auto G=GatherSlices().naive(E,h,d,3);
+    Ltensor<float> Eg(E.get_dims(),0,0);
+    Ltensor<float> Egn(E.get_dims(),0,0);
+    GatherSlices().scatter_add(Eg,F,h,d,3);
+    h.inv().for_each([&](const int i, const int j){
+	Egn.slice(d,i).add(F.slice(3,j));});
+    cout<<"rank 4, dim "<<d<<": gather "<<F.diff2(G)<<", scatter_add "<<Eg.diff2(Egn)<<endl;
+  }
+  TensorView<float> T(D.transp(1,3));
+  cout<<"transposed: "<<GatherSlices()(T,h,0,2).diff2(GatherSlices().naive(T,h,0,2))<<endl;
+
 
 }
@@ -0,0 +1,80 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "GatherMapB.hpp"
+#include "GatherRows.hpp"
+#include "TensorProgram.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  const int n=50, nc=8;
+  GatherMapB g1=GatherMapB::random(30,n,0.2);
+  GatherMapB g2=GatherMapB::random(40,n,0.2);
+  GatherMapB g3=GatherMapB::random(20,30,0.2);
+  GatherMapB g4=GatherMapB::random(20,40,0.2);
+  GatherMapB g5=GatherMapB::random(60,20,0.2);
+  GatherMapB g6=GatherMapB::random(25,60,0.2);
+
+  // in -> a -> c, in -> b -> c, then c -> d -> out. a and b are independent, and d can reuse their memory.
+  TensorProgram<GatherRows,GatherMapB> prog(dims(25,1),dims(n,1));
+  int a=prog.add_var(dims(30,1));
+  int b=prog.add_var(dims(40,1));
+  int c=prog.add_var(dims(20,1));
+  int d=prog.add_var(dims(60,1));
+  prog.add_map(g1,a,0);
+  prog.add_map(g2,b,0);
+  prog.add_map(g3,c,a);
+  prog.add_map(g4,c,b);
+  prog.add_map(g5,d,c);
+  prog.add_map(g6,1,d);
+  prog.compile();
+  cout<<prog.plan->str()<<endl;
+
+  Ltensor<float> x=Ltensor<float>::gaussian({n,nc});
+  Ltensor<float> A({30,nc},0,0), B({40,nc},0,0), C({20,nc},0,0), D({60,nc},0,0), R({25,nc},0,0);
+  GatherRows()(A,x,g1);
+  GatherRows()(B,x,g2);
+  GatherRows()(C,A,g3);
+  GatherRows()(C,B,g4);
+  GatherRows()(D,C,g5);
+  GatherRows()(R,D,g6);
+
+  for(int i=0; i<3; i++){
+    Ltensor<float> r({25,nc},0,0);
+    prog(r,x);
+    auto& ws=dynamic_cast<TensorProgramWorkspace<float>&>(*prog.workspaces.idle.back());
+    cout<<"run "<<i<<": error "<<r.diff2(R)<<", workspace at "<<ws.arena.blob.get()<<endl;
+  }
+
+  // concurrent calls of the same program
+  vector<float> errors(4);
+  vector<thread> threads;
+  for(int t=0; t<4; t++)
+    threads.push_back(thread([&,t](){
+	  for(int i=0; i<20; i++){
+	    Ltensor<float> r({25,nc},0,0);
+	    prog(r,x);
+	    errors[t]+=r.diff2(R);
+	  }
+	}));
+  for(auto& p:threads) p.join();
+  cout<<"concurrent runs: error "<<errors[0]+errors[1]+errors[2]+errors[3]<<", "<<prog.workspaces.idle.size()<<" workspace(s)"<<endl;
+
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "WeightedGatherMapB.hpp"
+#include "GatherRows.hpp"
+#include "Ltensor.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session;
+
+  // edges (source -> target, weight), three of them into target 1
+  vector<int> sources({0,1,2,3,0});
+  vector<int> targets({1,0,1,2,1});
+  vector<float> weights({0.5,1.0,2.0,-1.0,4.0});
+  WeightedGatherMapB g(sources,targets,weights);
+
+  // every list holds exactly the edges into its target, as (source, weight) pairs
+  int nedges=0;
+  for(int i=0; i<g.size(); i++) nedges+=g.size_of(i);
+  cout<<"lists: "<<g.size()<<", edges: "<<nedges<<" of "<<sources.size()<<endl;
+  for(int i=0; i<g.size(); i++){
+    cout<<g.target(i)<<" <-";
+    for(int j=0; j<g.size_of(i); j++)
+      cout<<" ("<<g.src(i,j)<<","<<g.weight(i,j)<<")";
+    cout<<endl;
+  }
+
+  // the same map applied to a tensor
+  Ltensor<float> x({4,2},0,0);
+  for(int i=0; i<4; i++)
+    for(int c=0; c<2; c++) x.set(i,c,10*i+c);
+  Ltensor<float> r({3,2},0,0);
+  GatherRows().weighted(r,x,g);
+  Ltensor<float> R({3,2},0,0);
+  for(int e=0; e<sources.size(); e++)
+    for(int c=0; c<2; c++) R.inc(targets[e],c,weights[e]*x(sources[e],c));
+  cout<<"gather error: "<<r.diff2(R)<<endl;
+
+}
@@ -0,0 +1,373 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+
+#ifndef _CnineArenaMemoryManager
+#define _CnineArenaMemoryManager
+
+#include "Cnine_base.hpp"
+#include "MemoryManager.hpp"
+#include "MemPolicy.hpp"
+
+
+namespace cnine{
+
+
+  // ---- ArenaMemoryManager -----------------------------------------------------------------------------------
+  //
+  // Manages one large arena on the host or the GPU with a two level segregated fit (TLSF) scheme.
+  // Free blocks are kept in lists indexed by (fl,sl), where fl is the position of the leading bit of the
+  // block size and sl the next sl_bits bits, and two levels of bitmaps record which lists are non-empty.
+  // malloc finds a large enough free block with a couple of bit scans, and free coalesces a block with
+  // its physical neighbors through the prev/next links, so both are O(1) apart from the hash lookup of
+  // the freed pointer. Block metadata lives on the host, so the arena itself is never touched.
+  // A host arena starts on a granularity (128 byte) boundary, or a huge page boundary and advised to use
+  // huge pages if default_mem_policy asks for huge pages at its size, so every block is 128-byte aligned.
+  // malloc_aligned serves larger alignments by over-allocating the block.
+
+
+  class ArenaMemoryManager: public MemoryManager{
+  public:
+
+    static constexpr int sl_bits=4;
+    static constexpr int sl_count=1<<sl_bits;
+    static constexpr int fl_count=64;
+
+
+    class Block{
+    public:
+      size_t beg;
+      size_t size;
+      bool used=false;
+      int prev_phys=-1;
+      int next_phys=-1;
+      int prev_free=-1;
+      int next_free=-1;
+    };
+
+
+    size_t _size;
+    int dev=0;
+    void* arr=nullptr;
+    size_t granularity=128;
+    string name;
+
+    mutable mutex mx;
+    mutable vector<Block> blocks;
+    mutable vector<int> spare_blocks;
+    mutable std::unordered_map<size_t,int> used_blocks;
+
+    mutable uint64_t fl_bitmap=0;
+    mutable uint32_t sl_bitmap[fl_count];
+    mutable int free_heads[fl_count][sl_count];
+
+    mutable size_t used_bytes=0;
+    mutable size_t peak_bytes=0;
+    mutable size_t n_free_blocks=0;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    ArenaMemoryManager(const size_t __size, const int _dev=0):
+      ArenaMemoryManager("",__size,_dev){}
+
+    ArenaMemoryManager(const string _name, const size_t __size, const int _dev=0):
+      dev(_dev), name(_name){
+      _size=(__size/granularity)*granularity;
+      if(_size==0) _size=granularity;
+      if(dev==0){
+	const bool huge=default_mem_policy.huge(_size);
+	if(posix_memalign(&arr,huge?MemPolicy::huge_page_size:granularity,_size)!=0)
+	  throw std::runtime_error("Memory manager "+name+": cannot allocate arena of "+to_string(_size)+" bytes.");
+	if(huge) MemPolicy::advise_huge(arr,_size);
+      }
+      if(dev==1) CUDA_SAFE(cudaMalloc((void **)&arr,_size));
+      reset();
+    }
+
+    ~ArenaMemoryManager(){
+      if(dev==0 && arr) {::free(arr);}
+      if(dev==1 && arr) {CUDA_SAFE(cudaFree(arr));}
+    }
+
+
+  public: // ---- Copying ------------------------------------------------------------------------------------
+
+
+    ArenaMemoryManager(const ArenaMemoryManager& x)=delete;
+    ArenaMemoryManager& operator=(const ArenaMemoryManager& x)=delete;
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    size_t size() const{
+      return _size;
+    }
+
+    size_t in_use() const{
+      lock_guard<mutex> lock(mx);
+      return used_bytes;
+    }
+
+    size_t peak() const{
+      lock_guard<mutex> lock(mx);
+      return peak_bytes;
+    }
+
+    size_t largest_free_block() const{
+      lock_guard<mutex> lock(mx);
+      return largest_free_block_nolock();
+    }
+
+    // 1-(largest free block)/(total free space); 0 means the free space is contiguous
+    double fragmentation() const{
+      lock_guard<mutex> lock(mx);
+      return fragmentation_nolock();
+    }
+
+
+    template<typename TYPE>
+    TYPE* alloc(const size_t n) const{
+      return static_cast<TYPE*>(malloc(n*sizeof(TYPE)));
+    }
+
+
+    void* malloc(const size_t _n) const{
+      return allocate(_n,granularity);
+    }
+
+    void* malloc_aligned(const size_t _n, const size_t alignment) const{
+      if(alignment<=granularity) return malloc(_n);
+      return allocate(_n+alignment-granularity,alignment);
+    }
+
+    // Allocate a block of at least _n bytes and return the first address in it that is a multiple of 
+    // alignment. The block is found again in free by that address.
+    void* allocate(const size_t _n, const size_t alignment) const{
+      lock_guard<mutex> lock(mx);
+      size_t n=std::max(granularity,((_n+granularity-1)/granularity)*granularity);
+
+      int fl,sl;
+      mapping_search(n,fl,sl);
+      int b=find_suitable(fl,sl);
+      if(b<0)
+	throw std::runtime_error("Memory manager "+name+": out of space (requested "+to_string(_n)+" bytes).");
+      remove_free(b);
+
+      if(blocks[b].size>=n+granularity){
+	int r=new_block();
+	Block& rem=blocks[r];
+	Block& block=blocks[b];
+	rem.beg=block.beg+n;
+	rem.size=block.size-n;
+	rem.prev_phys=b;
+	rem.next_phys=block.next_phys;
+	if(block.next_phys>=0) blocks[block.next_phys].prev_phys=r;
+	block.next_phys=r;
+	block.size=n;
+	insert_free(r);
+      }
+
+      Block& block=blocks[b];
+      block.used=true;
+      const size_t base=reinterpret_cast<size_t>(arr);
+      const size_t offs=((base+block.beg+alignment-1)/alignment)*alignment-base;
+      used_blocks[offs]=b;
+      used_bytes+=block.size;
+      peak_bytes=std::max(peak_bytes,used_bytes);
+      return static_cast<void*>(static_cast<char*>(arr)+offs);
+    }
+
+
+    void free(void* p) const{
+      lock_guard<mutex> lock(mx);
+      size_t offs=static_cast<char*>(p)-static_cast<char*>(arr);
+      auto it=used_blocks.find(offs);
+      if(it==used_blocks.end())
+	throw std::runtime_error("Memory manager "+name+" in free(void*): not a managed object or already deallocated.");
+      int b=it->second;
+      used_blocks.erase(it);
+
+      blocks[b].used=false;
+      used_bytes-=blocks[b].size;
+
+      int next=blocks[b].next_phys;
+      if(next>=0 && !blocks[next].used){
+	remove_free(next);
+	absorb_next(b);
+      }
+
+      int prev=blocks[b].prev_phys;
+      if(prev>=0 && !blocks[prev].used){
+	remove_free(prev);
+	absorb_next(prev);
+	b=prev;
+      }
+
+      insert_free(b);
+    }
+
+
+    void clear() const{
+      lock_guard<mutex> lock(mx);
+      reset();
+    }
+
+
+  private: // ---- TLSF internals ---------------------------------------------------------------------------
+
+
+    // the _nolock functions expect the caller to hold mx
+
+    size_t largest_free_block_nolock() const{
+      if(fl_bitmap==0) return 0;
+      int fl=63-__builtin_clzll(fl_bitmap);
+      int sl=31-__builtin_clz(sl_bitmap[fl]);
+      size_t t=0;
+      for(int i=free_heads[fl][sl]; i>=0; i=blocks[i].next_free)
+	t=std::max(t,blocks[i].size);
+      return t;
+    }
+
+    double fragmentation_nolock() const{
+      size_t free_bytes=_size-used_bytes;
+      if(free_bytes==0) return 0;
+      return 1.0-((double)largest_free_block_nolock())/free_bytes;
+    }
+
+
+    void reset() const{
+      blocks.clear();
+      spare_blocks.clear();
+      used_blocks.clear();
+      fl_bitmap=0;
+      for(int i=0; i<fl_count; i++){
+	sl_bitmap[i]=0;
+	for(int j=0; j<sl_count; j++)
+	  free_heads[i][j]=-1;
+      }
+      used_bytes=0;
+      n_free_blocks=0;
+      int b=new_block();
+      blocks[b].beg=0;
+      blocks[b].size=_size;
+      insert_free(b);
+    }
+
+    // The list that a free block of size n belongs to
+    static void mapping_insert(const size_t n, int& fl, int& sl){
+      if(n<(size_t)sl_count){
+	fl=0;
+	sl=n;
+	return;
+      }
+      int t=63-__builtin_clzll(n);
+      sl=(n>>(t-sl_bits))-sl_count;
+      fl=t-sl_bits+1;
+    }
+
+    // The first list whose blocks are all guaranteed to be at least n bytes
+    static void mapping_search(size_t n, int& fl, int& sl){
+      if(n>=(size_t)sl_count)
+	n+=(((size_t)1)<<(63-__builtin_clzll(n)-sl_bits))-1;
+      mapping_insert(n,fl,sl);
+    }
+
+    int find_suitable(int fl, int sl) const{
+      if(fl>=fl_count) return -1;
+      uint32_t sl_map=sl_bitmap[fl]&(~0u<<sl);
+      if(sl_map==0){
+	uint64_t fl_map=(fl+1<64)?(fl_bitmap&(~0ull<<(fl+1))):0;
+	if(fl_map==0) return -1;
+	fl=__builtin_ctzll(fl_map);
+	sl_map=sl_bitmap[fl];
+      }
+      sl=__builtin_ctz(sl_map);
+      return free_heads[fl][sl];
+    }
+
+    void insert_free(const int b) const{
+      int fl,sl;
+      mapping_insert(blocks[b].size,fl,sl);
+      Block& block=blocks[b];
+      block.prev_free=-1;
+      block.next_free=free_heads[fl][sl];
+      if(block.next_free>=0) blocks[block.next_free].prev_free=b;
+      free_heads[fl][sl]=b;
+      fl_bitmap|=(1ull<<fl);
+      sl_bitmap[fl]|=(1u<<sl);
+      n_free_blocks++;
+    }
+
+    void remove_free(const int b) const{
+      int fl,sl;
+      mapping_insert(blocks[b].size,fl,sl);
+      Block& block=blocks[b];
+      if(block.prev_free>=0) blocks[block.prev_free].next_free=block.next_free;
+      else free_heads[fl][sl]=block.next_free;
+      if(block.next_free>=0) blocks[block.next_free].prev_free=block.prev_free;
+      if(free_heads[fl][sl]<0){
+	sl_bitmap[fl]&=~(1u<<sl);
+	if(sl_bitmap[fl]==0) fl_bitmap&=~(1ull<<fl);
+      }
+      block.prev_free=-1;
+      block.next_free=-1;
+      n_free_blocks--;
+    }
+
+    // Merge the physically next block into b and recycle its record
+    void absorb_next(const int b) const{
+      int next=blocks[b].next_phys;
+      blocks[b].size+=blocks[next].size;
+      blocks[b].next_phys=blocks[next].next_phys;
+      if(blocks[next].next_phys>=0) blocks[blocks[next].next_phys].prev_phys=b;
+      spare_blocks.push_back(next);
+    }
+
+    int new_block() const{
+      if(spare_blocks.size()>0){
+	int b=spare_blocks.back();
+	spare_blocks.pop_back();
+	blocks[b]=Block();
+	return b;
+      }
+      blocks.push_back(Block());
+      return blocks.size()-1;
+    }
+
+
+  public: // ---- I/O ---------------------------------------------------------------------------------------
+
+
+    string str(const string indent="") const{
+      lock_guard<mutex> lock(mx);
+      ostringstream oss;
+      oss<<indent<<"Arena memory manager "<<name<<" (size="<<size()<<",dev="<<dev<<"):"<<endl;
+      oss<<indent<<"  In use:         "<<used_bytes<<" bytes in "<<used_blocks.size()<<" blocks"<<endl;
+      oss<<indent<<"  Peak use:       "<<peak_bytes<<" bytes"<<endl;
+      oss<<indent<<"  Free:           "<<_size-used_bytes<<" bytes in "<<n_free_blocks<<" blocks"<<endl;
+      oss<<indent<<"  Fragmentation:  "<<fragmentation_nolock()<<endl;
+      return oss.str();
+    }
+
+    friend ostream& operator<<(ostream& stream, const ArenaMemoryManager& x){
+      stream<<x.str(); return stream;
+    }
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+
+#ifndef _CnineBifstream
+#define _CnineBifstream
+
+#include "Cnine_base.hpp"
+#include <fstream>
+
+
+namespace cnine{
+
+
+  // ---- Bifstream --------------------------------------------------------------------------------------------
+  //
+  // Binary input file stream. Tensor payloads are read in chunks of at most chunk_bytes bytes, and
+  // checksums stored in the file are verified if checksums is set.
+
+
+  class Bifstream: public ifstream{
+  public:
+
+    string filename;
+    bool checksums=true;
+    size_t chunk_bytes=((size_t)1)<<26;
+
+
+    Bifstream(const string _filename):
+      ifstream(_filename,ios::binary),
+      filename(_filename){
+      if(!is_open()) CNINE_ERROR("Cannot open "+filename+" for reading");
+    }
+
+
+  public: // ---- Reading ------------------------------------------------------------------------------------
+
+
+    template<typename TYPE>
+    TYPE get(){
+      TYPE x;
+      read(x);
+      return x;
+    }
+
+    template<typename TYPE>
+    Bifstream& read(TYPE& x){
+      ifstream::read(reinterpret_cast<char*>(&x),sizeof(TYPE));
+      check();
+      return *this;
+    }
+
+    template<typename TYPE>
+    Bifstream& read_array(TYPE* p, const size_t n){
+      ifstream::read(reinterpret_cast<char*>(p),n*sizeof(TYPE));
+      check();
+      return *this;
+    }
+
+    string get_string(){
+      size_t n=get<uint64_t>();
+      string x(n,' ');
+      ifstream::read(&x[0],n);
+      check();
+      return x;
+    }
+
+    // Skip forward to the next multiple of n bytes
+    Bifstream& align(const size_t n){
+      size_t p=pos();
+      seekg(((p+n-1)/n)*n);
+      return *this;
+    }
+
+    size_t pos(){
+      return tellg();
+    }
+
+    // Number of bytes between the current position and the end of the file
+    size_t remaining(){
+      const size_t p=pos();
+      seekg(0,ios::end);
+      const size_t end=tellg();
+      seekg(p);
+      check();
+      return end>p?end-p:0;
+    }
+
+    void check(){
+      if(fail()) CNINE_ERROR("Error reading from "+filename+" (unexpected end of file?)");
+    }
+
+  };
+
+}
+
+#endif
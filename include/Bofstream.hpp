@@ -0,0 +1,88 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+
+#ifndef _CnineBofstream
+#define _CnineBofstream
+
+#include "Cnine_base.hpp"
+#include <fstream>
+
+
+namespace cnine{
+
+
+  // ---- Bofstream --------------------------------------------------------------------------------------------
+  //
+  // Binary output file stream. Tensors serialized to it are written in chunks of at most chunk_bytes bytes,
+  // with a checksum of each payload if checksums is set.
+
+
+  class Bofstream: public ofstream{
+  public:
+
+    string filename;
+    bool checksums=false;
+    size_t chunk_bytes=((size_t)1)<<26;
+
+
+    Bofstream(const string _filename, const bool _checksums=false):
+      ofstream(_filename,ios::binary|ios::trunc),
+      filename(_filename),
+      checksums(_checksums){
+      if(!is_open()) CNINE_ERROR("Cannot open "+filename+" for writing");
+    }
+
+
+  public: // ---- Writing ------------------------------------------------------------------------------------
+
+
+    template<typename TYPE>
+    Bofstream& write(const TYPE& x){
+      ofstream::write(reinterpret_cast<const char*>(&x),sizeof(TYPE));
+      return *this;
+    }
+
+    template<typename TYPE>
+    Bofstream& write_array(const TYPE* p, const size_t n){
+      ofstream::write(reinterpret_cast<const char*>(p),n*sizeof(TYPE));
+      return *this;
+    }
+
+    Bofstream& write_string(const string& x){
+      write<uint64_t>(x.size());
+      ofstream::write(x.data(),x.size());
+      return *this;
+    }
+
+    // Pad the file with zeros up to the next multiple of n bytes
+    Bofstream& align(const size_t n){
+      size_t p=pos();
+      size_t q=((p+n-1)/n)*n;
+      for(size_t i=p; i<q; i++) put(0);
+      return *this;
+    }
+
+    size_t pos(){
+      return tellp();
+    }
+
+    void check(){
+      if(fail()) CNINE_ERROR("Error writing to "+filename);
+    }
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+
+#ifndef _CnineCachingMemoryManager
+#define _CnineCachingMemoryManager
+
+#include "Cnine_base.hpp"
+#include "MemoryManager.hpp"
+#include "MemPolicy.hpp"
+#include <atomic>
+
+
+namespace cnine{
+
+
+  // ---- CachingMemoryManager ---------------------------------------------------------------------------------
+  //
+  // A thread safe caching allocator for host memory. Requests are rounded up to size classes (four per
+  // octave, so at most 25% of a block is wasted) and freed blocks are kept on per-thread free lists for
+  // reuse by later requests of the same class. When a thread's list overflows, or the thread exits, its
+  // blocks go to a global free list shared by all threads. The total number of cached bytes is capped at
+  // max_cached; blocks freed beyond the cap, and requests larger than the largest size class, go straight
+  // back to the system. trim() returns all cached blocks, those of every thread, to the system. Every block
+  // is 64-byte aligned. Blocks requested with a larger alignment by malloc_aligned are not cached, and huge
+  // page aligned ones are advised to use huge pages.
+
+
+  class CachingMemoryManager: public MemoryManager{
+  public:
+
+    static constexpr size_t header_size=64;
+    static constexpr size_t alignment=64;
+    static constexpr size_t min_class_size=64;
+    static constexpr int nclasses=4*25; // up to 2^31 bytes
+
+
+    class Header{
+    public:
+      size_t size;
+      int size_class;
+      const CachingMemoryManager* owner;
+      size_t offset; // of the block from the start of the allocation
+      size_t align; // of the allocation
+    };
+
+
+    // The cache of one thread. Only its thread allocates from it and frees into it, and mx is only ever
+    // contended by trim(), which empties the caches of all threads.
+    class ThreadCache{
+    public:
+
+      const CachingMemoryManager* owner=nullptr;
+      vector<void*> bins[nclasses];
+      size_t bytes=0;
+      mutex mx;
+
+      ~ThreadCache(){
+	lock_guard<mutex> lock(registry_mx());
+	if(owner) owner->absorb(*this);
+      }
+
+    };
+
+
+    string name;
+    size_t max_cached;
+    size_t max_thread_cached;
+
+    mutable mutex mx;
+    mutable vector<void*> global_bins[nclasses];
+    mutable std::set<ThreadCache*> thread_caches;
+
+    mutable atomic<size_t> cached_bytes;
+    mutable atomic<size_t> used_bytes;
+    mutable atomic<size_t> n_malloc;
+    mutable atomic<size_t> n_thread_hits;
+    mutable atomic<size_t> n_global_hits;
+    mutable atomic<size_t> n_system;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    CachingMemoryManager(const size_t _max_cached=((size_t)1)<<30, const size_t _max_thread_cached=((size_t)1)<<26):
+      max_cached(_max_cached),
+      max_thread_cached(_max_thread_cached){
+      cached_bytes=0;
+      used_bytes=0;
+      n_malloc=0;
+      n_thread_hits=0;
+      n_global_hits=0;
+      n_system=0;
+    }
+
+    CachingMemoryManager(const string _name, const size_t _max_cached=((size_t)1)<<30):
+      CachingMemoryManager(_max_cached){
+      name=_name;
+    }
+
+    ~CachingMemoryManager(){
+      lock_guard<mutex> lock(registry_mx());
+      for(auto p:thread_caches){
+	for(int c=0; c<nclasses; c++){
+	  for(auto q:p->bins[c]) release(q);
+	  p->bins[c].clear();
+	}
+	p->owner=nullptr;
+      }
+      for(int c=0; c<nclasses; c++)
+	for(auto q:global_bins[c]) release(q);
+    }
+
+
+  public: // ---- Copying ------------------------------------------------------------------------------------
+
+
+    CachingMemoryManager(const CachingMemoryManager& x)=delete;
+    CachingMemoryManager& operator=(const CachingMemoryManager& x)=delete;
+
+
+  public: // ---- Size classes -------------------------------------------------------------------------------
+
+
+    static size_t class_size(const int c){
+      const int octave=c/4;
+      const size_t base=min_class_size<<octave;
+      return base+(c%4)*(base/4);
+    }
+
+    static int size_class(const size_t n){
+      if(n<=min_class_size) return 0;
+      int octave=0;
+      while((min_class_size<<(octave+1))<n) octave++;
+      const size_t base=min_class_size<<octave;
+      const int sub=(n-base+base/4-1)/(base/4);
+      return 4*octave+sub;
+    }
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    size_t size() const{
+      return cached_bytes+used_bytes;
+    }
+
+    size_t cached() const{
+      return cached_bytes;
+    }
+
+    size_t in_use() const{
+      return used_bytes;
+    }
+
+    double hit_rate() const{
+      if(n_malloc==0) return 0;
+      return ((double)(n_thread_hits+n_global_hits))/n_malloc;
+    }
+
+
+    template<typename TYPE>
+    TYPE* alloc(const size_t n) const{
+      return static_cast<TYPE*>(malloc(n*sizeof(TYPE)));
+    }
+
+
+    void* malloc(const size_t n) const{
+      n_malloc++;
+      const int c=size_class(n);
+
+      if(c>=nclasses){
+	n_system++;
+	used_bytes+=n;
+	return acquire(n,-1);
+      }
+      const size_t csize=class_size(c);
+      used_bytes+=csize;
+
+      ThreadCache& tc=thread_cache();
+      {
+	lock_guard<mutex> lock(tc.mx);
+	if(tc.bins[c].size()>0){
+	  void* p=tc.bins[c].back();
+	  tc.bins[c].pop_back();
+	  tc.bytes-=csize;
+	  cached_bytes-=csize;
+	  n_thread_hits++;
+	  return p;
+	}
+      }
+
+      {
+	lock_guard<mutex> lock(mx);
+	if(global_bins[c].size()>0){
+	  void* p=global_bins[c].back();
+	  global_bins[c].pop_back();
+	  cached_bytes-=csize;
+	  n_global_hits++;
+	  return p;
+	}
+      }
+
+      n_system++;
+      return acquire(csize,c);
+    }
+
+
+    void* malloc_aligned(const size_t n, const size_t _alignment) const{
+      if(_alignment<=alignment) return malloc(n);
+      n_malloc++;
+      n_system++;
+      used_bytes+=n;
+      char* p=static_cast<char*>(::operator new(n+_alignment,std::align_val_t(_alignment)));
+      if(_alignment==MemPolicy::huge_page_size) MemPolicy::advise_huge(p,n+_alignment);
+      return make_block(p,_alignment,_alignment,n,-1);
+    }
+
+
+    void free(void* p) const{
+      if(!p) return;
+      Header& h=header(p);
+      const int c=h.size_class;
+
+      if(c<0){
+	used_bytes-=h.size;
+	release(p);
+	return;
+      }
+      const size_t csize=h.size;
+      used_bytes-=csize;
+
+      if(cached_bytes+csize>max_cached){
+	release(p);
+	return;
+      }
+      cached_bytes+=csize;
+
+      ThreadCache& tc=thread_cache();
+      lock_guard<mutex> lock(tc.mx);
+      tc.bins[c].push_back(p);
+      tc.bytes+=csize;
+      if(tc.bytes>max_thread_cached)
+	flush(tc);
+    }
+
+
+    // Return all cached blocks to the system: those in the caches of every thread that has used this 
+    // manager, and those in the global list
+    void trim() const{
+      {
+	lock_guard<mutex> registry_lock(registry_mx());
+	for(auto tc:thread_caches){
+	  lock_guard<mutex> lock(tc->mx);
+	  for(int c=0; c<nclasses; c++){
+	    for(auto p:tc->bins[c]) release(p);
+	    cached_bytes-=tc->bins[c].size()*class_size(c);
+	    tc->bins[c].clear();
+	  }
+	  tc->bytes=0;
+	}
+      }
+
+      lock_guard<mutex> lock(mx);
+      for(int c=0; c<nclasses; c++){
+	for(auto p:global_bins[c]) release(p);
+	cached_bytes-=global_bins[c].size()*class_size(c);
+	global_bins[c].clear();
+      }
+    }
+
+    void clear() const{
+      trim();
+    }
+
+
+  private: // ---- Internals --------------------------------------------------------------------------------
+
+
+    static Header& header(void* p){
+      return *reinterpret_cast<Header*>(static_cast<char*>(p)-header_size);
+    }
+
+    void* acquire(const size_t n, const int c) const{
+      char* p=static_cast<char*>(::operator new(n+header_size,std::align_val_t(alignment)));
+      return make_block(p,header_size,alignment,n,c);
+    }
+
+    // The block offset bytes into the allocation at p, with its header just before it
+    void* make_block(char* p, const size_t offset, const size_t align, const size_t n, const int c) const{
+      Header& h=*reinterpret_cast<Header*>(p+offset-header_size);
+      h.size=n;
+      h.size_class=c;
+      h.owner=this;
+      h.offset=offset;
+      h.align=align;
+      return static_cast<void*>(p+offset);
+    }
+
+    static void release(void* p){
+      const Header& h=header(p);
+      ::operator delete(static_cast<char*>(p)-h.offset,std::align_val_t(h.align));
+    }
+
+    // Move the older half of each of the thread's bins to the global list; called with tc.mx held
+    void flush(ThreadCache& tc) const{
+      lock_guard<mutex> lock(mx);
+      for(int c=0; c<nclasses; c++){
+	auto& bin=tc.bins[c];
+	const int n=bin.size()/2+bin.size()%2;
+	global_bins[c].insert(global_bins[c].end(),bin.begin(),bin.begin()+n);
+	bin.erase(bin.begin(),bin.begin()+n);
+	tc.bytes-=n*class_size(c);
+      }
+    }
+
+    // Called with registry_mx held when a thread with a cache exits
+    void absorb(ThreadCache& tc) const{
+      lock_guard<mutex> lock(mx);
+      for(int c=0; c<nclasses; c++){
+	global_bins[c].insert(global_bins[c].end(),tc.bins[c].begin(),tc.bins[c].end());
+	tc.bins[c].clear();
+      }
+      tc.bytes=0;
+      thread_caches.erase(&tc);
+    }
+
+    ThreadCache& thread_cache() const{
+      static thread_local vector<unique_ptr<ThreadCache> > caches;
+      for(auto& p:caches)
+	if(p->owner==this) return *p;
+      lock_guard<mutex> lock(registry_mx());
+      for(auto& p:caches)
+	if(p->owner==nullptr){
+	  p->owner=this;
+	  thread_caches.insert(p.get());
+	  return *p;
+	}
+      caches.push_back(unique_ptr<ThreadCache>(new ThreadCache()));
+      caches.back()->owner=this;
+      thread_caches.insert(caches.back().get());
+      return *caches.back();
+    }
+
+    static mutex& registry_mx(){
+      static mutex _mx;
+      return _mx;
+    }
+
+
+  public: // ---- I/O ---------------------------------------------------------------------------------------
+
+
+    string str(const string indent="") const{
+      ostringstream oss;
+      oss<<indent<<"Caching memory manager "<<name<<":"<<endl;
+      oss<<indent<<"  In use:             "<<used_bytes<<" bytes"<<endl;
+      oss<<indent<<"  Cached:             "<<cached_bytes<<" bytes (max "<<max_cached<<")"<<endl;
+      oss<<indent<<"  Allocations:        "<<n_malloc<<endl;
+      oss<<indent<<"  Thread cache hits:  "<<n_thread_hits<<endl;
+      oss<<indent<<"  Global cache hits:  "<<n_global_hits<<endl;
+      oss<<indent<<"  System allocations: "<<n_system<<endl;
+      oss<<indent<<"  Hit rate:           "<<hit_rate()<<endl;
+      return oss.str();
+    }
+
+    friend ostream& operator<<(ostream& stream, const CachingMemoryManager& x){
+      stream<<x.str(); return stream;
+    }
+
+  };
+
+}
+
+#endif
@@ -17,6 +17,8 @@
 
 #include "Cnine_base.hpp"
 #include "CnineLog.hpp"
+#include "ThreadPool.hpp"
+#include "MemPolicy.hpp"
 #include <chrono>
 #include <ctime>
 
@@ -40,6 +42,7 @@ namespace cnine{
   extern float* cuda_oneS;
 
   extern thread_local int nthreads;
+  extern bool deterministic_reductions;
 
 
   class cnine_session{
@@ -109,14 +112,46 @@ namespace cnine{
     }
     
 
+  public: // ---- Threading -----------------------------------------------------------------------------------
+
+
+    // Make reductions give bitwise identical results regardless of the number of threads
+    void set_deterministic_reductions(const bool x=true){
+      deterministic_reductions=x;
+    }
+
+
+  public: // ---- Memory policy ------------------------------------------------------------------------------
+
+
+    // Alignment in bytes of all subsequently allocated host tensors, including those from an installed
+    // host memory manager. Row padding is not a session setting: it changes the strides of a tensor, so it
+    // is only applied to tensors constructed with an explicit MemPolicy.
+    void set_alignment(const size_t n){
+      CNINE_ASSRT(n>0 && (n&(n-1))==0);
+      default_mem_policy.alignment=n;
+    }
+
+    // Back host blobs of at least threshold bytes by transparent huge pages (0 to turn off)
+    void set_huge_pages(const size_t threshold){
+      default_mem_policy.huge_page_threshold=threshold;
+    }
+
+    const MemPolicy& mem_policy() const{
+      return default_mem_policy;
+    }
+
+
   public: // ---- I/O ----------------------------------------------------------------------------------------
 
 
     string str(const string indent="") const{
       ostringstream oss;
       cout<<indent<<"cnine session started "<<std::ctime(&start_time);
-      cout<<indent<<"Number of CPU threads: "<<nthreads<<endl;
+      cout<<indent<<"Number of CPU threads: "<<nthreads<<" ("<<thread_pool.size()<<" pool workers started)"<<endl;
+      cout<<indent<<"Deterministic reductions: "<<(deterministic_reductions?"on":"off")<<endl;
       cout<<indent<<"GPU footprint for streaming operations: "<<streaming_footprint<<" MB"<<endl;
+      cout<<indent<<"Host memory policy: "<<default_mem_policy<<endl;
       return oss.str();
     }
 
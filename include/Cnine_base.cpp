@@ -24,6 +24,8 @@
 #include "GPUbuffer.hpp"
 #include "AsyncGPUbuffer.hpp"
 #include "MemoryManager.hpp"
+#include "ThreadPool.hpp"
+#include "MemPolicy.hpp"
 
 #ifdef _WITH_CENGINE
 #include "Cengine_base.cpp"
@@ -32,11 +34,15 @@
 namespace cnine{
 
   thread_local int nthreads=1;
+  ThreadPool thread_pool;
+  bool deterministic_reductions=false;
 
   int streaming_footprint=1024;
   thread_local DeviceSelector dev_selector;
 
   thread_local MemoryManager* vram_manager=nullptr;
+  thread_local MemoryManager* host_manager=nullptr;
+  MemPolicy default_mem_policy;
 
   string base_indent="";
   float* cuda_oneS=nullptr;
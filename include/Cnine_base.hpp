@@ -292,6 +292,41 @@ namespace cnine{
 
   enum dtype_enum{dint,dfloat,ddouble,dcint,dcfloat,dcdouble};
 
+  template<typename TYPE>
+  inline dtype_enum dtype_of(){
+    if constexpr(std::is_same<TYPE,int>::value) return dint;
+    if constexpr(std::is_same<TYPE,float>::value) return dfloat;
+    if constexpr(std::is_same<TYPE,double>::value) return ddouble;
+    if constexpr(std::is_same<TYPE,complex<int> >::value) return dcint;
+    if constexpr(std::is_same<TYPE,complex<float> >::value) return dcfloat;
+    if constexpr(std::is_same<TYPE,complex<double> >::value) return dcdouble;
+    throw std::runtime_error("Cnine error in dtype_of: unsupported type.");
+  }
+
+  inline size_t dtype_size(const dtype_enum x){
+    switch(x){
+    case dint: return sizeof(int);
+    case dfloat: return sizeof(float);
+    case ddouble: return sizeof(double);
+    case dcint: return sizeof(complex<int>);
+    case dcfloat: return sizeof(complex<float>);
+    case dcdouble: return sizeof(complex<double>);
+    }
+    return 0;
+  }
+
+  inline string dtype_name(const dtype_enum x){
+    switch(x){
+    case dint: return "int";
+    case dfloat: return "float";
+    case ddouble: return "double";
+    case dcint: return "complex<int>";
+    case dcfloat: return "complex<float>";
+    case dcdouble: return "complex<double>";
+    }
+    return "unknown";
+  }
+
 
   class view_flag{
   public:
@@ -108,6 +108,17 @@ namespace cnine{
       (*this)[i]=(*this)[i+1]*dims[i+1];
     }
 
+    // Regular strides for dims, except that each row (the last dimension) is padded to row_len elements
+    static GstridesB padded(const Gdims& dims, const size_t row_len){
+      GstridesB R(dims);
+      int k=dims.size();
+      if(k<2 || row_len<=dims[k-1]) return R;
+      R[k-2]=row_len;
+      for(int i=k-3; i>=0; i--)
+	R[i]=R[i+1]*dims[i+1];
+      return R;
+    }
+
 
   public: // ---- ATEN --------------------------------------------------------------------------------------
 
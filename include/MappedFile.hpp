@@ -0,0 +1,172 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+
+#ifndef _CnineMappedFile
+#define _CnineMappedFile
+
+#include "Cnine_base.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+
+
+namespace cnine{
+
+
+  // ---- MappedFile -------------------------------------------------------------------------------------------
+  //
+  // A file mapped into the address space. In readonly mode the pages are shared and read only, in
+  // copy_on_write mode writes go to private copies of the touched pages and never reach the file, and in
+  // shared mode writes go through to the file. Pages are only read from disk when first touched.
+
+
+  class MappedFile{
+  public:
+
+    enum map_mode{readonly,copy_on_write,shared};
+
+    string path;
+    map_mode mode;
+    int fd=-1;
+    void* addr=nullptr;
+    size_t _size=0;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    // Map an existing file
+    MappedFile(const string& _path, const map_mode _mode=readonly):
+      path(_path), mode(_mode){
+      fd=::open(path.c_str(),mode==shared?O_RDWR:O_RDONLY);
+      if(fd<0) CNINE_ERROR("Cannot open file "+path+": "+std::strerror(errno));
+      struct stat st;
+      if(fstat(fd,&st)!=0) fail("Cannot stat file");
+      _size=st.st_size;
+      map();
+    }
+
+    // Create (or truncate) a file of size n and map it in shared mode
+    MappedFile(const string& _path, const size_t n):
+      path(_path), mode(shared), _size(n){
+      fd=::open(path.c_str(),O_RDWR|O_CREAT|O_TRUNC,0644);
+      if(fd<0) CNINE_ERROR("Cannot create file "+path+": "+std::strerror(errno));
+      if(ftruncate(fd,n)!=0) fail("Cannot resize file");
+      map();
+    }
+
+    ~MappedFile(){
+      if(addr) munmap(addr,_size);
+      if(fd>=0) ::close(fd);
+    }
+
+    MappedFile(const MappedFile& x)=delete;
+    MappedFile& operator=(const MappedFile& x)=delete;
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    size_t size() const{
+      return _size;
+    }
+
+    char* data() const{
+      return static_cast<char*>(addr);
+    }
+
+    bool writable() const{
+      return mode!=readonly;
+    }
+
+    // Ask the kernel to start reading the pages covering [offs,offs+n) in the background
+    void prefetch(const size_t offs, const size_t n) const{
+      advise(offs,n,MADV_WILLNEED);
+    }
+
+    // Tell the kernel the pages covering [offs,offs+n) will not be needed soon
+    void release(const size_t offs, const size_t n) const{
+      if(mode==copy_on_write) return; // would discard private modifications
+      advise(offs,n,MADV_DONTNEED);
+    }
+
+    // Write modified pages back to the file
+    void sync() const{
+      if(mode==shared && addr) msync(addr,_size,MS_SYNC);
+    }
+
+    // Prefetch hint for an arbitrary range of host memory
+    static void prefetch_range(const void* p, const size_t n){
+      size_t a=reinterpret_cast<size_t>(p);
+      size_t beg=(a/page_size())*page_size();
+      madvise(reinterpret_cast<void*>(beg),n+a-beg,MADV_WILLNEED);
+    }
+
+    static size_t page_size(){
+      static size_t p=sysconf(_SC_PAGESIZE);
+      return p;
+    }
+
+
+  private:
+
+    void map(){
+      if(_size==0) return;
+      int prot=(mode==readonly)?PROT_READ:(PROT_READ|PROT_WRITE);
+      int flags=(mode==shared)?MAP_SHARED:MAP_PRIVATE;
+      addr=mmap(nullptr,_size,prot,flags,fd,0);
+      if(addr==MAP_FAILED){
+	addr=nullptr;
+	fail("Cannot map file");
+      }
+    }
+
+    // Close the file and throw. The constructors call this for errors after the file is opened, since the
+    // destructor does not run when a constructor throws.
+    void fail(const string& what){
+      const string msg=what+" "+path+": "+std::strerror(errno);
+      ::close(fd);
+      fd=-1;
+      CNINE_ERROR(msg);
+    }
+
+    void advise(size_t offs, size_t n, const int advice) const{
+      if(!addr || offs>=_size) return;
+      n=std::min(n,_size-offs);
+      size_t beg=(offs/page_size())*page_size();
+      madvise(data()+beg,n+offs-beg,advice);
+    }
+
+
+  public: // ---- I/O ---------------------------------------------------------------------------------------
+
+
+    string str() const{
+      ostringstream oss;
+      oss<<"MappedFile("<<path<<","<<_size<<" bytes,"<<(mode==readonly?"readonly":(mode==shared?"shared":"copy_on_write"))<<")";
+      return oss.str();
+    }
+
+    friend ostream& operator<<(ostream& stream, const MappedFile& x){
+      stream<<x.str(); return stream;
+    }
+
+  };
+
+}
+
+#endif
@@ -51,6 +51,15 @@ namespace cnine{
     MemArr(const size_t _memsize, const int _dev=0):
       blob(new MemBlob<TYPE>(_memsize,_dev)){}
 
+    MemArr(const size_t _memsize, const MemPolicy& policy, const int _dev=0):
+      blob(new MemBlob<TYPE>(_memsize,policy,_dev)){}
+
+    MemArr(const size_t _memsize, const MemPolicy& policy, const fill_zero& dummy, const int _dev=0):
+      MemArr(_memsize,policy,_dev){
+      if(device()==0) std::fill(blob->arr,blob->arr+_memsize,0);
+      if(device()==1) CUDA_SAFE(cudaMemset(blob->arr,0,_memsize*sizeof(TYPE)));
+    }
+
     MemArr(const size_t _memsize, const fill_zero& dummy, const int _dev=0):
       MemArr(_memsize,_dev){
       if(device()==0) std::fill(blob->arr,blob->arr+_memsize,0);
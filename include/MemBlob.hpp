@@ -18,6 +18,8 @@
 #include "Cnine_base.hpp"
 #include "CnineCallStack.hpp"
 #include "MemoryManager.hpp"
+#include "MemPolicy.hpp"
+#include "MappedFile.hpp"
 #include "fnlog.hpp"
 
 #ifdef _WITH_CUDA
@@ -35,6 +37,8 @@ namespace cnine{
 
   extern CallStack call_stack;
   extern thread_local MemoryManager* vram_manager;
+  extern thread_local MemoryManager* host_manager;
+  extern MemPolicy default_mem_policy;
   extern CnineLog cnine_log;
 
 
@@ -48,6 +52,9 @@ namespace cnine{
     int dev=0;
     bool is_view=false;
     const MemoryManager* manager=nullptr;
+    size_t memsize=0;
+    size_t alignment=0;
+    std::shared_ptr<MappedFile> mapping;
 
     ~MemBlob(){
       if(is_view) return;
@@ -56,7 +63,10 @@ namespace cnine{
 	return;
       }
       BLOB_DEBUG("Delete blob.");
-      if(dev==0 && arr) {delete[] arr;}
+      if(dev==0 && arr){
+	std::destroy_n(arr,memsize);
+	MemPolicy::deallocate(arr,alignment);
+      }
       if(dev==1 && arr) {CUDA_SAFE(cudaFree(arr));}
     }
 
@@ -64,6 +74,9 @@ namespace cnine{
 
 
     MemBlob(size_t _memsize, const int _dev=0):
+      MemBlob(_memsize,default_mem_policy,_dev){}
+
+    MemBlob(size_t _memsize, const MemPolicy& policy, const int _dev=0):
       dev(_dev){
       if(_memsize<1) _memsize=1;
       BLOB_DEBUG("New blob of size "+to_string(_memsize)+" on device "+to_string(_dev)+".");
@@ -75,8 +88,17 @@ namespace cnine{
 	return;
       }
 
+      if(host_manager && _dev==0){
+	manager=host_manager;
+	const size_t nbytes=_memsize*sizeof(TYPE);
+	arr=static_cast<TYPE*>(manager->malloc_aligned(nbytes,policy.alignment_for(nbytes,alignof(TYPE))));
+	return;
+      }
+
       //fnlog timer("MemBlob not managed");
-      CPUCODE(arr=new TYPE[_memsize];);
+      CPUCODE(arr=static_cast<TYPE*>(policy.allocate(_memsize*sizeof(TYPE),alignment,alignof(TYPE)));
+	memsize=_memsize;
+	std::uninitialized_default_construct_n(arr,memsize););
       GPUCODE(CUDA_SAFE(cudaMalloc((void **)&arr, _memsize*sizeof(TYPE))););
     }
 
@@ -103,6 +125,19 @@ namespace cnine{
       is_view(true){}
 
 
+  public: // ---- Mapped files -------------------------------------------------------------------------------
+
+
+    // Blob backed by a mapped file starting offs bytes into the file. The mapping is released when the
+    // last blob referring to it is destroyed.
+    MemBlob(const std::shared_ptr<MappedFile>& _mapping, const size_t offs):
+      arr(reinterpret_cast<TYPE*>(_mapping->data()+offs)),
+      dev(0),
+      is_view(true),
+      mapping(_mapping){}
+
+
+
   };
 
 }
@@ -0,0 +1,127 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+
+#ifndef _CnineMemPolicy
+#define _CnineMemPolicy
+
+#include "Cnine_base.hpp"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+
+namespace cnine{
+
+
+  // ---- MemPolicy --------------------------------------------------------------------------------------------
+  //
+  // How host blobs are allocated. Every blob is aligned to alignment bytes (a power of two, at least 64 by
+  // default so that blobs never share a cache line). Blobs of at least huge_page_threshold bytes are aligned
+  // to huge_page_size instead and advised to use transparent huge pages. If pad_rows is set, tensors created
+  // with this policy passed explicitly pad their leading stride so that every row starts on an aligned address.
+
+
+  class MemPolicy{
+  public:
+
+    static constexpr size_t huge_page_size=((size_t)1)<<21;
+
+    size_t alignment=64;
+    size_t huge_page_threshold=0; // 0 means never use huge pages
+    bool pad_rows=false;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    MemPolicy(){}
+
+    MemPolicy(const size_t _alignment, const size_t _huge_page_threshold=0, const bool _pad_rows=false):
+      alignment(_alignment),
+      huge_page_threshold(_huge_page_threshold),
+      pad_rows(_pad_rows){
+      CNINE_ASSRT(alignment>0 && (alignment&(alignment-1))==0);
+    }
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    bool huge(const size_t nbytes) const{
+      return huge_page_threshold>0 && nbytes>=huge_page_threshold;
+    }
+
+    // Alignment actually used for a blob of nbytes bytes of elements of alignment elt_align
+    size_t alignment_for(const size_t nbytes, const size_t elt_align=1) const{
+      if(huge(nbytes)) return huge_page_size;
+      return std::max(alignment,elt_align);
+    }
+
+    // Number of elements of size elt_size that a row of n elements is padded to
+    size_t padded_row(const size_t n, const size_t elt_size) const{
+      if(!pad_rows || alignment%elt_size!=0) return n;
+      const size_t k=alignment/elt_size;
+      return ((n+k-1)/k)*k;
+    }
+
+
+  public: // ---- Allocation --------------------------------------------------------------------------------
+
+
+    // Allocate nbytes of raw host memory according to the policy; returns the alignment used
+    void* allocate(size_t nbytes, size_t& _alignment, const size_t elt_align=1) const{
+      _alignment=alignment_for(nbytes,elt_align);
+      nbytes=std::max(_alignment,((nbytes+_alignment-1)/_alignment)*_alignment);
+      void* p=::operator new(nbytes,std::align_val_t(_alignment));
+      if(_alignment==huge_page_size) advise_huge(p,nbytes);
+      return p;
+    }
+
+    // Ask for the nbytes of host memory at p, which should be huge page aligned, to use transparent huge pages
+    static void advise_huge(void* p, const size_t nbytes){
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+      madvise(p,nbytes,MADV_HUGEPAGE);
+#endif
+    }
+
+    static void deallocate(void* p, const size_t _alignment){
+      ::operator delete(p,std::align_val_t(_alignment));
+    }
+
+
+  public: // ---- I/O ---------------------------------------------------------------------------------------
+
+
+    string str() const{
+      ostringstream oss;
+      oss<<"MemPolicy(alignment="<<alignment;
+      if(huge_page_threshold>0) oss<<",huge_pages>="<<huge_page_threshold;
+      if(pad_rows) oss<<",pad_rows";
+      oss<<")";
+      return oss.str();
+    }
+
+    friend ostream& operator<<(ostream& stream, const MemPolicy& x){
+      stream<<x.str(); return stream;
+    }
+
+  };
+
+
+  extern MemPolicy default_mem_policy;
+
+}
+
+#endif
@@ -24,14 +24,26 @@ namespace cnine{
 
     virtual ~MemoryManager(){};
     virtual size_t size() const=0;
-    virtual void* malloc(const int n) const=0;
+    virtual void* malloc(const size_t n) const=0;
     virtual void free(void* p) const=0;
     virtual void clear() const=0;
 
+    // Allocate n bytes at an address that is a multiple of alignment, a power of two. Managers that can 
+    // honor larger alignments than their blocks naturally have override this.
+    virtual void* malloc_aligned(const size_t n, const size_t alignment) const{
+      void* p=malloc(n);
+      if(reinterpret_cast<size_t>(p)%alignment!=0){
+	free(p);
+	CNINE_ERROR("memory manager cannot align blocks to "+std::to_string(alignment)+" bytes");
+      }
+      return p;
+    }
+
   };
 
 
   extern thread_local MemoryManager* vram_manager;
+  extern thread_local MemoryManager* host_manager;
 
   class using_vram_manager{
   public:
@@ -45,6 +57,18 @@ namespace cnine{
     }
   };
 
+  class using_host_manager{
+  public:
+    MemoryManager* old;
+    using_host_manager(MemoryManager* mm){
+      old=host_manager;
+      host_manager=mm;
+    }
+    ~using_host_manager(){
+      host_manager=old;
+    }
+  };
+
 }
 
 #endif 
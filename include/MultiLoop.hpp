@@ -15,13 +15,16 @@
 
 #ifndef _MultiLoop
 #define _MultiLoop
-#include "ThreadGroup.hpp"
+#include "ThreadPool.hpp"
 
 namespace cnine{
 
   extern thread_local int nthreads;
 
 
+  // Runs lambda(0),...,lambda(n-1) on the shared thread pool using at most nthreads threads. 
+  // Each iteration sees nthreads set to its share of the thread budget.
+
   class MultiLoop{
   public:
     
@@ -32,10 +35,7 @@ namespace cnine{
 	return;
       }
       
-      ThreadGroup threads(nthreads);
-      for(int i=0; i<n; i++)
-	threads.add(std::max(1,nthreads/n),lambda,i);
-
+      parallel_for(0,n,1,lambda);
     }
 
   };
@@ -54,7 +54,8 @@ namespace cnine{
       _size=(__size/granularity)*granularity;
       cout<<"Starting SimpleMemoryManager(size="<<_size<<",dev="<<dev<<")."<<endl;
       if(_size==0) _size=1;
-      if(dev==0) arr=::malloc(_size);
+      if(dev==0 && posix_memalign(&arr,granularity,_size)!=0) // so that blocks are 128-byte aligned
+	throw std::runtime_error("Memory manager "+name+": cannot allocate "+to_string(_size)+" bytes.");
       if(dev==1) CUDA_SAFE(cudaMalloc((void **)&arr,_size));
       blocks.push_back(SimpleMemoryBlock(0,_size));
     }
@@ -85,14 +86,14 @@ namespace cnine{
 
 
     template<typename TYPE>
-    TYPE* alloc(const int n) const{
+    TYPE* alloc(const size_t n) const{
       return static_cast<TYPE*>(malloc(n*sizeof(TYPE)));
     }
 
 
-    void* malloc(const int _n) const{
+    void* malloc(const size_t _n) const{
 
-      int n=roundup(_n,granularity);
+      size_t n=((_n+granularity-1)/granularity)*granularity;
       block_it it=blocks.begin();
       while(it!=blocks.end() && (it->used || it->size<n)){
 	it++;
@@ -1,14 +1,13 @@
-
 /*
- * This file is part of cnine, a lightweight C++ tensor library. 
- *  
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
  * Copyright (c) 2021, Imre Risi Kondor
  *
- * This source code file is subject to the terms of the noncommercial 
- * license distributed with cnine in the file LICENSE.TXT. Commercial 
- * use is prohibited. All redistributed versions of this file (in 
- * original or modified form) must retain this copyright notice and 
- * must be accompanied by a verbatim copy of the license. 
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
  *
  */
 
@@ -16,65 +15,351 @@
 #ifndef _ThreadPool
 #define _ThreadPool
 
+#include "Cnine_base.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <exception>
+
+
 namespace cnine{
 
+  extern thread_local int nthreads;
+
+
+  // ---- ThreadPool -------------------------------------------------------------------------------------------
+  //
+  // A persistent pool of worker threads, started lazily the first time a parallel loop asks for them.
+  // Each worker owns a deque of tasks: it pushes and pops its own tasks at the back and steals from the
+  // front of the other workers' deques when it runs out. Tasks submitted from outside the pool go to a
+  // shared injection queue. The thread that starts a parallel loop works on the loop's chunks itself, then
+  // withdraws the helper tasks that were not picked up and sleeps until the chunks claimed by other
+  // threads are done. It never runs unrelated tasks while waiting, so thread local state stays put
+  // across a loop. Loops can still be nested: a thread only waits for chunks that other threads are
+  // already running.
+
+
   class ThreadPool{
   public:
 
-    mutex mx;
-    mutex gate;
-    atomic<int> nthreads;
-    int maxthreads=4;
-    vector<thread> threads;
+    typedef std::function<void()> Task;
+
+    static constexpr int max_workers=256;
+
+
+    class Entry{
+    public:
+      Task task;
+      const void* owner; // the job the task helps with, so that it can be withdrawn
+    };
+
+
+    class Worker{
+    public:
+      mutex mx;
+      std::deque<Entry> tasks;
+      thread th;
+    };
+
+
+    class Job{
+    public:
+      int begin, end, grain, nchunks;
+      int subthreads=1;
+      const std::function<void(int,int)>* fn;
+      atomic<int> next;
+      atomic<int> ndone;
+      std::exception_ptr err=nullptr;
+      mutex err_mx;
+      mutex done_mx;
+      condition_variable done_cv;
+
+      Job(const int _begin, const int _end, const int _grain, const std::function<void(int,int)>* _fn):
+	begin(_begin), end(_end), grain(_grain), fn(_fn){
+	nchunks=(end-begin+grain-1)/grain;
+	next=0;
+	ndone=0;
+      }
+
+      void work(){
+	while(true){
+	  int c=next++;
+	  if(c>=nchunks) return;
+	  int i0=begin+c*grain;
+	  int i1=std::min(end,i0+grain);
+	  int saved=nthreads;
+	  nthreads=subthreads;
+	  try{
+	    (*fn)(i0,i1);
+	  }catch(...){
+	    lock_guard<mutex> lock(err_mx);
+	    if(!err) err=std::current_exception();
+	  }
+	  nthreads=saved;
+	  if(++ndone==nchunks){
+	    lock_guard<mutex> lock(done_mx);
+	    done_cv.notify_all();
+	  }
+	}
+      }
+
+      bool done() const{
+	return ndone==nchunks;
+      }
+
+      void wait(){
+	if(done()) return;
+	unique_lock<mutex> lock(done_mx);
+	done_cv.wait(lock,[this](){return done();});
+      }
+
+    };
 
 
   public:
 
-    ThreadPool()=delete;
-  
-    ThreadPool(const int _maxthreads=4): 
-      maxthreads(_maxthreads){}
+    std::vector<Worker*> workers;
+    atomic<int> nworkers;
+    atomic<int> nqueued;
+    atomic<bool> shutdown;
+
+    std::deque<Entry> injection;
+    mutex injection_mx;
+
+    mutex mx;
+    condition_variable cv;
+
+    inline static thread_local int worker_id=-1;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    ThreadPool(){
+      workers.resize(max_workers,nullptr);
+      nworkers=0;
+      nqueued=0;
+      shutdown=false;
+    }
+
+    ThreadPool(const ThreadPool& x)=delete;
+    ThreadPool& operator=(const ThreadPool& x)=delete;
 
     ~ThreadPool(){
-      while(nrunning>0){
-	running_cv.wait();
+      {
+	lock_guard<mutex> lock(mx);
+	shutdown=true;
+      }
+      cv.notify_all();
+      int n=nworkers;
+      for(int i=0; i<n; i++){
+	workers[i]->th.join();
+	delete workers[i];
       }
     }
 
 
-  public:
+  public: // ---- Access ------------------------------------------------------------------------------------
+
 
-    template<class FUNCTION>
-    launch(FUNCTION lambda){
-      
+    int size() const{
+      return nworkers;
     }
 
+    // Make sure there are at least n worker threads (not counting the calling thread)
+    void reserve(const int n){
+      if(nworkers>=n) return;
+      lock_guard<mutex> lock(mx);
+      while(nworkers<std::min(n,max_workers)){
+	int id=nworkers;
+	Worker* w=new Worker();
+	workers[id]=w;
+	w->th=thread([this,id](){run_worker(id);});
+	nworkers++;
+      }
+    }
 
-    template<class FUNCTION, class OBJ>
-    inline void ThreadPool::add(FUNCTION lambda, const OBJ x){
-      lock_guard<mutex> lock(mx); //                                   unnecessary if called from a single thread
-      threadManager.enqueue(this);
-      gate.lock(); //                                                  gate can only be unlocked by threadManager
-      nthreads++;
-      threads.push_back(thread([this,lambda](OBJ _x){
-	    lambda(_x); 
-	    nthreads--; threadManager.release(this);},x));
-      #ifdef _THREADBANKVERBOSE
-      printinfo();
-      #endif
- }
 
+  public: // ---- Tasks -------------------------------------------------------------------------------------
 
 
-    bool is_ready(){return nthreads<maxthreads;}
+    void push(Task task, const void* owner=nullptr){
+      nqueued++;
+      if(worker_id>=0){
+	Worker& w=*workers[worker_id];
+	lock_guard<mutex> lock(w.mx);
+	w.tasks.push_back({std::move(task),owner});
+      }else{
+	lock_guard<mutex> lock(injection_mx);
+	injection.push_back({std::move(task),owner});
+      }
+      {lock_guard<mutex> lock(mx);}
+      cv.notify_one();
+    }
+
+    bool try_pop(Task& task){
+      if(nqueued==0) return false;
+
+      if(worker_id>=0){
+	Worker& w=*workers[worker_id];
+	lock_guard<mutex> lock(w.mx);
+	if(w.tasks.size()>0){
+	  task=std::move(w.tasks.back().task);
+	  w.tasks.pop_back();
+	  nqueued--;
+	  return true;
+	}
+      }
+
+      {
+	lock_guard<mutex> lock(injection_mx);
+	if(injection.size()>0){
+	  task=std::move(injection.front().task);
+	  injection.pop_front();
+	  nqueued--;
+	  return true;
+	}
+      }
+
+      int n=nworkers;
+      int start=worker_id>=0?worker_id+1:0;
+      for(int i=0; i<n; i++){
+	Worker& w=*workers[(start+i)%n];
+	lock_guard<mutex> lock(w.mx);
+	if(w.tasks.size()>0){
+	  task=std::move(w.tasks.front().task);
+	  w.tasks.pop_front();
+	  nqueued--;
+	  return true;
+	}
+      }
+      return false;
+    }
+
+    // Remove the tasks pushed by this thread on behalf of owner that have not started yet. They are
+    // normally at the back of the queue they were pushed to.
+    int withdraw(const void* owner){
+      auto remove=[&](std::deque<Entry>& q){
+	int r=0;
+	for(auto it=q.end(); it!=q.begin();){
+	  --it;
+	  if(it->owner==owner){it=q.erase(it); r++;}
+	}
+	return r;
+      };
+      int r;
+      if(worker_id>=0){
+	Worker& w=*workers[worker_id];
+	lock_guard<mutex> lock(w.mx);
+	r=remove(w.tasks);
+      }else{
+	lock_guard<mutex> lock(injection_mx);
+	r=remove(injection);
+      }
+      nqueued-=r;
+      return r;
+    }
+
+
+  public: // ---- Parallel loops ----------------------------------------------------------------------------
+
+
+    // Split [begin,end) into chunks of size grain and call lambda(i0,i1) on each chunk using at most
+    // nparticipants threads, including the calling thread. Each participant's nthreads is set to its share
+    // of the calling thread's budget, so that nested loops divide the remaining threads between them.
+    void parallel_for_chunks(const int begin, const int end, const int grain, const int nparticipants,
+      const std::function<void(int,int)>& lambda){
+      if(end<=begin) return;
+      const int _grain=std::max(1,grain);
+      const int nchunks=(end-begin+_grain-1)/_grain;
+      const int n=std::min(nchunks,nparticipants);
+      if(n<=1){
+	for(int i0=begin; i0<end; i0+=_grain)
+	  lambda(i0,std::min(end,i0+_grain));
+	return;
+      }
+
+      reserve(nparticipants-1);
+      auto job=make_shared<Job>(begin,end,_grain,&lambda);
+      job->subthreads=std::max(1,nparticipants/n);
+      for(int i=1; i<n; i++)
+	push([job](){job->work();},job.get());
+      job->work();
+      withdraw(job.get());
+      job->wait();
+      if(job->err) std::rethrow_exception(job->err);
+    }
 
-    void printinfo();
 
-  
+  private:
+
+    void run_worker(const int id){
+      worker_id=id;
+      while(true){
+	Task task;
+	if(try_pop(task)){
+	  task();
+	  continue;
+	}
+	unique_lock<mutex> lock(mx);
+	cv.wait(lock,[this](){return shutdown || nqueued>0;});
+	if(shutdown) return;
+      }
+    }
+
+
+  public: // ---- I/O ---------------------------------------------------------------------------------------
+
+
+    string str() const{
+      ostringstream oss;
+      oss<<"ThreadPool("<<nworkers<<" workers, "<<nqueued<<" queued tasks)";
+      return oss.str();
+    }
+
+    friend ostream& operator<<(ostream& stream, const ThreadPool& x){
+      stream<<x.str(); return stream;
+    }
+
   };
 
 
+  extern ThreadPool thread_pool;
+
+
+  // ---- Functions --------------------------------------------------------------------------------------------
+
+
+  // Call lambda(i) for each i in [begin,end), distributing chunks of grain consecutive indices over at
+  // most nthreads threads of the shared pool
+  template<typename FUNCTION>
+  inline void parallel_for(const int begin, const int end, const int grain, FUNCTION lambda){
+    if(nthreads<=1 || end-begin<=grain){
+      for(int i=begin; i<end; i++) lambda(i);
+      return;
+    }
+    thread_pool.parallel_for_chunks(begin,end,grain,nthreads,[&lambda](const int i0, const int i1){
+	for(int i=i0; i<i1; i++) lambda(i);});
+  }
+
+  // Call lambda(i0,i1) on consecutive chunks [i0,i1) of at most grain indices covering [begin,end)
+  template<typename FUNCTION>
+  inline void parallel_for_chunks(const int begin, const int end, const int grain, FUNCTION lambda){
+    if(nthreads<=1 || end-begin<=grain){
+      for(int i0=begin; i0<end; i0+=std::max(1,grain))
+	lambda(i0,std::min(end,i0+std::max(1,grain)));
+      return;
+    }
+    thread_pool.parallel_for_chunks(begin,end,grain,nthreads,[&lambda](const int i0, const int i1){
+	lambda(i0,i1);});
+  }
+
 }
 
 
-#endif 
+#endif
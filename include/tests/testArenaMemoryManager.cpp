@@ -0,0 +1,75 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "ArenaMemoryManager.hpp"
+#include "SimpleMemoryManager.hpp"
+#include <chrono>
+#include <random>
+
+using namespace cnine;
+
+
+template<typename MANAGER>
+double churn(const MANAGER& mm, const int nblocks, const int niter){
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<int> size_distr(1,1<<14);
+  std::uniform_int_distribution<int> slot_distr(0,nblocks-1);
+  vector<void*> live(nblocks,nullptr);
+  for(int i=0; i<nblocks; i++)
+    live[i]=mm.malloc(size_distr(gen));
+
+  auto t0=std::chrono::steady_clock::now();
+  for(int i=0; i<niter; i++){
+    int j=slot_distr(gen);
+    mm.free(live[j]);
+    live[j]=mm.malloc(size_distr(gen));
+  }
+  auto t1=std::chrono::steady_clock::now();
+
+  for(auto p:live) mm.free(p);
+  return std::chrono::duration<double,std::micro>(t1-t0).count()/niter;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session;
+  const size_t arena_size=((size_t)1)<<30;
+
+  {
+    ArenaMemoryManager mm("arena",arena_size);
+    void* a=mm.malloc(1000);
+    void* b=mm.malloc(5000);
+    void* c=mm.malloc(300);
+    mm.free(b);
+    cout<<mm<<endl;
+    mm.free(a);
+    mm.free(c);
+    cout<<mm<<endl;
+  }
+
+  // the error names the arena
+  try{ArenaMemoryManager too_big("too_big",((size_t)1)<<62);}
+  catch(const std::runtime_error& e){cout<<e.what()<<endl<<endl;}
+
+  for(int nblocks: {1000,10000}){
+    ArenaMemoryManager arena("arena",arena_size);
+    SimpleMemoryManager simple("simple",arena_size);
+    cout<<nblocks<<" live blocks:"<<endl;
+    cout<<"  ArenaMemoryManager:  "<<churn(arena,nblocks,20000)<<" us per free/malloc"<<endl;
+    cout<<"  SimpleMemoryManager: "<<churn(simple,nblocks,20000)<<" us per free/malloc"<<endl;
+  }
+
+}
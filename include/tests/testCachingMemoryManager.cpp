@@ -0,0 +1,49 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "TensorView_functions.hpp"
+#include "CachingMemoryManager.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+  CachingMemoryManager mm("host");
+
+  {
+    using_host_manager hm(&mm);
+    TensorView<float> A=TensorView<float>::gaussian({100,100});
+    TensorView<float> B=TensorView<float>::gaussian({100,100});
+
+    for(int i=0; i<1000; i++){
+      TensorView<float> C=A+B;
+      TensorView<float> D=C.odot(A);
+    }
+
+    MultiLoop(8,[&](const int i){
+	using_host_manager hm(&mm);
+	for(int j=0; j<100; j++){
+	  TensorView<float> C=A+B;
+	}
+      });
+  }
+
+  cout<<mm<<endl;
+  mm.trim();
+  cout<<"Cached after trim: "<<mm.cached()<<" bytes"<<endl;
+
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "TensorView_functions.hpp"
+#include "ArenaMemoryManager.hpp"
+#include "CachingMemoryManager.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session;
+  session.set_huge_pages(1<<24);
+  cout<<session.mem_policy()<<endl;
+
+  TensorView<float> A=TensorView<float>::gaussian({5,7});
+  cout<<"A aligned to 64: "<<(reinterpret_cast<size_t>(A.get_arr())%64==0)<<endl;
+
+  TensorView<double> B({1<<12,1<<10},fill_zero());
+  cout<<"B aligned to 2MB: "<<(reinterpret_cast<size_t>(B.get_arr())%MemPolicy::huge_page_size==0)<<endl;
+
+  MemPolicy padded(64,0,true);
+  TensorView<float> C({5,7},padded,4,0);
+  cout<<"C strides: "<<C.strides<<endl;
+  for(int i=0; i<5; i++)
+    cout<<(reinterpret_cast<size_t>(&C.arr[C.strides[0]*i])%64==0);
+  cout<<endl;
+
+  C.set(A);
+  cout<<C<<endl;
+  cout<<C+A<<endl;
+
+  session.set_alignment(256);
+  ArenaMemoryManager arena(1<<20);
+  CachingMemoryManager caching;
+  {
+    using_host_manager guard(&arena);
+    TensorView<float> D=TensorView<float>::gaussian({5,7});
+    TensorView<float> E=TensorView<float>::gaussian({3,3});
+    cout<<"arena blocks aligned to 256: "<<(reinterpret_cast<size_t>(D.get_arr())%256==0 && 
+      reinterpret_cast<size_t>(E.get_arr())%256==0)<<endl;
+  }
+  cout<<"arena empty again: "<<(arena.in_use()==0)<<endl;
+  {
+    using_host_manager guard(&caching);
+    TensorView<float> D=TensorView<float>::gaussian({5,7});
+    TensorView<double> F({1<<12,1<<10},fill_zero());
+    cout<<"cached blocks aligned to 256: "<<(reinterpret_cast<size_t>(D.get_arr())%256==0)<<", to 2MB: "<<
+      (reinterpret_cast<size_t>(F.get_arr())%MemPolicy::huge_page_size==0)<<endl;
+  }
+  cout<<"caching manager empty again: "<<(caching.in_use()==0)<<endl;
+
+}
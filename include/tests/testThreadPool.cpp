@@ -0,0 +1,61 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2021, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#include "Cnine_base.cpp"
+
+#include "CnineSession.hpp"
+#include "ThreadPool.hpp"
+#include "MultiLoop.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  atomic<long> total(0);
+  parallel_for(0,1000,16,[&](const int i){
+      total+=i;});
+  cout<<"Sum of 0..999: "<<total<<endl;
+
+  vector<long> row_sums(8,0);
+  parallel_for(0,8,1,[&](const int i){
+      atomic<long> t(0);
+      parallel_for(0,10000,100,[&](const int j){t+=i*j;});
+      row_sums[i]=t;
+    });
+  for(int i=0; i<8; i++)
+    cout<<row_sums[i]<<" ";
+  cout<<endl;
+
+  // a thread waiting for a loop does not run other iterations of the enclosing loop in the meantime
+  static thread_local int current=-1;
+  atomic<int> clobbered(0);
+  parallel_for(0,64,1,[&](const int i){
+      current=i;
+      atomic<long> t(0);
+      parallel_for(0,1000,10,[&](const int j){t+=j;});
+      if(current!=i) clobbered++;
+    });
+  cout<<"Iterations whose thread local state changed during a wait: "<<clobbered<<endl;
+
+  auto t0=chrono::system_clock::now();
+  for(int k=0; k<1000; k++)
+    MultiLoop(4,[](const int i){});
+  cout<<"1000 MultiLoops: "<<chrono::duration<double,std::milli>(chrono::system_clock::now()-t0).count()<<" ms"<<endl;
+
+  cout<<session<<endl;
+  cout<<thread_pool<<endl;
+
+}
@@ -0,0 +1,143 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _cnine_BSRlayout
+#define _cnine_BSRlayout
+
+#include "Cnine_base.hpp"
+#include <map>
+
+
+namespace cnine{
+
+
+  // ---- BSRlayout --------------------------------------------------------------------------------------------
+  //
+  // Compressed sparse row index of a block sparse matrix with n block rows: the blocks of block row i are
+  // k=ptr[i],...,ptr[i+1]-1, in increasing order of their block column idx[k], and the data of block k is
+  // slice offs[k] of the tensor holding the blocks. Built from the nested maps of double_indexed_map.
+
+
+  class BSRlayout{
+  public:
+
+    int n=0;
+    vector<int> ptr;
+    vector<int> idx;
+    vector<int> offs;
+
+
+  public: // ---- Constructors -------------------------------------------------------------------------------
+
+
+    BSRlayout():
+      ptr(1,0){}
+
+    BSRlayout(const int _n, const std::map<int,std::map<int,int> >& blocks):
+      n(_n), ptr(_n+1,0){
+      for(auto& p:blocks){
+	CNINE_ASSRT(p.first<n);
+	ptr[p.first+1]=p.second.size();
+      }
+      for(int i=0; i<n; i++)
+	ptr[i+1]+=ptr[i];
+      idx.resize(ptr[n]);
+      offs.resize(ptr[n]);
+      for(auto& p:blocks){
+	int k=ptr[p.first];
+	for(auto& q:p.second){
+	  idx[k]=q.first;
+	  offs[k]=q.second;
+	  k++;
+	}
+      }
+    }
+
+
+  public: // ---- Transposes ---------------------------------------------------------------------------------
+
+
+    // The layout of the transpose with m block rows, by counting sort, so its rows are sorted as well
+    BSRlayout transp(const int m) const{
+      BSRlayout R;
+      R.n=m;
+      R.ptr.assign(m+1,0);
+      R.idx.resize(nnzb());
+      R.offs.resize(nnzb());
+      for(auto j:idx){
+	CNINE_ASSRT(j<m);
+	R.ptr[j+1]++;
+      }
+      for(int j=0; j<m; j++)
+	R.ptr[j+1]+=R.ptr[j];
+      vector<int> next(R.ptr.begin(),R.ptr.end()-1);
+      for(int i=0; i<n; i++)
+	for(int k=ptr[i]; k<ptr[i+1]; k++){
+	  const int t=next[idx[k]]++;
+	  R.idx[t]=i;
+	  R.offs[t]=offs[k];
+	}
+      return R;
+    }
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    int size() const{
+      return n;
+    }
+
+    int nnzb() const{
+      return ptr[n];
+    }
+
+    int size_of(const int i) const{
+      CNINE_ASSRT(i<n);
+      return ptr[i+1]-ptr[i];
+    }
+
+    // Position of block column j in block row i, or -1
+    int find(const int i, const int j) const{
+      auto it=std::lower_bound(idx.begin()+ptr[i],idx.begin()+ptr[i+1],j);
+      if(it==idx.begin()+ptr[i+1] || *it!=j) return -1;
+      return it-idx.begin();
+    }
+
+
+  public: // ---- I/O ----------------------------------------------------------------------------------------
+
+
+    string classname() const{
+      return "BSRlayout";
+    }
+
+    string str(const string indent="") const{
+      ostringstream oss;
+      for(int i=0; i<n; i++){
+	oss<<indent<<i<<": ";
+	for(int k=ptr[i]; k<ptr[i+1]; k++)
+	  oss<<"("<<idx[k]<<":"<<offs[k]<<")";
+	oss<<endl;
+      }
+      return oss.str();
+    }
+
+    friend ostream& operator<<(ostream& stream, const BSRlayout& x){
+      stream<<x.str(); return stream;}
+
+  };
+
+}
+
+#endif
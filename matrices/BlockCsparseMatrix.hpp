@@ -22,6 +22,12 @@
 #include "double_indexed_map.hpp"
 #include "once.hpp"
 #include "GatherMapB.hpp"
+#include "BSRlayout.hpp"
+#include "ThreadPool.hpp"
+#include "CpuElementwise.hpp"
+#include "BalancedPartition.hpp"
+#include "CpuGemm.hpp"
+#include "fnlog.hpp"
 
 namespace cnine{
 
@@ -65,6 +71,29 @@ namespace cnine{
 
     RemoteCopy<int,ITENSOR> row_offsets_on_device=cnine::RemoteCopy<int,ITENSOR>([this](const int& _dev){
 	return to_share(new ITENSOR(row_offsets(),_dev));});
+
+    // The lazily built BSR layouts. They are immutable once built, so copies of the matrix share them.
+    class BSRcache{
+    public:
+      std::mutex mx;
+      shared_ptr<BSRlayout> bsr;
+      shared_ptr<BSRlayout> transp;
+      BSRcache(){}
+      BSRcache(const BSRcache& x){
+	std::lock_guard<std::mutex> lock(const_cast<BSRcache&>(x).mx);
+	bsr=x.bsr; 
+	transp=x.transp;
+      }
+      BSRcache& operator=(const BSRcache& x){
+	if(&x==this) return *this;
+	std::scoped_lock lock(mx,const_cast<BSRcache&>(x).mx);
+	bsr=x.bsr;
+	transp=x.transp;
+	return *this;
+      }
+    };
+
+    mutable BSRcache _bsr;
     
       
   public: // ---- Constructors -----------------------------------------------------------------------------
@@ -151,6 +180,27 @@ namespace cnine{
       offsets.for_each([&](const int i, const int j, const int offset){
 	  lambda(i,j,mx.slice(0,offset));});
     }
+
+    // The compressed block row index of the matrix, built on first use. Safe to call from several threads.
+    const BSRlayout& bsr() const{
+      std::lock_guard<std::mutex> lock(_bsr.mx);
+      return bsr_locked();
+    }
+
+    // The same for the transpose, i.e., by block columns
+    const BSRlayout& bsr_transp() const{
+      std::lock_guard<std::mutex> lock(_bsr.mx);
+      if(!_bsr.transp) _bsr.transp=make_shared<BSRlayout>(bsr_locked().transp(mblocks));
+      return *_bsr.transp;
+    }
+
+  private:
+
+    // bsr() with _bsr.mx held
+    const BSRlayout& bsr_locked() const{
+      if(!_bsr.bsr) _bsr.bsr=make_shared<BSRlayout>(nblocks,offsets.rmap);
+      return *_bsr.bsr;
+    }
       
 
   public: // ---- Operations --------------------------------------------------------------------------------
@@ -176,9 +226,8 @@ namespace cnine{
       CNINE_ASSRT(x.dim(1)==r.dim(1));
 
       if(dev==0){
-	for_each_block([&](const int i, const int j, const TENSOR& b){
-	    r.rows(i*blockn,blockn).add_mprod(b,x.rows(j*blockm,blockm));
-	  });
+	fnlog timer("BlockCsparseMatrix::apply_to()");
+	multiply(bsr(),false,r,x);
       }else{
 	CUDA_STREAM(BSM_apply_to_BV_cu(*this,r,x,stream));
       }
@@ -196,40 +245,190 @@ namespace cnine{
       CNINE_ASSRT(x.dim(1)==r.dim(1));
 
       if(dev==0){
-	for_each_block([&](const int i, const int j, const TENSOR& b){
-	    r.rows(j*blockm,blockm).add_mprod(b.transp(),x.rows(i*blockn,blockn));
-	  });
+	fnlog timer("BlockCsparseMatrix::apply_transp_to()");
+	multiply(bsr_transp(),true,r,x);
       }else{
 	CUDA_STREAM(BSM_apply_to_BV_cu(*this,r,x,stream));
       }
     }
 
 
-    BlockCsparseMatrix operator*(const BlockCsparseMatrix& x){
-
-      BlockCsparseMatrix R;
-      int t=0;
-      for(auto& p1:offsets.rmap)
-	for(auto& p2:x.offsets.cmap){
-	  bool found=0;
-	  for(auto& q1:p1.second)
-	    if(p2.second.find(q1.first)!=p2.second.end()){
-	      found=true;
-	      break;
+    // Block sparse product. The symbolic phase finds the block pattern of each block row of the result by
+    // merging the sorted block rows of y selected by the blocks of the corresponding block row of this
+    // matrix. The numeric phase then accumulates each product of blocks straight into its preallocated 
+    // slot of the result, visiting the slots of a block row in order. Both phases run in parallel over 
+    // ranges of block rows of roughly equal work.
+    BlockCsparseMatrix operator*(const BlockCsparseMatrix& y) const{
+      CNINE_ASSRT(mblocks==y.nblocks);
+      CNINE_ASSRT(blockm==y.blockn);
+      CNINE_ASSRT(y.get_dev()==get_dev());
+      fnlog timer("BlockCsparseMatrix::operator*(BlockCsparseMatrix)");
+      const BSRlayout& A=bsr();
+      const BSRlayout& B=y.bsr();
+      const int N=A.size();
+
+      // the work of each block row is the number of block products it takes
+      BalancedPartition parts(N,[&](const int i){
+	  size_t t=A.size_of(i)+1;
+	  for(int k=A.ptr[i]; k<A.ptr[i+1]; k++)
+	    t+=B.size_of(A.idx[k]);
+	  return t;
+	},(size_t)blockn*blockm*y.blockm);
+
+      // symbolic phase
+      vector<vector<int> > pattern(N);
+      parts.for_each_range([&](const int i0, const int i1){
+	  vector<int> buf;
+	  for(int i=i0; i<i1; i++){
+	    vector<int>& cols=pattern[i];
+	    for(int k=A.ptr[i]; k<A.ptr[i+1]; k++){
+	      const int c=A.idx[k];
+	      buf.clear();
+	      std::set_union(cols.begin(),cols.end(),B.idx.begin()+B.ptr[c],B.idx.begin()+B.ptr[c+1],
+		std::back_inserter(buf));
+	      cols.swap(buf);
 	    }
-	  if(found) R.offsets.set(p1.first,p2.first,t++);
+	  }
+	});
+
+      BlockCsparseMatrix R(nblocks,y.mblocks,blockn,y.blockm);
+      auto C=make_shared<BSRlayout>();
+      C->n=N;
+      C->ptr.assign(N+1,0);
+      for(int i=0; i<N; i++)
+	C->ptr[i+1]=C->ptr[i]+pattern[i].size();
+      const int nnzb=C->ptr[N];
+      C->idx.resize(nnzb);
+      C->offs.resize(nnzb);
+      for(int i=0; i<N; i++){
+	std::copy(pattern[i].begin(),pattern[i].end(),C->idx.begin()+C->ptr[i]);
+	for(int s=C->ptr[i]; s<C->ptr[i+1]; s++){
+	  C->offs[s]=s;
+	  R.offsets.set(i,C->idx[s],s);
 	}
+      }
+      R.mx.reset(TENSOR(dims(nnzb,blockn,y.blockm),0,get_dev()));
+      R._bsr.bsr=C;
+
+      // numeric phase
+      if(get_dev()>0){
+	for(int i=0; i<N; i++)
+	  for(int k=A.ptr[i]; k<A.ptr[i+1]; k++){
+	    const int c=A.idx[k];
+	    for(int l=B.ptr[c]; l<B.ptr[c+1]; l++)
+	      R.mx.slice(0,C->find(i,B.idx[l])).add_mprod(mx.slice(0,A.offs[k]),y.mx.slice(0,B.offs[l]));
+	  }
+	return R;
+      }
 
-      R.mx.reset(TENSOR(dims(t,blockn,x.blockm),0,get_dev()));
-      for(auto& p1:offsets.rmap)
-	for(auto& p2:x.offsets.cmap)
-	  for(auto& q1:p1.second)
-	    if(p2.second.find(q1.first)!=p2.second.end())
-	      R.block(p1.first,p2.first).add_mprod(block(p1.first,q1.first),x.block(q1.first,p2.first));
+      TYPE* rarr=R.mx.get_arr();
+      const int rs0=R.mx.strides[0], rs1=R.mx.strides[1], rs2=R.mx.strides[2];
+      const int as0=mx.strides[0], as1=mx.strides[1], as2=mx.strides[2];
+      const int ys0=y.mx.strides[0], ys1=y.mx.strides[1], ys2=y.mx.strides[2];
+      const int zero=0;
+      parts.for_each([&](const int i){
+	  for(int k=A.ptr[i]; k<A.ptr[i+1]; k++){
+	    const int c=A.idx[k];
+	    int s=C->ptr[i];
+	    for(int l=B.ptr[c]; l<B.ptr[c+1]; l++){
+	      while(C->idx[s]<B.idx[l]) s++;
+	      block_row(blockn,blockm,rarr+((size_t)s)*rs0,rs1,rs2,mx.get_arr(),as0,as1,as2,&zero,&A.offs[k],1,
+		y.mx.get_arr()+((size_t)B.offs[l])*ys0,ys1,ys2,y.blockm);
+	    }
+	  }
+	});
       return R;
     }
 
 
+  private: // ---- Block row kernels -----------------------------------------------------------------------
+
+
+    static constexpr int tile_cols=BalancedPartition::tile_cols;
+    static constexpr int large_block=32;
+
+    // r+=A*x (or A^T*x if transp) on the host, where L is the block row index of A (or of A^T). Each task
+    // takes a range of block rows with roughly equal numbers of blocks and accumulates all the blocks of 
+    // each of its block rows into the corresponding rows of r, so the tasks write to disjoint rows. 
+    void multiply(const BSRlayout& L, const bool transp, const TensorView<TYPE>& r, const TensorView<TYPE>& x) const{
+      const int N=L.size();
+      const int k=x.dim(1);
+      if(N==0 || k==0 || L.nnzb()==0) return;
+
+      const int bn=transp?blockm:blockn;
+      const int bm=transp?blockn:blockm;
+      const int bs0=transp?mx.strides[2]:mx.strides[1];
+      const int bs1=transp?mx.strides[1]:mx.strides[2];
+      const int ms0=mx.strides[0];
+      const int rs0=r.strides[0], rs1=r.strides[1];
+      const int xs0=x.strides[0], xs1=x.strides[1];
+
+      BalancedPartition(N,[&](const int i){return L.size_of(i)+1;},(size_t)bn*bm*k).for_each([&](const int i){
+	  block_row(bn,bm,r.get_arr()+((size_t)i)*bn*rs0,rs0,rs1,mx.get_arr(),ms0,bs0,bs1,
+	    L.idx.data()+L.ptr[i],L.offs.data()+L.ptr[i],L.size_of(i),x.get_arr(),xs0,xs1,k);});
+    }
+
+    // Dispatch one block row to the kernel specialized for the block shape. Large blocks go through the 
+    // packed GEMM instead.
+    static void block_row(const int bn, const int bm, TYPE* r, const int rs0, const int rs1, const TYPE* mx, 
+      const int ms0, const int bs0, const int bs1, const int* cols, const int* offs, const int nb, 
+      const TYPE* x, const int xs0, const int xs1, const int k){
+      if(nb==0) return;
+      if constexpr(std::is_same<TYPE,float>::value || std::is_same<TYPE,double>::value){
+	if(bn>=large_block && bm>=large_block && k>=large_block){
+	  for(int q=0; q<nb; q++)
+	    CpuGemm<TYPE>::add(bn,k,bm,1,mx+((size_t)offs[q])*ms0,bs0,bs1,
+	      x+((size_t)cols[q])*bm*xs0,xs0,xs1,r,rs0,rs1);
+	  return;
+	}
+      }
+      if(bn==bm){
+	switch(bn){
+	case 1: block_row_kernel<1,1>(bn,bm,r,rs0,rs1,mx,ms0,bs0,bs1,cols,offs,nb,x,xs0,xs1,k); return;
+	case 2: block_row_kernel<2,2>(bn,bm,r,rs0,rs1,mx,ms0,bs0,bs1,cols,offs,nb,x,xs0,xs1,k); return;
+	case 3: block_row_kernel<3,3>(bn,bm,r,rs0,rs1,mx,ms0,bs0,bs1,cols,offs,nb,x,xs0,xs1,k); return;
+	case 4: block_row_kernel<4,4>(bn,bm,r,rs0,rs1,mx,ms0,bs0,bs1,cols,offs,nb,x,xs0,xs1,k); return;
+	case 8: block_row_kernel<8,8>(bn,bm,r,rs0,rs1,mx,ms0,bs0,bs1,cols,offs,nb,x,xs0,xs1,k); return;
+	case 16: block_row_kernel<16,16>(bn,bm,r,rs0,rs1,mx,ms0,bs0,bs1,cols,offs,nb,x,xs0,xs1,k); return;
+	}
+      }
+      block_row_kernel<0,0>(bn,bm,r,rs0,rs1,mx,ms0,bs0,bs1,cols,offs,nb,x,xs0,xs1,k);
+    }
+
+    // r+=sum_q B_q*x[cols[q]] for the blocks B_q of one block row, one tile of tile_cols columns of x at 
+    // a time, so the bn rows of the tile of r stay in L1 while the blocks stream through. BN and BM are
+    // the block shape if known at compile time, or 0.
+    template<int BN, int BM>
+    static void block_row_kernel(const int _bn, const int _bm, TYPE* r, const int rs0, const int rs1, 
+      const TYPE* mx, const int ms0, const int bs0, const int bs1, const int* cols, const int* offs, const int nb, 
+      const TYPE* x, const int xs0, const int xs1, const int k){
+      const int bn=BN>0?BN:_bn;
+      const int bm=BM>0?BM:_bm;
+      const bool unit=(rs1==1 && xs1==1);
+      for(int c0=0; c0<k; c0+=tile_cols){
+	const int mc=std::min(tile_cols,k-c0);
+	for(int q=0; q<nb; q++){
+	  if(q+1<nb) CNINE_PREFETCH(mx+((size_t)offs[q+1])*ms0);
+	  const TYPE* B=mx+((size_t)offs[q])*ms0;
+	  const TYPE* xq=x+((size_t)cols[q])*bm*xs0+((size_t)c0)*xs1;
+	  for(int a=0; a<bn; a++){
+	    TYPE* t=r+((size_t)a)*rs0+((size_t)c0)*rs1;
+	    for(int b=0; b<bm; b++){
+	      const TYPE v=B[a*bs0+b*bs1];
+	      const TYPE* s=xq+((size_t)b)*xs0;
+	      if(unit){
+		CNINE_IVDEP
+		for(int c=0; c<mc; c++) t[c]+=v*s[c];
+	      }else{
+		for(int c=0; c<mc; c++) t[c*rs1]+=v*s[c*xs1];
+	      }
+	    }
+	  }
+	}
+      }
+    }
+
+
   public: // ---- I/O ---------------------------------------------------------------------------------------
 
 
@@ -16,37 +16,45 @@
 
 #include "Cnine_base.hpp"
 //#include "RtensorA.hpp"
-#include "Tensor.hpp"
+#include "TensorView.hpp"
 #include "array_pool.hpp"
 #include "CSRvector.hpp"
+#include "ThreadPool.hpp"
+#include "CpuElementwise.hpp"
+#include "BalancedPartition.hpp"
+#include "SparseAccumulator.hpp"
+#include "fnlog.hpp"
 
 
 namespace cnine{
 
 
-  template<class TYPE>
-  class CSRmatrix: public array_pool<TYPE>{
+  // CSRmatrix<TYPE,int64_t> stores matrices with 2^30 or more nonzeros. The column indices stay 32 bit.
+
+  template<class TYPE, typename OFFSET>
+  class CSRmatrix: public array_pool<TYPE,OFFSET>{
   public:
 
-    using array_pool<TYPE>::arr;
-    using array_pool<TYPE>::arrg;
-    using array_pool<TYPE>::tail;
-    using array_pool<TYPE>::memsize;
-    using array_pool<TYPE>::dev;
-    using array_pool<TYPE>::is_view;
-    using array_pool<TYPE>::dir;
+    using array_pool<TYPE,OFFSET>::arr;
+    using array_pool<TYPE,OFFSET>::arrg;
+    using array_pool<TYPE,OFFSET>::tail;
+    using array_pool<TYPE,OFFSET>::memsize;
+    using array_pool<TYPE,OFFSET>::dev;
+    using array_pool<TYPE,OFFSET>::is_view;
+    using array_pool<TYPE,OFFSET>::dir;
 
-    using array_pool<TYPE>::reserve;
-    using array_pool<TYPE>::size;
-    using array_pool<TYPE>::offset;
-    using array_pool<TYPE>::size_of;
+    using array_pool<TYPE,OFFSET>::reserve;
+    using array_pool<TYPE,OFFSET>::size;
+    using array_pool<TYPE,OFFSET>::offset;
+    using array_pool<TYPE,OFFSET>::size_of;
 
-    using array_pool<TYPE>::get_device;
+    using array_pool<TYPE,OFFSET>::get_device;
 
     int n=0;
     int m=0;
 
-    mutable CSRmatrix<TYPE>* transpp=nullptr;
+    mutable CSRmatrix* transpp=nullptr; // cached transpose, dropped by every operation that changes the matrix
+    mutable std::mutex transp_mx;
 
     ~CSRmatrix(){
       if(is_view) return;
@@ -58,31 +66,32 @@ namespace cnine{
 
 
     CSRmatrix():
-      array_pool<TYPE>(){}
+      array_pool<TYPE,OFFSET>(){}
 
     CSRmatrix(const int _n, const int _m):
-      array_pool<TYPE>(_n), n(_n), m(_m){}
+      array_pool<TYPE,OFFSET>(_n), n(_n), m(_m){}
 
 
   public: // ---- Copying ------------------------------------------------------------------------------------
 
 
-    CSRmatrix(const CSRmatrix<TYPE>& x):
-      array_pool<TYPE>(x){
+    CSRmatrix(const CSRmatrix& x):
+      array_pool<TYPE,OFFSET>(x){
       n=x.n;
       m=x.m;
     }
 
-    CSRmatrix(CSRmatrix<TYPE>&& x):
-      array_pool<TYPE>(std::move(x)){
+    CSRmatrix(CSRmatrix&& x):
+      array_pool<TYPE,OFFSET>(std::move(x)){
       n=x.n;
       m=x.m;
     }
 
-    CSRmatrix& operator=(const CSRmatrix<TYPE>& x){
-      array_pool<TYPE>::operator=(x);
+    CSRmatrix& operator=(const CSRmatrix& x){
+      array_pool<TYPE,OFFSET>::operator=(x);
       n=x.n;
       m=x.m;
+      clear_transp();
       return *this;
     }
 
@@ -91,11 +100,12 @@ namespace cnine{
 
 
     CSRmatrix(const CSRmatrix& x, const int _dev):
-      array_pool<float>(x,_dev), n(x.n), m(x.m){
+      array_pool<TYPE,OFFSET>(x,_dev), n(x.n), m(x.m){
     }
 
     CSRmatrix& to_device(const int _dev){
-      array_pool<float>::to_device(_dev);
+      clear_transp();
+      array_pool<TYPE,OFFSET>::to_device(_dev);
       return *this;
     }
 
@@ -110,11 +120,11 @@ namespace cnine{
       CSRmatrix(x.n0,x.n1){
       dir.resize0(x.n0);
 
-      int t=0;
+      size_t t=0;
       for(int i=0; i<n; i++)
 	for(int j=0; j<m; j++)
 	  if(x(i,j)!=0) t++;
-      array_pool<TYPE>::reserve(2*t);
+      reserve(array_pool<TYPE,OFFSET>::checked_total(2*t));
 
       tail=0;
       for(int i=0; i<n; i++){
@@ -179,7 +189,7 @@ namespace cnine{
 
     int size_of(const int i) const{
       CNINE_CHECK_RANGE(if(i>=n) throw std::out_of_range("In CSRmatrix::size_of(): index "+to_string(i)+" out of range (0,"+to_string(n-1)+")."));
-      return array_pool<TYPE>::size_of(i)/2;
+      return array_pool<TYPE,OFFSET>::size_of(i)/2;
     }
 
     //int lenght_of_row(const int i){
@@ -192,7 +202,7 @@ namespace cnine{
       CNINE_CHECK_RANGE(if(i>=n) throw std::out_of_range("In CSRmatrix::operator(): index "+to_string(i)+" out of range (0,"+to_string(n-1)+")."));
       CNINE_CHECK_RANGE(if(i>=m) throw std::out_of_range("In CSRmatrix::operator(): index "+to_string(i)+" out of range (0,"+to_string(m-1)+")."));
       CNINE_ASSRT(i<size());
-      int offs=dir(i,0);
+      OFFSET offs=dir(i,0);
       int s=dir(i,1);
       for(int a=0; a<s; a++)
 	if(*reinterpret_cast<int*>(arr+offs+2*a)==j)
@@ -203,7 +213,8 @@ namespace cnine{
     void set_at(const int i, const int k, const int j, const TYPE v){
       CNINE_CHECK_RANGE(if(i>=n) throw std::out_of_range("In CSRmatrix::set_at(...): index "+to_string(i)+" out of range (0,"+to_string(n-1)+")."));
       CNINE_CHECK_RANGE(if(k>=size_of(i)) throw std::out_of_range("In CSRmatrix::set_at(...): index "+to_string(k)+" out of range (0,"+to_string(size_of(i)-1)+")."));
-      int offs=offset(i);
+      clear_transp();
+      OFFSET offs=offset(i);
       *reinterpret_cast<int*>(arr+offs+2*k)=j;
       arr[offs+2*k+1]=v;
     }
@@ -222,7 +233,7 @@ namespace cnine{
       }
       for(int i=0; i<size(); i++){
 	int len=size_of(i);
-	int offs=offset(i);
+	OFFSET offs=offset(i);
 	for(int j=0; j<len; j++)
 	  lambda(i,*reinterpret_cast<int*>(arr+offs+2*j),arr[offs+2*j+1]);
       }
@@ -236,10 +247,10 @@ namespace cnine{
     void push_back(const vector<int>& ix, const vector<TYPE>& v){
       int len=ix.size();
       CNINE_ASSRT(v.size()==len);
-      if(tail+2*len>memsize)
-	reserve(std::max(2*memsize,tail+2*len));
+      clear_transp();
+      array_pool<TYPE,OFFSET>::grow((size_t)tail+2*len);
       for(int i=0; i<len; i++){
-	arr[tail+2*i]=ix[i];
+	*reinterpret_cast<int*>(arr+tail+2*i)=ix[i];
 	arr[tail+2*i+1]=v[i];
       }
       dir.push_back(tail,2*len);
@@ -247,6 +258,170 @@ namespace cnine{
     }
 
 
+  public: // ---- Operations ---------------------------------------------------------------------------------
+
+
+    static constexpr int tile_cols=BalancedPartition::tile_cols;
+    static constexpr int prefetch_dist=BalancedPartition::prefetch_dist;
+
+    TensorView<TYPE> operator*(const TensorView<TYPE>& x) const{
+      CNINE_ASSRT(x.ndims()==1 || x.ndims()==2);
+      Gdims rdims(x.get_dims());
+      rdims[0]=n;
+      TensorView<TYPE> R(rdims,0,x.get_dev());
+      apply_to(R,x);
+      return R;
+    }
+
+    // r+=A*x, where x is a vector of length m or an m x k matrix, and r is a vector of length n or an n x k 
+    // matrix. The rows are split into ranges of roughly equal numbers of nonzeros, one range per task, and 
+    // each task accumulates into its own rows of r, vectorized along the columns of x.
+    void apply_to(const TensorView<TYPE>& r, const TensorView<TYPE>& x) const{
+      CNINE_CPUONLY();
+      CNINE_ASSRT(x.get_dev()==0 && r.get_dev()==0);
+      CNINE_ASSRT(x.ndims()==r.ndims());
+      CNINE_ASSRT(x.ndims()==1 || x.ndims()==2);
+      CNINE_ASSRT(x.dim(0)==m);
+      CNINE_ASSRT(r.dim(0)==n);
+      CNINE_ASSRT(size()<=n);
+      const bool matrix=(x.ndims()==2);
+      if(matrix) CNINE_ASSRT(r.dim(1)==x.dim(1));
+      multiply(r.get_arr(),r.strides[0],matrix?r.strides[1]:1,x.get_arr(),x.strides[0],matrix?x.strides[1]:1,
+	matrix?x.dim(1):1);
+    }
+
+    // r+=A^T*x. This goes through the cached transpose rather than scattering into r, so that each task 
+    // still writes to its own rows only.
+    void apply_transp_to(const TensorView<TYPE>& r, const TensorView<TYPE>& x) const{
+      transp().apply_to(r,x);
+    }
+
+
+    // Sparse-sparse product. The symbolic pass counts the nonzeros of each row of the result, which fixes
+    // the layout of the output, then the numeric pass fills in each row with sorted columns. Both passes 
+    // run in parallel over ranges of rows of roughly equal work, each task with its own SparseAccumulator.
+    CSRmatrix operator*(const CSRmatrix& y) const{
+      CNINE_CPUONLY();
+      CNINE_CPUONLY1(y);
+      CNINE_ASSRT(m==y.n);
+      fnlog timer("CSRmatrix::operator*(CSRmatrix)");
+      const int N=size();
+      CSRmatrix R(n,y.m);
+
+      // this matrix may also store fewer than n rows, the rows of R past N stay empty
+      if(N==0){
+	for(int i=0; i<n; i++){
+	  R.dir.set(i,0,0);
+	  R.dir.set(i,1,0);
+	}
+	return R;
+      }
+
+      // y may store fewer than y.n rows (rows are appended by push_back), the missing ones are zero
+      auto ysize_of=[&](const int k){return k<y.size()?y.size_of(k):0;};
+
+      // upper bound on the number of nonzeros in each row, which is also the work it takes
+      vector<size_t> bound(N,0);
+      for(int i=0; i<N; i++){
+	const TYPE* p=arr+offset(i);
+	const int len=size_of(i);
+	for(int j=0; j<len; j++)
+	  bound[i]+=ysize_of(*reinterpret_cast<const int*>(p+2*j));
+      }
+      BalancedPartition parts(N,[&](const int i){return bound[i]+size_of(i)+1;});
+
+      auto for_each_product=[&](const int i, const auto& fn){
+	const TYPE* p=arr+offset(i);
+	const int len=size_of(i);
+	for(int j=0; j<len; j++){
+	  const int k=*reinterpret_cast<const int*>(p+2*j);
+	  const TYPE a=p[2*j+1];
+	  const int ylen=ysize_of(k);
+	  if(ylen==0) continue;
+	  const TYPE* q=y.arr+y.offset(k);
+	  for(int l=0; l<ylen; l++)
+	    fn(*reinterpret_cast<const int*>(q+2*l),a*q[2*l+1]);
+	}
+      };
+
+      vector<int> nnz(N,0);
+      parts.for_each_range([&](const int i0, const int i1){
+	  SparseAccumulator<TYPE> acc(y.m);
+	  for(int i=i0; i<i1; i++){
+	    acc.start(bound[i]);
+	    for_each_product(i,[&](const int c, const TYPE v){acc.insert(c);});
+	    nnz[i]=acc.size();
+	  }
+	});
+
+      size_t t=0;
+      for(int i=0; i<N; i++){
+	R.dir.set(i,0,t);
+	R.dir.set(i,1,2*nnz[i]);
+	t+=2*nnz[i];
+      }
+      for(int i=N; i<n; i++){
+	R.dir.set(i,0,t);
+	R.dir.set(i,1,0);
+      }
+      R.reserve(array_pool<TYPE,OFFSET>::checked_total(t));
+      R.tail=t;
+
+      parts.for_each_range([&](const int i0, const int i1){
+	  SparseAccumulator<TYPE> acc(y.m);
+	  for(int i=i0; i<i1; i++){
+	    acc.start(bound[i]);
+	    for_each_product(i,[&](const int c, const TYPE v){acc.add(c,v);});
+	    acc.flush(R.arr+R.offset(i));
+	  }
+	});
+      return R;
+    }
+
+
+  private:
+
+    void multiply(TYPE* r, const int rs0, const int rs1, const TYPE* x, const int xs0, const int xs1, 
+      const int k) const{
+      const int N=size();
+      if(N==0 || k==0) return;
+
+      BalancedPartition(N,[&](const int i){return size_of(i)+1;},k).for_each([&](const int i){
+	  multiply_row(r+((size_t)i)*rs0,rs1,arr+offset(i),size_of(i),x,xs0,xs1,k);});
+    }
+
+    // t+=sum_j v_j*x[c_j] for the (c_j,v_j) pairs of one row, in tiles of tile_cols columns
+    static void multiply_row(TYPE* t, const int ts, const TYPE* p, const int len, const TYPE* x, const int xs0, 
+      const int xs1, const int k){
+      auto col=[p](const int j){return *reinterpret_cast<const int*>(p+2*j);};
+
+      if(k==1){
+	TYPE a=0;
+	for(int j=0; j<len; j++)
+	  a+=p[2*j+1]*x[((size_t)col(j))*xs0];
+	t[0]+=a;
+	return;
+      }
+
+      const bool unit=(ts==1 && xs1==1);
+      for(int c0=0; c0<k; c0+=tile_cols){
+	const int mc=std::min(tile_cols,k-c0);
+	TYPE* tt=t+((size_t)c0)*ts;
+	for(int j=0; j<len; j++){
+	  if(j+prefetch_dist<len) CNINE_PREFETCH(x+((size_t)col(j+prefetch_dist))*xs0+((size_t)c0)*xs1);
+	  const TYPE v=p[2*j+1];
+	  const TYPE* s=x+((size_t)col(j))*xs0+((size_t)c0)*xs1;
+	  if(unit){
+	    CNINE_IVDEP
+	    for(int c=0; c<mc; c++) tt[c]+=v*s[c];
+	  }else{
+	    for(int c=0; c<mc; c++) tt[c*ts]+=v*s[c*xs1];
+	  }
+	}
+      }
+    }
+
+
   public: // ---- GPU access ---------------------------------------------------------------------------------
 
     
@@ -258,15 +433,27 @@ namespace cnine{
   public: // ---- Transposes ---------------------------------------------------------------------------------
 
 
+    // The transpose, built on first use and cached until the matrix changes. Safe to call from several
+    // threads at once.
     const CSRmatrix& transp() const{
+      std::lock_guard<std::mutex> lock(transp_mx);
       if(!transpp) make_transp();
       return *transpp;
     }
 
+    // Drop the cached transpose
+    void clear_transp(){
+      std::lock_guard<std::mutex> lock(transp_mx);
+      if(transpp) delete transpp;
+      transpp=nullptr;
+    }
+
+  private:
+
     void make_transp() const{
       if(transpp) delete transpp;
-      transpp=new CSRmatrix<TYPE>(m,n);
-      CSRmatrix<TYPE>& T=*transpp;
+      transpp=new CSRmatrix(m,n);
+      CSRmatrix& T=*transpp;
       T.reserve(tail);
 
       vector<int> len(m,0);
@@ -282,7 +469,7 @@ namespace cnine{
 
       std::fill(len.begin(),len.end(),0);
       for_each([&](const int i, const int j, const TYPE v){
-	  int offs=T.offset(j);
+	  OFFSET offs=T.offset(j);
 	  *reinterpret_cast<int*>(T.arr+offs+2*len[j])=i;
 	  T.arr[offs+2*len[j]+1]=v;
 	  len[j]++;
@@ -0,0 +1,165 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#ifndef _cnine_SparseAccumulator
+#define _cnine_SparseAccumulator
+
+#include "Cnine_base.hpp"
+
+
+namespace cnine{
+
+
+  // ---- SparseAccumulator ------------------------------------------------------------------------------------
+  //
+  // Accumulates one sparse row of ncols columns at a time, as in the rows of a sparse matrix product. Each
+  // row is started with an upper bound on the number of distinct columns it can have. If the bound is at
+  // least ncols/dense_ratio, the row goes into a dense array reset by stamping, otherwise into an open
+  // addressing hash table of at least twice the bound. Either way, the work per row is proportional to the
+  // number of updates and not to ncols. Meant to be created once per task and reused across its rows.
+
+
+  template<typename TYPE>
+  class SparseAccumulator{
+  public:
+
+    static constexpr int dense_ratio=16;
+
+    int ncols;
+    bool dense=false;
+    int stamp=0;
+    int mask=0;
+    vector<int> stamps;
+    vector<int> keys;
+    vector<TYPE> vals;
+    vector<TYPE> hvals;
+    vector<int> touched; // columns in dense mode, slots in hash mode
+    vector<pair<int,TYPE> > buf;
+
+
+  public: // ---- Constructors -------------------------------------------------------------------------------
+
+
+    SparseAccumulator(const int _ncols):
+      ncols(_ncols){}
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    int size() const{
+      return touched.size();
+    }
+
+    // Start a new row with at most bound distinct columns
+    void start(const size_t bound){
+      clear();
+      dense=(bound*dense_ratio>=(size_t)ncols);
+      if(dense){
+	if(stamps.size()==0){
+	  stamps.assign(ncols,0);
+	  vals.assign(ncols,0);
+	}
+	if(++stamp==std::numeric_limits<int>::max()){
+	  std::fill(stamps.begin(),stamps.end(),0);
+	  stamp=1;
+	}
+      }else{
+	size_t cap=16;
+	while(cap<2*bound) cap*=2;
+	if(keys.size()<cap){
+	  keys.assign(cap,-1);
+	  hvals.resize(cap);
+	}
+	mask=cap-1;
+      }
+    }
+
+    // Register column j without a value (symbolic phase)
+    void insert(const int j){
+      if(dense){
+	if(stamps[j]!=stamp){
+	  stamps[j]=stamp;
+	  touched.push_back(j);
+	}
+      }else slot(j);
+    }
+
+    void add(const int j, const TYPE v){
+      if(dense){
+	if(stamps[j]!=stamp){
+	  stamps[j]=stamp;
+	  vals[j]=v;
+	  touched.push_back(j);
+	}else vals[j]+=v;
+      }else hvals[slot(j)]+=v;
+    }
+
+    // Write the (column,value) pairs of the current row to p in the interleaved layout of CSRmatrix, in
+    // increasing order of columns
+    void flush(TYPE* p){
+      const int N=touched.size();
+      if(dense){
+	if((size_t)N*dense_ratio>=(size_t)ncols){
+	  int k=0;
+	  for(int j=0; j<ncols && k<N; j++)
+	    if(stamps[j]==stamp) write(p,k++,j,vals[j]);
+	  return;
+	}
+	std::sort(touched.begin(),touched.end());
+	for(int k=0; k<N; k++)
+	  write(p,k,touched[k],vals[touched[k]]);
+	return;
+      }
+      buf.resize(N);
+      for(int k=0; k<N; k++)
+	buf[k]=make_pair(keys[touched[k]],hvals[touched[k]]);
+      std::sort(buf.begin(),buf.end(),[](const pair<int,TYPE>& a, const pair<int,TYPE>& b){
+	  return a.first<b.first;});
+      for(int k=0; k<N; k++)
+	write(p,k,buf[k].first,buf[k].second);
+    }
+
+
+  private:
+
+    void clear(){
+      if(!dense)
+	for(auto s:touched) keys[s]=-1;
+      touched.clear();
+    }
+
+    int slot(const int j){
+      int s=(((unsigned int)j)*2654435761u)&mask;
+      while(true){
+	if(keys[s]==j) return s;
+	if(keys[s]==-1){
+	  keys[s]=j;
+	  hvals[s]=0;
+	  touched.push_back(s);
+	  return s;
+	}
+	s=(s+1)&mask;
+      }
+    }
+
+    static void write(TYPE* p, const int k, const int j, const TYPE v){
+      *reinterpret_cast<int*>(p+2*k)=j;
+      p[2*k+1]=v;
+    }
+
+  };
+
+}
+
+#endif
@@ -206,8 +206,13 @@ namespace cnine{
 // 	  if(x(i,j)!=0) set(i,j,x(i,j));
 //     }
 
+    SparseRmatrix(const CSRmatrix<float>& x):
+      n(x.n), m(x.m){
+      x.for_each([&](const int i, const int j, const float v){set(i,j,v);});
+    }
+
     TensorView<float> dense() const{
-      Tensor<float> R({n,m},0,0);
+      TensorView<float> R({n,m},0,0);
       forall_nonzero([&](const int i, const int j, const float v){
 	  R.set(i,j,v);});
       return R;
@@ -338,8 +343,14 @@ namespace cnine{
     }
 
 
+    // Sparse-sparse product, computed by the SpGEMM of CSRmatrix
+    SparseRmatrix operator*(const SparseRmatrix& y) const{
+      CNINE_ASSRT(m==y.n);
+      return SparseRmatrix(csrmatrix()*y.csrmatrix());
+    }
+
     CSRmatrix<float> csrmatrix() const{
-      cnine::CSRmatrix<float> R;
+      cnine::CSRmatrix<float> R(n,m);
       R.dir.resize0(n);
       //cout<<R.dir<<endl;
       int t=0;
@@ -0,0 +1,62 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "BlockCsparseMatrix.hpp"
+
+using namespace cnine;
+
+
+TensorView<float> dense(const BlockCsparseMatrix<float>& A){
+  TensorView<float> D({A.nrows(),A.ncols()},0,0);
+  A.for_each_block([&](const int i, const int j, const TensorView<float>& b){
+      D.block(i*A.block_n(),j*A.block_m(),A.block_n(),A.block_m())+=b;});
+  return D;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  // specialized square shapes, a generic shape, and one large enough for the packed GEMM
+  vector<pair<int,int> > shapes({{1,1},{3,3},{4,4},{16,16},{2,5},{40,40}});
+  for(auto& p: shapes){
+    const int nb=20, mb=15, k=37;
+    GatherMapB mask=GatherMapB::random(nb,mb,0.2);
+    BlockCsparseMatrix<float> A(nb,mb,p.first,p.second,mask.arr,4);
+    TensorView<float> D=dense(A);
+
+    TensorView<float> x=TensorView<float>::gaussian({A.ncols(),k});
+    TensorView<float> R({A.nrows(),k},0,0);
+    R.add_mprod(D,x);
+
+    TensorView<float> y=TensorView<float>::gaussian({A.nrows(),k});
+    TensorView<float> S({A.ncols(),k},0,0);
+    S.add_mprod(D.transp(),y);
+    TensorView<float> T({A.ncols(),k},0,0);
+    A.apply_transp_to(T,y);
+
+    // a strided right hand side
+    TensorView<float> xt=TensorView<float>::gaussian({k,A.ncols()});
+    TensorView<float> Rt({A.nrows(),k},0,0);
+    A.apply_to(Rt,xt.transp());
+    TensorView<float> Rt0({A.nrows(),k},0,0);
+    Rt0.add_mprod(D,xt.transp());
+
+    cout<<p.first<<"x"<<p.second<<" blocks: apply_to "<<(A*x).diff2(R)<<", apply_transp_to "<<T.diff2(S);
+    cout<<", strided "<<Rt.diff2(Rt0)<<endl;
+  }
+
+}
@@ -0,0 +1,80 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "BlockCsparseMatrix.hpp"
+#include <chrono>
+
+using namespace cnine;
+
+
+TensorView<float> dense(const BlockCsparseMatrix<float>& A){
+  TensorView<float> D({A.nrows(),A.ncols()},0,0);
+  A.for_each_block([&](const int i, const int j, const TensorView<float>& b){
+      D.block(i*A.block_n(),j*A.block_m(),A.block_n(),A.block_m())+=b;});
+  return D;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  vector<int> sizes({1,3,4,5,40});
+  for(auto b: sizes){
+    const int nb=30;
+    GatherMapB maskA=GatherMapB::random(nb,nb,0.1);
+    GatherMapB maskB=GatherMapB::random(nb,nb,0.1);
+    BlockCsparseMatrix<float> A(nb,nb,b,b,maskA.arr,4);
+    BlockCsparseMatrix<float> B(nb,nb,b,b,maskB.arr,4);
+    TensorView<float> DA=dense(A);
+    TensorView<float> DB=dense(B);
+
+    TensorView<float> P({A.nrows(),B.ncols()},0,0);
+    P.add_mprod(DA,DB);
+    BlockCsparseMatrix<float> C=A*B;
+
+    TensorView<float> P2({A.nrows(),A.ncols()},0,0);
+    P2.add_mprod(DA,DA);
+    TensorView<float> P3({A.nrows(),A.ncols()},0,0);
+    P3.add_mprod(P2,DA);
+    BlockCsparseMatrix<float> A3=(A*A)*A;
+
+    cout<<b<<"x"<<b<<" blocks: A*B "<<dense(C).diff2(P)<<", A*A*A "<<dense(A3).diff2(P3);
+    cout<<" ("<<C.mx.dim(0)<<" blocks in A*B)"<<endl;
+  }
+
+  // a rectangular chain with blocks of different shapes
+  GatherMapB maskA=GatherMapB::random(12,9,0.3);
+  GatherMapB maskB=GatherMapB::random(9,7,0.3);
+  BlockCsparseMatrix<float> A(12,9,2,3,maskA.arr,4);
+  BlockCsparseMatrix<float> B(9,7,3,5,maskB.arr,4);
+  TensorView<float> P({A.nrows(),B.ncols()},0,0);
+  P.add_mprod(dense(A),dense(B));
+  cout<<"2x3 by 3x5 blocks: "<<dense(A*B).diff2(P)<<endl;
+
+  // throughput of squaring a larger operator
+  const int nb=400, b=8;
+  GatherMapB mask=GatherMapB::random(nb,nb,0.02);
+  BlockCsparseMatrix<float> L(nb,nb,b,b,mask.arr,4);
+  size_t nprod=0;
+  const BSRlayout& I=L.bsr();
+  for(int k=0; k<I.nnzb(); k++) nprod+=I.size_of(I.idx[k]);
+  auto t0=std::chrono::steady_clock::now();
+  BlockCsparseMatrix<float> L2=L*L;
+  auto t1=std::chrono::steady_clock::now();
+  double ms=std::chrono::duration<double,std::milli>(t1-t0).count();
+  cout<<"L*L: "<<nprod<<" block products in "<<ms<<" ms, "<<2.0*nprod*b*b*b/ms/1e6<<" GFlops"<<endl;
+
+}
@@ -0,0 +1,74 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "CSRmatrix.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  const int n=300, m=200, k=37;
+  TensorView<float> D=TensorView<float>::gaussian({n,m});
+  uniform_real_distribution<float> u(0,1);
+  for(int i=0; i<n; i++)
+    for(int j=0; j<m; j++)
+      if(u(rndGen)>0.05) D.set(i,j,0);
+  CSRmatrix<float> A(D);
+
+  TensorView<float> x=TensorView<float>::gaussian({m});
+  TensorView<float> X=TensorView<float>::gaussian({m,k});
+  TensorView<float> Y=TensorView<float>::gaussian({n,k});
+
+  TensorView<float> r({n},0,0);
+  r.add_mvprod(D,x);
+  cout<<"SpMV: "<<(A*x).diff2(r)<<endl;
+
+  TensorView<float> R({n,k},0,0);
+  R.add_mprod(D,X);
+  cout<<"SpMM: "<<(A*X).diff2(R)<<endl;
+
+  TensorView<float> S({m,k},0,0);
+  S.add_mprod(D.transp(),Y);
+  TensorView<float> T({m,k},0,0);
+  A.apply_transp_to(T,Y);
+  cout<<"transposed SpMM: "<<T.diff2(S)<<endl;
+
+  // strided operands: the columns of X.transp() are not contiguous
+  TensorView<float> Xt=TensorView<float>::gaussian({k,m});
+  TensorView<float> Rt({k,n},0,0);
+  A.apply_to(Rt.transp(),Xt.transp());
+  TensorView<float> Rt0({n,k},0,0);
+  Rt0.add_mprod(D,Xt.transp());
+  cout<<"strided SpMM: "<<Rt.transp().diff2(Rt0)<<endl;
+
+  // the cached transpose follows changes to the matrix
+  CSRmatrix<float> B;
+  B.n=2; B.m=3;
+  B.push_back({0,2},{1,2});
+  cout<<"transpose before changes: "<<endl<<TensorView<float>(B.transp())<<endl;
+  B.set_at(0,1,1,5);
+  B.push_back({0},{4});
+  cout<<"transpose after changes: "<<endl<<TensorView<float>(B.transp())<<endl;
+
+  // a product with a right operand that stores fewer rows than it has
+  CSRmatrix<float> C;
+  C.n=3; C.m=3;
+  C.push_back({1},{2});
+  cout<<"product with short operand: "<<endl<<TensorView<float>(B*C)<<endl;
+
+}
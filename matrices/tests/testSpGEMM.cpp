@@ -0,0 +1,82 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "SparseRmatrix.hpp"
+
+using namespace cnine;
+
+
+TensorView<float> sparse_gaussian(const int n, const int m, const float p){
+  TensorView<float> D=TensorView<float>::gaussian({n,m});
+  uniform_real_distribution<float> u(0,1);
+  for(int i=0; i<n; i++)
+    for(int j=0; j<m; j++)
+      if(u(rndGen)>p) D.set(i,j,0);
+  return D;
+}
+
+bool sorted(const CSRmatrix<float>& A){
+  bool r=true;
+  int prev_i=-1, prev_j=-1;
+  A.for_each([&](const int i, const int j, const float v){
+      if(i==prev_i && j<=prev_j) r=false;
+      prev_i=i; prev_j=j;});
+  return r;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session(4);
+
+  // very sparse operands go through the hash accumulator, the denser ones through the dense one
+  for(auto p: vector<float>({0.002,0.05,0.3})){
+    const int n=300, k=400, m=2000;
+    TensorView<float> D=sparse_gaussian(n,k,p);
+    TensorView<float> E=sparse_gaussian(k,m,p);
+    CSRmatrix<float> A(D);
+    CSRmatrix<float> B(E);
+
+    CSRmatrix<float> C=A*B;
+    TensorView<float> F({n,m},0,0);
+    F.add_mprod(D,E);
+    cout<<"density "<<p<<": SpGEMM "<<TensorView<float>(C).diff2(F)<<", sorted: "<<(sorted(C)?"yes":"no")<<endl;
+  }
+
+  // A and B only store some of their rows, the missing ones are zero
+  {
+    CSRmatrix<float> A;
+    A.n=4; A.m=3;
+    A.push_back({0,2},{1.0,2.0});
+    CSRmatrix<float> B;
+    B.n=3; B.m=5;
+    B.push_back({1},{3.0});
+    CSRmatrix<float> C=A*B;
+    TensorView<float> F({4,5},0,0);
+    F.set(0,1,3.0);
+    bool empty=true;
+    for(int i=1; i<4; i++)
+      if(C.size_of(i)!=0 || C.offset(i)>C.tail) empty=false;
+    cout<<"partial rows: SpGEMM "<<TensorView<float>(C).diff2(F)<<", empty rows: "<<(empty?"yes":"no")<<endl;
+  }
+
+  TensorView<float> D=sparse_gaussian(100,100,0.03);
+  SparseRmatrix S(D);
+  SparseRmatrix S2=S*S;
+  TensorView<float> F({100,100},0,0);
+  F.add_mprod(D,D);
+  cout<<"SparseRmatrix product: "<<S2.dense().diff2(F)<<endl;
+
+}
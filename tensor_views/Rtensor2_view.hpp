@@ -20,6 +20,7 @@
 #include "Gtensor.hpp"
 
 #include "Rtensor1_view.hpp"
+#include "CpuGemm.hpp"
 
 #ifdef _WITH_CUBLAS
 #include <cublas_v2.h>
@@ -218,6 +219,10 @@ namespace cnine{
     }
 
     void add_mprod(const Rtensor2_view& x, const Rtensor2_view& y){
+      if(dev==0){
+	add_matmul_AA(x,y);
+	return;
+      }
       if(is_regular()){
 	if(x.is_regular() && y.is_regular()){
 	  add_matmul_AA(x,y);
@@ -244,13 +249,7 @@ namespace cnine{
       CNINE_ASSRT(y.dev==dev);
 
       if(dev==0){
-	for(int a=0; a<n0; a++)
-	  for(int b=0; b<n1; b++){
-	    float t=0;
-	    for(int i=0; i<I; i++)
-	      t+=x(a,i)*y(i,b);
-	    inc(a,b,t);
-	  }
+	CpuGemm<float>::add(n0,n1,I,1.0,x.arr,x.s0,x.s1,y.arr,y.s0,y.s1,arr,s0,s1);
       }
       if(dev==1){
 	CNINE_ASSRT(s1==1);
@@ -272,13 +271,7 @@ namespace cnine{
       CNINE_ASSRT(y.dev==dev);
 
       if(dev==0){
-	for(int a=0; a<n0; a++)
-	  for(int b=0; b<n1; b++){
-	    float t=0;
-	    for(int i=0; i<I; i++)
-	      t+=x(a,i)*y(b,i);
-	    inc(a,b,t);
-	  }
+	CpuGemm<float>::add(n0,n1,I,1.0,x.arr,x.s0,x.s1,y.arr,y.s1,y.s0,arr,s0,s1);
       }
 
       if(dev==1){
@@ -301,13 +294,7 @@ namespace cnine{
       CNINE_ASSRT(y.dev==dev);
 
       if(dev==0){
-	for(int a=0; a<n0; a++)
-	  for(int b=0; b<n1; b++){
-	    float t=0;
-	    for(int i=0; i<I; i++)
-	      t+=x(i,a)*y(i,b);
-	    inc(a,b,t);
-	  }
+	CpuGemm<float>::add(n0,n1,I,1.0,x.arr,x.s1,x.s0,y.arr,y.s0,y.s1,arr,s0,s1);
       }
 
       if(dev==1){
@@ -301,11 +301,14 @@ namespace cnine{
     //return batch_grid_fused_view1_of(*this);
     //}
 
-    auto batch_grid_fused_view2() const -> decltype(batch_grid_fused_view2_of(*this)){
+    // templated so that the return type is only looked up for the types that have a view
+    template<typename TYPE2=TYPE>
+    auto batch_grid_fused_view2() const -> decltype(batch_grid_fused_view2_of(std::declval<const Ltensor<TYPE2>&>())){
       return batch_grid_fused_view2_of(*this);
     }
 
-    auto bgfused_view3() const -> decltype(batch_grid_fused_view3_of(*this)){
+    template<typename TYPE2=TYPE>
+    auto bgfused_view3() const -> decltype(batch_grid_fused_view3_of(std::declval<const Ltensor<TYPE2>&>())){
       return batch_grid_fused_view3_of(*this);
     }
 
@@ -855,6 +858,36 @@ namespace cnine{
     }
 
 
+  public: // ---- Binary serialization ----------------------------------------------------------------------
+
+
+    void serialize(Bofstream& ofs) const{
+      TensorFileHeader header=BASE::file_header();
+      header.flags|=TensorFileHeader::has_labels;
+      header.batched=labels._batched;
+      header.narray=labels._narray;
+      BASE::serialize(ofs,header);
+    }
+
+    Ltensor(Bifstream& ifs){
+      TensorFileHeader header=BASE::read_file_header(ifs);
+      BASE::reset(BASE(header.get_dims(),header.get_strides(),0));
+      if(header.flags&TensorFileHeader::has_labels)
+	labels=DimLabels(header.batched,header.narray);
+      BASE::read_payload(ifs,header);
+    }
+
+    void save(const string filename, const bool checksum=false) const{
+      Bofstream ofs(filename,checksum);
+      serialize(ofs);
+    }
+
+    static Ltensor load(const string filename){
+      Bifstream ifs(filename);
+      return Ltensor(ifs);
+    }
+
+
   public: // ---- I/O ---------------------------------------------------------------------------------------
 
 
@@ -74,8 +74,8 @@ namespace cnine{
     }
       
     LtensorBpack& operator=(const LtensorBpack& x){
-      GELIB_ASSRT(_nbatch==x._nbatch);
-      GELIB_ASSRT(_gdims==x._gdims);
+      CNINE_ASSRT(_nbatch==x._nbatch);
+      CNINE_ASSRT(_gdims==x._gdims);
       _dev=x._dev;
       for(auto& p:tensors)
 	p.second=x.tensors[p.first];
@@ -207,6 +207,59 @@ namespace cnine{
     }
 
 
+  public: // ---- Binary serialization ----------------------------------------------------------------------
+
+
+    // The pack is stored as a short header with the batch and grid dimensions followed by the key and
+    // the serialized tensor of each member. Each tensor starts at a page boundary.
+    void serialize(Bofstream& ofs) const{
+      ofs.write_array("CNINEPAK",8);
+      ofs.write<int32_t>(_nbatch);
+      ofs.write<int32_t>(_gdims.size());
+      for(auto p:_gdims) ofs.write<int32_t>(p);
+      ofs.write<uint64_t>(tensors.size());
+      for(auto& p:tensors){
+	if constexpr(std::is_same<KEY,string>::value) ofs.write_string(p.first);
+	else{
+	  ostringstream oss;
+	  oss<<p.first;
+	  ofs.write_string(oss.str());
+	}
+	p.second.serialize(ofs);
+      }
+      ofs.check();
+    }
+
+    LtensorBpack(Bifstream& ifs){
+      char magic[8];
+      ifs.read_array(magic,8);
+      if(string(magic,8)!="CNINEPAK") CNINE_ERROR(ifs.filename+" does not contain a tensor pack");
+      _nbatch=ifs.get<int32_t>();
+      int k=ifs.get<int32_t>();
+      for(int i=0; i<k; i++) _gdims.push_back(ifs.get<int32_t>());
+      size_t n=ifs.get<uint64_t>();
+      for(size_t i=0; i<n; i++){
+	KEY key;
+	if constexpr(std::is_same<KEY,string>::value) key=ifs.get_string();
+	else{
+	  istringstream iss(ifs.get_string());
+	  iss>>key;
+	}
+	tensors.emplace(key,TENSOR(ifs));
+      }
+    }
+
+    void save(const string filename, const bool checksum=false) const{
+      Bofstream ofs(filename,checksum);
+      serialize(ofs);
+    }
+
+    static LtensorBpack load(const string filename){
+      Bifstream ifs(filename);
+      return LtensorBpack(ifs);
+    }
+
+
   public: // ---- I/O ---------------------------------------------------------------------------------------
 
 
@@ -0,0 +1,163 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library.
+ *
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial
+ * license distributed with cnine in the file LICENSE.TXT. Commercial
+ * use is prohibited. All redistributed versions of this file (in
+ * original or modified form) must retain this copyright notice and
+ * must be accompanied by a verbatim copy of the license.
+ *
+ */
+
+
+#ifndef _CnineTensorFileHeader
+#define _CnineTensorFileHeader
+
+#include "Cnine_base.hpp"
+#include "Gdims.hpp"
+#include "GstridesB.hpp"
+#include <cstring>
+#include <limits>
+
+
+namespace cnine{
+
+
+  // ---- TensorChecksum ---------------------------------------------------------------------------------------
+  //
+  // 64 bit FNV-1a hash of a byte stream, which can be fed in arbitrary chunks.
+
+
+  class TensorChecksum{
+  public:
+
+    uint64_t h=0xcbf29ce484222325ull;
+
+    void update(const void* p, const size_t n){
+      const unsigned char* q=static_cast<const unsigned char*>(p);
+      uint64_t t=h;
+      for(size_t i=0; i<n; i++){
+	t^=q[i];
+	t*=0x100000001b3ull;
+      }
+      h=t;
+    }
+
+    uint64_t value() const{
+      return h;
+    }
+
+  };
+
+
+  // ---- TensorFileHeader -------------------------------------------------------------------------------------
+  //
+  // Fixed size header at the start of a tensor file. The payload starts at data_offset, which is a multiple
+  // of the page size so that it can be mapped directly. Strides are in elements, relative to the start of
+  // the payload. If the has_labels flag is set, batched and narray hold the DimLabels of an Ltensor, and if
+  // has_checksum is set, checksum is the TensorChecksum of the payload.
+
+
+  class TensorFileHeader{
+  public:
+
+    static constexpr int max_ndims=16;
+    static constexpr uint64_t data_alignment=4096;
+    static constexpr uint32_t current_version=1;
+
+    char magic[8];
+    uint32_t version=current_version;
+    int32_t dtype=0;
+    int32_t ndims=0;
+    uint32_t flags=0;
+    uint64_t dims[max_ndims];
+    uint64_t strides[max_ndims];
+    uint64_t data_offset=data_alignment;
+    uint64_t data_bytes=0;
+    uint64_t checksum=0;
+    int32_t batched=0;
+    int32_t narray=0;
+
+    static constexpr uint32_t has_checksum=1;
+    static constexpr uint32_t has_labels=2;
+
+
+  public: // ---- Constructors ------------------------------------------------------------------------------
+
+
+    TensorFileHeader(){
+      std::memcpy(magic,"CNINETNS",8);
+      std::fill(dims,dims+max_ndims,0);
+      std::fill(strides,strides+max_ndims,0);
+    }
+
+    TensorFileHeader(const dtype_enum _dtype, const Gdims& _dims, const GstridesB& _strides):
+      TensorFileHeader(){
+      CNINE_ASSRT(_dims.size()<=max_ndims);
+      dtype=_dtype;
+      ndims=_dims.size();
+      for(int i=0; i<ndims; i++){
+	dims[i]=_dims[i];
+	strides[i]=_strides[i];
+      }
+      data_bytes=_strides.memsize(_dims)*dtype_size(_dtype);
+    }
+
+
+  public: // ---- Access -------------------------------------------------------------------------------------
+
+
+    bool valid() const{
+      return std::memcmp(magic,"CNINETNS",8)==0 && version<=current_version && ndims>=0 && ndims<=max_ndims;
+    }
+
+    dtype_enum get_dtype() const{
+      return static_cast<dtype_enum>(dtype);
+    }
+
+    Gdims get_dims() const{
+      Gdims R;
+      for(int i=0; i<ndims; i++) R.push_back(dims[i]);
+      return R;
+    }
+
+    GstridesB get_strides() const{
+      GstridesB R;
+      for(int i=0; i<ndims; i++) R.push_back(strides[i]);
+      return R;
+    }
+
+    uint64_t file_size() const{
+      return data_offset+data_bytes;
+    }
+
+    void check(const dtype_enum _dtype, const string& path) const{
+      if(!valid()) CNINE_ERROR(path+" is not a cnine tensor file");
+      if(get_dtype()!=_dtype) CNINE_ERROR(path+" contains a tensor of type "+dtype_name(get_dtype())+", not "+dtype_name(_dtype));
+    }
+
+    // Check that the dimensions, strides and data size describe a payload of at most available bytes, 
+    // before anything is allocated or read based on them.
+    void check_payload(const uint64_t available, const string& path) const{
+      const uint64_t n=available/dtype_size(get_dtype());
+      uint64_t total=1;
+      for(int i=0; i<ndims; i++){
+	if(dims[i]>(uint64_t)std::numeric_limits<int>::max() || (dims[i]>0 && strides[i]>n/dims[i]))
+	  CNINE_ERROR(path+" is corrupt: dimension "+std::to_string(i)+" in the header does not fit in the file");
+	if(dims[i]>0 && total>n/dims[i]) total=n+1;
+	else total*=dims[i];
+      }
+      if(ndims>0 && total>n) 
+	CNINE_ERROR(path+" is corrupt: the dimensions in the header do not fit in the file");
+      if(data_bytes!=get_strides().memsize(get_dims())*dtype_size(get_dtype()))
+	CNINE_ERROR(path+" is corrupt: "+std::to_string(data_bytes)+" data bytes in the header do not match the dimensions and strides");
+      if(data_bytes>available) CNINE_ERROR(path+" is truncated");
+    }
+
+  };
+
+}
+
+#endif
@@ -38,6 +38,12 @@
 #include "Itensor3_view.hpp"
 
 #include "tensor1_view.hpp"
+#include "CpuCgemm.hpp"
+#include "CpuElementwise.hpp"
+#include "CpuReduce.hpp"
+#include "TensorFileHeader.hpp"
+#include "Bofstream.hpp"
+#include "Bifstream.hpp"
 
 #include "TensorView_assign.hpp"
 #include "TensorView_add.hpp"
@@ -190,6 +196,22 @@ namespace cnine{
       arr=MemArr<TYPE>(N,_dev);
     }
 
+    // Allocate the tensor according to an explicit memory policy. If policy.pad_rows is set, the leading
+    // stride is padded so that every row starts at an aligned address. The policy only affects host tensors.
+    TensorView(const Gdims& _dims, const MemPolicy& policy, const int fcode, const int _dev):
+      dims(_dims),
+      strides(_dims.size()<2?GstridesB(_dims):GstridesB::padded(_dims,policy.padded_row(_dims[_dims.size()-1],sizeof(TYPE)))),
+      dev(0){
+      if(_dev>0){
+	reset(TensorView(_dims,fcode,_dev));
+	return;
+      }
+      size_t N=strides.memsize(dims);
+      if(fcode==0) arr=MemArr<TYPE>(N,policy,fill_zero(),0);
+      else arr=MemArr<TYPE>(N,policy,0);
+      if(fcode>1) set(TensorView(dims,fcode,0));
+    }
+
 #include "TensorView_constructors.hpp"
 
 
@@ -449,6 +471,7 @@ namespace cnine{
 #include "TensorView_gen_ops.inc"
 #include "TensorView_ATen.inc"
 #include "TensorView_IO.inc"
+#include "TensorView_files.inc"
 
   
   public: // ---- In-place Operations ------------------------------------------------------------------------
@@ -459,7 +482,7 @@ namespace cnine{
 	if(is_contiguous())
 	  std::fill(mem(),mem()+asize(),0);
 	else
-	  CNINE_UNIMPL();
+	  apply([](TYPE& v){v=0;});
       }
       if(dev==1){
 	if(is_contiguous()){
@@ -471,12 +494,7 @@ namespace cnine{
 
 
     void inplace_times(const TYPE c){
-      if(dev==0){
-	if(is_contiguous())
-	  for(int i=0; i<asize(); i++) arr[i]*=c;
-	else
-	  for_each([&](const Gindex& ix, TYPE& x){x*=c;});
-      }
+      if(dev==0) apply([c](TYPE& x){x*=c;});
       if(dev==1){
 	if(is_contiguous()){
 	  const float cr=c;
@@ -555,6 +573,23 @@ namespace cnine{
 	  CNINE_ASSRT(y.dims[1]==r.dims[1]);
 	  CNINE_ASSRT(x.dims[1]==y.dims[0]);
 
+	  if constexpr(std::is_same<TYPE,float>::value || std::is_same<TYPE,double>::value){
+	    if(r.dev==0){
+	      CpuGemm<TYPE>::add(r.dims[0],r.dims[1],x.dims[1],1,x.mem(),x.strides[0],x.strides[1],
+		y.mem(),y.strides[0],y.strides[1],r.mem(),r.strides[0],r.strides[1]);
+	      return;
+	    }
+	  }
+	  if constexpr(std::is_same<TYPE,complex<float> >::value || std::is_same<TYPE,complex<double> >::value){
+	    if(r.dev==0){
+	      typedef typename TYPE::value_type REAL;
+	      CpuCgemm<REAL>::add(r.dims[0],r.dims[1],x.dims[1],
+		x.template mem_as<REAL>(),x.template mem_as<REAL>()+1,2*x.strides[0],2*x.strides[1],false,
+		y.template mem_as<REAL>(),y.template mem_as<REAL>()+1,2*y.strides[0],2*y.strides[1],false,
+		r.template mem_as<REAL>(),r.template mem_as<REAL>()+1,2*r.strides[0],2*r.strides[1]);
+	      return;
+	    }
+	  }
 	  r.view2().add_matmul_AA(x.view2(),y.view2());
 
 	  /*
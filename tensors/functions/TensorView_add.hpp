@@ -16,6 +16,7 @@
 #define _cnine_TensorView_add
 
 //#include "TensorView.hpp"
+#include "CpuElementwise.hpp"
 
 
 namespace cnine{
@@ -42,11 +43,13 @@ namespace cnine{
     int dev=r.get_dev();
     CNINE_ASSRT(x.get_dev()==dev);
 
+    if(dev==0){
+      cpu_elementwise(r.get_dims(),r.get_arr(),r.get_strides(),x.get_arr(),x.get_strides(),
+	[](TYPE& a, TYPE& b){a+=b;});
+      return;
+    }
+
     if(r.is_contiguous() && r.get_strides()==x.get_strides()){
-      if(dev==0){
-	stdadd(x.get_arr(),x.get_arr()+x.memsize(),r.get_arr());
-	return;
-      }
       if(dev==1){
 	if constexpr(std::is_same<TYPE,float>::value){
 	  const float alpha=1.0; // todo, saxpy can work for non-contiguous too
@@ -68,12 +71,6 @@ namespace cnine{
     }
 
     auto [rp,xp]=r.co_scrunch(x);
-    //cout<<rp.dims<<" "<<xp.dims<<endl;
-    //cout<<rp.strides<<" "<<xp.strides<<endl;
-
-    if(dev==0){
-      TensorView_add_loops(rp,xp);
-    }
 
     if(dev==1){// this is probably not going to work for non-contiguous tensors
       if constexpr(std::is_same<TYPE,int>::value || 
@@ -86,80 +83,6 @@ namespace cnine{
     }
   }
 
-
-  template<typename TYPE>
-  void TensorView_add_loops(const TensorView<TYPE>& r, const TensorView<TYPE>& x){
-    int D=r.ndims();
-    TYPE* rarr=r.get_arr();
-    TYPE* xarr=x.get_arr();
-
-    if(D==1){
-      int n0=r.dim(0);
-      int rs0=r.get_strides()(0);
-      int xs0=x.get_strides()(0);
-      for(int i0=0; i0<n0; i0++)
-	rarr[i0*rs0]+=xarr[i0*xs0];
-    }
-
-    if(D==2){
-      //cout<<r<<x<<endl;
-      int n0=r.dim(0);
-      int rs0=r.get_strides()(0);
-      int xs0=x.get_strides()(0);
-      int n1=r.dim(1);
-      int rs1=r.get_strides()(1);
-      int xs1=x.get_strides()(1);
-
-      for(int i0=0; i0<n0; i0++)
-	for(int i1=0; i1<n1; i1++)
-	  rarr[i0*rs0+i1*rs1]+=xarr[i0*xs0+i1*xs1];
-      //cout<<r<<endl;
-    }
-
-    if(D==3){
-      int n0=r.dim(0);
-      int rs0=r.get_strides()(0);
-      int xs0=x.get_strides()(0);
-      int n1=r.dim(1);
-      int rs1=r.get_strides()(1);
-      int xs1=x.get_strides()(1);
-      int n2=r.dim(2);
-      int rs2=r.get_strides()(2);
-      int xs2=x.get_strides()(2);
-
-      for(int i0=0; i0<n0; i0++)
-	for(int i1=0; i1<n1; i1++)
-	  for(int i2=0; i2<n2; i2++)
-	    rarr[i0*rs0+i1*rs1+i2*rs2]+=xarr[i0*xs0+i1*xs1+i2*xs2];
-    }
-
-    if(D==4){
-      int n0=r.dim(0);
-      int rs0=r.get_strides()(0);
-      int xs0=x.get_strides()(0);
-      int n1=r.dim(1);
-      int rs1=r.get_strides()(1);
-      int xs1=x.get_strides()(1);
-      int n2=r.dim(2);
-      int rs2=r.get_strides()(2);
-      int xs2=x.get_strides()(2);
-      int n3=r.dim(3);
-      int rs3=r.get_strides()(3);
-      int xs3=x.get_strides()(3);
-
-      for(int i0=0; i0<n0; i0++)
-	for(int i1=0; i1<n1; i1++)
-	  for(int i2=0; i2<n2; i2++)
-	    for(int i3=0; i3<n3; i3++)
-	      rarr[i0*rs0+i1*rs1+i2*rs2+i3*rs3]+=xarr[i0*xs0+i1*xs1+i2*xs2+i3*xs3];
-    }
-
-    if(D>4){
-      r.for_each([&](const Gindex& ix, TYPE& v) {v+=x(ix);});
-    }
-
-  }
-
 }
 
 #endif 
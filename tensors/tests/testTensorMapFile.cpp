@@ -0,0 +1,90 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "TensorView_functions.hpp"
+#include <dirent.h>
+
+using namespace cnine;
+
+
+int open_fds(){
+  int n=0;
+  DIR* d=opendir("/proc/self/fd");
+  while(readdir(d)) n++;
+  closedir(d);
+  return n;
+}
+
+
+int main(int argc, char** argv){
+
+  cnine_session session;
+
+  TensorView<float> A=TensorView<float>::gaussian({6,4});
+  {
+    TensorView<float> M=TensorView<float>::map_new_file("/tmp/cnine_test.tensor",A.dims);
+    M.set(A);
+    M.sync();
+  }
+
+  TensorView<float> B=TensorView<float>::map_file("/tmp/cnine_test.tensor");
+  cout<<B.repr()<<endl;
+  B.prefetch_rows(2,5);
+  cout<<B.rows(2,3)<<endl;
+  cout<<"Difference: "<<(B-A).norm()<<endl;
+
+  TensorView<float> C=TensorView<float>::map_file("/tmp/cnine_test.tensor");
+  C.set(0,0,100);
+  cout<<"Copy on write: "<<C(0,0)<<" "<<TensorView<float>::map_file("/tmp/cnine_test.tensor")(0,0)<<endl;
+
+  try{
+    TensorView<double>::map_file("/tmp/cnine_test.tensor");
+  }catch(const std::runtime_error& e){
+    cout<<e.what()<<endl;
+  }
+
+  // headers whose dimensions, data size or offset do not match the data in the file
+  for(int k=0; k<3; k++){
+    {
+      TensorView<float> M=TensorView<float>::map_new_file("/tmp/cnine_test_bad.tensor",A.dims);
+      M.set(A);
+      M.sync();
+    }
+    {
+      MappedFile f("/tmp/cnine_test_bad.tensor",MappedFile::shared);
+      TensorFileHeader* h=reinterpret_cast<TensorFileHeader*>(f.data());
+      if(k==0) h->dims[0]=1000;
+      if(k==1) h->data_bytes+=1;
+      if(k==2) h->data_offset+=2;
+      f.sync();
+    }
+    try{
+      TensorView<float>::map_file("/tmp/cnine_test_bad.tensor");
+      cout<<"Corrupt header accepted"<<endl;
+    }catch(const std::runtime_error& e){
+      cout<<e.what()<<endl;
+    }
+  }
+
+  // a file that opens but cannot be mapped must not leak its descriptor
+  const int nfds=open_fds();
+  for(int i=0; i<10; i++){
+    try{
+      MappedFile("/tmp");
+    }catch(const std::runtime_error& e){}
+  }
+  cout<<"Descriptors leaked by failed maps: "<<open_fds()-nfds<<endl;
+
+}
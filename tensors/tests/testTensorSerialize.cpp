@@ -0,0 +1,92 @@
+/*
+ * This file is part of cnine, a lightweight C++ tensor library. 
+ *  
+ * Copyright (c) 2024, Imre Risi Kondor
+ *
+ * This source code file is subject to the terms of the noncommercial 
+ * license distributed with cnine in the file LICENSE.TXT. Commercial 
+ * use is prohibited. All redistributed versions of this file (in 
+ * original or modified form) must retain this copyright notice and 
+ * must be accompanied by a verbatim copy of the license. 
+ *
+ */
+
+#include "Cnine_base.cpp"
+#include "CnineSession.hpp"
+#include "TensorView_functions.hpp"
+#include "LtensorBpack.hpp"
+
+using namespace cnine;
+
+
+int main(int argc, char** argv){
+
+  cnine_session session;
+
+  TensorView<float> A=TensorView<float>::gaussian({5,6});
+  A.save("/tmp/cnine_A.tensor",true);
+  cout<<"Regular:    "<<(TensorView<float>::load("/tmp/cnine_A.tensor")-A).norm()<<endl;
+  cout<<"Mapped:     "<<(TensorView<float>::map_file("/tmp/cnine_A.tensor")-A).norm()<<endl;
+
+  TensorView<float> At=A.transp();
+  At.save("/tmp/cnine_At.tensor");
+  TensorView<float> Bt=TensorView<float>::load("/tmp/cnine_At.tensor");
+  cout<<"Transposed: "<<(Bt-At).norm()<<" strides="<<Bt.strides<<endl;
+
+  TensorView<complex<float> > C=TensorView<complex<float> >::gaussian({4,4,4});
+  TensorView<complex<float> > Cs=C.slice(1,2);
+  {
+    Bofstream ofs("/tmp/cnine_C.tensor",true);
+    ofs.chunk_bytes=32; // force several chunks
+    Cs.serialize(ofs);
+  }
+  TensorView<complex<float> > D({4,4},fill_zero());
+  D.load_into("/tmp/cnine_C.tensor");
+  cout<<"Slice:      "<<(D-Cs).norm()<<endl;
+
+  Ltensor<float> L(2,{3},{2,2},4,0);
+  L.save("/tmp/cnine_L.tensor");
+  Ltensor<float> L2=Ltensor<float>::load("/tmp/cnine_L.tensor");
+  cout<<L2.repr()<<endl;
+
+  LtensorBpack<int,Ltensor<float> > pack(0,Gdims());
+  pack.tensors.emplace(3,Ltensor<float>(Gdims({2,3}),4,0));
+  pack.tensors.emplace(7,Ltensor<float>(Gdims({4}),3,0));
+  pack.save("/tmp/cnine_pack.bin",true);
+  auto pack2=LtensorBpack<int,Ltensor<float> >::load("/tmp/cnine_pack.bin");
+  cout<<pack2<<endl;
+
+  {
+    std::fstream f("/tmp/cnine_A.tensor",ios::in|ios::out|ios::binary);
+    f.seekp(4096+8);
+    f.put(1);
+  }
+  try{
+    TensorView<float>::load("/tmp/cnine_A.tensor");
+  }catch(const std::runtime_error& e){
+    cout<<e.what()<<endl;
+  }
+
+  // headers whose data size or dimensions promise more than the file holds
+  for(int k=0; k<2; k++){
+    A.save("/tmp/cnine_bad.tensor");
+    {
+      std::fstream f("/tmp/cnine_bad.tensor",ios::in|ios::out|ios::binary);
+      TensorFileHeader h;
+      f.read(reinterpret_cast<char*>(&h),sizeof(h));
+      if(k==0) h.data_bytes*=1000;
+      if(k==1) h.dims[0]=1000000;
+      f.seekp(0);
+      f.write(reinterpret_cast<char*>(&h),sizeof(h));
+    }
+    try{
+      TensorView<float>::load("/tmp/cnine_bad.tensor");
+      cout<<"Corrupt header accepted"<<endl;
+    }catch(const std::runtime_error& e){
+      cout<<e.what()<<endl;
+    }
+  }
+
+  for(auto f:{"A","At","C","L","bad"}) std::remove((string("/tmp/cnine_")+f+".tensor").c_str());
+  std::remove("/tmp/cnine_pack.bin");
+}